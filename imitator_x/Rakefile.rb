@@ -37,11 +37,16 @@ CLEAN.include("ext/*.o")
 CLEAN.include("ext/Makefile")
 CLEAN.include("ext/mkmf.log")
 CLOBBER.include("ext/*.so")
+CLEAN.include("bench/wm_standin")
+CLOBBER.include("bench/results.json")
 
 Rake::RDocTask.new do |rt|
   rt.options = ["--charset=ISO-8859-1"] #Needed for correct displaying of chars like ä. 
   rt.rdoc_files.include("README.rdoc", "TODO.rdoc", "COPYING.rdoc", "COPYING.LESSER.rdoc")
   rt.rdoc_files.include("ext/x.c")
+  rt.rdoc_files.include("ext/connection.c")
+  rt.rdoc_files.include("ext/stats.c")
+  rt.rdoc_files.include("ext/journal.c")
   rt.rdoc_files.include("ext/xwindow.c")
   rt.rdoc_files.include("ext/mouse.c")
   rt.rdoc_files.include("ext/clipboard.c")
@@ -74,7 +79,7 @@ DESC
   s.files = [Dir["lib/**/*.rb"], Dir["ext/**/**.c"], Dir["ext/**/*.h"], Dir["test/*.rb"], "ext/extconf.rb", "lib/imitator_x_special_chars.yml", "Rakefile.rb", "README.rdoc", "TODO.rdoc", "COPYING.rdoc", "COPYING.LESSER.rdoc"].flatten
   s.extensions << "ext/extconf.rb"
   s.has_rdoc = true
-  s.extra_rdoc_files = %w[README.rdoc TODO.rdoc COPYING.rdoc COPYING.LESSER.rdoc ext/x.c ext/xwindow.c ext/mouse.c ext/clipboard.c ext/keyboard.c] #Why doesn't RDoc document the C files automatically?
+  s.extra_rdoc_files = %w[README.rdoc TODO.rdoc COPYING.rdoc COPYING.LESSER.rdoc ext/x.c ext/connection.c ext/stats.c ext/journal.c ext/xwindow.c ext/mouse.c ext/clipboard.c ext/keyboard.c] #Why doesn't RDoc document the C files automatically?
   s.rdoc_options << "-t" << "Imitator for X: RDocs" << "-m" << "README.rdoc" << "-c" << "ISO-8859-1"
   s.test_files = Dir["test/test_*.rb"]
   #s.rubyforge_project = 
@@ -95,5 +100,22 @@ task :compile do
   end
 end
 
+file "bench/wm_standin" => "bench/wm_standin.c" do |t|
+  sh "cc -O2 -o #{t.name} #{t.prerequisites.first} -lX11"
+end
+
+desc "Runs the benchmarks on a private Xvfb (needs Xvfb and a compiled extension)."
+task :bench => "bench/wm_standin" do
+  ruby "bench/bench.rb"
+end
+
+namespace :bench do
+  desc "Makes bench/results.json the baseline later 'rake bench' runs compare against."
+  task :baseline do
+    raise("No results yet, run 'rake bench' first!") unless File.exist?("bench/results.json")
+    cp "bench/results.json", "bench/baseline.json"
+  end
+end
+
 desc "Compiles, tests and then creates the gem file."
 task :default => [:clobber, :compile, :test, :gem]
\ No newline at end of file
@@ -0,0 +1,214 @@
+#!/usr/bin/env ruby
+#Encoding: UTF-8
+=begin
+--
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright © 2010 Marvin Gülker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+++
+=end
+
+#Benchmarks for Imitator for X. Run them via <tt>rake bench</tt>. 
+#
+#This script starts a private Xvfb and the window manager stand-in 
+#(wm_standin.c), so it neither needs nor disturbs your desktop. Each 
+#benchmark measures throughput and latency of one public API method; 
+#the round-trips per call come from Imitator::X.stats. 
+#
+#The results are written as JSON to bench/results.json (or $IMITATOR_BENCH_OUTPUT) 
+#and compared against bench/baseline.json if it exists. <tt>rake bench:baseline</tt> 
+#makes the current results the new baseline. Environment variables: 
+#[IMITATOR_BENCH_DISPLAY] (:99) The display the Xvfb gets. 
+#[IMITATOR_BENCH_THRESHOLD] (0.2) Slowdown that counts as a regression, 0.2 means 20%. 
+#[IMITATOR_BENCH_FILTER] Only run benchmarks whose name matches this regular expression. 
+
+require "json"
+require "rbconfig"
+
+module ImitatorBench
+  
+  DIR = File.expand_path(File.dirname(__FILE__))
+  DISPLAY = ENV["IMITATOR_BENCH_DISPLAY"] || ":99"
+  OUTPUT = ENV["IMITATOR_BENCH_OUTPUT"] || File.join(DIR, "results.json")
+  BASELINE = File.join(DIR, "baseline.json")
+  THRESHOLD = Float(ENV["IMITATOR_BENCH_THRESHOLD"] || 0.2)
+  FILTER = ENV["IMITATOR_BENCH_FILTER"] ? Regexp.new(ENV["IMITATOR_BENCH_FILTER"]) : //
+  STANDIN = File.join(DIR, "wm_standin")
+  
+  #Window counts for the XWindow.search benchmarks
+  WINDOW_COUNTS = [10, 100, 1000]
+  #Payload sizes for the Clipboard benchmarks, in bytes
+  CLIPBOARD_SIZES = [1, 1024, 1024 ** 2, 10 * 1024 ** 2, 100 * 1024 ** 2]
+  
+  module_function
+  
+  #Starts Xvfb and the stand-in, sets DISPLAY. 
+  def start_x
+    socket = "/tmp/.X11-unix/X#{DISPLAY[/\d+/]}"
+    raise("Display #{DISPLAY} is in use, set IMITATOR_BENCH_DISPLAY!") if File.exist?(socket)
+    @xvfb = spawn("Xvfb", DISPLAY, "-screen", "0", "1280x1024x24", "-nolisten", "tcp", [:out, :err] => "/dev/null")
+    100.times{break if File.exist?(socket); sleep 0.1}
+    raise("Xvfb didn't start!") unless File.exist?(socket)
+    ENV["DISPLAY"] = DISPLAY
+    
+    @standin = IO.popen([STANDIN], "r+")
+    raise("The window manager stand-in didn't start!") unless @standin.gets == "ready\n"
+  end
+  
+  #Stops what start_x started. 
+  def stop_x
+    if @standin
+      @standin.puts("quit")
+      @standin.close
+    end
+    if @xvfb
+      Process.kill("TERM", @xvfb)
+      Process.wait(@xvfb)
+    end
+  end
+  
+  #Tells the stand-in to provide +count+ windows. 
+  def windows(count)
+    @standin.puts("windows #{count}")
+    answer = @standin.gets
+    raise("Stand-in failed: #{answer}") unless answer == "ok #{count}\n"
+  end
+  
+  #Calls the block +iterations+ times (after one warm-up call) and returns 
+  #a hash of the measured values. +unit_size+ is what one call processes, 
+  #e.g. the number of characters, for the throughput. 
+  def measure(iterations, unit_size = 1)
+    yield
+    Imitator::X.reset_stats
+    times = Array.new(iterations) do
+      start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      yield
+      Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    end
+    stats = Imitator::X.stats
+    total = times.inject(:+)
+    sorted = times.sort
+    percentile = lambda{|p| sorted[((sorted.size - 1) * p).round]}
+    {
+      "iterations" => iterations, 
+      "ops_per_sec" => iterations / total, 
+      "units_per_sec" => iterations * unit_size / total, 
+      "mean" => total / iterations, 
+      "p50" => percentile[0.5], 
+      "p95" => percentile[0.95], 
+      "p99" => percentile[0.99], 
+      "max" => sorted.last, 
+      "round_trips_per_call" => stats[:round_trips].fdiv(iterations), 
+      "requests_per_call" => stats[:requests].fdiv(iterations)
+    }
+  end
+  
+  #Runs the benchmark +name+ unless it's filtered out. Errors are recorded, not raised, 
+  #e.g. a 100 MB clipboard may exceed the X server's maximum request size. 
+  def bench(results, name, iterations, unit_size = 1, &block)
+    return unless name =~ FILTER
+    print "#{name}... "
+    results[name] = measure(iterations, unit_size, &block)
+    puts "#{results[name]["ops_per_sec"].round(1)} ops/s, p95 #{(results[name]["p95"] * 1000).round(3)} ms"
+  rescue => e
+    results[name] = {"error" => "#{e.class}: #{e.message}"}
+    puts "failed: #{results[name]["error"]}"
+  end
+  
+  def run_all
+    results = {}
+    ascii = "The quick brown fox jumps over the lazy dog 0123456789"
+    unicode = "Äpfel über Öl, naïve café: €, ß, ñ"
+    
+    bench(results, "Keyboard.simulate/ascii", 20, ascii.size){Imitator::X::Keyboard.simulate(ascii, true)}
+    bench(results, "Keyboard.simulate/unicode", 20, unicode.size){Imitator::X::Keyboard.simulate(unicode, true)}
+    bench(results, "Keyboard.key", 200){Imitator::X::Keyboard.key("Shift+a")}
+    
+    bench(results, "Mouse.move", 200){Imitator::X::Mouse.move(rand(1280), rand(1024), 1, true)}
+    bench(results, "Mouse.click", 200){Imitator::X::Mouse.click}
+    
+    WINDOW_COUNTS.each do |count|
+      windows(count)
+      title = "Imitator bench window #{count / 2}"
+      #Without a display argument, XWindow.search would ask :0.0
+      conn = Imitator::X::Connection.default
+      bench(results, "XWindow.search/#{count}/string", 20){Imitator::X::XWindow.search(title, nil, conn)}
+      bench(results, "XWindow.search/#{count}/regexp", 20){Imitator::X::XWindow.search(/bench window #{count / 2}$/, nil, conn)}
+    end
+    windows(0)
+    
+    CLIPBOARD_SIZES.each do |size|
+      text = "x" * size
+      iterations = size > 1024 ** 2 ? 3 : 20
+      bench(results, "Clipboard.write/#{size}", iterations, size){Imitator::X::Clipboard.write(text)}
+      bench(results, "Clipboard.read/#{size}", iterations, size){Imitator::X::Clipboard.read}
+    end
+    
+    results
+  end
+  
+  #Prints how +results+ compare to the baseline and returns the names 
+  #of the benchmarks that got slower by more than THRESHOLD. 
+  def compare(results, baseline)
+    regressions = []
+    puts
+    puts "%-32s %14s %14s %9s" % ["Benchmark", "Baseline ops/s", "Current ops/s", "Change"]
+    results.each_pair do |name, result|
+      old = baseline[name]
+      next if old.nil? or old["error"] or result["error"]
+      change = result["ops_per_sec"] / old["ops_per_sec"] - 1
+      regressions << name if change < -THRESHOLD
+      puts "%-32s %14.1f %14.1f %+8.1f%%%s" % [name, old["ops_per_sec"], result["ops_per_sec"], change * 100, change < -THRESHOLD ? " REGRESSION" : ""]
+    end
+    regressions
+  end
+  
+  def main
+    start_x
+    #Not before, Connection.default uses the DISPLAY set by start_x
+    $imitator_x_charfile_path = File.join(DIR, "..", "lib", "imitator_x_special_chars.yml")
+    require_relative "../lib/imitator/x"
+    
+    results = run_all
+    output = {
+      "meta" => {
+        "time" => Time.now.utc.to_s, 
+        "ruby" => RUBY_DESCRIPTION, 
+        "version" => Imitator::X::VERSION, 
+        "commit" => `git -C '#{DIR}' rev-parse HEAD 2>/dev/null`.chomp
+      }, 
+      "results" => results
+    }
+    File.open(OUTPUT, "w"){|f| f.write(JSON.pretty_generate(output))}
+    puts "Results written to #{OUTPUT}."
+    
+    if File.exist?(BASELINE)
+      regressions = compare(results, JSON.parse(File.read(BASELINE))["results"])
+      unless regressions.empty?
+        puts "#{regressions.size} benchmark(s) got more than #{(THRESHOLD * 100).round}% slower."
+        exit 1
+      end
+    else
+      puts "No baseline to compare with, run 'rake bench:baseline' to make these results the baseline."
+    end
+  ensure
+    stop_x
+  end
+  
+end
+
+ImitatorBench.main if $0 == __FILE__
@@ -0,0 +1,248 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+/*
+*Window manager stand-in for the benchmarks (see bench.rb). It does just enough 
+*of what a real desktop does for Imitator for X to work: 
+*- Announces some EWMH hints on the root window. 
+*- Acts as the clipboard manager: saves the CLIPBOARD on SAVE_TARGETS requests and 
+*  serves it afterwards. 
+*- Creates top-level windows on demand, so XWindow.search has something to search. 
+*
+*Commands are read from stdin, one per line, and answered on stdout: 
+*  windows N   Have exactly N windows titled "Imitator bench window <i>". Answers "ok N". 
+*  quit        Exits. 
+*It prints "ready" once it's set up. 
+*
+*Compile with: cc -o wm_standin wm_standin.c -lX11 
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#define MAX_WINDOWS 100000
+
+static Display * p_display;
+static Window root, manager_win;
+static Atom clipboard_atom, manager_atom, save_targets_atom, targets_atom, utf8_atom, data_atom, client_list_atom, pid_atom;
+/*The clipboard content we took over*/
+static unsigned char * p_data = NULL;
+static unsigned long data_len = 0;
+/*The SAVE_TARGETS request we're working on, requestor is None if there's none*/
+static XSelectionRequestEvent pending_save;
+static Window windows[MAX_WINDOWS];
+static int num_windows = 0;
+
+/*
+*Answers the SelectionRequest +p_req+. +property+ is None if we refuse it. 
+*/
+static void notify(XSelectionRequestEvent * p_req, Atom property)
+{
+  XEvent xevt;
+  
+  memset(&xevt, 0, sizeof(XEvent));
+  xevt.xselection.type = SelectionNotify;
+  xevt.xselection.requestor = p_req->requestor;
+  xevt.xselection.selection = p_req->selection;
+  xevt.xselection.target = p_req->target;
+  xevt.xselection.property = property;
+  xevt.xselection.time = p_req->time;
+  XSendEvent(p_display, p_req->requestor, False, NoEventMask, &xevt);
+}
+
+/*
+*Handles requests for the CLIPBOARD_MANAGER and CLIPBOARD selections. 
+*/
+static void handle_request(XSelectionRequestEvent * p_req)
+{
+  Atom targets[3];
+  
+  if (p_req->selection == manager_atom && p_req->target == save_targets_atom && pending_save.requestor == None)
+  {
+    /*Fetch the content from the current CLIPBOARD owner, we answer once we have it*/
+    pending_save = *p_req;
+    XConvertSelection(p_display, clipboard_atom, utf8_atom, data_atom, manager_win, p_req->time);
+  }
+  else if (p_req->selection == clipboard_atom && p_req->target == targets_atom)
+  {
+    targets[0] = targets_atom;
+    targets[1] = utf8_atom;
+    targets[2] = XA_STRING;
+    XChangeProperty(p_display, p_req->requestor, p_req->property, XA_ATOM, 32, PropModeReplace, (unsigned char *) targets, 3);
+    notify(p_req, p_req->property);
+  }
+  else if (p_req->selection == clipboard_atom && (p_req->target == utf8_atom || p_req->target == XA_STRING))
+  {
+    XChangeProperty(p_display, p_req->requestor, p_req->property, p_req->target, 8, PropModeReplace, p_data, data_len);
+    notify(p_req, p_req->property);
+  }
+  else
+    notify(p_req, None);
+}
+
+/*
+*Called when the CLIPBOARD owner answered our request for its content. 
+*/
+static void handle_notify(XSelectionEvent * p_sel)
+{
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char * p_prop = NULL;
+  
+  if (pending_save.requestor == None)
+    return;
+  
+  if (p_sel->property != None)
+  {
+    XGetWindowProperty(p_display, manager_win, data_atom, 0, 0x1fffffff, True, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after, &p_prop);
+    free(p_data);
+    data_len = nitems;
+    p_data = (unsigned char *) malloc(data_len + 1);
+    memcpy(p_data, p_prop, data_len);
+    XFree(p_prop);
+    XSetSelectionOwner(p_display, clipboard_atom, manager_win, CurrentTime);
+    notify(&pending_save, pending_save.property);
+  }
+  else
+    notify(&pending_save, None);
+  pending_save.requestor = None;
+}
+
+/*
+*Creates or destroys windows until there are +count+ of them. 
+*/
+static void set_window_count(int count)
+{
+  char title[100];
+  long pid = getpid(); /*Xlib wants longs for 32-bit properties*/
+  
+  if (count > MAX_WINDOWS)
+    count = MAX_WINDOWS;
+  while (num_windows < count)
+  {
+    windows[num_windows] = XCreateSimpleWindow(p_display, root, 0, 0, 100, 100, 0, 0, 0);
+    sprintf(title, "Imitator bench window %i", num_windows);
+    XStoreName(p_display, windows[num_windows], title);
+    XChangeProperty(p_display, windows[num_windows], pid_atom, XA_CARDINAL, 32, PropModeReplace, (unsigned char *) &pid, 1);
+    XMapWindow(p_display, windows[num_windows]);
+    num_windows++;
+  }
+  while (num_windows > count)
+    XDestroyWindow(p_display, windows[--num_windows]);
+  
+  XChangeProperty(p_display, root, client_list_atom, XA_WINDOW, 32, PropModeReplace, (unsigned char *) windows, num_windows);
+  XSync(p_display, False);
+}
+
+/*
+*Executes the command +cmd+ read from stdin. Returns 0 on "quit". 
+*/
+static int handle_command(const char * cmd)
+{
+  int count;
+  
+  if (sscanf(cmd, "windows %i", &count) == 1)
+  {
+    set_window_count(count);
+    printf("ok %i\n", num_windows);
+  }
+  else if (strncmp(cmd, "quit", 4) == 0)
+    return 0;
+  else
+    printf("error unknown command\n");
+  fflush(stdout);
+  return 1;
+}
+
+int main(int argc, char * argv[])
+{
+  XEvent xevt;
+  fd_set fds;
+  char line[256];
+  Atom supported[6];
+  int xfd;
+  
+  if ((p_display = XOpenDisplay(NULL)) == NULL)
+  {
+    fprintf(stderr, "Couldn't open display!\n");
+    return 1;
+  }
+  root = XDefaultRootWindow(p_display);
+  
+  clipboard_atom = XInternAtom(p_display, "CLIPBOARD", False);
+  manager_atom = XInternAtom(p_display, "CLIPBOARD_MANAGER", False);
+  save_targets_atom = XInternAtom(p_display, "SAVE_TARGETS", False);
+  targets_atom = XInternAtom(p_display, "TARGETS", False);
+  utf8_atom = XInternAtom(p_display, "UTF8_STRING", False);
+  data_atom = XInternAtom(p_display, "IMITATOR_BENCH_DATA", False);
+  client_list_atom = XInternAtom(p_display, "_NET_CLIENT_LIST", False);
+  pid_atom = XInternAtom(p_display, "_NET_WM_PID", False);
+  
+  /*Pretend to be an EWMH window manager*/
+  supported[0] = XInternAtom(p_display, "_NET_SUPPORTED", False);
+  supported[1] = XInternAtom(p_display, "_NET_ACTIVE_WINDOW", False);
+  supported[2] = pid_atom;
+  supported[3] = client_list_atom;
+  supported[4] = XInternAtom(p_display, "_NET_CLIENT_LIST_STACKING", False);
+  supported[5] = XInternAtom(p_display, "_NET_WM_NAME", False);
+  XChangeProperty(p_display, root, supported[0], XA_ATOM, 32, PropModeReplace, (unsigned char *) supported, 6);
+  
+  /*Become the clipboard manager*/
+  manager_win = XCreateSimpleWindow(p_display, root, 0, 0, 1, 1, 0, 0, 0);
+  XSetSelectionOwner(p_display, manager_atom, manager_win, CurrentTime);
+  pending_save.requestor = None;
+  set_window_count(0);
+  
+  printf("ready\n");
+  fflush(stdout);
+  
+  xfd = ConnectionNumber(p_display);
+  for (;;)
+  {
+    while (XPending(p_display))
+    {
+      XNextEvent(p_display, &xevt);
+      if (xevt.type == SelectionRequest)
+        handle_request(&xevt.xselectionrequest);
+      else if (xevt.type == SelectionNotify)
+        handle_notify(&xevt.xselection);
+      /*SelectionClear: someone else owns CLIPBOARD now, nothing to do*/
+    }
+    XFlush(p_display);
+    
+    FD_ZERO(&fds);
+    FD_SET(xfd, &fds);
+    FD_SET(STDIN_FILENO, &fds);
+    if (select((xfd > STDIN_FILENO ? xfd : STDIN_FILENO) + 1, &fds, NULL, NULL, NULL) < 0)
+      break;
+    if (FD_ISSET(STDIN_FILENO, &fds))
+    {
+      if (fgets(line, 256, stdin) == NULL || !handle_command(line))
+        break;
+    }
+  }
+  
+  XCloseDisplay(p_display);
+  return 0;
+}
@@ -0,0 +1,228 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "cache.h"
+#include "batch.h"
+
+/*******************Helper functions**************************/
+
+/*
+*Appends an operation to +p_batch+ and records the call that made it. 
+*/
+static imitator_batch_op * append_op(imitator_batch * p_batch, Window win, enum imitator_batch_op_kind kind)
+{
+  imitator_batch_op * p_op;
+  
+  if (p_batch->num_ops == p_batch->ops_capacity)
+  {
+    p_batch->ops_capacity = p_batch->ops_capacity * 2 + 16;
+    REALLOC_N(p_batch->p_ops, imitator_batch_op, p_batch->ops_capacity);
+  }
+  p_op = &p_batch->p_ops[p_batch->num_ops++];
+  MEMZERO(p_op, imitator_batch_op, 1);
+  p_op->win = win;
+  p_op->kind = kind;
+  return p_op;
+}
+
+/*
+*Records that the current call ended up in the operation +op_index+. 
+*/
+static void add_call(imitator_batch * p_batch, unsigned int op_index)
+{
+  if (p_batch->num_calls == p_batch->calls_capacity)
+  {
+    p_batch->calls_capacity = p_batch->calls_capacity * 2 + 16;
+    REALLOC_N(p_batch->p_calls, unsigned int, p_batch->calls_capacity);
+  }
+  p_batch->p_calls[p_batch->num_calls++] = op_index;
+}
+
+/*
+*Sends the request(s) for +p_op+. 
+*/
+static void send_op(Display * p_display, imitator_batch_op * p_op)
+{
+  switch (p_op->kind)
+  {
+    case IMITATOR_BATCH_CONFIGURE:
+      XConfigureWindow(p_display, p_op->win, p_op->value_mask, &p_op->changes);
+      break;
+    case IMITATOR_BATCH_MAP:
+      XMapWindow(p_display, p_op->win);
+      break;
+    case IMITATOR_BATCH_UNMAP:
+      XUnmapWindow(p_display, p_op->win);
+      break;
+    case IMITATOR_BATCH_FOCUS:
+      XSetInputFocus(p_display, p_op->win, RevertToNone, CurrentTime);
+      break;
+    case IMITATOR_BATCH_ACTIVATE:
+      imitator_send_active_window_message(p_display, p_op->win, XDefaultRootWindow(p_display));
+      break;
+  }
+}
+
+/*******************Interface**************************/
+
+imitator_batch * imitator_batch_begin(imitator_connection * p_conn)
+{
+  imitator_batch * p_batch = ALLOC(imitator_batch);
+  
+  MEMZERO(p_batch, imitator_batch, 1);
+  p_batch->thread = rb_thread_current();
+  p_batch->p_next = p_conn->p_batches;
+  p_conn->p_batches = p_batch;
+  return p_batch;
+}
+
+void imitator_batch_end(imitator_connection * p_conn, imitator_batch * p_batch)
+{
+  imitator_batch ** pp_link;
+  
+  for(pp_link = &p_conn->p_batches; *pp_link != NULL; pp_link = &(*pp_link)->p_next)
+  {
+    if (*pp_link == p_batch)
+    {
+      *pp_link = p_batch->p_next;
+      break;
+    }
+  }
+  xfree(p_batch->p_ops);
+  xfree(p_batch->p_calls);
+  xfree(p_batch);
+}
+
+imitator_batch * imitator_current_batch(Display * p_display)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  imitator_batch * p_batch;
+  VALUE thread;
+  
+  if (p_conn == NULL || p_conn->p_batches == NULL)
+    return NULL;
+  thread = rb_thread_current();
+  for(p_batch = p_conn->p_batches; p_batch != NULL; p_batch = p_batch->p_next)
+  {
+    if (p_batch->thread == thread)
+      return p_batch;
+  }
+  return NULL;
+}
+
+void imitator_batch_configure(imitator_batch * p_batch, Window win, unsigned int value_mask, const XWindowChanges * p_changes)
+{
+  imitator_batch_op * p_op = NULL;
+  unsigned int i;
+  
+  /*Merge with the window's changes right before. If anything else was queued after them, 
+  *merging would change the order the X server sees, e.g. of raising two windows. */
+  if (p_batch->num_ops > 0)
+  {
+    i = p_batch->num_ops - 1;
+    if (p_batch->p_ops[i].win == win && p_batch->p_ops[i].kind == IMITATOR_BATCH_CONFIGURE)
+      p_op = &p_batch->p_ops[i];
+  }
+  if (p_op == NULL)
+  {
+    p_op = append_op(p_batch, win, IMITATOR_BATCH_CONFIGURE);
+    i = p_batch->num_ops - 1;
+  }
+  
+  /*A new stack mode without a sibling is relative to all siblings, not the old one*/
+  if ((value_mask & CWStackMode) && !(value_mask & CWSibling))
+    p_op->value_mask &= ~CWSibling;
+  if (value_mask & CWX)
+    p_op->changes.x = p_changes->x;
+  if (value_mask & CWY)
+    p_op->changes.y = p_changes->y;
+  if (value_mask & CWWidth)
+    p_op->changes.width = p_changes->width;
+  if (value_mask & CWHeight)
+    p_op->changes.height = p_changes->height;
+  if (value_mask & CWBorderWidth)
+    p_op->changes.border_width = p_changes->border_width;
+  if (value_mask & CWSibling)
+    p_op->changes.sibling = p_changes->sibling;
+  if (value_mask & CWStackMode)
+    p_op->changes.stack_mode = p_changes->stack_mode;
+  p_op->value_mask |= value_mask;
+  add_call(p_batch, i);
+}
+
+void imitator_batch_add(imitator_batch * p_batch, Window win, enum imitator_batch_op_kind kind)
+{
+  append_op(p_batch, win, kind);
+  add_call(p_batch, p_batch->num_ops - 1);
+}
+
+VALUE imitator_batch_flush(Display * p_display, imitator_batch * p_batch)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  imitator_batch_op * p_op;
+  imitator_x_error err;
+  VALUE op_results = rb_ary_new2(p_batch->num_ops);
+  VALUE results = rb_ary_new2(p_batch->num_calls);
+  unsigned int i;
+  
+  for(i = 0; i < p_batch->num_ops; i++)
+  {
+    p_op = &p_batch->p_ops[i];
+    p_op->first_serial = NextRequest(p_display);
+    send_op(p_display, p_op);
+    p_op->last_serial = NextRequest(p_display);
+    if (p_op->kind == IMITATOR_BATCH_CONFIGURE && p_conn != NULL && p_conn->p_window_cache != NULL)
+      imitator_cache_forget_geometry(p_conn->p_window_cache, p_op->win);
+  }
+  /*One round-trip for all of them. Only errors after the last operation would be raised here, 
+  *theirs stay queued and are taken one by one. */
+  imitator_sync(p_display, NextRequest(p_display));
+  
+  for(i = 0; i < p_batch->num_ops; i++)
+  {
+    p_op = &p_batch->p_ops[i];
+    if (imitator_take_x_errors(p_display, p_op->first_serial, p_op->last_serial, &err) > 0)
+      rb_ary_push(op_results, imitator_x_error_new(p_display, &err));
+    else
+      rb_ary_push(op_results, Qnil);
+  }
+  for(i = 0; i < p_batch->num_calls; i++)
+    rb_ary_push(results, rb_ary_entry(op_results, p_batch->p_calls[i]));
+  
+  return results;
+}
+
+void imitator_send_active_window_message(Display * p_display, Window win, Window root)
+{
+  XEvent xevt;
+  
+  xevt.type = ClientMessage; /*It's a message for a client*/
+  xevt.xclient.display = p_display;
+  xevt.xclient.window = win;
+  xevt.xclient.message_type = imitator_atom(p_display, IMITATOR_ATOM_NET_ACTIVE_WINDOW); /*Activate request*/
+  xevt.xclient.format = 32; /*Using 32-bit messages*/
+  xevt.xclient.data.l[0] = 2L;
+  xevt.xclient.data.l[1] = CurrentTime;
+  
+  /*Actually send the event; this has to happen to all child windows of the target window. */
+  XSendEvent(p_display, root, False, SubstructureNotifyMask | SubstructureRedirectMask, &xevt);
+}
@@ -0,0 +1,81 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_BATCH_HEADER
+#define IMITATOR_BATCH_HEADER
+
+/*
+*Window operations queued by an XWindow.batch block. They're sent when the 
+*block ends, with a single round-trip for all of them. All changes to the 
+*geometry and stacking order of a window queued one after another are merged 
+*into one ConfigureWindow. 
+*/
+
+/*What a queued operation does*/
+enum imitator_batch_op_kind {
+  IMITATOR_BATCH_CONFIGURE,
+  IMITATOR_BATCH_MAP,
+  IMITATOR_BATCH_UNMAP,
+  IMITATOR_BATCH_FOCUS,
+  IMITATOR_BATCH_ACTIVATE
+};
+
+typedef struct {
+  Window win;
+  enum imitator_batch_op_kind kind;
+  /*For IMITATOR_BATCH_CONFIGURE*/
+  unsigned int value_mask;
+  XWindowChanges changes;
+  /*The requests sent for the operation, [first, last)*/
+  unsigned long first_serial;
+  unsigned long last_serial;
+} imitator_batch_op;
+
+typedef struct imitator_batch_s {
+  /*The thread running the block*/
+  VALUE thread;
+  imitator_batch_op * p_ops;
+  unsigned int num_ops;
+  unsigned int ops_capacity;
+  /*For every method call, the index of the operation it ended up in*/
+  unsigned int * p_calls;
+  unsigned int num_calls;
+  unsigned int calls_capacity;
+  /*Next batch of the same connection*/
+  struct imitator_batch_s * p_next;
+} imitator_batch;
+
+/*Starts a batch for the current thread on +p_conn+*/
+imitator_batch * imitator_batch_begin(imitator_connection * p_conn);
+/*Forgets the batch again, without sending anything. Also works after +p_conn+ was closed. */
+void imitator_batch_end(imitator_connection * p_conn, imitator_batch * p_batch);
+/*Returns the batch of the current thread on +p_display+'s connection, NULL if there's none*/
+imitator_batch * imitator_current_batch(Display * p_display);
+/*Queues a ConfigureWindow of +win+ with the +value_mask+ fields of +p_changes+*/
+void imitator_batch_configure(imitator_batch * p_batch, Window win, unsigned int value_mask, const XWindowChanges * p_changes);
+/*Queues the operation +kind+ (not IMITATOR_BATCH_CONFIGURE) on +win+*/
+void imitator_batch_add(imitator_batch * p_batch, Window win, enum imitator_batch_op_kind kind);
+/*Sends all queued operations and waits once for the X server. Returns an array with an 
+*entry for every queued call: nil, or the XProtocolError it caused. */
+VALUE imitator_batch_flush(Display * p_display, imitator_batch * p_batch);
+/*Asks the window manager to activate +win+ (_NET_ACTIVE_WINDOW), by sending a message to +root+. 
+*Just sends the request. */
+void imitator_send_active_window_message(Display * p_display, Window win, Window root);
+
+#endif
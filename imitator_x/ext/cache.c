@@ -0,0 +1,1431 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "ruby/util.h"
+
+/*For rb_protect()ing the queries*/
+struct fetch_args {
+  imitator_window_cache * p_cache;
+  imitator_cached_window * p_node;
+};
+
+/*******************Helper functions**************************/
+
+static imitator_cached_window * lookup(imitator_window_cache * p_cache, Window win)
+{
+  st_data_t value;
+  
+  if (st_lookup(p_cache->p_windows, (st_data_t) win, &value))
+    return (imitator_cached_window *) value;
+  return NULL;
+}
+
+/*
+*Puts +p_node+ on the list of windows refresh() looks at. 
+*/
+static void mark_pending(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  if (p_node->pending)
+    return;
+  if (p_cache->num_pending == p_cache->pending_capacity)
+  {
+    p_cache->pending_capacity = p_cache->pending_capacity * 2 + 64;
+    REALLOC_N(p_cache->p_pending, Window, p_cache->pending_capacity);
+  }
+  p_cache->p_pending[p_cache->num_pending++] = p_node->id;
+  p_node->pending = True;
+}
+
+/*
+*Returns how many levels below its root +p_node+ is, or -1 if a parent is 
+*unknown. Stores the root in +p_root+. 
+*/
+static int depth_of(imitator_window_cache * p_cache, imitator_cached_window * p_node, Window * p_root)
+{
+  int depth = 0;
+  
+  while (p_node->parent_valid && p_node->parent != None)
+  {
+    p_node = lookup(p_cache, p_node->parent);
+    if (p_node == NULL || depth == 10000) /*Either we don't know or something went badly wrong*/
+      return -1;
+    depth++;
+  }
+  if (!p_node->parent_valid)
+    return -1;
+  *p_root = p_node->id;
+  return depth;
+}
+
+/*
+*Adds +p_node+ to the title index if its title is valid. 
+*/
+static void index_add(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  const char * title = p_node->title == NULL ? "(null)" : p_node->title;
+  imitator_title_entry * p_entry;
+  st_data_t value;
+  
+  if (!p_node->title_valid)
+    return;
+  if (st_lookup(p_cache->p_titles, (st_data_t) title, &value))
+    p_entry = (imitator_title_entry *) value;
+  else
+  {
+    p_entry = ALLOC(imitator_title_entry);
+    p_entry->title = ruby_strdup(title);
+    p_entry->wins = NULL;
+    p_entry->num_wins = 0;
+    p_entry->capacity = 0;
+    st_insert(p_cache->p_titles, (st_data_t) p_entry->title, (st_data_t) p_entry);
+  }
+  if (p_entry->num_wins == p_entry->capacity)
+  {
+    p_entry->capacity = p_entry->capacity * 2 + 2;
+    REALLOC_N(p_entry->wins, Window, p_entry->capacity);
+  }
+  p_entry->wins[p_entry->num_wins++] = p_node->id;
+}
+
+static void free_title_entry(imitator_title_entry * p_entry)
+{
+  xfree(p_entry->wins);
+  xfree(p_entry->title);
+  xfree(p_entry);
+}
+
+/*
+*Removes +p_node+ from the title index. 
+*/
+static void index_remove(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  st_data_t key = (st_data_t) (p_node->title == NULL ? "(null)" : p_node->title);
+  imitator_title_entry * p_entry;
+  st_data_t value;
+  unsigned int i;
+  
+  if (!p_node->title_valid || !st_lookup(p_cache->p_titles, key, &value))
+    return;
+  p_entry = (imitator_title_entry *) value;
+  for(i = 0; i < p_entry->num_wins; i++)
+  {
+    if (p_entry->wins[i] == p_node->id)
+    {
+      p_entry->wins[i] = p_entry->wins[--p_entry->num_wins];
+      break;
+    }
+  }
+  if (p_entry->num_wins == 0)
+  {
+    st_delete(p_cache->p_titles, &key, &value);
+    free_title_entry(p_entry);
+  }
+}
+
+/*
+*Sets the title of +p_node+ to +title+ (malloc()ed or NULL), which is taken over. 
+*/
+static void set_title(imitator_window_cache * p_cache, imitator_cached_window * p_node, char * title)
+{
+  index_remove(p_cache, p_node);
+  free(p_node->title);
+  p_node->title = title;
+  p_node->title_valid = True;
+  index_add(p_cache, p_node);
+}
+
+/*
+*Forgets the title of +p_node+, it's fetched again by the next refresh(). 
+*/
+static void invalidate_title(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  index_remove(p_cache, p_node);
+  free(p_node->title);
+  p_node->title = NULL;
+  p_node->title_valid = False;
+  mark_pending(p_cache, p_node);
+}
+
+/*
+*Adds +win+ to the cache and asks X for its events. Nothing about it is 
+*known yet. Call inside a pair of imitator_ignore_x_errors() serials, the 
+*window may be gone already. 
+*/
+static imitator_cached_window * track(imitator_window_cache * p_cache, Window win)
+{
+  imitator_cached_window * p_node = lookup(p_cache, win);
+  
+  if (p_node != NULL)
+    return p_node;
+  
+  p_node = ALLOC(imitator_cached_window);
+  MEMZERO(p_node, imitator_cached_window, 1);
+  p_node->id = win;
+  st_insert(p_cache->p_windows, (st_data_t) win, (st_data_t) p_node);
+  XSelectInput(p_cache->p_display, win, IMITATOR_TRACK_MASK | imitator_idle_event_mask(p_cache->p_display, win));
+  mark_pending(p_cache, p_node);
+  return p_node;
+}
+
+/*
+*Returns the node of +win+, tracking it if it's new. 
+*/
+static imitator_cached_window * get_node(imitator_window_cache * p_cache, Window win)
+{
+  unsigned long serial = NextRequest(p_cache->p_display);
+  imitator_cached_window * p_node = track(p_cache, win);
+  
+  imitator_ignore_x_errors(p_cache->p_display, serial, NextRequest(p_cache->p_display));
+  return p_node;
+}
+
+/*
+*Removes +win+ from the children of +p_parent+. 
+*/
+static void remove_child(imitator_cached_window * p_parent, Window win)
+{
+  unsigned int i;
+  
+  for(i = 0; i < p_parent->num_children; i++)
+  {
+    if (p_parent->children[i] == win)
+    {
+      memmove(p_parent->children + i, p_parent->children + i + 1, sizeof(Window) * (p_parent->num_children - i - 1));
+      p_parent->num_children--;
+      return;
+    }
+  }
+}
+
+/*
+*Inserts +win+ into the children of +p_parent+, right above +sibling+. If +sibling+ 
+*is None, +win+ goes to the bottom. If +win+ is already there, it's moved. 
+*/
+static void insert_child(imitator_cached_window * p_parent, Window win, Window sibling)
+{
+  unsigned int i, pos = 0;
+  
+  remove_child(p_parent, win);
+  if (p_parent->num_children == p_parent->children_capacity)
+  {
+    p_parent->children_capacity = p_parent->children_capacity * 2 + 8;
+    REALLOC_N(p_parent->children, Window, p_parent->children_capacity);
+  }
+  if (sibling != None)
+  {
+    pos = p_parent->num_children; /*On top if we don't find the sibling*/
+    for(i = 0; i < p_parent->num_children; i++)
+    {
+      if (p_parent->children[i] == sibling)
+      {
+        pos = i + 1;
+        break;
+      }
+    }
+  }
+  memmove(p_parent->children + pos + 1, p_parent->children + pos, sizeof(Window) * (p_parent->num_children - pos));
+  p_parent->children[pos] = win;
+  p_parent->num_children++;
+}
+
+/*
+*Puts +win+ on top of its siblings. 
+*/
+static void insert_child_on_top(imitator_cached_window * p_parent, Window win)
+{
+  remove_child(p_parent, win);
+  insert_child(p_parent, win, p_parent->num_children > 0 ? p_parent->children[p_parent->num_children - 1] : None);
+}
+
+/*
+*Returns the parent's node if the parent's children are known. 
+*/
+static imitator_cached_window * known_parent(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  imitator_cached_window * p_parent;
+  
+  if (!p_node->parent_valid)
+    return NULL;
+  p_parent = lookup(p_cache, p_node->parent);
+  if (p_parent == NULL || !p_parent->children_valid)
+    return NULL;
+  return p_parent;
+}
+
+static void free_node(imitator_cached_window * p_node)
+{
+  free(p_node->title);
+  xfree(p_node->children);
+  xfree(p_node);
+}
+
+/*
+*Removes +win+ from the cache. 
+*/
+static void forget_window(imitator_window_cache * p_cache, Window win)
+{
+  imitator_cached_window * p_node;
+  imitator_cached_window * p_parent;
+  st_data_t key = (st_data_t) win;
+  st_data_t value;
+  
+  if (!st_delete(p_cache->p_windows, &key, &value))
+    return;
+  p_node = (imitator_cached_window *) value;
+  if ((p_parent = known_parent(p_cache, p_node)) != NULL)
+    remove_child(p_parent, win);
+  index_remove(p_cache, p_node);
+  free_node(p_node); /*It may stay in p_pending, refresh() skips it*/
+}
+
+/*
+*Replaces the children of +p_node+ by the +num_children+ windows in +p_children+. 
+*Children we didn't know yet are tracked. 
+*/
+static void set_children(imitator_window_cache * p_cache, imitator_cached_window * p_node, const Window * p_children, unsigned int num_children)
+{
+  imitator_cached_window * p_child;
+  unsigned long serial = NextRequest(p_cache->p_display);
+  unsigned int i;
+  
+  p_node->num_children = 0;
+  for(i = 0; i < num_children; i++)
+  {
+    p_child = track(p_cache, p_children[i]);
+    p_child->parent = p_node->id;
+    p_child->parent_valid = True;
+    insert_child_on_top(p_node, p_children[i]);
+    mark_pending(p_cache, p_child); /*May have come from somewhere we didn't explore*/
+  }
+  imitator_ignore_x_errors(p_cache->p_display, serial, NextRequest(p_cache->p_display));
+  p_node->children_valid = True;
+}
+
+/*
+*Queries the parent and children of +p_args->p_node+. 
+*/
+static VALUE fetch_tree(VALUE arg)
+{
+  struct fetch_args * p_args = (struct fetch_args *) arg;
+  Window root, parent;
+  Window * p_children;
+  unsigned int num_children;
+  
+  imitator_query_tree(p_args->p_cache->p_display, p_args->p_node->id, &root, &parent, &p_children, &num_children);
+  p_args->p_node->parent = parent;
+  p_args->p_node->parent_valid = True;
+  set_children(p_args->p_cache, p_args->p_node, p_children, num_children);
+  
+  if (p_children != NULL)
+    XFree(p_children);
+  return Qnil;
+}
+
+/*
+*Queries the geometry and map state of +p_args->p_node+. 
+*/
+static VALUE fetch_geometry(VALUE arg)
+{
+  struct fetch_args * p_args = (struct fetch_args *) arg;
+  imitator_cached_window * p_node = p_args->p_node;
+  XWindowAttributes xattr;
+  
+  imitator_get_window_attributes(p_args->p_cache->p_display, p_node->id, &xattr);
+  p_node->x = xattr.x;
+  p_node->y = xattr.y;
+  p_node->width = xattr.width;
+  p_node->height = xattr.height;
+  p_node->border_width = xattr.border_width;
+  p_node->geometry_valid = True;
+  p_node->mapped = xattr.map_state != IsUnmapped;
+  p_node->mapped_valid = True;
+  return Qnil;
+}
+
+/*
+*Calls +func+ for +p_node+. If it raises (most likely since the window 
+*doesn't exist), the node is dropped and the rb_protect() state is returned. 
+*/
+static int try_fetch(imitator_window_cache * p_cache, imitator_cached_window * p_node, VALUE (*func)(VALUE))
+{
+  struct fetch_args args = {p_cache, p_node};
+  int state = 0;
+  
+  rb_protect(func, (VALUE) &args, &state);
+  if (state)
+    forget_window(p_cache, p_node->id);
+  return state;
+}
+
+/*
+*Like try_fetch(), but passes the exception on. 
+*/
+static void protected_fetch(imitator_window_cache * p_cache, imitator_cached_window * p_node, VALUE (*func)(VALUE))
+{
+  int state = try_fetch(p_cache, p_node, func);
+  
+  if (state)
+    rb_jump_tag(state);
+}
+
+/*
+*Arguments for fetch_layer(). 
+*/
+struct layer_args {
+  Display * p_display;
+  const Window * p_wins;
+  unsigned int count;
+  char ** pp_titles;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+};
+
+/*
+*Fetches the titles and children of a layer of refresh(), for rb_protect(). 
+*/
+static VALUE fetch_layer(VALUE arg)
+{
+  struct layer_args * p_args = (struct layer_args *) arg;
+  
+  imitator_get_titles_and_children(p_args->p_display, p_args->p_wins, p_args->count, p_args->pp_titles, p_args->pp_children, p_args->p_num_children);
+  return Qnil;
+}
+
+/*
+*Marks the windows +p_wins+ still in +p_cache+ pending again. 
+*/
+static void mark_list_pending(imitator_window_cache * p_cache, const Window * p_wins, unsigned int count)
+{
+  imitator_cached_window * p_node;
+  unsigned int i;
+  
+  for(i = 0; i < count; i++)
+  {
+    if ((p_node = lookup(p_cache, p_wins[i])) != NULL)
+      mark_pending(p_cache, p_node);
+  }
+}
+
+/*
+*Marks +p_node+ and everything below it that we know pending. 
+*/
+static void mark_tree_pending(imitator_window_cache * p_cache, imitator_cached_window * p_node)
+{
+  imitator_cached_window * p_child;
+  unsigned int i;
+  
+  mark_pending(p_cache, p_node);
+  if (!p_node->children_valid)
+    return;
+  for(i = 0; i < p_node->num_children; i++)
+  {
+    if ((p_child = lookup(p_cache, p_node->children[i])) != NULL)
+      mark_tree_pending(p_cache, p_child);
+  }
+}
+
+/*
+*Fetches what's missing of the pending windows inside p_cache->complete_depth: titles, 
+*and children for the windows above it. New children are pending themselves, so this 
+*takes one round-trip per layer that has something new. Windows outside stay pending. 
+*/
+static void refresh(imitator_window_cache * p_cache)
+{
+  imitator_cached_window * p_node;
+  Window * p_list;
+  Window * p_batch;
+  Window * p_deferred = NULL;
+  char ** pp_titles;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+  unsigned int i, num_list, num_batch, num_deferred = 0, deferred_capacity = 0;
+  Window root;
+  int depth, state;
+  Display * p_display = p_cache->p_display;
+  imitator_connection * p_conn;
+  struct layer_args args;
+  
+  while (p_cache->num_pending > 0)
+  {
+    /*Take the list, set_children() starts a new one*/
+    p_list = p_cache->p_pending;
+    num_list = p_cache->num_pending;
+    p_cache->p_pending = NULL;
+    p_cache->num_pending = 0;
+    p_cache->pending_capacity = 0;
+    
+    p_batch = ALLOC_N(Window, num_list);
+    num_batch = 0;
+    for(i = 0; i < num_list; i++)
+    {
+      if ((p_node = lookup(p_cache, p_list[i])) == NULL) /*Destroyed meanwhile*/
+        continue;
+      p_node->pending = False;
+      depth = depth_of(p_cache, p_node, &root);
+      if (depth < 0 || depth > p_cache->complete_depth)
+      {
+        /*Not needed now, keep it for a deeper exploration. If its parent turns 
+        *up during this refresh, set_children() marks it pending again. */
+        if (num_deferred == deferred_capacity)
+        {
+          deferred_capacity = deferred_capacity * 2 + 64;
+          REALLOC_N(p_deferred, Window, deferred_capacity);
+        }
+        p_deferred[num_deferred++] = p_list[i];
+        continue;
+      }
+      if (!p_node->title_valid || (!p_node->children_valid && depth < p_cache->complete_depth))
+        p_batch[num_batch++] = p_list[i];
+    }
+    xfree(p_list);
+    
+    if (num_batch > 0)
+    {
+      pp_titles = ALLOC_N(char *, num_batch);
+      pp_children = ALLOC_N(Window *, num_batch);
+      p_num_children = ALLOC_N(unsigned int, num_batch);
+      MEMZERO(pp_titles, char *, num_batch);
+      MEMZERO(pp_children, Window *, num_batch);
+      MEMZERO(p_num_children, unsigned int, num_batch);
+      args.p_display = p_display;
+      args.p_wins = p_batch;
+      args.count = num_batch;
+      args.pp_titles = pp_titles;
+      args.pp_children = pp_children;
+      args.p_num_children = p_num_children;
+      rb_protect(fetch_layer, (VALUE) &args, &state);
+      if (state)
+      {
+        imitator_free_list((void **) pp_titles, num_batch);
+        imitator_free_list((void **) pp_children, num_batch);
+        xfree(p_num_children);
+        xfree(pp_children);
+        xfree(pp_titles);
+        /*Fetch them with the next refresh, unless the cache was dropped meanwhile*/
+        p_conn = imitator_connection_of(p_display);
+        if (p_conn != NULL && p_conn->p_window_cache == p_cache)
+        {
+          mark_list_pending(p_cache, p_batch, num_batch);
+          mark_list_pending(p_cache, p_deferred, num_deferred);
+        }
+        xfree(p_batch);
+        xfree(p_deferred);
+        rb_jump_tag(state);
+      }
+      for(i = 0; i < num_batch; i++)
+      {
+        /*Vanished windows look childless and untitled until their DestroyNotify arrives*/
+        p_node = lookup(p_cache, p_batch[i]);
+        set_title(p_cache, p_node, pp_titles[i]);
+        set_children(p_cache, p_node, pp_children[i], p_num_children[i]);
+      }
+      imitator_free_list((void **) pp_children, num_batch);
+      xfree(p_num_children);
+      xfree(pp_children);
+      xfree(pp_titles);
+    }
+    xfree(p_batch);
+  }
+  
+  /*Put the deferred windows back*/
+  mark_list_pending(p_cache, p_deferred, num_deferred);
+  xfree(p_deferred);
+}
+
+/*
+*Returns the number of the screen whose root window is +root+, or -1. 
+*/
+static int screen_of_root(Display * p_display, Window root)
+{
+  int i;
+  
+  for(i = 0; i < ScreenCount(p_display); i++)
+  {
+    if (RootWindow(p_display, i) == root)
+      return i;
+  }
+  return -1;
+}
+
+/*
+*Reads the window list +property+ of +root+ into +pp_wins+. Returns False if it isn't set. 
+*/
+static Bool fetch_client_list(Display * p_display, Window root, Atom property, Window ** pp_wins, unsigned int * p_count)
+{
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char * p_value = NULL;
+  Bool supported;
+  
+  *pp_wins = NULL;
+  *p_count = 0;
+  imitator_get_window_property(p_display, root, property, 0, 1000000, False, XA_WINDOW, &actual_type, &actual_format, &nitems, &bytes_after, &p_value);
+  supported = actual_type == XA_WINDOW && actual_format == 32;
+  if (supported && nitems > 0)
+  {
+    /*Xlib hands out format 32 as longs, i.e. Windows*/
+    *pp_wins = (Window *) malloc(sizeof(Window) * nitems);
+    memcpy(*pp_wins, p_value, sizeof(Window) * nitems);
+    *p_count = nitems;
+  }
+  if (p_value != NULL)
+    XFree(p_value);
+  return supported;
+}
+
+/*
+*Arguments of the cached lookups of many windows. Everything they allocate is kept 
+*here, so free_lookup() can free it also if asking X raises. 
+*/
+struct lookup_args {
+  imitator_window_cache * p_cache;
+  const Window * p_wins;
+  unsigned int count;
+  /*Where the results go, as far as the lookup has them*/
+  char ** pp_titles;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+  long * p_pids;
+  imitator_x_error * p_errors;
+  /*The nodes of +p_wins+, and the windows among them (at +p_indices+) we have to ask X about*/
+  imitator_cached_window ** pp_nodes;
+  Window * p_missing;
+  unsigned int * p_indices;
+  unsigned int num_missing;
+  /*X's answers for +p_missing+*/
+  char ** pp_fetched_titles;
+  Window ** pp_fetched_children;
+  unsigned int * p_fetched_num;
+  long * p_fetched_pids;
+  imitator_x_error * p_fetch_errors;
+  /*For imitator_cached_find_client_title(): the malloc()ed client list, the title 
+  *and where the clients with that title go*/
+  Window * p_clients;
+  const char * title;
+  Window ** pp_found;
+  unsigned int * p_num_found;
+};
+
+/*
+*Sets up +p_args+ for a lookup of the +count+ windows +p_wins+ in +p_cache+. 
+*/
+static void init_lookup(struct lookup_args * p_args, imitator_window_cache * p_cache, const Window * p_wins, unsigned int count)
+{
+  MEMZERO(p_args, struct lookup_args, 1);
+  p_args->p_cache = p_cache;
+  p_args->p_wins = p_wins;
+  p_args->count = count;
+}
+
+/*
+*Frees what a lookup allocated, for rb_ensure(). 
+*/
+static VALUE free_lookup(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  
+  /*Fetched titles that no node took over, e.g. because the next request raised*/
+  if (p_args->pp_fetched_titles != NULL)
+    imitator_free_list((void **) p_args->pp_fetched_titles, p_args->num_missing);
+  if (p_args->pp_fetched_children != NULL)
+    imitator_free_list((void **) p_args->pp_fetched_children, p_args->num_missing);
+  xfree(p_args->pp_fetched_titles);
+  xfree(p_args->pp_fetched_children);
+  xfree(p_args->p_fetched_num);
+  xfree(p_args->p_fetched_pids);
+  xfree(p_args->p_fetch_errors);
+  xfree(p_args->p_indices);
+  xfree(p_args->p_missing);
+  xfree(p_args->pp_nodes);
+  free(p_args->p_clients);
+  return Qnil;
+}
+
+static Bool title_missing(const imitator_cached_window * p_node)
+{
+  return !p_node->title_valid;
+}
+
+static Bool children_missing(const imitator_cached_window * p_node)
+{
+  return !p_node->children_valid;
+}
+
+static Bool title_or_children_missing(const imitator_cached_window * p_node)
+{
+  return !p_node->title_valid || !p_node->children_valid;
+}
+
+static Bool pid_missing(const imitator_cached_window * p_node)
+{
+  return !p_node->pid_valid;
+}
+
+/*
+*Tracks the windows of +p_args+, stores their nodes and lists those +is_missing+ 
+*says we have to ask X about. Clears the errors, if wanted. 
+*/
+static void find_missing(struct lookup_args * p_args, Bool (*is_missing)(const imitator_cached_window *))
+{
+  Display * p_display = p_args->p_cache->p_display;
+  unsigned long serial;
+  unsigned int i;
+  
+  p_args->pp_nodes = ALLOC_N(imitator_cached_window *, p_args->count);
+  p_args->p_missing = ALLOC_N(Window, p_args->count);
+  p_args->p_indices = ALLOC_N(unsigned int, p_args->count);
+  serial = NextRequest(p_display);
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_args->pp_nodes[i] = track(p_args->p_cache, p_args->p_wins[i]);
+    if (p_args->p_errors != NULL)
+      p_args->p_errors[i].error_code = 0;
+    if (is_missing(p_args->pp_nodes[i]))
+    {
+      p_args->p_indices[p_args->num_missing] = i;
+      p_args->p_missing[p_args->num_missing++] = p_args->p_wins[i];
+    }
+  }
+  imitator_ignore_x_errors(p_display, serial, NextRequest(p_display));
+}
+
+/*
+*Makes sure the titles of +p_args+'s windows are known, asking X for all missing ones at once, 
+*and stores their nodes in p_args->pp_nodes. The titles end up in the title index. 
+*Unless p_args->p_errors is NULL, it gets the error asking for each title caused, or an 
+*error_code of 0. Windows whose request failed aren't given a title. 
+*/
+static void fetch_titles(struct lookup_args * p_args)
+{
+  unsigned int i;
+  
+  /*Find out which titles we don't know*/
+  find_missing(p_args, title_missing);
+  if (p_args->num_missing == 0)
+    return;
+  
+  /*Ask for all of them at once*/
+  p_args->pp_fetched_titles = ALLOC_N(char *, p_args->num_missing);
+  p_args->p_fetch_errors = ALLOC_N(imitator_x_error, p_args->num_missing);
+  MEMZERO(p_args->pp_fetched_titles, char *, p_args->num_missing);
+  imitator_get_titles(p_args->p_cache->p_display, p_args->p_missing, p_args->num_missing, p_args->pp_fetched_titles, p_args->p_fetch_errors);
+  for(i = 0; i < p_args->num_missing; i++)
+  {
+    if (p_args->p_errors != NULL)
+      p_args->p_errors[p_args->p_indices[i]] = p_args->p_fetch_errors[i];
+    /*A vanished window has no name to remember*/
+    if (p_args->p_fetch_errors[i].error_code != 0)
+      continue;
+    /*The node can't be gone, we didn't process events meanwhile. It owns the title now. */
+    set_title(p_args->p_cache, lookup(p_args->p_cache, p_args->p_missing[i]), p_args->pp_fetched_titles[i]);
+    p_args->pp_fetched_titles[i] = NULL;
+  }
+}
+
+/*
+*Copies the children of +p_node+ into +pp_children+ and +p_num_children+. 
+*/
+static void copy_children(const imitator_cached_window * p_node, Window ** pp_children, unsigned int * p_num_children)
+{
+  *p_num_children = p_node->num_children;
+  *pp_children = NULL;
+  if (p_node->num_children > 0)
+  {
+    *pp_children = (Window *) malloc(sizeof(Window) * p_node->num_children);
+    memcpy(*pp_children, p_node->children, sizeof(Window) * p_node->num_children);
+  }
+}
+
+/*
+*Body of imitator_cached_get_titles(). 
+*/
+static VALUE get_titles_body(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  unsigned int i;
+  
+  fetch_titles(p_args);
+  for(i = 0; i < p_args->count; i++)
+    p_args->pp_titles[i] = p_args->pp_nodes[i]->title == NULL ? NULL : strdup(p_args->pp_nodes[i]->title);
+  return Qnil;
+}
+
+/*
+*Body of imitator_cached_get_pids(). 
+*/
+static VALUE get_pids_body(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  imitator_cached_window * p_node;
+  unsigned int i;
+  
+  find_missing(p_args, pid_missing);
+  
+  /*Ask for all of them at once; the X-Resource fallback is one more batch*/
+  if (p_args->num_missing > 0)
+  {
+    p_args->p_fetched_pids = ALLOC_N(long, p_args->num_missing);
+    p_args->p_fetch_errors = ALLOC_N(imitator_x_error, p_args->num_missing);
+    imitator_get_pids(p_args->p_cache->p_display, p_args->p_missing, p_args->num_missing, p_args->p_fetched_pids, p_args->p_fetch_errors);
+    for(i = 0; i < p_args->num_missing; i++)
+    {
+      if (p_args->p_errors != NULL)
+        p_args->p_errors[p_args->p_indices[i]] = p_args->p_fetch_errors[i];
+      if (p_args->p_fetch_errors[i].error_code != 0) /*A vanished window has no PID to remember*/
+        continue;
+      p_node = lookup(p_args->p_cache, p_args->p_missing[i]);
+      p_node->pid = p_args->p_fetched_pids[i];
+      p_node->pid_valid = True;
+    }
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+    p_args->p_pids[i] = p_args->pp_nodes[i]->pid_valid ? p_args->pp_nodes[i]->pid : -1;
+  return Qnil;
+}
+
+/*
+*Allocates the buffers for X's titles (if +titles+) and children of the missing windows of +p_args+. 
+*/
+static void alloc_fetched(struct lookup_args * p_args, Bool titles)
+{
+  if (titles)
+  {
+    p_args->pp_fetched_titles = ALLOC_N(char *, p_args->num_missing);
+    MEMZERO(p_args->pp_fetched_titles, char *, p_args->num_missing);
+  }
+  p_args->pp_fetched_children = ALLOC_N(Window *, p_args->num_missing);
+  p_args->p_fetched_num = ALLOC_N(unsigned int, p_args->num_missing);
+  MEMZERO(p_args->pp_fetched_children, Window *, p_args->num_missing);
+  MEMZERO(p_args->p_fetched_num, unsigned int, p_args->num_missing);
+}
+
+/*
+*Body of imitator_cached_get_titles_and_children(). 
+*/
+static VALUE get_titles_and_children_body(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  imitator_cached_window * p_node;
+  unsigned int i;
+  
+  find_missing(p_args, title_or_children_missing);
+  
+  /*Ask for everything we don't know at once. Vanished windows 
+  *look childless and untitled until their DestroyNotify arrives. */
+  if (p_args->num_missing > 0)
+  {
+    alloc_fetched(p_args, True);
+    imitator_get_titles_and_children(p_args->p_cache->p_display, p_args->p_missing, p_args->num_missing, 
+                                     p_args->pp_fetched_titles, p_args->pp_fetched_children, p_args->p_fetched_num);
+    for(i = 0; i < p_args->num_missing; i++)
+    {
+      p_node = lookup(p_args->p_cache, p_args->p_missing[i]);
+      set_title(p_args->p_cache, p_node, p_args->pp_fetched_titles[i]);
+      p_args->pp_fetched_titles[i] = NULL; /*The node owns it now*/
+      set_children(p_args->p_cache, p_node, p_args->pp_fetched_children[i], p_args->p_fetched_num[i]);
+    }
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_args->pp_titles[i] = p_args->pp_nodes[i]->title == NULL ? NULL : strdup(p_args->pp_nodes[i]->title);
+    copy_children(p_args->pp_nodes[i], &p_args->pp_children[i], &p_args->p_num_children[i]);
+  }
+  return Qnil;
+}
+
+/*
+*Body of imitator_cached_query_trees(). 
+*/
+static VALUE query_trees_body(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  unsigned int i;
+  
+  find_missing(p_args, children_missing);
+  if (p_args->num_missing > 0)
+  {
+    alloc_fetched(p_args, False);
+    imitator_query_trees(p_args->p_cache->p_display, p_args->p_missing, p_args->num_missing, p_args->pp_fetched_children, p_args->p_fetched_num);
+    for(i = 0; i < p_args->num_missing; i++)
+      set_children(p_args->p_cache, lookup(p_args->p_cache, p_args->p_missing[i]), p_args->pp_fetched_children[i], p_args->p_fetched_num[i]);
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+    copy_children(p_args->pp_nodes[i], &p_args->pp_children[i], &p_args->p_num_children[i]);
+  return Qnil;
+}
+
+/*
+*Body of imitator_cached_find_client_title(), the clients are p_args->p_wins. 
+*/
+static VALUE find_client_title_body(VALUE arg)
+{
+  struct lookup_args * p_args = (struct lookup_args *) arg;
+  imitator_title_entry * p_entry;
+  unsigned int i, j;
+  st_data_t value;
+  
+  /*Only the first time, the cache keeps the titles of the windows it tracks*/
+  fetch_titles(p_args);
+  
+  /*The clients with that title, in the order of the client list*/
+  if (p_args->count == 0 || !st_lookup(p_args->p_cache->p_titles, (st_data_t) p_args->title, &value))
+    return Qnil;
+  p_entry = (imitator_title_entry *) value;
+  *p_args->pp_found = (Window *) malloc(sizeof(Window) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+  {
+    for(j = 0; j < p_entry->num_wins; j++)
+    {
+      if (p_entry->wins[j] == p_args->p_wins[i])
+      {
+        (*p_args->pp_found)[(*p_args->p_num_found)++] = p_args->p_wins[i];
+        break;
+      }
+    }
+  }
+  if (*p_args->p_num_found == 0)
+  {
+    free(*p_args->pp_found);
+    *p_args->pp_found = NULL;
+  }
+  return Qnil;
+}
+
+/*
+*Returns the cache of +p_display+'s connection after applying the pending 
+*events, or NULL if it has none. 
+*/
+static imitator_window_cache * get_cache(Display * p_display)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn == NULL || p_conn->p_window_cache == NULL)
+    return NULL;
+  imitator_process_events(p_display);
+  return p_conn->p_window_cache;
+}
+
+static int free_title_entry_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+  free_title_entry((imitator_title_entry *) value);
+  return ST_DELETE;
+}
+
+static int free_node_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+  imitator_window_cache * p_cache = (imitator_window_cache *) arg;
+  
+  if (p_cache != NULL)
+    XSelectInput(p_cache->p_display, (Window) key, imitator_idle_event_mask(p_cache->p_display, (Window) key));
+  free_node((imitator_cached_window *) value);
+  return ST_DELETE;
+}
+
+/*******************Interface**************************/
+
+imitator_window_cache * imitator_cache_new(Display * p_display)
+{
+  imitator_window_cache * p_cache = ALLOC(imitator_window_cache);
+  unsigned long serial;
+  int i;
+  
+  p_cache->p_display = p_display;
+  p_cache->p_windows = st_init_numtable();
+  p_cache->generation = 0;
+  p_cache->p_titles = st_init_strtable();
+  p_cache->p_pending = NULL;
+  p_cache->num_pending = 0;
+  p_cache->pending_capacity = 0;
+  p_cache->complete_depth = 0;
+  p_cache->net_wm_name = imitator_atom(p_display, IMITATOR_ATOM_NET_WM_NAME);
+  p_cache->net_wm_pid = imitator_atom(p_display, IMITATOR_ATOM_NET_WM_PID);
+  p_cache->p_client_lists = ALLOC_N(imitator_client_list, 2 * ScreenCount(p_display));
+  memset(p_cache->p_client_lists, 0, sizeof(imitator_client_list) * 2 * ScreenCount(p_display));
+  p_cache->net_client_list = imitator_atom(p_display, IMITATOR_ATOM_NET_CLIENT_LIST);
+  p_cache->net_client_list_stacking = imitator_atom(p_display, IMITATOR_ATOM_NET_CLIENT_LIST_STACKING);
+  
+  /*Everything starts at the roots*/
+  serial = NextRequest(p_display);
+  for(i = 0; i < ScreenCount(p_display); i++)
+  {
+    track(p_cache, RootWindow(p_display, i))->parent_valid = True; /*Roots have no parent, i.e. None*/
+  }
+  imitator_ignore_x_errors(p_display, serial, NextRequest(p_display));
+  imitator_flush(p_display);
+  
+  return p_cache;
+}
+
+void imitator_cache_free(imitator_window_cache * p_cache, Bool unselect)
+{
+  unsigned long serial = NextRequest(p_cache->p_display);
+  int i;
+  
+  st_foreach(p_cache->p_windows, free_node_i, (st_data_t) (unselect ? p_cache : NULL));
+  if (unselect)
+  {
+    /*Windows destroyed meanwhile cause BadWindow*/
+    imitator_ignore_x_errors(p_cache->p_display, serial, NextRequest(p_cache->p_display));
+    imitator_flush(p_cache->p_display);
+  }
+  st_free_table(p_cache->p_windows);
+  st_foreach(p_cache->p_titles, free_title_entry_i, 0);
+  st_free_table(p_cache->p_titles);
+  xfree(p_cache->p_pending);
+  for(i = 0; i < 2 * ScreenCount(p_cache->p_display); i++)
+    free(p_cache->p_client_lists[i].wins);
+  xfree(p_cache->p_client_lists);
+  xfree(p_cache);
+}
+
+void imitator_cache_handle_event(imitator_window_cache * p_cache, const imitator_event * p_evt)
+{
+  imitator_cached_window * p_node = lookup(p_cache, p_evt->window);
+  imitator_cached_window * p_parent;
+  unsigned long serial;
+  int screen;
+  
+  p_cache->generation++;
+  switch (p_evt->type)
+  {
+    case CreateNotify:
+      /*We get this only for children of tracked windows, so track the new one as well*/
+      serial = NextRequest(p_cache->p_display);
+      p_node = track(p_cache, p_evt->window);
+      imitator_ignore_x_errors(p_cache->p_display, serial, NextRequest(p_cache->p_display));
+      p_node->parent = p_evt->parent;
+      p_node->parent_valid = True;
+      p_node->x = p_evt->x;
+      p_node->y = p_evt->y;
+      p_node->width = p_evt->width;
+      p_node->height = p_evt->height;
+      p_node->border_width = p_evt->border_width;
+      p_node->geometry_valid = True;
+      p_node->mapped = False;
+      p_node->mapped_valid = True;
+      if ((p_parent = known_parent(p_cache, p_node)) != NULL)
+        insert_child_on_top(p_parent, p_evt->window);
+      break;
+    case DestroyNotify:
+      forget_window(p_cache, p_evt->window);
+      break;
+    case ReparentNotify:
+      if (p_node == NULL)
+        break;
+      if ((p_parent = known_parent(p_cache, p_node)) != NULL)
+        remove_child(p_parent, p_evt->window);
+      p_node->parent = p_evt->parent;
+      p_node->parent_valid = True;
+      p_node->x = p_evt->x;
+      p_node->y = p_evt->y;
+      if ((p_parent = known_parent(p_cache, p_node)) != NULL)
+        insert_child_on_top(p_parent, p_evt->window);
+      mark_pending(p_cache, p_node); /*It may have moved into the explored part of the tree*/
+      break;
+    case ConfigureNotify:
+      if (p_node == NULL)
+        break;
+      p_node->x = p_evt->x;
+      p_node->y = p_evt->y;
+      p_node->width = p_evt->width;
+      p_node->height = p_evt->height;
+      p_node->border_width = p_evt->border_width;
+      p_node->geometry_valid = True;
+      if ((p_parent = known_parent(p_cache, p_node)) != NULL)
+        insert_child(p_parent, p_evt->window, p_evt->sibling);
+      break;
+    case GravityNotify:
+      if (p_node == NULL)
+        break;
+      p_node->x = p_evt->x;
+      p_node->y = p_evt->y;
+      break;
+    case MapNotify:
+    case UnmapNotify:
+      if (p_node == NULL)
+        break;
+      p_node->mapped = (p_evt->type == MapNotify);
+      p_node->mapped_valid = True;
+      break;
+    case CirculateNotify:
+      if (p_node == NULL || (p_parent = known_parent(p_cache, p_node)) == NULL)
+        break;
+      if (p_evt->place == PlaceOnTop)
+        insert_child_on_top(p_parent, p_evt->window);
+      else
+        insert_child(p_parent, p_evt->window, None);
+      break;
+    case PropertyNotify:
+      if (p_node != NULL && (p_evt->atom == XA_WM_NAME || p_evt->atom == p_cache->net_wm_name))
+        invalidate_title(p_cache, p_node); /*Fetched again when needed*/
+      else if (p_node != NULL && p_evt->atom == p_cache->net_wm_pid)
+        p_node->pid_valid = False;
+      else if ((p_evt->atom == p_cache->net_client_list || p_evt->atom == p_cache->net_client_list_stacking) 
+               && (screen = screen_of_root(p_cache->p_display, p_evt->window)) >= 0)
+        p_cache->p_client_lists[2 * screen + (p_evt->atom == p_cache->net_client_list_stacking)].valid = False;
+      break;
+  }
+}
+
+void imitator_cache_forget_geometry(imitator_window_cache * p_cache, Window win)
+{
+  imitator_cached_window * p_node = lookup(p_cache, win);
+  
+  if (p_node != NULL)
+    p_node->geometry_valid = False;
+}
+
+Bool imitator_cache_tracks(imitator_window_cache * p_cache, Window win)
+{
+  return lookup(p_cache, win) != NULL;
+}
+
+void imitator_cached_query_tree(Display * p_display, Window win, Window * p_parent, Window ** pp_children, unsigned int * p_num_children)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_cached_window * p_node;
+  Window root;
+  Window * p_children;
+  
+  if (p_cache == NULL)
+  {
+    imitator_query_tree(p_display, win, &root, p_parent, &p_children, p_num_children);
+    *pp_children = NULL;
+    if (*p_num_children > 0)
+    {
+      *pp_children = (Window *) malloc(sizeof(Window) * *p_num_children);
+      memcpy(*pp_children, p_children, sizeof(Window) * *p_num_children);
+    }
+    if (p_children != NULL)
+      XFree(p_children);
+    return;
+  }
+  
+  p_node = get_node(p_cache, win);
+  if (!p_node->children_valid || !p_node->parent_valid)
+    protected_fetch(p_cache, p_node, fetch_tree);
+  
+  *p_parent = p_node->parent;
+  copy_children(p_node, pp_children, p_num_children);
+}
+
+void imitator_cached_get_titles(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, imitator_x_error * p_errors)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  struct lookup_args args;
+  
+  if (p_cache == NULL)
+  {
+    imitator_get_titles(p_display, p_wins, count, pp_titles, p_errors);
+    return;
+  }
+  
+  init_lookup(&args, p_cache, p_wins, count);
+  args.pp_titles = pp_titles;
+  args.p_errors = p_errors;
+  rb_ensure(get_titles_body, (VALUE) &args, free_lookup, (VALUE) &args);
+}
+
+void imitator_cached_windows_exist(Display * p_display, const Window * p_wins, unsigned int count, Bool * p_exist)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_cached_window * p_node;
+  Window * p_unknown;
+  Bool * p_unknown_exist;
+  unsigned int i, j, num_unknown = 0;
+  unsigned long serial;
+  
+  if (p_cache == NULL)
+  {
+    imitator_windows_exist(p_display, p_wins, count, p_exist);
+    return;
+  }
+  
+  /*Geometry and map state come from replies or events after we selected the 
+  *events, so the DestroyNotify can't have been missed. Ask X about the rest. */
+  p_unknown = ALLOC_N(Window, count);
+  serial = NextRequest(p_display);
+  for(i = 0; i < count; i++)
+  {
+    p_node = track(p_cache, p_wins[i]);
+    p_exist[i] = p_node->geometry_valid || p_node->mapped_valid;
+    if (!p_exist[i])
+      p_unknown[num_unknown++] = p_wins[i];
+  }
+  imitator_ignore_x_errors(p_display, serial, NextRequest(p_display));
+  
+  if (num_unknown > 0)
+  {
+    p_unknown_exist = ALLOC_N(Bool, num_unknown);
+    imitator_windows_exist(p_display, p_unknown, num_unknown, p_unknown_exist);
+    for(i = 0, j = 0; i < count; i++)
+    {
+      if (p_exist[i]) /*Known before*/
+        continue;
+      if (p_unknown_exist[j])
+        p_exist[i] = True;
+      else
+        forget_window(p_cache, p_wins[i]); /*Nothing to track*/
+      j++;
+    }
+    xfree(p_unknown_exist);
+  }
+  xfree(p_unknown);
+}
+
+Bool imitator_cached_exists(Display * p_display, Window win)
+{
+  Bool exists;
+  
+  imitator_cached_windows_exist(p_display, &win, 1, &exists);
+  return exists;
+}
+
+Bool imitator_cached_is_mapped(Display * p_display, Window win)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_cached_window * p_node;
+  XWindowAttributes xattr;
+  
+  if (p_cache == NULL)
+  {
+    imitator_get_window_attributes(p_display, win, &xattr);
+    return xattr.map_state != IsUnmapped;
+  }
+  
+  p_node = get_node(p_cache, win);
+  if (!p_node->mapped_valid)
+    protected_fetch(p_cache, p_node, fetch_geometry);
+  return p_node->mapped;
+}
+
+Bool imitator_cached_get_client_list(Display * p_display, Window root, Bool stacking, Window ** pp_wins, unsigned int * p_count)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  Atom property = imitator_atom(p_display, stacking ? IMITATOR_ATOM_NET_CLIENT_LIST_STACKING : IMITATOR_ATOM_NET_CLIENT_LIST);
+  imitator_client_list * p_list;
+  int screen = screen_of_root(p_display, root);
+  
+  if (p_cache == NULL || screen < 0)
+    return fetch_client_list(p_display, root, property, pp_wins, p_count);
+  
+  /*The window manager changes it on the root, which we watch*/
+  p_list = &p_cache->p_client_lists[2 * screen + (stacking ? 1 : 0)];
+  if (!p_list->valid)
+  {
+    free(p_list->wins);
+    p_list->wins = NULL;
+    p_list->count = 0;
+    p_list->supported = fetch_client_list(p_display, root, property, &p_list->wins, &p_list->count);
+    p_list->valid = True;
+  }
+  *pp_wins = NULL;
+  *p_count = p_list->count;
+  if (p_list->count > 0)
+  {
+    *pp_wins = (Window *) malloc(sizeof(Window) * p_list->count);
+    memcpy(*pp_wins, p_list->wins, sizeof(Window) * p_list->count);
+  }
+  return p_list->supported;
+}
+
+void imitator_cached_get_geometry(Display * p_display, Window win, int * p_x, int * p_y, unsigned int * p_width, unsigned int * p_height)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_cached_window * p_node;
+  XWindowAttributes xattr;
+  
+  if (p_cache == NULL)
+  {
+    imitator_get_window_attributes(p_display, win, &xattr);
+    *p_x = xattr.x;
+    *p_y = xattr.y;
+    *p_width = xattr.width;
+    *p_height = xattr.height;
+    return;
+  }
+  
+  p_node = get_node(p_cache, win);
+  if (!p_node->geometry_valid)
+    protected_fetch(p_cache, p_node, fetch_geometry);
+  *p_x = p_node->x;
+  *p_y = p_node->y;
+  *p_width = p_node->width;
+  *p_height = p_node->height;
+}
+
+void imitator_cached_get_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids, imitator_x_error * p_errors)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  struct lookup_args args;
+  
+  if (p_cache == NULL)
+  {
+    imitator_get_pids(p_display, p_wins, count, p_pids, p_errors);
+    return;
+  }
+  
+  init_lookup(&args, p_cache, p_wins, count);
+  args.p_pids = p_pids;
+  args.p_errors = p_errors;
+  rb_ensure(get_pids_body, (VALUE) &args, free_lookup, (VALUE) &args);
+}
+
+void imitator_cached_get_titles_and_children(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, Window ** pp_children, unsigned int * p_num_children)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  struct lookup_args args;
+  
+  if (p_cache == NULL)
+  {
+    imitator_get_titles_and_children(p_display, p_wins, count, pp_titles, pp_children, p_num_children);
+    return;
+  }
+  
+  init_lookup(&args, p_cache, p_wins, count);
+  args.pp_titles = pp_titles;
+  args.pp_children = pp_children;
+  args.p_num_children = p_num_children;
+  rb_ensure(get_titles_and_children_body, (VALUE) &args, free_lookup, (VALUE) &args);
+}
+
+void imitator_cached_query_trees(Display * p_display, const Window * p_wins, unsigned int count, Window ** pp_children, unsigned int * p_num_children)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  struct lookup_args args;
+  
+  if (p_cache == NULL)
+  {
+    imitator_query_trees(p_display, p_wins, count, pp_children, p_num_children);
+    return;
+  }
+  
+  init_lookup(&args, p_cache, p_wins, count);
+  args.pp_children = pp_children;
+  args.p_num_children = p_num_children;
+  rb_ensure(query_trees_body, (VALUE) &args, free_lookup, (VALUE) &args);
+}
+
+Bool imitator_cached_explore(Display * p_display, int max_depth)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_cached_window * p_root;
+  int i;
+  
+  if (p_cache == NULL)
+    return False;
+  if (max_depth < 0)
+    max_depth = INT_MAX;
+  
+  if (max_depth > p_cache->complete_depth)
+  {
+    /*The windows at the old border need their children now*/
+    p_cache->complete_depth = max_depth;
+    for(i = 0; i < ScreenCount(p_display); i++)
+    {
+      if ((p_root = lookup(p_cache, RootWindow(p_display, i))) != NULL)
+        mark_tree_pending(p_cache, p_root);
+    }
+  }
+  refresh(p_cache);
+  return True;
+}
+
+unsigned int imitator_cached_find_title(Display * p_display, Window root, const char * title, int max_depth, Window ** pp_wins)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  imitator_title_entry * p_entry;
+  imitator_cached_window * p_node;
+  st_data_t value;
+  Window win_root;
+  int * p_depths;
+  int depth;
+  unsigned int i, j, count = 0;
+  
+  *pp_wins = NULL;
+  if (p_cache == NULL)
+    return 0;
+  refresh(p_cache); /*Titles that changed since imitator_cached_explore()*/
+  if (!st_lookup(p_cache->p_titles, (st_data_t) title, &value))
+    return 0;
+  p_entry = (imitator_title_entry *) value;
+  
+  *pp_wins = (Window *) malloc(sizeof(Window) * p_entry->num_wins);
+  p_depths = ALLOC_N(int, p_entry->num_wins);
+  for(i = 0; i < p_entry->num_wins; i++)
+  {
+    if ((p_node = lookup(p_cache, p_entry->wins[i])) == NULL)
+      continue;
+    depth = depth_of(p_cache, p_node, &win_root);
+    if (depth < 1 || win_root != root || (max_depth >= 0 && depth > max_depth))
+      continue;
+    /*Insertion sort, upper layers first*/
+    for(j = count; j > 0 && p_depths[j - 1] > depth; j--)
+    {
+      (*pp_wins)[j] = (*pp_wins)[j - 1];
+      p_depths[j] = p_depths[j - 1];
+    }
+    (*pp_wins)[j] = p_entry->wins[i];
+    p_depths[j] = depth;
+    count++;
+  }
+  xfree(p_depths);
+  
+  if (count == 0)
+  {
+    free(*pp_wins);
+    *pp_wins = NULL;
+  }
+  return count;
+}
+
+Bool imitator_cached_find_client_title(Display * p_display, Window root, const char * title, Window ** pp_wins, unsigned int * p_count)
+{
+  imitator_window_cache * p_cache = get_cache(p_display);
+  Window * p_clients;
+  unsigned int num_clients;
+  struct lookup_args args;
+  
+  *pp_wins = NULL;
+  *p_count = 0;
+  if (p_cache == NULL)
+    return False;
+  if (!imitator_cached_get_client_list(p_display, root, False, &p_clients, &num_clients))
+  {
+    free(p_clients);
+    return False;
+  }
+  
+  init_lookup(&args, p_cache, p_clients, num_clients);
+  args.p_clients = p_clients;
+  args.title = title;
+  args.pp_found = pp_wins;
+  args.p_num_found = p_count;
+  rb_ensure(find_client_title_body, (VALUE) &args, free_lookup, (VALUE) &args);
+  return True;
+}
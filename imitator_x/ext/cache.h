@@ -0,0 +1,151 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_CACHE_HEADER
+#define IMITATOR_CACHE_HEADER
+
+/*
+*The window cache (see Connection#window_cache=) remembers the window tree 
+*of a connection. It asks X for events on every window it knows, so it can 
+*keep itself current from the event stream instead of querying the server. 
+*Windows are only queried the first time somebody asks about them. 
+*/
+
+/*What the cache knows about a window. A field is only meaningful if its *_valid flag is set. */
+typedef struct {
+  Window id;
+  Window parent;
+  Bool parent_valid;
+  /*Relative to the parent*/
+  int x;
+  int y;
+  unsigned int width;
+  unsigned int height;
+  unsigned int border_width;
+  Bool geometry_valid;
+  Bool mapped;
+  Bool mapped_valid;
+  /*UTF-8 _NET_WM_NAME or WM_NAME, NULL if unset*/
+  char * title;
+  Bool title_valid;
+  /*As for imitator_get_pids()*/
+  long pid;
+  Bool pid_valid;
+  /*In stacking order, bottom-most first*/
+  Window * children;
+  unsigned int num_children;
+  unsigned int children_capacity;
+  Bool children_valid;
+  /*True while the window is in the cache's list of windows to refresh*/
+  Bool pending;
+} imitator_cached_window;
+
+/*The windows with one title, in the title index*/
+typedef struct {
+  char * title;
+  Window * wins;
+  unsigned int num_wins;
+  unsigned int capacity;
+} imitator_title_entry;
+
+/*A root window's _NET_CLIENT_LIST or _NET_CLIENT_LIST_STACKING*/
+typedef struct {
+  Window * wins;
+  unsigned int count;
+  /*False if the window manager doesn't set the property*/
+  Bool supported;
+  Bool valid;
+} imitator_client_list;
+
+typedef struct imitator_window_cache_s {
+  Display * p_display;
+  /*Window -> imitator_cached_window * */
+  st_table * p_windows;
+  /*Incremented by every event, so waiters know when to look again*/
+  unsigned long generation;
+  /*Title ("(null)" for windows without one) -> imitator_title_entry *, for all windows with a valid title*/
+  st_table * p_titles;
+  /*Windows whose title or children may have to be fetched (again)*/
+  Window * p_pending;
+  unsigned int num_pending;
+  unsigned int pending_capacity;
+  /*All windows up to this depth below a root are known with title, and all above 
+  *it with their children. 0 means only the roots, INT_MAX the whole tree. */
+  int complete_depth;
+  Atom net_wm_name;
+  Atom net_wm_pid;
+  /*Two per screen, the client list and the stacking one*/
+  imitator_client_list * p_client_lists;
+  Atom net_client_list;
+  Atom net_client_list_stacking;
+} imitator_window_cache;
+
+/*Starts caching the window tree of +p_display+*/
+imitator_window_cache * imitator_cache_new(Display * p_display);
+/*Frees the cache. If +unselect+ is True, X is told that we don't want the events anymore. */
+void imitator_cache_free(imitator_window_cache * p_cache, Bool unselect);
+/*Updates the cache from +p_evt+*/
+void imitator_cache_handle_event(imitator_window_cache * p_cache, const imitator_event * p_evt);
+/*Marks the geometry of +win+ outdated, e.g. after we moved it*/
+void imitator_cache_forget_geometry(imitator_window_cache * p_cache, Window win);
+/*True if +p_cache+ tracks +win+, i.e. X sends us its events*/
+Bool imitator_cache_tracks(imitator_window_cache * p_cache, Window win);
+
+/*
+*The following functions answer from the cache of +p_display+'s connection, 
+*if it has one, and query the X server otherwise. They raise XProtocolErrors 
+*like the Xlib functions do. Everything returned is malloc()ed. 
+*/
+
+/*Like XQueryTree(), but +pp_children+ must be free()d*/
+void imitator_cached_query_tree(Display * p_display, Window win, Window * p_parent, Window ** pp_children, unsigned int * p_num_children);
+/*Like imitator_get_titles()*/
+void imitator_cached_get_titles(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, imitator_x_error * p_errors);
+/*Like imitator_query_trees()*/
+void imitator_cached_query_trees(Display * p_display, const Window * p_wins, unsigned int count, Window ** pp_children, unsigned int * p_num_children);
+/*Like imitator_get_titles_and_children()*/
+void imitator_cached_get_titles_and_children(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, Window ** pp_children, unsigned int * p_num_children);
+/*Like imitator_get_pids()*/
+void imitator_cached_get_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids, imitator_x_error * p_errors);
+/*Like imitator_windows_exist()*/
+void imitator_cached_windows_exist(Display * p_display, const Window * p_wins, unsigned int count, Bool * p_exist);
+/*Checks wheather +win+ exists. Doesn't raise XProtocolErrors. */
+Bool imitator_cached_exists(Display * p_display, Window win);
+/*Checks wheather +win+ is mapped (its ancestors may not be)*/
+Bool imitator_cached_is_mapped(Display * p_display, Window win);
+/*Makes sure the cache knows every window down to +max_depth+ (negative for all) below 
+*the roots, with the titles. Returns False if +p_display+'s connection has no cache. */
+Bool imitator_cached_explore(Display * p_display, int max_depth);
+/*Stores the windows below +root+, down to +max_depth+ (negative for all), with the exact 
+*title +title+ ("(null)" for those without a title) in +pp_wins+ (malloc()ed, NULL if there 
+*are none), upper layers first, and returns their number. Call imitator_cached_explore() before. */
+unsigned int imitator_cached_find_title(Display * p_display, Window root, const char * title, int max_depth, Window ** pp_wins);
+/*Stores the windows in the _NET_CLIENT_LIST of +root+ with the exact title +title+ ("(null)" for 
+*those without a title) in +pp_wins+ (malloc()ed, NULL if there are none), in the list's order. 
+*Answers from the title index. Returns False if +p_display+'s connection has no cache or the 
+*window manager doesn't provide the list. */
+Bool imitator_cached_find_client_title(Display * p_display, Window root, const char * title, Window ** pp_wins, unsigned int * p_count);
+/*Stores the windows in the _NET_CLIENT_LIST of +root+ (or, if +stacking+ is True, in 
+*_NET_CLIENT_LIST_STACKING, bottom-most first) in +pp_wins+ (malloc()ed, NULL if there are none). 
+*Returns False if the window manager doesn't provide the list. */
+Bool imitator_cached_get_client_list(Display * p_display, Window root, Bool stacking, Window ** pp_wins, unsigned int * p_count);
+/*Gets the geometry of +win+ relative to its parent*/
+void imitator_cached_get_geometry(Display * p_display, Window win, int * p_x, int * p_y, unsigned int * p_width, unsigned int * p_height);
+
+#endif
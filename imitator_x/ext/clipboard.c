@@ -18,6 +18,7 @@ You should have received a copy of the GNU Lesser General Public License
 along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************************/
 #include "x.h"
+#include "connection.h"
 #include "clipboard.h"
 
 /*
@@ -78,7 +79,29 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *
 *This module operates on UTF-8-encoded strings; that means, you should pass UTF-8-encoded strings to Clipboard.write and 
 *you get back UTF-8-encoded strings from Clipboard.read. 
+*
+*All methods operate on Imitator::X::Connection.default. 
+*/
+
+/*******************Helper functions**************************/
+
+/*
+*Predicate for imitator_if_event() that only accepts selection events addressed to the 
+*requestor window +arg+ points to. The connection is shared, so there may be 
+*events for other windows in the queue. 
 */
+static Bool is_selection_event_for(Display * p_display, XEvent * p_xevt, XPointer arg)
+{
+  Window win = *((Window *) arg);
+  
+  if (p_xevt->type == SelectionNotify)
+    return p_xevt->xselection.requestor == win;
+  if (p_xevt->type == SelectionRequest)
+    return p_xevt->xselectionrequest.owner == win;
+  return False;
+}
+
+/********************Module functions**********************/
 
 /*
 *call-seq: 
@@ -98,6 +121,7 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 static VALUE m_read(int argc, VALUE argv[], VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Atom clipboard, actual_type;
   Window win;
   XEvent xevt;
@@ -112,39 +136,43 @@ static VALUE m_read(int argc, VALUE argv[], VALUE self)
   if (NIL_P(rclipboard))
     rclipboard = ID2SYM(rb_intern("clipboard"));
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   rclipboard = rb_funcall(rclipboard, rb_intern("to_s"), 0); /*Symbol -> String*/
   rclipboard = rb_funcall(rclipboard, rb_intern("upcase"), 0); /*String -> STRING*/
-  clipboard = XInternAtom(p_display, StringValuePtr(rclipboard), True); /*STRING -> Atom(STRING)*/
+  clipboard = imitator_intern_atom(p_display, StringValuePtr(rclipboard), True); /*STRING -> Atom(STRING)*/
   if (clipboard == None)
     rb_raise(rb_eArgError, "Invalid clipboard specified!");
   
   /*Check wheather there is a clipboard owner, and if not, just return an empty string. */
-  if (XGetSelectionOwner(p_display, clipboard) == None)
+  if (imitator_get_selection_owner(p_display, clipboard) == None)
     return rb_str_new2("");
   
   /*Create a window for selection interaction*/
   win = CREATE_REQUESTOR_WIN;
   
   /*Order the selection content from the current selection owner*/
+  serial = NextRequest(p_display);
   XConvertSelection(p_display, clipboard, UTF8_ATOM, IMITATOR_X_CLIP_ATOM, win, CurrentTime);
   /*Wait until our requestor window gets the message that it has received the selection content*/
   for (;;)
   {
-    XNextEvent(p_display, &xevt);
+    imitator_if_event(p_display, &xevt, is_selection_event_for, (XPointer) &win, serial);
     if (xevt.type == SelectionNotify)
       break;
   }
   if (xevt.xselection.property == None)
-      rb_raise(XError, "Could not retrieve selection (XConvertSelection() failed)! Is there non-text data in the clipboard?");
+  {
+    XDestroyWindow(p_display, win);
+    imitator_flush(p_display);
+    rb_raise(XError, "Could not retrieve selection (XConvertSelection() failed)! Is there non-text data in the clipboard?");
+  }
   
   /*Read the selection property of our requestor window, just in order to get the selection content's size. We don't read the actual data here. */
-  XGetWindowProperty(xevt.xselection.display, xevt.xselection.requestor, xevt.xselection.property, 0, 0, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after_return, &property);
+  imitator_get_window_property(xevt.xselection.display, xevt.xselection.requestor, xevt.xselection.property, 0, 0, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after_return, &property);
   cp = (char *) malloc(bytes_after_return); /*Nice - we already get the number of bytes to allocate from X*/
   /*This is the exciting moment. Reads the data from our requestor window. */
-  XGetWindowProperty(xevt.xselection.display, xevt.xselection.requestor, xevt.xselection.property, 0, bytes_after_return, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after_return, &property);
+  imitator_get_window_property(xevt.xselection.display, xevt.xselection.requestor, xevt.xselection.property, 0, bytes_after_return, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes_after_return, &property);
   /*Now copy it away from X, since X wants to XFree() it's data*/
   strcpy(cp, (char *) property);
   /*Convert it to a Ruby UTF-8 string*/
@@ -154,8 +182,7 @@ static VALUE m_read(int argc, VALUE argv[], VALUE self)
   XFree(property);
   free(cp);
   XDestroyWindow(p_display, win); /*We don't need the window anymore, a new request will create a new window*/
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_flush(p_display);
   
   return result;
 }
@@ -181,6 +208,7 @@ static VALUE m_read(int argc, VALUE argv[], VALUE self)
 static VALUE m_write(VALUE self, VALUE rtext)
 {
   Display * p_display;
+  unsigned long serial;
   Window win, clipboard_owner;
   XEvent xevt, xevt2;
   Atom targets[6], target_sizes[12], save_targets[2];
@@ -194,15 +222,16 @@ static VALUE m_write(VALUE self, VALUE rtext)
   utf8_len = NUM2INT(rb_funcall(rb_funcall(rb_funcall(rtext_utf8, rb_intern("bytes"), 0), rb_intern("to_a"), 0), rb_intern("length"), 0));
   iso_latin1_len = NUM2INT(rb_funcall(rtext_iso_latin1, rb_intern("length"), 0));
   
-  /*Open default display*/
-  p_display = XOpenDisplay(NULL);
-  /*Let Ruby handle protocol errors*/
-  XSetErrorHandler(handle_x_errors);
+  /*Get the default display*/
+  p_display = imitator_default_display();
+  /*Throw away the SelectionClear events of earlier writes, they'd pile up in the queue otherwise*/
+  while (XCheckTypedEvent(p_display, SelectionClear, &xevt))
+    ;
   /*This are the TARGETS we support*/
   targets[0] = TARGETS_ATOM;
   targets[1] = UTF8_ATOM;
   targets[2] = XA_STRING;
-  targets[3] = XInternAtom(p_display, "TIMESTAMP", True); /*TODO: Implement this request*/
+  targets[3] = TIMESTAMP_ATOM; /*TODO: Implement this request*/
   targets[4] = SAVE_TARGETS_ATOM;
   targets[5] = TARGET_SIZES_ATOM;
   /*These are the target's sizes*/
@@ -215,7 +244,7 @@ static VALUE m_write(VALUE self, VALUE rtext)
   target_sizes[4] = XA_STRING;
   target_sizes[5] = iso_latin1_len;
   
-  target_sizes[6] = XInternAtom(p_display, "TIMESTAMP", True);
+  target_sizes[6] = TIMESTAMP_ATOM;
   target_sizes[7] = -1;
   
   target_sizes[8] = SAVE_TARGETS_ATOM;
@@ -227,40 +256,35 @@ static VALUE m_write(VALUE self, VALUE rtext)
   save_targets[0] = UTF8_ATOM;
   save_targets[1] = XA_STRING;
   if (CLIPBOARD_MANAGER_ATOM == None)
-  {
-    XSetErrorHandler(NULL);
-    XCloseDisplay(p_display);
     rb_raise(XError, "No clipboard manager available!");
-  }
   
   /*Create a window for copying into CLIPBOARD*/
   win = CREATE_REQUESTOR_WIN;
   
   /*Make sure that there's a clipboard manager which can process our request*/
-  if ( (clipboard_owner = XGetSelectionOwner(p_display, CLIPBOARD_MANAGER_ATOM)) == None)
+  if ( (clipboard_owner = imitator_get_selection_owner(p_display, CLIPBOARD_MANAGER_ATOM)) == None)
   {
     XDestroyWindow(p_display, win);
-    XSetErrorHandler(NULL);
-    XCloseDisplay(p_display);
+    imitator_flush(p_display);
     rb_raise(XError, "No owner for the CLIPBOARD_MANAGER selection!");
   }
   
   /*Get control of the CLIPBOARD*/
   XSetSelectionOwner(p_display, CLIPBOARD_ATOM, win, CurrentTime);
-  if (XGetSelectionOwner(p_display, CLIPBOARD_ATOM) != win)
+  if (imitator_get_selection_owner(p_display, CLIPBOARD_ATOM) != win)
   {
     XDestroyWindow(p_display, win);
-    XSetErrorHandler(NULL);
-    XCloseDisplay(p_display);
+    imitator_flush(p_display);
     rb_raise(XError, "Could not acquire ownership of the CLIPBOARD selection!");
   }
   
   /*Our application "needs to exit"*/
+  serial = NextRequest(p_display);
   XChangeProperty(p_display, win, IMITATOR_X_CLIP_ATOM, XA_ATOM, 32, PropModeReplace, (unsigned char *) save_targets, 1);
   XConvertSelection(p_display, CLIPBOARD_MANAGER_ATOM, SAVE_TARGETS_ATOM, IMITATOR_X_CLIP_ATOM, win, CurrentTime);
   for (;;)
   {
-    XNextEvent(p_display, &xevt);
+    imitator_if_event(p_display, &xevt, is_selection_event_for, (XPointer) &win, serial);
     if (xevt.type == SelectionRequest) /*selection-related event*/
     {
       /*This is for all anserwing events the same (except "not supported")*/
@@ -273,7 +297,7 @@ static VALUE m_write(VALUE self, VALUE rtext)
       xevt2.xselection.property = xevt.xselectionrequest.property;
       
       /*Handle individual selection requests*/
-      if (xevt.xselectionrequest.target == XInternAtom(p_display, "TARGETS", True)) /*TARGETS information requested*/
+      if (xevt.xselectionrequest.target == TARGETS_ATOM) /*TARGETS information requested*/
       {
         /*Write supported TARGETS into the requestor*/
         XChangeProperty(p_display, xevt.xselectionrequest.requestor, xevt.xselectionrequest.property, XA_ATOM, 32, PropModeReplace, (unsigned char *) targets, 6);
@@ -296,10 +320,10 @@ static VALUE m_write(VALUE self, VALUE rtext)
         unsigned char * prop;
         Atom * wanted_atoms;
         /*See how much data is there and allocate this amount*/
-        XGetWindowProperty(p_display, xevt.xselectionrequest.requestor, xevt.xselectionrequest.property, 0, 0, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
+        imitator_get_window_property(p_display, xevt.xselectionrequest.requestor, xevt.xselectionrequest.property, 0, 0, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
         wanted_atoms = (Atom *) malloc(sizeof(Atom) * nitems);
         /*Now get the data and copy it to our variable*/
-        XGetWindowProperty(p_display, xevt.xselectionrequest.requestor, xevt.xselectionrequest.property, 0, 1000000, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
+        imitator_get_window_property(p_display, xevt.xselectionrequest.requestor, xevt.xselectionrequest.property, 0, 1000000, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
         memcpy(wanted_atoms, prop, sizeof(Atom) * nitems);
         /*Now handle each single request by it's own*/
         for(i = 0;i < nitems; i++)
@@ -350,8 +374,7 @@ static VALUE m_write(VALUE self, VALUE rtext)
       if (xevt.xselection.property == None) /*Ooops - conversion failed, we're still the owner of CLIPBOARD*/
       {
         XDestroyWindow(p_display, win);
-        XSetErrorHandler(NULL);
-        XCloseDisplay(p_display);
+        imitator_flush(p_display);
         rb_raise(XError, "Unable to request the clipboard manager to acquire the CLIPBOARD selection!");
       }
       else if (xevt.xselection.property == IMITATOR_X_CLIP_ATOM) /*Success - we're out of responsibility now and can safely exit*/
@@ -361,8 +384,7 @@ static VALUE m_write(VALUE self, VALUE rtext)
   
   /*Cleanup actions*/
   XDestroyWindow(p_display, win);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_flush(p_display);
   
   return rtext;
 }
@@ -396,25 +418,19 @@ VALUE m_clear(VALUE self, VALUE args)
   if (RTEST(rb_funcall(args, rb_intern("empty?"), 0)))
     rb_ary_push(args, ID2SYM(rb_intern("clipboard")));
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   length = NUM2INT(rb_funcall(args, rb_intern("length"), 0));
   for(i = 0; i < length; i++)
   {
     rtemp = rb_funcall(rb_ary_entry(args, i), rb_intern("upcase"), 0);
-    selection = XInternAtom(p_display, StringValuePtr(rtemp), True);
+    selection = imitator_intern_atom(p_display, StringValuePtr(rtemp), True);
     if (selection == None)
-    {
-      XSetErrorHandler(NULL);
-      XCloseDisplay(p_display);
       rb_raise(XError, "Invalid selection specified!");
-    }
     XSetSelectionOwner(p_display, selection, None, CurrentTime);
   }
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_flush(p_display);
   return Qnil;
 }
 
@@ -21,34 +21,38 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 #define IMITATOR_CLIPBOARD_HEADER
 
 /*All the macros defined here assume that you have an open X server connection stored 
-*in a variable p_display. */
+*in a variable p_display. The atoms are looked up in the connection's atom table, 
+*see imitator_atom(). */
+
+/*TIMESTAMP atom*/
+#define TIMESTAMP_ATOM imitator_atom(p_display, IMITATOR_ATOM_TIMESTAMP)
 
 /*UTF-8 X-Encoding atom*/
-#define UTF8_ATOM XInternAtom(p_display, "UTF8_STRING", True)
+#define UTF8_ATOM imitator_atom(p_display, IMITATOR_ATOM_UTF8_STRING)
 
 /*Atom for the CLIPBOARD selection*/
-#define CLIPBOARD_ATOM XInternAtom(p_display, "CLIPBOARD", True)
+#define CLIPBOARD_ATOM imitator_atom(p_display, IMITATOR_ATOM_CLIPBOARD)
 
 /*CLIPBOARD_MANAGER atom*/
-#define CLIPBOARD_MANAGER_ATOM XInternAtom(p_display, "CLIPBOARD_MANAGER", True)
+#define CLIPBOARD_MANAGER_ATOM imitator_atom(p_display, IMITATOR_ATOM_CLIPBOARD_MANAGER)
 
 /*ATOM_PAIR atom*/
-#define ATOM_PAIR_ATOM XInternAtom(p_display, "ATOM_PAIR", True)
+#define ATOM_PAIR_ATOM imitator_atom(p_display, IMITATOR_ATOM_ATOM_PAIR)
 
 /*SAVE_TARGETS atom*/
-#define SAVE_TARGETS_ATOM XInternAtom(p_display, "SAVE_TARGETS", True)
+#define SAVE_TARGETS_ATOM imitator_atom(p_display, IMITATOR_ATOM_SAVE_TARGETS)
 
 /*TARGET_SIZES atom*/
-#define TARGET_SIZES_ATOM XInternAtom(p_display, "TARGET_SIZES", True)
+#define TARGET_SIZES_ATOM imitator_atom(p_display, IMITATOR_ATOM_TARGET_SIZES)
 
 /*TARGETS atom*/
-#define TARGETS_ATOM XInternAtom(p_display, "TARGETS", True)
+#define TARGETS_ATOM imitator_atom(p_display, IMITATOR_ATOM_TARGETS)
 
 /*MULTIPLE request atom*/
-#define MULTIPLE_ATOM XInternAtom(p_display, "MULTIPLE", True)
+#define MULTIPLE_ATOM imitator_atom(p_display, IMITATOR_ATOM_MULTIPLE)
 
 /*Atom for storing properties used by this library*/
-#define IMITATOR_X_CLIP_ATOM XInternAtom(p_display, "IMITATOR_X_CLIP", False)
+#define IMITATOR_X_CLIP_ATOM imitator_atom(p_display, IMITATOR_ATOM_IMITATOR_X_CLIP)
 
 /*In order to work with the X selections, we need a window. 
 *This macro just creates a simple, unmapped window that is used for 
@@ -0,0 +1,657 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "stats.h"
+#include "events.h"
+#include "cache.h"
+#include "ewmh.h"
+#include "subscriptions.h"
+#include "journal.h"
+#include "ruby/util.h"
+#include <pthread.h>
+
+/*
+*Document-class: Imitator::X::Connection
+*A connection to an X server. Opening a connection is expensive (it's a full 
+*handshake with the X server), so Imitator for X keeps one connection per display 
+*string open and lets all the Mouse, Keyboard, Clipboard and XWindow methods share it. 
+*You normally don't have to care about this class at all. 
+*
+*There are two ways of getting a Connection: 
+*[Connection.open] Returns the *shared* connection for a display string. This is what the library uses internally. 
+*[Connection.new] Opens a private connection nobody else uses. 
+*
+*Mouse, Keyboard and Clipboard operate on Connection.default, which is the shared 
+*connection to the display named by the DISPLAY environment variable unless you assign 
+*another one or temporarily switch it with Connection#use. XWindow methods take a 
+*Connection wherever they take a +display+ number. 
+*===Example
+*  #Send keystrokes to another X server
+*  conn = Imitator::X::Connection.new(":1")
+*  conn.use do
+*    Imitator::X::Keyboard.simulate("Hello from display 1")
+*  end
+*  conn.close
+*/
+
+/*Maps display strings (nil for $DISPLAY) to the shared connections*/
+static VALUE shared_connections = Qnil;
+/*The connection assigned via Connection.default=, nil if none*/
+static VALUE default_connection = Qnil;
+/*Name of the thread-local variable Connection#use sets*/
+static ID id_thread_connection;
+/*Linked list of all open connections*/
+static imitator_connection * p_open_connections = NULL;
+/*Guards p_open_connections. The X error handler walks it without the GVL. */
+static pthread_mutex_t open_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*Names of the atoms in enum imitator_atom_index, same order*/
+static const char * const atom_names[IMITATOR_ATOM_COUNT] = {
+  "UTF8_STRING",
+  "CLIPBOARD",
+  "CLIPBOARD_MANAGER",
+  "ATOM_PAIR",
+  "SAVE_TARGETS",
+  "TARGET_SIZES",
+  "TARGETS",
+  "MULTIPLE",
+  "TIMESTAMP",
+  "IMITATOR_X_CLIP",
+  "_NET_SUPPORTED",
+  "_NET_ACTIVE_WINDOW",
+  "_NET_WM_PID",
+  "_NET_WM_NAME",
+  "_NET_CLIENT_LIST",
+  "_NET_CLIENT_LIST_STACKING"
+};
+
+/*******************Helper functions**************************/
+
+/*
+*Removes +p_conn+ from the list of open connections and closes it. If calls 
+*without the GVL are using the Display, the last of them closes it. 
+*/
+static void close_connection(imitator_connection * p_conn)
+{
+  imitator_connection ** pp_link;
+  
+  if (p_conn->p_display == NULL)
+    return;
+  pthread_mutex_lock(&open_connections_lock);
+  for(pp_link = &p_open_connections; *pp_link != NULL; pp_link = &(*pp_link)->p_next)
+  {
+    if (*pp_link == p_conn)
+    {
+      *pp_link = p_conn->p_next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&open_connections_lock);
+  if (p_conn->p_window_cache != NULL)
+  {
+    imitator_cache_free(p_conn->p_window_cache, False); /*The server forgets our event masks anyway*/
+    p_conn->p_window_cache = NULL;
+  }
+  if (p_conn->p_ewmh != NULL)
+  {
+    imitator_ewmh_free(p_conn->p_ewmh);
+    p_conn->p_ewmh = NULL;
+  }
+  imitator_subscriptions_free(p_conn->p_subscriptions); /*The pump notices*/
+  p_conn->p_subscriptions = NULL;
+  imitator_journal_free(p_conn->p_journal);
+  p_conn->p_journal = NULL;
+  if (p_conn->num_calls > 0)
+    p_conn->p_closing_display = p_conn->p_display;
+  else
+    XCloseDisplay(p_conn->p_display);
+  p_conn->p_display = NULL;
+  p_conn->p_next = NULL;
+  p_conn->atoms_interned = False; /*Atoms are only valid for one server*/
+  p_conn->num_x_errors = 0;
+  memset(p_conn->ignored_ranges, 0, sizeof(p_conn->ignored_ranges));
+}
+
+/*
+*Closes the connection when the Ruby object is garbage-collected. 
+*/
+static void connection_free(void * ptr)
+{
+  imitator_connection * p_conn = (imitator_connection *) ptr;
+  
+  close_connection(p_conn);
+  if (p_conn->num_calls > 0) /*imitator_end_call() frees it*/
+  {
+    p_conn->free_pending = True;
+    return;
+  }
+  xfree(p_conn->display_string);
+  xfree(p_conn);
+}
+
+static void connection_mark(void * ptr)
+{
+  imitator_connection * p_conn = (imitator_connection *) ptr;
+  
+  rb_gc_mark(p_conn->window_map);
+  imitator_subscriptions_mark(p_conn->p_subscriptions);
+}
+
+static size_t connection_memsize(const void * ptr)
+{
+  return sizeof(imitator_connection);
+}
+
+static const rb_data_type_t connection_type = {
+  "Imitator::X::Connection",
+  {connection_mark, connection_free, connection_memsize,},
+};
+
+imitator_connection * imitator_get_connection(VALUE rconn)
+{
+  imitator_connection * p_conn;
+  
+  TypedData_Get_Struct(rconn, imitator_connection, &connection_type, p_conn);
+  return p_conn;
+}
+
+Display * imitator_get_display(VALUE rconn)
+{
+  return imitator_connection_display(imitator_get_connection(rconn));
+}
+
+Display * imitator_connection_display(imitator_connection * p_conn)
+{
+  if (p_conn->p_display == NULL)
+    imitator_raise_closed();
+  return p_conn->p_display;
+}
+
+void imitator_raise_closed(void)
+{
+  rb_raise(XError, "The connection has been closed!");
+}
+
+imitator_connection * imitator_begin_call(Display * p_display)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn != NULL)
+    p_conn->num_calls++; /*We hold the GVL, so do all others that count*/
+  return p_conn;
+}
+
+Bool imitator_end_call(imitator_connection * p_conn)
+{
+  if (p_conn == NULL)
+    return True;
+  if (--p_conn->num_calls > 0 || p_conn->p_closing_display == NULL)
+    return p_conn->p_display != NULL;
+  
+  /*Connection#close or the GC ran meanwhile, and we're the last call*/
+  XCloseDisplay(p_conn->p_closing_display);
+  p_conn->p_closing_display = NULL;
+  if (p_conn->free_pending)
+  {
+    xfree(p_conn->display_string);
+    xfree(p_conn);
+  }
+  return False;
+}
+
+VALUE imitator_connection_for(VALUE rdisplay_string)
+{
+  VALUE rconn;
+  VALUE args[1];
+  
+  if (!NIL_P(rdisplay_string))
+    rdisplay_string = rb_str_new_frozen(StringValue(rdisplay_string));
+  
+  /*Reuse the connection if we already have one that's not closed*/
+  rconn = rb_hash_lookup(shared_connections, rdisplay_string);
+  if (!NIL_P(rconn) && imitator_get_connection(rconn)->p_display != NULL)
+    return rconn;
+  
+  args[0] = rdisplay_string;
+  rconn = rb_class_new_instance(1, args, Connection);
+  rb_hash_aset(shared_connections, rdisplay_string, rconn);
+  return rconn;
+}
+
+imitator_connection * imitator_connection_of(Display * p_display)
+{
+  imitator_connection * p_conn;
+  
+  pthread_mutex_lock(&open_connections_lock);
+  for(p_conn = p_open_connections; p_conn != NULL; p_conn = p_conn->p_next)
+  {
+    if (p_conn->p_display == p_display)
+      break;
+  }
+  pthread_mutex_unlock(&open_connections_lock);
+  return p_conn;
+}
+
+Atom imitator_atom(Display * p_display, int index)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn == NULL) /*Not one of ours, shouldn't happen*/
+    return imitator_intern_atom(p_display, atom_names[index], False);
+  
+  /*Intern all of them in one go, that's a single round-trip*/
+  if (!p_conn->atoms_interned)
+  {
+    imitator_intern_atoms(p_display, (char **) atom_names, IMITATOR_ATOM_COUNT, False, p_conn->atoms);
+    p_conn->atoms_interned = True;
+  }
+  return p_conn->atoms[index];
+}
+
+void imitator_record_x_error(Display * p_display, const imitator_x_error * p_err)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  unsigned int i;
+  
+  /*Xlib holds the display lock while calling the error handler, so no locking here*/
+  if (p_conn == NULL)
+    return;
+  for(i = 0; i < IMITATOR_MAX_IGNORED_RANGES; i++)
+  {
+    if (p_err->serial >= p_conn->ignored_ranges[i][0] && p_err->serial < p_conn->ignored_ranges[i][1])
+      return;
+  }
+  /*If the queue is full, the oldest error goes. Whoever waits for an error 
+  *waits for a recent one; the old ones are left over from requests nobody checked. */
+  if (p_conn->num_x_errors == IMITATOR_MAX_X_ERRORS)
+  {
+    memmove(p_conn->x_errors, p_conn->x_errors + 1, (IMITATOR_MAX_X_ERRORS - 1) * sizeof(imitator_x_error));
+    p_conn->num_x_errors--;
+  }
+  p_conn->x_errors[p_conn->num_x_errors++] = *p_err;
+}
+
+void imitator_ignore_x_errors(Display * p_display, unsigned long first_serial, unsigned long last_serial)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn == NULL || first_serial == last_serial)
+    return;
+  
+  XLockDisplay(p_display);
+  /*The oldest range is overwritten; its requests are long answered*/
+  p_conn->ignored_ranges[p_conn->next_ignored_range][0] = first_serial;
+  p_conn->ignored_ranges[p_conn->next_ignored_range][1] = last_serial;
+  p_conn->next_ignored_range = (p_conn->next_ignored_range + 1) % IMITATOR_MAX_IGNORED_RANGES;
+  XUnlockDisplay(p_display);
+}
+
+unsigned int imitator_take_x_errors(Display * p_display, unsigned long first_serial, unsigned long last_serial, imitator_x_error * p_err)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  unsigned int i, kept = 0, taken = 0;
+  
+  if (p_conn == NULL)
+    return 0;
+  
+  XLockDisplay(p_display);
+  for(i = 0; i < p_conn->num_x_errors; i++)
+  {
+    if (p_conn->x_errors[i].serial >= first_serial && p_conn->x_errors[i].serial < last_serial)
+    {
+      if (taken == 0 && p_err != NULL)
+        *p_err = p_conn->x_errors[i];
+      taken++;
+    }
+    else /*Belongs to another call, keep it*/
+      p_conn->x_errors[kept++] = p_conn->x_errors[i];
+  }
+  p_conn->num_x_errors = kept;
+  XUnlockDisplay(p_display);
+  
+  return taken;
+}
+
+const char * imitator_atom_name(int index)
+{
+  return atom_names[index];
+}
+
+VALUE imitator_default_connection(void)
+{
+  VALUE rconn;
+  
+  /*Connection#use takes precedence*/
+  rconn = rb_thread_local_aref(rb_thread_current(), id_thread_connection);
+  if (!NIL_P(rconn))
+    return rconn;
+  if (!NIL_P(default_connection))
+    return default_connection;
+  return imitator_connection_for(Qnil);
+}
+
+Display * imitator_default_display(void)
+{
+  return imitator_get_display(imitator_default_connection());
+}
+
+/*
+*Used by Connection#use to restore the previous connection of the current thread. 
+*/
+static VALUE restore_thread_connection(VALUE rprevious)
+{
+  rb_thread_local_aset(rb_thread_current(), id_thread_connection, rprevious);
+  return Qnil;
+}
+
+/*************************Class methods***********************************/
+
+static VALUE connection_alloc(VALUE klass)
+{
+  imitator_connection * p_conn;
+  
+  return TypedData_Make_Struct(klass, imitator_connection, &connection_type, p_conn);
+}
+
+/*
+*call-seq: 
+*  Connection.open( [ display_string = nil ] ) ==> aConnection
+*
+*Returns the shared connection to +display_string+. The first call opens it, 
+*every further call returns the same object until it's closed. 
+*===Parameters
+*[+display_string+] (nil) A string of form <tt>":display.screen"</tt>. If nil, the DISPLAY environment variable is used. 
+*===Return value
+*The shared Connection. 
+*===Raises
+*[XError] Couldn't connect to the X server. 
+*===Example
+*  conn = Imitator::X::Connection.open(":0.0")
+*  conn.equal?(Imitator::X::Connection.open(":0.0")) #=> true
+*/
+static VALUE cm_open(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rdisplay_string;
+  
+  rb_scan_args(argc, argv, "01", &rdisplay_string);
+  return imitator_connection_for(rdisplay_string);
+}
+
+/*
+*call-seq: 
+*  Connection.default() ==> aConnection
+*
+*Returns the connection Mouse, Keyboard and Clipboard currently use. 
+*===Return value
+*The Connection given to Connection#use if called inside its block, otherwise 
+*the one assigned via Connection.default=, otherwise the shared connection to 
+*the display named by the DISPLAY environment variable. 
+*===Example
+*  p Imitator::X::Connection.default #=> #<Imitator::X::Connection ":0">
+*/
+static VALUE cm_default(VALUE self)
+{
+  return imitator_default_connection();
+}
+
+/*
+*call-seq: 
+*  Connection.default = conn ==> conn
+*
+*Sets the connection Mouse, Keyboard and Clipboard use. Pass nil to 
+*go back to the shared connection to $DISPLAY. 
+*===Parameters
+*[+conn+] A Connection or nil. 
+*===Return value
+*+conn+. 
+*===Example
+*  Imitator::X::Connection.default = Imitator::X::Connection.open(":1")
+*/
+static VALUE cm_set_default(VALUE self, VALUE rconn)
+{
+  if (!NIL_P(rconn))
+    imitator_get_connection(rconn); /*Type check*/
+  default_connection = rconn;
+  return rconn;
+}
+
+/****************************Instance methods*************************************/
+
+/*
+*call-seq: 
+*  Connection.new( [ display_string = nil ] ) ==> aConnection
+*
+*Opens a new, private connection to an X server. Use Connection.open if you 
+*want the shared one. 
+*===Parameters
+*[+display_string+] (nil) A string of form <tt>":display.screen"</tt>. If nil, the DISPLAY environment variable is used. 
+*===Return value
+*A brand new Connection. 
+*===Raises
+*[XError] Couldn't connect to the X server. 
+*===Example
+*  conn = Imitator::X::Connection.new(":0")
+*/
+static VALUE m_initialize(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rdisplay_string;
+  imitator_connection * p_conn = imitator_get_connection(self);
+  
+  rb_scan_args(argc, argv, "01", &rdisplay_string);
+  if (p_conn->p_display != NULL)
+    rb_raise(rb_eRuntimeError, "Connection already initialized!");
+  
+  if (!NIL_P(rdisplay_string))
+    p_conn->display_string = ruby_strdup(StringValueCStr(rdisplay_string));
+  p_conn->p_display = XOpenDisplay(p_conn->display_string);
+  if (p_conn->p_display == NULL)
+    rb_raise(XError, "Couldn't open display '%s'!", XDisplayName(p_conn->display_string));
+  pthread_mutex_lock(&open_connections_lock);
+  p_conn->p_next = p_open_connections;
+  p_open_connections = p_conn;
+  pthread_mutex_unlock(&open_connections_lock);
+  p_conn->stats_serial = NextRequest(p_conn->p_display);
+  imitator_stats_connection_opened();
+  
+  return self;
+}
+
+/*
+*Returns the name of the display this connection is connected to. 
+*===Return value
+*The display string as reported by X, e.g. <tt>":0.0"</tt>. 
+*===Example
+*  p Imitator::X::Connection.default.display_string #=> ":0"
+*/
+static VALUE m_display_string(VALUE self)
+{
+  imitator_connection * p_conn = imitator_get_connection(self);
+  
+  if (p_conn->p_display != NULL)
+    return rb_str_new2(XDisplayString(p_conn->p_display));
+  return rb_str_new2(XDisplayName(p_conn->display_string));
+}
+
+/*
+*Human-readable description of form <tt>#<Imitator::X::Connection ":0.0"></tt>. 
+*/
+static VALUE m_inspect(VALUE self)
+{
+  VALUE rstr = rb_str_new2("#<Imitator::X::Connection ");
+  
+  rb_str_append(rstr, rb_inspect(m_display_string(self)));
+  if (imitator_get_connection(self)->p_display == NULL)
+    rb_str_cat2(rstr, " (closed)");
+  rb_str_cat2(rstr, ">");
+  return rstr;
+}
+
+/*
+*Waits until the X server has processed every request sent over this 
+*connection. Errors caused by those requests that weren't raised yet are 
+*raised now; if there are several, you get the one of the oldest request. 
+*===Return value
+*+self+. 
+*===Raises
+*[XProtocolError] One of the outstanding requests failed. 
+*===Example
+*  Imitator::X::Connection.default.sync
+*/
+static VALUE m_sync(VALUE self)
+{
+  imitator_sync(imitator_get_display(self), 0);
+  return self;
+}
+
+/*
+*call-seq: 
+*  use(){|conn| ...} ==> anObject
+*
+*Makes +self+ the default connection of the current thread while 
+*the block runs. 
+*===Return value
+*The block's return value. 
+*===Example
+*  Imitator::X::Connection.new(":1").use do
+*    Imitator::X::Mouse.move(10, 10)
+*  end
+*/
+static VALUE m_use(VALUE self)
+{
+  VALUE rprevious;
+  
+  rb_need_block();
+  imitator_get_display(self); /*Don't accept closed connections*/
+  rprevious = rb_thread_local_aref(rb_thread_current(), id_thread_connection);
+  rb_thread_local_aset(rb_thread_current(), id_thread_connection, self);
+  return rb_ensure(rb_yield, self, restore_thread_connection, rprevious);
+}
+
+/*
+*Closes the connection. Using it afterwards raises a XError; Connection.open 
+*will give you a fresh one. 
+*===Return value
+*nil. 
+*===Example
+*  conn = Imitator::X::Connection.new
+*  conn.close
+*  conn.closed? #=> true
+*/
+static VALUE m_close(VALUE self)
+{
+  close_connection(imitator_get_connection(self));
+  return Qnil;
+}
+
+/*
+*Checks wheather or not this connection has been closed. 
+*===Return value
+*true or false. 
+*/
+static VALUE m_is_closed(VALUE self)
+{
+  if (imitator_get_connection(self)->p_display == NULL)
+    return Qtrue;
+  return Qfalse;
+}
+
+/*
+*call-seq: 
+*  window_cache = bool ==> bool
+*
+*Turns the window cache of this connection on or off. It's off by default. 
+*
+*With the cache on, XWindow.search, XWindow#children, XWindow#parent, XWindow#position 
+*and XWindow#size remember what the X server told them and ask for 
+*structure and property events of every window they saw, so they can 
+*answer later calls without a round trip to the server. 
+*===Parameters
+*[+bool+] true to start caching, false to stop and forget everything. 
+*===Return value
+*+bool+. 
+*===Raises
+*[XError] The connection is closed. 
+*===Example
+*  conn = Imitator::X::Connection.default
+*  conn.window_cache = true
+*  Imitator::X::XWindow.search(/gedit/) #Walks the tree
+*  Imitator::X::XWindow.search(/gedit/) #Answered from the cache
+*===Remarks
+*The cache only learns about changes from the events X sends, which 
+*are read when you call one of the methods above. Until then, it may lag 
+*behind the server just like a result you kept around yourself would. 
+*The event masks are per client, so other programs aren't affected. 
+*/
+static VALUE m_set_window_cache(VALUE self, VALUE rbool)
+{
+  imitator_connection * p_conn = imitator_get_connection(self);
+  Display * p_display = imitator_get_display(self);
+  
+  if (RTEST(rbool) && p_conn->p_window_cache == NULL)
+    p_conn->p_window_cache = imitator_cache_new(p_display);
+  else if (!RTEST(rbool) && p_conn->p_window_cache != NULL)
+  {
+    imitator_cache_free(p_conn->p_window_cache, True);
+    p_conn->p_window_cache = NULL;
+  }
+  return rbool;
+}
+
+/*
+*Checks wheather or not the window cache of this connection is on. 
+*See #window_cache=. 
+*===Return value
+*true or false. 
+*/
+static VALUE m_window_cache(VALUE self)
+{
+  if (imitator_get_connection(self)->p_window_cache == NULL)
+    return Qfalse;
+  return Qtrue;
+}
+
+/***********************Init-Function*******************************/
+
+void Init_connection(void)
+{
+  Connection = rb_define_class_under(X, "Connection", rb_cObject);
+  rb_define_alloc_func(Connection, connection_alloc);
+  
+  shared_connections = rb_hash_new();
+  rb_gc_register_address(&shared_connections);
+  rb_gc_register_address(&default_connection);
+  id_thread_connection = rb_intern("__imitator_x_connection__");
+  
+  rb_define_singleton_method(Connection, "open", cm_open, -1);
+  rb_define_singleton_method(Connection, "default", cm_default, 0);
+  rb_define_singleton_method(Connection, "default=", cm_set_default, 1);
+  
+  rb_define_method(Connection, "initialize", m_initialize, -1);
+  rb_define_method(Connection, "display_string", m_display_string, 0);
+  rb_define_method(Connection, "inspect", m_inspect, 0);
+  rb_define_method(Connection, "sync", m_sync, 0);
+  rb_define_method(Connection, "use", m_use, 0);
+  rb_define_method(Connection, "close", m_close, 0);
+  rb_define_method(Connection, "closed?", m_is_closed, 0);
+  rb_define_method(Connection, "window_cache=", m_set_window_cache, 1);
+  rb_define_method(Connection, "window_cache?", m_window_cache, 0);
+}
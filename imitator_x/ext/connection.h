@@ -0,0 +1,134 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_CONNECTION_HEADER
+#define IMITATOR_CONNECTION_HEADER
+
+/*The atoms every connection interns once, see imitator_atom(). 
+*Keep in sync with atom_names in connection.c. */
+enum imitator_atom_index {
+  IMITATOR_ATOM_UTF8_STRING,
+  IMITATOR_ATOM_CLIPBOARD,
+  IMITATOR_ATOM_CLIPBOARD_MANAGER,
+  IMITATOR_ATOM_ATOM_PAIR,
+  IMITATOR_ATOM_SAVE_TARGETS,
+  IMITATOR_ATOM_TARGET_SIZES,
+  IMITATOR_ATOM_TARGETS,
+  IMITATOR_ATOM_MULTIPLE,
+  IMITATOR_ATOM_TIMESTAMP,
+  IMITATOR_ATOM_IMITATOR_X_CLIP,
+  IMITATOR_ATOM_NET_SUPPORTED,
+  IMITATOR_ATOM_NET_ACTIVE_WINDOW,
+  IMITATOR_ATOM_NET_WM_PID,
+  IMITATOR_ATOM_NET_WM_NAME,
+  IMITATOR_ATOM_NET_CLIENT_LIST,
+  IMITATOR_ATOM_NET_CLIENT_LIST_STACKING,
+  IMITATOR_ATOM_COUNT
+};
+
+/*Number of X errors a connection remembers until they're raised. Beyond that, the oldest are dropped. */
+#define IMITATOR_MAX_X_ERRORS 64
+/*Number of serial ranges whose X errors a connection ignores at once*/
+#define IMITATOR_MAX_IGNORED_RANGES 16
+
+/*The native part of an Imitator::X::Connection. */
+typedef struct imitator_connection_s {
+  /*The X server connection, NULL after Connection#close*/
+  Display * p_display;
+  /*The display string the connection was opened with, NULL for $DISPLAY*/
+  char * display_string;
+  /*Interned atoms, indexed by enum imitator_atom_index. Only valid if atoms_interned is True. */
+  Atom atoms[IMITATOR_ATOM_COUNT];
+  Bool atoms_interned;
+  /*X errors nobody raised yet, oldest first. Guarded by XLockDisplay(). */
+  imitator_x_error x_errors[IMITATOR_MAX_X_ERRORS];
+  unsigned int num_x_errors;
+  /*[first, last) serials whose errors are dropped, see imitator_ignore_x_errors(). Guarded by XLockDisplay(). */
+  unsigned long ignored_ranges[IMITATOR_MAX_IGNORED_RANGES][2];
+  unsigned int next_ignored_range;
+  /*See Connection#window_cache=, NULL if disabled*/
+  struct imitator_window_cache_s * p_window_cache;
+  /*The window manager's _NET_SUPPORTED, NULL until somebody asks*/
+  struct imitator_ewmh_s * p_ewmh;
+  /*Running XWindow.batch blocks, one per thread*/
+  struct imitator_batch_s * p_batches;
+  /*Window ID -> XWindow, an ObjectSpace::WeakMap. 0 until the first XWindow is made. */
+  VALUE window_map;
+  /*XWindow#on blocks, NULL until the first one*/
+  struct imitator_subscriptions_s * p_subscriptions;
+  /*See Imitator::X.events, NULL until the first call*/
+  struct imitator_journal_s * p_journal;
+  /*Threads in imitator_wait_for_configure(), NULL if there are none*/
+  struct imitator_configure_waiter_s * p_configure_waiters;
+  /*Requests up to here are counted in Imitator::X.stats*/
+  unsigned long stats_serial;
+  /*Calls on +p_display+ that run without the GVL, see imitator_begin_call()*/
+  unsigned int num_calls;
+  /*The Display Connection#close couldn't close yet because calls were running. The last one closes it. */
+  Display * p_closing_display;
+  /*True if the Connection was garbage-collected while calls were running. The last one frees it. */
+  Bool free_pending;
+  /*Next open connection, see imitator_connection_of(). Guarded by a mutex, the error handler needs it without the GVL. */
+  struct imitator_connection_s * p_next;
+} imitator_connection;
+
+/*Imitator::X::Connection*/
+VALUE Connection;
+
+/*Returns the native part of the Connection +rconn+. Raises a TypeError for non-Connections. */
+imitator_connection * imitator_get_connection(VALUE rconn);
+/*Returns the open Display of the Connection +rconn+. Raises a XError if it was closed. */
+Display * imitator_get_display(VALUE rconn);
+/*Like imitator_get_display(), for the native part +p_conn+*/
+Display * imitator_connection_display(imitator_connection * p_conn);
+/*Raises the XError for closed connections*/
+void imitator_raise_closed(void);
+/*Call before releasing the GVL for something that uses +p_display+. Until the matching 
+*imitator_end_call(), neither Connection#close nor the GC closes +p_display+. Returns the 
+*connection to pass to imitator_end_call(), NULL if +p_display+ isn't one of ours. */
+imitator_connection * imitator_begin_call(Display * p_display);
+/*Call with the GVL after what imitator_begin_call() was for. Returns False if the connection 
+*was closed meanwhile; the Display mustn't be used anymore then. */
+Bool imitator_end_call(imitator_connection * p_conn);
+/*Returns the shared Connection for +rdisplay_string+ (a String or nil), opening it on first use. */
+VALUE imitator_connection_for(VALUE rdisplay_string);
+/*Returns the native part of the open connection that uses +p_display+, NULL if there's none. */
+imitator_connection * imitator_connection_of(Display * p_display);
+/*Appends +p_err+ to the error queue of +p_display+'s connection. Only for handle_x_errors(). */
+void imitator_record_x_error(Display * p_display, const imitator_x_error * p_err);
+/*Removes the queued errors of +p_display+ caused by the requests from +first_serial+ up to (excluding) 
+*+last_serial+ and stores the first of them in +p_err+ (if not NULL). Returns how many there were. 
+*Doesn't need the GVL. */
+unsigned int imitator_take_x_errors(Display * p_display, unsigned long first_serial, unsigned long last_serial, imitator_x_error * p_err);
+/*Drops X errors of +p_display+ caused by the requests from +first_serial+ up to (excluding) +last_serial+, 
+*for requests that may fail harmlessly. Only the latest IMITATOR_MAX_IGNORED_RANGES ranges are remembered. */
+void imitator_ignore_x_errors(Display * p_display, unsigned long first_serial, unsigned long last_serial);
+/*Returns the atom +index+ (one of enum imitator_atom_index) of +p_display+. All atoms are interned on first use. */
+Atom imitator_atom(Display * p_display, int index);
+/*Returns the name of the atom +index+, e.g. "_NET_WM_PID" for IMITATOR_ATOM_NET_WM_PID. */
+const char * imitator_atom_name(int index);
+/*Returns the Connection Mouse, Keyboard and Clipboard use, see Connection.default. */
+VALUE imitator_default_connection(void);
+/*Shorthand for imitator_get_display(imitator_default_connection()). */
+Display * imitator_default_display(void);
+
+/*Connection initialization function*/
+void Init_connection(void);
+
+#endif
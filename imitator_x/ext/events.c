@@ -0,0 +1,306 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "cache.h"
+#include "ewmh.h"
+#include "subscriptions.h"
+#include "journal.h"
+#include "stats.h"
+
+/*******************Helper functions**************************/
+
+/*
+*Predicate for XCheckIfEvent() that accepts the events imitator_process_events() 
+*takes care of. Everything else (e.g. the clipboard's selection events) stays in the queue. 
+*/
+static Bool is_processed_event(Display * p_display, XEvent * p_xevt, XPointer arg)
+{
+  if (p_xevt->type == MappingNotify)
+    return True;
+  return imitator_event_from_xevent(p_xevt, (imitator_event *) arg);
+}
+
+/*
+*A thread waiting in imitator_wait_for_configure(). Lives on its stack. 
+*/
+typedef struct imitator_configure_waiter_s {
+  Window win;
+  /*Only ConfigureNotify events sent after processing this request count*/
+  unsigned long first_serial;
+  /*The ConfigureNotify, once it came*/
+  imitator_event evt;
+  Bool done;
+  struct imitator_configure_waiter_s * p_next;
+} imitator_configure_waiter;
+
+/*
+*Hands +p_evt+ to the threads in imitator_wait_for_configure() waiting for it. 
+*Whichever thread processes the events, the waiter gets its ConfigureNotify. 
+*/
+static void hand_to_waiters(imitator_connection * p_conn, const imitator_event * p_evt)
+{
+  imitator_configure_waiter * p_waiter;
+  
+  if (p_evt->type != ConfigureNotify)
+    return;
+  for(p_waiter = p_conn->p_configure_waiters; p_waiter != NULL; p_waiter = p_waiter->p_next)
+  {
+    if (!p_waiter->done && p_evt->window == p_waiter->win && p_evt->serial >= p_waiter->first_serial)
+    {
+      p_waiter->evt = *p_evt;
+      p_waiter->done = True;
+    }
+  }
+}
+
+/*
+*Passes +p_evt+ on to whoever is interested on +p_conn+. 
+*/
+static void dispatch_event(imitator_connection * p_conn, Display * p_display, const imitator_event * p_evt)
+{
+  if (p_conn == NULL)
+    return;
+  if (p_conn->p_configure_waiters != NULL)
+    hand_to_waiters(p_conn, p_evt);
+  if (p_conn->p_journal != NULL)
+    imitator_journal_handle_event(p_conn->p_journal, p_evt);
+  if (p_conn->p_ewmh != NULL)
+    imitator_ewmh_handle_event(p_conn->p_ewmh, p_display, p_evt);
+  if (p_conn->p_window_cache != NULL)
+    imitator_cache_handle_event(p_conn->p_window_cache, p_evt);
+  if (p_conn->p_subscriptions != NULL)
+    imitator_subscriptions_handle_event(p_conn->p_subscriptions, p_evt);
+}
+
+/*
+*Arguments for wait_for_configure() and remove_waiter(). 
+*/
+struct configure_wait_args {
+  Display * p_display;
+  imitator_connection * p_conn;
+  double max_seconds;
+  imitator_configure_waiter waiter;
+};
+
+/*
+*Processes events until the waiter got its ConfigureNotify. Returns Qtrue if it did, 
+*Qfalse if +max_seconds+ passed. 
+*/
+static VALUE wait_for_configure(VALUE arg)
+{
+  struct configure_wait_args * p_args = (struct configure_wait_args *) arg;
+  double deadline = imitator_stats_now() + p_args->max_seconds;
+  
+  while (True)
+  {
+    imitator_process_events(p_args->p_display); /*Or another thread did it for us*/
+    if (p_args->waiter.done)
+      return Qtrue;
+    imitator_check_x_errors(p_args->p_display, p_args->waiter.first_serial); /*No event for a BadWindow*/
+    if (imitator_stats_now() >= deadline)
+      return Qfalse;
+    if (!imitator_wait_for_events(p_args->p_display, deadline - imitator_stats_now()))
+      imitator_raise_closed();
+  }
+}
+
+/*
+*Takes the waiter of wait_for_configure() off its connection, also if it raised. 
+*/
+static VALUE remove_waiter(VALUE arg)
+{
+  struct configure_wait_args * p_args = (struct configure_wait_args *) arg;
+  imitator_configure_waiter ** pp_link;
+  
+  for(pp_link = &p_args->p_conn->p_configure_waiters; *pp_link != NULL; pp_link = &(*pp_link)->p_next)
+  {
+    if (*pp_link == &p_args->waiter)
+    {
+      *pp_link = p_args->waiter.p_next;
+      break;
+    }
+  }
+  return Qnil;
+}
+
+/*******************Interface**************************/
+
+int imitator_event_from_xevent(const XEvent * p_xevt, imitator_event * p_evt)
+{
+  MEMZERO(p_evt, imitator_event, 1);
+  p_evt->type = p_xevt->type;
+  p_evt->serial = p_xevt->xany.serial;
+  p_evt->event_window = p_xevt->xany.window;
+  
+  switch (p_xevt->type)
+  {
+    case CreateNotify:
+      p_evt->window = p_xevt->xcreatewindow.window;
+      p_evt->parent = p_xevt->xcreatewindow.parent;
+      p_evt->x = p_xevt->xcreatewindow.x;
+      p_evt->y = p_xevt->xcreatewindow.y;
+      p_evt->width = p_xevt->xcreatewindow.width;
+      p_evt->height = p_xevt->xcreatewindow.height;
+      p_evt->border_width = p_xevt->xcreatewindow.border_width;
+      return 1;
+    case DestroyNotify:
+      p_evt->window = p_xevt->xdestroywindow.window;
+      return 1;
+    case ReparentNotify:
+      p_evt->window = p_xevt->xreparent.window;
+      p_evt->parent = p_xevt->xreparent.parent;
+      p_evt->x = p_xevt->xreparent.x;
+      p_evt->y = p_xevt->xreparent.y;
+      return 1;
+    case ConfigureNotify:
+      p_evt->window = p_xevt->xconfigure.window;
+      p_evt->sibling = p_xevt->xconfigure.above;
+      p_evt->x = p_xevt->xconfigure.x;
+      p_evt->y = p_xevt->xconfigure.y;
+      p_evt->width = p_xevt->xconfigure.width;
+      p_evt->height = p_xevt->xconfigure.height;
+      p_evt->border_width = p_xevt->xconfigure.border_width;
+      return 1;
+    case GravityNotify:
+      p_evt->window = p_xevt->xgravity.window;
+      p_evt->x = p_xevt->xgravity.x;
+      p_evt->y = p_xevt->xgravity.y;
+      return 1;
+    case MapNotify:
+      p_evt->window = p_xevt->xmap.window;
+      return 1;
+    case UnmapNotify:
+      p_evt->window = p_xevt->xunmap.window;
+      return 1;
+    case CirculateNotify:
+      p_evt->window = p_xevt->xcirculate.window;
+      p_evt->place = p_xevt->xcirculate.place;
+      return 1;
+    case PropertyNotify:
+      p_evt->window = p_xevt->xproperty.window;
+      p_evt->atom = p_xevt->xproperty.atom;
+      p_evt->time = p_xevt->xproperty.time;
+      return 1;
+    case FocusIn:
+    case FocusOut:
+      p_evt->window = p_xevt->xfocus.window;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void imitator_process_events(Display * p_display)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  XEvent xevt;
+  imitator_event evt;
+  
+  if (p_conn == NULL)
+    return;
+  /*Nobody is interested, but there may be events left over, e.g. from 
+  *imitator_wait_for_configure(). Drop them without reading the connection. */
+  if (p_conn->p_window_cache == NULL && p_conn->p_ewmh == NULL && p_conn->p_subscriptions == NULL && p_conn->p_journal == NULL && 
+      p_conn->p_configure_waiters == NULL && XQLength(p_display) == 0)
+    return;
+  
+  /*XCheckIfEvent() also reads what arrived on the connection, but never blocks*/
+  while (XCheckIfEvent(p_display, &xevt, is_processed_event, (XPointer) &evt))
+  {
+    if (xevt.type == MappingNotify) /*Someone changed the keyboard mapping*/
+    {
+      XRefreshKeyboardMapping(&xevt.xmapping);
+      continue;
+    }
+    imitator_event_from_xevent(&xevt, &evt);
+    dispatch_event(p_conn, p_display, &evt);
+  }
+}
+
+Bool imitator_wait_for_events(Display * p_display, double max_seconds)
+{
+  struct timeval timeout;
+  imitator_connection * p_conn;
+  
+  if (max_seconds > 0.1)
+    max_seconds = 0.1;
+  else if (max_seconds < 0)
+    max_seconds = 0;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = (long) (max_seconds * 1000000);
+  p_conn = imitator_begin_call(p_display);
+  rb_wait_for_single_fd(ConnectionNumber(p_display), RB_WAITFD_IN, &timeout);
+  return imitator_end_call(p_conn);
+}
+
+Bool imitator_wait_for_configure(Display * p_display, Window win, unsigned long first_serial, double max_seconds, imitator_event * p_evt)
+{
+  struct configure_wait_args args;
+  
+  args.p_display = p_display;
+  args.p_conn = imitator_connection_of(p_display);
+  args.max_seconds = max_seconds;
+  if (args.p_conn == NULL)
+    return False;
+  
+  /*Until we leave, whoever processes the events hands us our ConfigureNotify*/
+  MEMZERO(&args.waiter, imitator_configure_waiter, 1);
+  args.waiter.win = win;
+  args.waiter.first_serial = first_serial;
+  args.waiter.p_next = args.p_conn->p_configure_waiters;
+  args.p_conn->p_configure_waiters = &args.waiter;
+  if (!RTEST(rb_ensure(wait_for_configure, (VALUE) &args, remove_waiter, (VALUE) &args)))
+    return False;
+  *p_evt = args.waiter.evt;
+  return True;
+}
+
+long imitator_idle_event_mask(Display * p_display, Window win)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  long mask = imitator_subscriptions_mask(p_display, win);
+  int i;
+  
+  /*The EWMH set wants to hear about _NET_SUPPORTED*/
+  if (win == XDefaultRootWindow(p_display) && p_conn != NULL && p_conn->p_ewmh != NULL)
+    mask |= PropertyChangeMask;
+  /*The journal records what happens to the top-level windows*/
+  if (p_conn != NULL && p_conn->p_journal != NULL)
+  {
+    for(i = 0; i < ScreenCount(p_display); i++)
+    {
+      if (win == RootWindow(p_display, i))
+        mask |= IMITATOR_JOURNAL_ROOT_MASK;
+    }
+  }
+  return mask;
+}
+
+long imitator_event_mask(Display * p_display, Window win)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  long mask = imitator_idle_event_mask(p_display, win);
+  
+  if (p_conn != NULL && p_conn->p_window_cache != NULL && imitator_cache_tracks(p_conn->p_window_cache, win))
+    mask |= IMITATOR_TRACK_MASK;
+  return mask;
+}
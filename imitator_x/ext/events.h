@@ -0,0 +1,78 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_EVENTS_HEADER
+#define IMITATOR_EVENTS_HEADER
+
+/*The events we ask X for on every window we keep track of*/
+#define IMITATOR_TRACK_MASK (StructureNotifyMask | SubstructureNotifyMask | PropertyChangeMask)
+
+/*What we need to know of an X event. It's a lot smaller than a XEvent. */
+typedef struct {
+  /*CreateNotify, DestroyNotify, ...*/
+  int type;
+  /*The window the event is about*/
+  Window window;
+  /*The window whose event mask selected the event, the parent of +window+ for SubstructureNotifyMask*/
+  Window event_window;
+  /*CreateNotify and ReparentNotify: the (new) parent*/
+  Window parent;
+  /*ConfigureNotify: the sibling +window+ is now stacked on, None if it's at the bottom*/
+  Window sibling;
+  /*CreateNotify, ConfigureNotify, ReparentNotify and GravityNotify: the (new) geometry. 
+  *ReparentNotify and GravityNotify only set x and y. */
+  int x;
+  int y;
+  unsigned int width;
+  unsigned int height;
+  unsigned int border_width;
+  /*PropertyNotify: the property that changed*/
+  Atom atom;
+  /*CirculateNotify: PlaceOnTop or PlaceOnBottom*/
+  int place;
+  /*PropertyNotify: the server time of the change. CurrentTime for the other events, they don't tell. */
+  Time time;
+  /*Sequence number of the last request the X server processed before the event*/
+  unsigned long serial;
+} imitator_event;
+
+/*Fills +p_evt+ from +p_xevt+. Returns 0 if Imitator for X isn't interested in that kind of event. */
+int imitator_event_from_xevent(const XEvent * p_xevt, imitator_event * p_evt);
+/*Takes all events of interest out of +p_display+'s event queue (reading what the X server 
+*sent meanwhile) and passes them on, e.g. to the window cache. Needs the GVL. */
+void imitator_process_events(Display * p_display);
+/*Waits until the X server sends something to +p_display+, but at most +max_seconds+ 
+*(and never longer than a tenth of a second, since another thread may read the data 
+*meanwhile). Call imitator_process_events() before, queued events don't count. 
+*The GVL is released while waiting. Returns False if the connection was closed 
+*meanwhile, +p_display+ mustn't be used anymore then. */
+Bool imitator_wait_for_events(Display * p_display, double max_seconds);
+/*Waits at most +max_seconds+ for a ConfigureNotify about +win+ that X sent after processing 
+*the request +first_serial+ and stores it in +p_evt+. Processes the events meanwhile; if another 
+*thread processes them, it hands the ConfigureNotify over. Returns False if none came. Raises 
+*errors caused by the requests since +first_serial+. +win+ must have StructureNotifyMask selected. 
+*Needs the GVL. */
+Bool imitator_wait_for_configure(Display * p_display, Window win, unsigned long first_serial, double max_seconds, imitator_event * p_evt);
+/*Returns the event mask +win+ has when the window cache doesn't track it*/
+long imitator_idle_event_mask(Display * p_display, Window win);
+/*Returns the event mask +win+ should have: the one of the window cache if it tracks +win+, 
+*and the imitator_idle_event_mask(). */
+long imitator_event_mask(Display * p_display, Window win);
+
+#endif
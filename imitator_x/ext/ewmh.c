@@ -0,0 +1,143 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "ewmh.h"
+#include "ruby/util.h"
+
+/*******************Helper functions**************************/
+
+static int free_name_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+  xfree((char *) key);
+  return ST_DELETE;
+}
+
+/*
+*Returns the EWMH set of +p_display+'s connection, fetching _NET_SUPPORTED if it 
+*isn't valid. Returns NULL if there's no connection for +p_display+. 
+*/
+static imitator_ewmh * get_ewmh(Display * p_display)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  imitator_ewmh * p_ewmh;
+  Window root = XDefaultRootWindow(p_display);
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after, i;
+  unsigned char * p_value = NULL;
+  Atom * p_atoms;
+  st_data_t dummy;
+  
+  if (p_conn == NULL)
+    return NULL;
+  if (p_conn->p_ewmh == NULL)
+  {
+    p_ewmh = ALLOC(imitator_ewmh);
+    p_ewmh->known = 0;
+    p_ewmh->p_supported = st_init_numtable();
+    p_ewmh->p_names = st_init_strtable();
+    p_ewmh->present = False;
+    p_ewmh->valid = False;
+    p_conn->p_ewmh = p_ewmh;
+  }
+  p_ewmh = p_conn->p_ewmh;
+  imitator_process_events(p_display); /*Maybe it changed*/
+  if (p_ewmh->valid)
+    return p_ewmh;
+  
+  /*Ask for the PropertyNotify before reading, so we can't miss a change. 
+  *Don't take away what the window cache and the subscriptions selected. */
+  XSelectInput(p_display, root, imitator_event_mask(p_display, root));
+  /*Many great thanks to Jordan Sissel whose xdotool code 
+  *showed me how _NET_SUPPORTED works. */
+  imitator_get_window_property(p_display, root, imitator_atom(p_display, IMITATOR_ATOM_NET_SUPPORTED), 0, 1000000, False, XA_ATOM, 
+                               &actual_type, &actual_format, &nitems, &bytes_after, &p_value);
+  st_clear(p_ewmh->p_supported);
+  p_ewmh->known = 0;
+  p_ewmh->present = actual_type == XA_ATOM && actual_format == 32;
+  if (p_ewmh->present)
+  {
+    p_atoms = (Atom *) p_value; /*Format 32 comes as longs*/
+    for(i = 0; i < nitems; i++)
+      st_insert(p_ewmh->p_supported, (st_data_t) p_atoms[i], 1);
+    for(i = 0; i < IMITATOR_ATOM_COUNT; i++)
+    {
+      if (st_lookup(p_ewmh->p_supported, (st_data_t) imitator_atom(p_display, i), &dummy))
+        p_ewmh->known |= 1UL << i;
+    }
+  }
+  if (p_value != NULL)
+    XFree(p_value);
+  p_ewmh->valid = True;
+  return p_ewmh;
+}
+
+/*******************Interface**************************/
+
+void imitator_ewmh_free(imitator_ewmh * p_ewmh)
+{
+  st_free_table(p_ewmh->p_supported);
+  st_foreach(p_ewmh->p_names, free_name_i, 0);
+  st_free_table(p_ewmh->p_names);
+  xfree(p_ewmh);
+}
+
+void imitator_ewmh_handle_event(imitator_ewmh * p_ewmh, Display * p_display, const imitator_event * p_evt)
+{
+  if (p_evt->type == PropertyNotify && p_evt->window == XDefaultRootWindow(p_display) 
+      && p_evt->atom == imitator_atom(p_display, IMITATOR_ATOM_NET_SUPPORTED))
+    p_ewmh->valid = False;
+}
+
+Bool imitator_ewmh_present(Display * p_display)
+{
+  imitator_ewmh * p_ewmh = get_ewmh(p_display);
+  
+  return p_ewmh != NULL && p_ewmh->present;
+}
+
+Bool imitator_ewmh_supports(Display * p_display, int index)
+{
+  imitator_ewmh * p_ewmh = get_ewmh(p_display);
+  
+  return p_ewmh != NULL && (p_ewmh->known & (1UL << index)) != 0;
+}
+
+Bool imitator_ewmh_supported_name(Display * p_display, const char * name)
+{
+  imitator_ewmh * p_ewmh = get_ewmh(p_display);
+  st_data_t value;
+  Atom atom;
+  
+  if (p_ewmh == NULL)
+    return False;
+  if (!st_lookup(p_ewmh->p_names, (st_data_t) name, &value))
+  {
+    /*An atom nobody interned yet can't be in _NET_SUPPORTED*/
+    atom = imitator_intern_atom(p_display, name, True);
+    if (atom == None)
+      return False;
+    value = (st_data_t) atom;
+    st_insert(p_ewmh->p_names, (st_data_t) ruby_strdup(name), value); /*Atoms live as long as the server*/
+  }
+  return st_lookup(p_ewmh->p_supported, value, NULL);
+}
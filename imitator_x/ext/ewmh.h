@@ -0,0 +1,53 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_EWMH_HEADER
+#define IMITATOR_EWMH_HEADER
+
+/*
+*The EWMH features the window manager of a connection announces in 
+*_NET_SUPPORTED on the root window. They're fetched once and kept until 
+*a PropertyNotify tells us the window manager changed them. 
+*/
+
+typedef struct imitator_ewmh_s {
+  /*Bit i is set if the atom IMITATOR_ATOM_* i is supported*/
+  unsigned long known;
+  /*All supported atoms, Atom -> 1*/
+  st_table * p_supported;
+  /*Atom names asked for by imitator_ewmh_supported_name(), name -> Atom*/
+  st_table * p_names;
+  /*False if the window manager doesn't set _NET_SUPPORTED at all*/
+  Bool present;
+  /*False until fetched and after a change*/
+  Bool valid;
+} imitator_ewmh;
+
+/*Frees the EWMH set of a connection*/
+void imitator_ewmh_free(imitator_ewmh * p_ewmh);
+/*Updates +p_ewmh+ from +p_evt+*/
+void imitator_ewmh_handle_event(imitator_ewmh * p_ewmh, Display * p_display, const imitator_event * p_evt);
+/*Returns True if the window manager of +p_display+ sets _NET_SUPPORTED at all*/
+Bool imitator_ewmh_present(Display * p_display);
+/*Returns True if the window manager of +p_display+ supports the atom +index+ (one of enum imitator_atom_index)*/
+Bool imitator_ewmh_supports(Display * p_display, int index);
+/*Returns True if the window manager of +p_display+ supports the atom called +name+*/
+Bool imitator_ewmh_supported_name(Display * p_display, const char * name);
+
+#endif
@@ -30,10 +30,15 @@ Creates a makefile for building Imitator for X.
 You need the following libraries in order to compile successfully: 
 * X11 (X server)
 * Xtst (XTest extension library, for sending input)
+Optional: 
+* X11-xcb and xcb (the XCB backend, makes searching many windows a lot faster)
+* XRes (the X-Resource extension, finds the PIDs of windows without _NET_WM_PID)
 ==Switches
 * --help\t-h\tDisplays this help. 
 * --with-X11-dir=DIR\tLook in DIR for the X server libs. 
 * --with-Xtst-dir=DIR\tLook in DIR for the XTest lib. 
+* --without-xcb\tDon't use XCB even if it's available. 
+* --without-xres\tDon't use the X-Resource extension even if it's available. 
 
 By default, the /usr/X11/lib, /usr/X11RC6/lib, /usr/openwin/lib and 
 /usr/local/lib directories are searched for the X and XTest libraries. 
@@ -52,4 +57,23 @@ unless find_library("Xtst", "XTestFakeInput", "/usr/X11/lib", "/usr/X11RC6/lib",
   abort("Couldn't find XTest library!")
 end
 
+#Use XCB for requests about many windows if we can. It lets us send all 
+#requests before waiting for the first reply. 
+if with_config("xcb", true) and have_header("X11/Xlib-xcb.h") and have_library("X11-xcb", "XGetXCBConnection") and have_library("xcb", "xcb_get_property")
+  $defs.push("-DIMITATOR_X_USE_XCB")
+end
+
+#The X-Resource extension tells us the PID of windows without _NET_WM_PID
+if with_config("xres", true) and have_header("X11/extensions/XRes.h") and have_library("XRes", "XResQueryClientIds")
+  $defs.push("-DIMITATOR_X_USE_XRES")
+end
+
+#Blocking X requests are made without holding the GVL. Ruby 1.9 lacks 
+#these, x.h falls back to rb_thread_blocking_region() and rb_thread_wait_fd(). 
+have_header("ruby/thread.h")
+have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_wait_for_single_fd", "ruby/io.h")
+#Imitator::X.stats needs this to tell class and instance methods apart
+have_func("rb_current_receiver")
+
 create_makefile("x")
\ No newline at end of file
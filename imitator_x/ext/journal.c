@@ -0,0 +1,247 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "journal.h"
+#include "stats.h"
+#include "xwindow.h"
+
+/*
+*Document-method: Imitator::X.events
+*call-seq: 
+*  Imitator::X.events( [ since: 0 [, connection: Connection.default ] ] ) ==> anArray
+*
+*Returns what happened to the windows since the event numbered +since+. 
+*The first call starts the event journal of the connection, which from then on 
+*records the last 1024 events the connection receives: those of the top-level 
+*windows, and those the window cache (see Connection#window_cache=) or 
+*XWindow#on ask X for. 
+*===Parameters
+*[+since+] (0) The +sequence+ of the last event you already know. 
+*[+connection+] (Connection.default) The Connection whose events you want. 
+*===Return value
+*An array of Imitator::X::JournalEntry structs, oldest first. Their members are 
+*[+sequence+] The number of the event. Each connection counts from 1 on. 
+*[+type+] One of :create, :destroy, :reparent, :configure, :gravity, :map, :unmap, :circulate, :property, :focus_in and :focus_out. 
+*[+window+] The XWindow the event is about. 
+*[+parent+] :create and :reparent: the (new) parent XWindow, +nil+ otherwise. 
+*[+x+, +y+] :create, :configure, :reparent and :gravity: the (new) position relative to the parent, +nil+ otherwise. 
+*[+width+, +height+] :create and :configure: the (new) size, +nil+ otherwise. 
+*[+atom+] :property: the atom (an integer) of the property that changed, +nil+ otherwise. 
+*[+time+] :property: the X server's timestamp of the change, +nil+ otherwise. 
+*===Example
+*  Imitator::X.events #Start recording
+*  seen = 0
+*  loop do
+*    Imitator::X.events(since: seen).each do |evt|
+*      p [evt.type, evt.window]
+*      seen = evt.sequence
+*    end
+*    sleep 1
+*  end
+*===Remarks
+*Events that happened while Ruby was busy aren't lost, the X server keeps them until 
+*they're read. But if more than 1024 events arrive between two calls, the oldest ones 
+*are overwritten. You can tell that from a gap between +since+ and the +sequence+ of the 
+*first event returned, and Imitator::X.stats counts them as <tt>:events_dropped</tt>. 
+*/
+
+/*******************Helper functions**************************/
+
+/*
+*Returns the type of +p_record+ as a Symbol. 
+*/
+static VALUE type_to_ruby(const imitator_journal_record * p_record)
+{
+  switch (p_record->type)
+  {
+    case CreateNotify:
+      return ID2SYM(rb_intern("create"));
+    case DestroyNotify:
+      return ID2SYM(rb_intern("destroy"));
+    case ReparentNotify:
+      return ID2SYM(rb_intern("reparent"));
+    case ConfigureNotify:
+      return ID2SYM(rb_intern("configure"));
+    case GravityNotify:
+      return ID2SYM(rb_intern("gravity"));
+    case MapNotify:
+      return ID2SYM(rb_intern("map"));
+    case UnmapNotify:
+      return ID2SYM(rb_intern("unmap"));
+    case CirculateNotify:
+      return ID2SYM(rb_intern("circulate"));
+    case PropertyNotify:
+      return ID2SYM(rb_intern("property"));
+    case FocusIn:
+      return ID2SYM(rb_intern("focus_in"));
+    default:
+      return ID2SYM(rb_intern("focus_out"));
+  }
+}
+
+/*
+*Converts +p_record+ of +rconn+'s journal to a JournalEntry. 
+*/
+static VALUE record_to_ruby(VALUE rconn, const imitator_journal_record * p_record)
+{
+  VALUE rparent = Qnil, rx = Qnil, ry = Qnil, rwidth = Qnil, rheight = Qnil, ratom = Qnil, rtime = Qnil;
+  
+  switch (p_record->type)
+  {
+    case CreateNotify:
+    case ConfigureNotify:
+      rwidth = UINT2NUM(p_record->width);
+      rheight = UINT2NUM(p_record->height);
+      /*Fall through*/
+    case ReparentNotify:
+    case GravityNotify:
+      rx = INT2NUM(p_record->x);
+      ry = INT2NUM(p_record->y);
+      break;
+    case PropertyNotify:
+      ratom = ULONG2NUM(p_record->atom);
+      rtime = ULONG2NUM(p_record->time);
+      break;
+  }
+  if (p_record->type == CreateNotify || p_record->type == ReparentNotify)
+    rparent = imitator_xwindow_for(rconn, p_record->parent);
+  
+  return rb_struct_new(JournalEntry, ULONG2NUM(p_record->sequence), type_to_ruby(p_record), imitator_xwindow_for(rconn, p_record->window), rparent, rx, ry, rwidth, rheight, ratom, rtime);
+}
+
+/*
+*Creates the journal of +p_conn+ and asks X for the events of the top-level windows. 
+*/
+static void start_journal(imitator_connection * p_conn)
+{
+  Display * p_display = imitator_connection_display(p_conn);
+  Window root;
+  unsigned long serial;
+  int i;
+  
+  p_conn->p_journal = ALLOC(imitator_journal);
+  p_conn->p_journal->last = 0;
+  p_conn->p_journal->last_read = 0;
+  
+  for(i = 0; i < ScreenCount(p_display); i++)
+  {
+    root = RootWindow(p_display, i);
+    serial = NextRequest(p_display);
+    XSelectInput(p_display, root, imitator_event_mask(p_display, root));
+    imitator_ignore_x_errors(p_display, serial, NextRequest(p_display)); /*Can't fail, but don't raise it elsewhere*/
+  }
+  imitator_flush(p_display);
+}
+
+/*******************Interface**************************/
+
+void imitator_journal_free(imitator_journal * p_journal)
+{
+  if (p_journal != NULL)
+    xfree(p_journal);
+}
+
+void imitator_journal_handle_event(imitator_journal * p_journal, const imitator_event * p_evt)
+{
+  imitator_journal_record * p_record;
+  Bool dropped;
+  
+  /*A window that selects StructureNotifyMask itself and whose parent selects 
+  *SubstructureNotifyMask (e.g. a tracked one) gets each event twice. X sends 
+  *the copies one after the other, so they follow the record of the first one. */
+  if (p_journal->last > 0)
+  {
+    p_record = &p_journal->records[(p_journal->last - 1) % IMITATOR_JOURNAL_CAPACITY];
+    if (p_record->serial == p_evt->serial && p_record->type == p_evt->type && p_record->window == p_evt->window && p_record->event_window != p_evt->event_window)
+      return;
+  }
+  
+  p_journal->last++;
+  /*Overwrites record last - CAPACITY. Lost if nobody read it. */
+  dropped = p_journal->last > IMITATOR_JOURNAL_CAPACITY && p_journal->last - IMITATOR_JOURNAL_CAPACITY > p_journal->last_read;
+  p_record = &p_journal->records[(p_journal->last - 1) % IMITATOR_JOURNAL_CAPACITY];
+  
+  p_record->sequence = p_journal->last;
+  p_record->type = p_evt->type;
+  p_record->window = p_evt->window;
+  p_record->parent = p_evt->parent;
+  p_record->x = p_evt->x;
+  p_record->y = p_evt->y;
+  p_record->width = p_evt->width;
+  p_record->height = p_evt->height;
+  p_record->atom = p_evt->atom;
+  p_record->time = p_evt->time;
+  p_record->event_window = p_evt->event_window;
+  p_record->serial = p_evt->serial;
+  imitator_stats_journaled(dropped);
+}
+
+/*******************Module functions**************************/
+
+static VALUE m_events(int argc, VALUE argv[], VALUE self)
+{
+  VALUE hsh, rsince, rconn, result;
+  imitator_connection * p_conn;
+  imitator_journal * p_journal;
+  unsigned long since, first, n;
+  
+  rb_scan_args(argc, argv, "01", &hsh);
+  if (NIL_P(hsh))
+    hsh = rb_hash_new();
+  Check_Type(hsh, T_HASH);
+  rsince = rb_hash_lookup(hsh, ID2SYM(rb_intern("since")));
+  rconn = rb_hash_lookup(hsh, ID2SYM(rb_intern("connection")));
+  since = NIL_P(rsince) ? 0 : NUM2ULONG(rsince);
+  if (NIL_P(rconn))
+    rconn = imitator_default_connection();
+  p_conn = imitator_get_connection(rconn);
+  
+  if (p_conn->p_journal == NULL)
+  {
+    start_journal(p_conn);
+    return rb_ary_new();
+  }
+  /*Record what the X server sent meanwhile*/
+  imitator_process_events(imitator_connection_display(p_conn));
+  
+  p_journal = p_conn->p_journal;
+  result = rb_ary_new();
+  first = p_journal->last > IMITATOR_JOURNAL_CAPACITY ? p_journal->last - IMITATOR_JOURNAL_CAPACITY + 1 : 1;
+  if (since >= first)
+    first = since + 1;
+  /*Converting doesn't release the GVL, so nothing is written meanwhile*/
+  for(n = first; n <= p_journal->last; n++)
+    rb_ary_push(result, record_to_ruby(rconn, &p_journal->records[(n - 1) % IMITATOR_JOURNAL_CAPACITY]));
+  
+  if (p_journal->last > p_journal->last_read)
+    p_journal->last_read = p_journal->last;
+  return result;
+}
+
+/***********************Init-Function*******************************/
+
+void Init_journal(void)
+{
+  /*An event of Imitator::X.events*/
+  JournalEntry = rb_struct_define_under(X, "JournalEntry", "sequence", "type", "window", "parent", "x", "y", "width", "height", "atom", "time", NULL);
+  rb_define_module_function(X, "events", m_events, -1);
+}
@@ -0,0 +1,80 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_JOURNAL_HEADER
+#define IMITATOR_JOURNAL_HEADER
+
+/*
+*The event journal of a connection (see Imitator::X.events) is a ring of the last 
+*IMITATOR_JOURNAL_CAPACITY events imitator_process_events() read, whichever thread 
+*read them, numbered in the order they came in. That thread is the only writer. 
+*Readers just remember the number of the last event they saw, so reading takes 
+*nothing out and there may be any number of readers. 
+*/
+
+/*Number of events a journal holds. Older ones are overwritten. */
+#define IMITATOR_JOURNAL_CAPACITY 1024
+/*What the journal asks X for on the root windows*/
+#define IMITATOR_JOURNAL_ROOT_MASK (SubstructureNotifyMask | PropertyChangeMask)
+
+/*An event in the journal, with just what's needed to tell what happened*/
+typedef struct {
+  /*Numbered from 1 on*/
+  unsigned long sequence;
+  /*CreateNotify, DestroyNotify, ...*/
+  int type;
+  Window window;
+  /*CreateNotify and ReparentNotify: the (new) parent*/
+  Window parent;
+  /*As in imitator_event*/
+  int x;
+  int y;
+  unsigned int width;
+  unsigned int height;
+  /*PropertyNotify: the property that changed*/
+  Atom atom;
+  /*PropertyNotify: the server time of the change, CurrentTime otherwise*/
+  Time time;
+  /*As in imitator_event, to recognize the copies X sends to the parent*/
+  Window event_window;
+  unsigned long serial;
+} imitator_journal_record;
+
+typedef struct imitator_journal_s {
+  /*Record n is at records[(n - 1) % IMITATOR_JOURNAL_CAPACITY]*/
+  imitator_journal_record records[IMITATOR_JOURNAL_CAPACITY];
+  /*Number of the newest record, 0 while the journal is empty*/
+  unsigned long last;
+  /*Number of the newest record Imitator::X.events returned. Overwriting 
+  *a record after it counts as a dropped event. */
+  unsigned long last_read;
+} imitator_journal;
+
+/*Frees +p_journal+ (may be NULL), e.g. when the connection is closed*/
+void imitator_journal_free(imitator_journal * p_journal);
+/*Writes +p_evt+ to +p_journal+, overwriting the oldest record if it's full. 
+*Skips the copies of an event that X sends to more than one window. */
+void imitator_journal_handle_event(imitator_journal * p_journal, const imitator_event * p_evt);
+
+/*Journal initialization function*/
+void Init_journal(void);
+/*Imitator::X::JournalEntry*/
+VALUE JournalEntry;
+
+#endif
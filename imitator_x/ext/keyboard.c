@@ -18,6 +18,7 @@ You should have received a copy of the GNU Lesser General Public License
 along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************************/
 #include "x.h"
+#include "connection.h"
 #include "keyboard.h"
 
 /*
@@ -57,6 +58,8 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *The best way to find out how keys are generated is to run the following command 
 *and then press the wanted key: 
 *  xev | grep keysym
+*
+*All methods operate on Imitator::X::Connection.default. 
 */
 
 /********************Helper functions***********************/
@@ -64,8 +67,7 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 /*This function returns the KeyCode for the Ruby string specified by 
 *+rkey+. It first tries to convert it directly to a KeySym, and if that fails, 
 *it looks into the ALIASES hash (a constant of Keyboard) if there is an alias 
-*defined. If so, the KeySym for the alias is used. If not, the connection to the 
-*X server is closed and a XError is thrown. 
+*defined. If so, the KeySym for the alias is used. If not, a XError is thrown. 
 *Afterwards, the KeySym is converted to the desired KeyCode. 
 */
 KeyCode get_keycode(Display * p_display, VALUE rkey)
@@ -81,11 +83,7 @@ KeyCode get_keycode(Display * p_display, VALUE rkey)
     /*Look into the ALIASES hash for an alias*/
     ralias = rb_hash_lookup(rb_const_get(Keyboard, rb_intern("ALIASES")), rkey);
     if (NIL_P(ralias)) /*If no alias found*/
-    {
-      XSetErrorHandler(NULL);
-      XCloseDisplay(p_display);
       rb_raise(XError, "Invalid key '%s'!", StringValuePtr(rkey));
-    }
     else /*Use the alias for direct conversion*/
       code = get_keycode(p_display, ralias); /*The hash only stores valid keysym names; otherwise an endless recursion would occur here*/
   }
@@ -217,8 +215,7 @@ static VALUE m_key(VALUE self, VALUE keystr)
   arylen = NUM2INT(rb_funcall(keys, rb_intern("length"), 0));
   keycodes = (KeyCode *) malloc(sizeof(KeyCode) * arylen);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   /*Convert the array of Ruby key names into one of KeyCodes*/
   for(i = 0;i < arylen;i++)
@@ -234,8 +231,7 @@ static VALUE m_key(VALUE self, VALUE keystr)
   
   /*Cleanup actions*/
   free(keycodes);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_flush(p_display);
   return keys;
 }
 
@@ -362,6 +358,7 @@ static VALUE m_simulate(int argc, VALUE argv[], VALUE self)
   int i, length;
   KeyCode keycode;
   Display * p_display;
+  unsigned long serial;
   
   rb_scan_args(argc, argv, "11", &rtext, &rraw);
   if (RTEST(rraw))
@@ -370,8 +367,7 @@ static VALUE m_simulate(int argc, VALUE argv[], VALUE self)
   /*Ensure we're working with UTF-8-encoded strings*/
   rtext = rb_str_export_to_enc(rtext, rb_utf8_encoding());
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   if (raw) /*Raw string - no special keypresses*/
   {
@@ -436,6 +432,7 @@ static VALUE m_simulate(int argc, VALUE argv[], VALUE self)
     {
       /*Get the next command, of form [str, bool] where str is the string to simulate and bool wheather it's a special char or not*/
       rtemp = rb_ary_entry(rtokens, i);
+      serial = NextRequest(p_display);
       if (RTEST(rb_ary_entry(rtemp, 1))) /*This means we got a special character*/
       {
         keycode = get_keycode(p_display, rb_ary_entry(rtemp, 0));
@@ -452,13 +449,11 @@ static VALUE m_simulate(int argc, VALUE argv[], VALUE self)
       /*Ensure that the event(s) got processed before we send more - 
       *otherwise it could happen that in a sequence "ab{BS}c" the [A], [B] and [C] 
       *keypresses are executed before the [BackSpace] press. */
-      XSync(p_display, False);
+      imitator_sync(p_display, serial);
     }
   }
   
-  /*Cleanup actions*/
-  XSetErrorHandler(handle_x_errors);
-  XCloseDisplay(p_display);
+  imitator_flush(p_display);
   return rtext;
 }
 
@@ -485,8 +480,7 @@ static VALUE m_delete(int argc, VALUE argv[], VALUE self)
   
   rb_scan_args(argc, argv, "01", &del);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   if (RTEST(del))
     keycode = XKeysymToKeycode(p_display, XStringToKeysym("Delete"));
@@ -495,9 +489,8 @@ static VALUE m_delete(int argc, VALUE argv[], VALUE self)
   
   XTestFakeKeyEvent(p_display, keycode, True, CurrentTime);
   XTestFakeKeyEvent(p_display, keycode, False, CurrentTime);
+  imitator_flush(p_display);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return Qnil;
 }
 
@@ -532,14 +525,12 @@ static VALUE m_down(VALUE self, VALUE key)
   Display * p_display;
   KeyCode keycode;
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   keycode = get_keycode(p_display, key);
   XTestFakeKeyEvent(p_display, keycode, True, CurrentTime);
+  imitator_flush(p_display);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return Qnil;
 }
 
@@ -574,14 +565,12 @@ static VALUE m_up(VALUE self, VALUE key)
   Display * p_display;
   KeyCode keycode;
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   keycode = get_keycode(p_display, key);
   XTestFakeKeyEvent(p_display, keycode, False, CurrentTime);
+  imitator_flush(p_display);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return Qnil;
 }
 
@@ -18,6 +18,7 @@ You should have received a copy of the GNU Lesser General Public License
 along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************************/
 #include "x.h"
+#include "connection.h"
 #include "mouse.h"
 
 /*
@@ -27,6 +28,8 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *
 *Every method besides Mouse.move that claims to move the cursor to a specified 
 *position uses Mouse.move internally; so make sure you've read Mouse.move's documentation. 
+*
+*All methods operate on Imitator::X::Connection.default. 
 */
 
 /*
@@ -44,18 +47,14 @@ static VALUE m_pos(VALUE self)
   unsigned int mask;
   VALUE pos = rb_ary_new();
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   root = XDefaultRootWindow(p_display);
-  if (XQueryPointer(p_display, root, &root, &child_win, &rx, &ry, &wx, &wy, &mask) == False)
+  if (imitator_query_pointer(p_display, root, &root, &child_win, &rx, &ry, &wx, &wy, &mask) == False)
     rb_raise(XError, "Could not query the pointer's position!");
   rb_ary_push(pos, INT2NUM(rx));
   rb_ary_push(pos, INT2NUM(ry));
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  
   return pos;
 }
 
@@ -105,16 +104,13 @@ static VALUE m_move(int argc, VALUE argv[], VALUE self)
   goal_x = NUM2INT(rx);
   goal_y = NUM2INT(ry);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   /*Ignore the rest of the function if we only want to set the cursor*/
   if (RTEST(rset))
   {
     XTestFakeMotionEvent(p_display, 0, goal_x, goal_y, CurrentTime);
-    XSetErrorHandler(NULL);
-    XCloseDisplay(p_display);
-    return m_pos(self);
+    return m_pos(self); /*Querying the position also flushes the request*/
   }
   
   temp = m_pos(self); /*Get actual position, since we don't want to move off (0|0).*/
@@ -170,8 +166,6 @@ static VALUE m_move(int argc, VALUE argv[], VALUE self)
   /*Ensure that the cursor is really at the correct position*/
   XTestFakeMotionEvent(p_display, 0, goal_x, goal_y, CurrentTime);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return m_pos(self);
 }
 
@@ -218,8 +212,7 @@ static VALUE m_click(int argc, VALUE argv[], VALUE self)
     rb_raise(rb_eArgError, "Invalid button specified!");
   button = FIX2INT(rbutton2);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   /*Move the cursor if wanted before clicking*/
   args[0] = rb_hash_lookup(hsh, ID2SYM(rb_intern("x")));
@@ -232,8 +225,6 @@ static VALUE m_click(int argc, VALUE argv[], VALUE self)
   XTestFakeButtonEvent(p_display, (unsigned int)button, True, CurrentTime);
   XTestFakeButtonEvent(p_display, (unsigned int)button, False, CurrentTime);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return m_pos(self);
 }
 
@@ -266,13 +257,11 @@ static VALUE m_down(int argc, VALUE argv[], VALUE self)
     rb_raise(rb_eArgError, "Invalid button specified!");
   button = FIX2INT(rbutton);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   XTestFakeButtonEvent(p_display, (unsigned int)button, True, CurrentTime);
+  imitator_flush(p_display); /*Send the request now, the connection stays open*/
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return Qnil;
 }
 
@@ -306,13 +295,11 @@ static VALUE m_up(int argc, VALUE argv[], VALUE self)
     rb_raise(rb_eArgError, "Invalid button specified!");
   button = FIX2INT(rbutton);
   
-  p_display = XOpenDisplay(NULL);
-  XSetErrorHandler(handle_x_errors);
+  p_display = imitator_default_display();
   
   XTestFakeButtonEvent(p_display, (unsigned int)button, False, CurrentTime);
+  imitator_flush(p_display); /*Send the request now, the connection stays open*/
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return Qnil;
 }
 
@@ -0,0 +1,924 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "stats.h"
+#include "pipeline.h"
+#ifdef IMITATOR_X_USE_XCB
+#include <X11/Xlib-xcb.h>
+#endif
+#ifdef IMITATOR_X_USE_XRES
+#include <X11/extensions/XRes.h>
+#endif
+
+/*Maximum length of a title we read, in 32-bit units*/
+#define MAX_TITLE_LENGTH 1000000
+
+/*How many round-trips asking about +count+ windows costs*/
+#ifdef IMITATOR_X_USE_XCB
+#define ROUND_TRIPS(count) 1
+#else
+#define ROUND_TRIPS(count) (count)
+#endif
+
+struct pipeline_args {
+  Display * p_display;
+  const Window * p_wins;
+  unsigned int count;
+  void ** pp_results;
+  unsigned int * p_sizes;
+  Bool * p_exist;
+  XWindowAttributes * p_attrs;
+  /*For the titles*/
+  Atom net_wm_name;
+  Atom utf8_string;
+  /*Error of each window's requests, if wanted*/
+  imitator_x_error * p_errors;
+};
+
+/*For imitator_get_titles_and_children()*/
+struct level_args {
+  Display * p_display;
+  const Window * p_wins;
+  unsigned int count;
+  char ** pp_titles;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+  Atom net_wm_name;
+  Atom utf8_string;
+};
+
+/*For imitator_get_window_info()*/
+struct info_args {
+  Display * p_display;
+  const Window * p_wins;
+  unsigned int count;
+  unsigned int fields;
+  imitator_window_info * p_infos;
+  Atom net_wm_name;
+  Atom utf8_string;
+  Atom net_wm_pid;
+};
+
+/*
+*Returns a malloc()ed UTF-8 copy of the +len+ bytes of text at +p_value+. 
+*Text that isn't UTF-8 is taken as ISO-8859-1 (the STRING type), which is 
+*also the best guess for COMPOUND_TEXT. 
+*/
+static char * title_to_utf8(const unsigned char * p_value, size_t len, Bool is_utf8)
+{
+  char * p_title = (char *) malloc(is_utf8 ? len + 1 : 2 * len + 1);
+  size_t i, j = 0;
+  
+  if (is_utf8)
+  {
+    memcpy(p_title, p_value, len);
+    j = len;
+  }
+  else
+  {
+    for(i = 0; i < len; i++)
+    {
+      if (p_value[i] < 0x80)
+        p_title[j++] = p_value[i];
+      else /*Two bytes in UTF-8*/
+      {
+        p_title[j++] = 0xC0 | (p_value[i] >> 6);
+        p_title[j++] = 0x80 | (p_value[i] & 0x3F);
+      }
+    }
+  }
+  p_title[j] = '\0';
+  return p_title;
+}
+
+/*
+*Splits the +len+ bytes of a WM_CLASS property at +p_value+ into the instance 
+*and class name, stored in +p_info+ as malloc()ed UTF-8. 
+*/
+static void class_to_utf8(const unsigned char * p_value, size_t len, imitator_window_info * p_info)
+{
+  const unsigned char * p_nul = (const unsigned char *) memchr(p_value, '\0', len);
+  size_t name_len = p_nul == NULL ? len : (size_t) (p_nul - p_value);
+  
+  p_info->p_res_name = title_to_utf8(p_value, name_len, False);
+  if (name_len + 1 < len) /*Skip the NUL, the class name has one of its own*/
+  {
+    p_value += name_len + 1;
+    len -= name_len + 1;
+    p_nul = (const unsigned char *) memchr(p_value, '\0', len);
+    p_info->p_res_class = title_to_utf8(p_value, p_nul == NULL ? len : (size_t) (p_nul - p_value), False);
+  }
+}
+
+#ifdef IMITATOR_X_USE_XCB
+/***********************XCB backend***************************/
+
+/*
+*Returns the title in +p_net_reply+ (_NET_WM_NAME) or, if that isn't set, in +p_wm_reply+ (WM_NAME) 
+*as malloc()ed UTF-8, or NULL if the window has no name. Frees the replies. 
+*/
+static char * title_from_replies(xcb_get_property_reply_t * p_net_reply, xcb_get_property_reply_t * p_wm_reply, Atom utf8_string)
+{
+  char * p_title = NULL;
+  
+  /*Errors just give NULL*/
+  if (p_net_reply != NULL && p_net_reply->type == utf8_string && p_net_reply->format == 8)
+    p_title = title_to_utf8(xcb_get_property_value(p_net_reply), xcb_get_property_value_length(p_net_reply), True);
+  else if (p_wm_reply != NULL && p_wm_reply->type != XCB_NONE && p_wm_reply->format == 8)
+    p_title = title_to_utf8(xcb_get_property_value(p_wm_reply), xcb_get_property_value_length(p_wm_reply), p_wm_reply->type == utf8_string);
+  free(p_net_reply);
+  free(p_wm_reply);
+  return p_title;
+}
+
+/*
+*Stores +p_error+ in +p_err+, or an error_code of 0 if it's NULL. 
+*/
+static void error_from_xcb(xcb_generic_error_t * p_error, imitator_x_error * p_err)
+{
+  memset(p_err, 0, sizeof(imitator_x_error));
+  if (p_error == NULL)
+    return;
+  p_err->serial = p_error->full_sequence;
+  p_err->error_code = p_error->error_code;
+  p_err->request_code = p_error->major_code;
+  p_err->minor_code = p_error->minor_code;
+  p_err->resource_id = p_error->resource_id;
+}
+
+/*
+*Stores +p_error+ in +p_info+ unless it already has an error, then frees it. 
+*/
+static void keep_error(imitator_window_info * p_info, xcb_generic_error_t * p_error)
+{
+  if (p_error != NULL && p_info->error.error_code == 0)
+    error_from_xcb(p_error, &p_info->error);
+  free(p_error);
+}
+
+/*
+*Stores the children in +p_reply+ in +pp_children+ (malloc()ed, NULL if there are none), 
+*frees the reply and returns the number of children. 
+*/
+static unsigned int children_from_reply(xcb_query_tree_reply_t * p_reply, Window ** pp_children)
+{
+  xcb_window_t * p_xcb_children;
+  unsigned int i, num_children;
+  
+  *pp_children = NULL;
+  if (p_reply == NULL)
+    return 0;
+  num_children = xcb_query_tree_children_length(p_reply);
+  if (num_children > 0)
+  {
+    /*xcb_window_t is 32 bits, Window is a long*/
+    p_xcb_children = xcb_query_tree_children(p_reply);
+    *pp_children = (Window *) malloc(sizeof(Window) * num_children);
+    for(i = 0; i < num_children; i++)
+      (*pp_children)[i] = p_xcb_children[i];
+  }
+  free(p_reply);
+  return num_children;
+}
+
+/*
+*Sends a GetProperty(_NET_WM_NAME) and a GetProperty(WM_NAME) for every window, then collects the replies. 
+*/
+static void * get_titles_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  xcb_get_property_cookie_t * p_cookies;
+  xcb_generic_error_t * p_net_error, * p_wm_error;
+  char ** pp_titles = (char **) p_args->pp_results;
+  unsigned int i;
+  
+  p_cookies = (xcb_get_property_cookie_t *) malloc(sizeof(xcb_get_property_cookie_t) * 2 * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_cookies[2 * i] = xcb_get_property(p_conn, 0, p_args->p_wins[i], p_args->net_wm_name, p_args->utf8_string, 0, MAX_TITLE_LENGTH);
+    p_cookies[2 * i + 1] = xcb_get_property(p_conn, 0, p_args->p_wins[i], XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_TITLE_LENGTH);
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_net_error = p_wm_error = NULL;
+    pp_titles[i] = title_from_replies(xcb_get_property_reply(p_conn, p_cookies[2 * i], &p_net_error), 
+                                      xcb_get_property_reply(p_conn, p_cookies[2 * i + 1], &p_wm_error), p_args->utf8_string);
+    if (p_args->p_errors != NULL)
+      error_from_xcb(p_net_error != NULL ? p_net_error : p_wm_error, &p_args->p_errors[i]);
+    free(p_net_error);
+    free(p_wm_error);
+  }
+  
+  free(p_cookies);
+  return NULL;
+}
+
+/*
+*Sends a QueryTree for every window, then collects the replies. 
+*/
+static void * query_trees_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  xcb_query_tree_cookie_t * p_cookies;
+  Window ** pp_children = (Window **) p_args->pp_results;
+  unsigned int i;
+  
+  p_cookies = (xcb_query_tree_cookie_t *) malloc(sizeof(xcb_query_tree_cookie_t) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+    p_cookies[i] = xcb_query_tree(p_conn, p_args->p_wins[i]);
+  
+  for(i = 0; i < p_args->count; i++)
+    p_args->p_sizes[i] = children_from_reply(xcb_query_tree_reply(p_conn, p_cookies[i], NULL), &pp_children[i]);
+  
+  free(p_cookies);
+  return NULL;
+}
+
+/*
+*Sends a GetGeometry for every window, then checks which of them failed. 
+*/
+static void * windows_exist_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  xcb_get_geometry_cookie_t * p_cookies;
+  xcb_get_geometry_reply_t * p_reply;
+  unsigned int i;
+  
+  p_cookies = (xcb_get_geometry_cookie_t *) malloc(sizeof(xcb_get_geometry_cookie_t) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+    p_cookies[i] = xcb_get_geometry(p_conn, p_args->p_wins[i]);
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_reply = xcb_get_geometry_reply(p_conn, p_cookies[i], NULL); /*BadDrawable just gives NULL*/
+    p_args->p_exist[i] = p_reply != NULL;
+    free(p_reply);
+  }
+  
+  free(p_cookies);
+  return NULL;
+}
+
+/*
+*Sends a GetWindowAttributes and a GetGeometry for every window, then collects the replies. 
+*/
+static void * get_attributes_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  xcb_get_window_attributes_cookie_t * p_attr_cookies;
+  xcb_get_geometry_cookie_t * p_geometry_cookies;
+  xcb_get_window_attributes_reply_t * p_attr_reply;
+  xcb_get_geometry_reply_t * p_geometry_reply;
+  XWindowAttributes * p_attrs;
+  unsigned int i;
+  
+  p_attr_cookies = (xcb_get_window_attributes_cookie_t *) malloc(sizeof(xcb_get_window_attributes_cookie_t) * p_args->count);
+  p_geometry_cookies = (xcb_get_geometry_cookie_t *) malloc(sizeof(xcb_get_geometry_cookie_t) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_attr_cookies[i] = xcb_get_window_attributes(p_conn, p_args->p_wins[i]);
+    p_geometry_cookies[i] = xcb_get_geometry(p_conn, p_args->p_wins[i]);
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_attrs = &p_args->p_attrs[i];
+    memset(p_attrs, 0, sizeof(XWindowAttributes));
+    p_attr_reply = xcb_get_window_attributes_reply(p_conn, p_attr_cookies[i], NULL);
+    p_geometry_reply = xcb_get_geometry_reply(p_conn, p_geometry_cookies[i], NULL);
+    p_args->p_exist[i] = p_attr_reply != NULL && p_geometry_reply != NULL;
+    if (p_args->p_exist[i])
+    {
+      p_attrs->x = p_geometry_reply->x;
+      p_attrs->y = p_geometry_reply->y;
+      p_attrs->width = p_geometry_reply->width;
+      p_attrs->height = p_geometry_reply->height;
+      p_attrs->border_width = p_geometry_reply->border_width;
+      p_attrs->depth = p_geometry_reply->depth;
+      p_attrs->root = p_geometry_reply->root;
+      p_attrs->class = p_attr_reply->_class;
+      p_attrs->map_state = p_attr_reply->map_state;
+      p_attrs->override_redirect = p_attr_reply->override_redirect;
+    }
+    free(p_attr_reply);
+    free(p_geometry_reply);
+  }
+  
+  free(p_attr_cookies);
+  free(p_geometry_cookies);
+  return NULL;
+}
+
+/*
+*Sends the GetProperty(_NET_WM_NAME), GetProperty(WM_NAME) and QueryTree for every window, 
+*then collects all the replies. 
+*/
+static void * get_titles_and_children_without_gvl(void * ptr)
+{
+  struct level_args * p_args = (struct level_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  xcb_get_property_cookie_t * p_title_cookies;
+  xcb_query_tree_cookie_t * p_tree_cookies;
+  unsigned int i;
+  
+  p_title_cookies = (xcb_get_property_cookie_t *) malloc(sizeof(xcb_get_property_cookie_t) * 2 * p_args->count);
+  p_tree_cookies = (xcb_query_tree_cookie_t *) malloc(sizeof(xcb_query_tree_cookie_t) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_title_cookies[2 * i] = xcb_get_property(p_conn, 0, p_args->p_wins[i], p_args->net_wm_name, p_args->utf8_string, 0, MAX_TITLE_LENGTH);
+    p_title_cookies[2 * i + 1] = xcb_get_property(p_conn, 0, p_args->p_wins[i], XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_TITLE_LENGTH);
+    p_tree_cookies[i] = xcb_query_tree(p_conn, p_args->p_wins[i]);
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_args->pp_titles[i] = title_from_replies(xcb_get_property_reply(p_conn, p_title_cookies[2 * i], NULL), 
+                                              xcb_get_property_reply(p_conn, p_title_cookies[2 * i + 1], NULL), p_args->utf8_string);
+    p_args->p_num_children[i] = children_from_reply(xcb_query_tree_reply(p_conn, p_tree_cookies[i], NULL), &p_args->pp_children[i]);
+  }
+  
+  free(p_title_cookies);
+  free(p_tree_cookies);
+  return NULL;
+}
+
+/*
+*Sends the requests for all asked-for fields of every window, then collects the replies. 
+*/
+static void * get_window_info_without_gvl(void * ptr)
+{
+  struct info_args * p_args = (struct info_args *) ptr;
+  xcb_connection_t * p_conn = XGetXCBConnection(p_args->p_display);
+  /*Per window: _NET_WM_NAME, WM_NAME, WM_CLASS, _NET_WM_PID*/
+  xcb_get_property_cookie_t * p_prop_cookies;
+  xcb_query_tree_cookie_t * p_tree_cookies;
+  xcb_get_window_attributes_cookie_t * p_attr_cookies;
+  xcb_get_geometry_cookie_t * p_geometry_cookies;
+  xcb_get_property_reply_t * p_prop_reply;
+  xcb_get_window_attributes_reply_t * p_attr_reply;
+  xcb_get_geometry_reply_t * p_geometry_reply;
+  xcb_generic_error_t * p_net_error, * p_wm_error, * p_error;
+  imitator_window_info * p_info;
+  const Window * p_wins = p_args->p_wins;
+  unsigned int i;
+  
+  p_prop_cookies = (xcb_get_property_cookie_t *) malloc(sizeof(xcb_get_property_cookie_t) * 4 * p_args->count);
+  p_tree_cookies = (xcb_query_tree_cookie_t *) malloc(sizeof(xcb_query_tree_cookie_t) * p_args->count);
+  p_attr_cookies = (xcb_get_window_attributes_cookie_t *) malloc(sizeof(xcb_get_window_attributes_cookie_t) * p_args->count);
+  p_geometry_cookies = (xcb_get_geometry_cookie_t *) malloc(sizeof(xcb_get_geometry_cookie_t) * p_args->count);
+  for(i = 0; i < p_args->count; i++)
+  {
+    if (p_args->fields & IMITATOR_INFO_TITLE)
+    {
+      p_prop_cookies[4 * i] = xcb_get_property(p_conn, 0, p_wins[i], p_args->net_wm_name, p_args->utf8_string, 0, MAX_TITLE_LENGTH);
+      p_prop_cookies[4 * i + 1] = xcb_get_property(p_conn, 0, p_wins[i], XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, MAX_TITLE_LENGTH);
+    }
+    if (p_args->fields & IMITATOR_INFO_CLASS)
+      p_prop_cookies[4 * i + 2] = xcb_get_property(p_conn, 0, p_wins[i], XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, MAX_TITLE_LENGTH);
+    if (p_args->fields & IMITATOR_INFO_PID)
+      p_prop_cookies[4 * i + 3] = xcb_get_property(p_conn, 0, p_wins[i], p_args->net_wm_pid, XCB_ATOM_CARDINAL, 0, 1);
+    if (p_args->fields & IMITATOR_INFO_CHILDREN)
+      p_tree_cookies[i] = xcb_query_tree(p_conn, p_wins[i]);
+    if (p_args->fields & IMITATOR_INFO_ATTRIBUTES)
+    {
+      p_attr_cookies[i] = xcb_get_window_attributes(p_conn, p_wins[i]);
+      p_geometry_cookies[i] = xcb_get_geometry(p_conn, p_wins[i]);
+    }
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_info = &p_args->p_infos[i];
+    memset(p_info, 0, sizeof(imitator_window_info));
+    p_info->pid = -1;
+    if (p_args->fields & IMITATOR_INFO_TITLE)
+    {
+      p_info->p_title = title_from_replies(xcb_get_property_reply(p_conn, p_prop_cookies[4 * i], &p_net_error), 
+                                           xcb_get_property_reply(p_conn, p_prop_cookies[4 * i + 1], &p_wm_error), p_args->utf8_string);
+      keep_error(p_info, p_net_error);
+      keep_error(p_info, p_wm_error);
+    }
+    if (p_args->fields & IMITATOR_INFO_CLASS)
+    {
+      p_prop_reply = xcb_get_property_reply(p_conn, p_prop_cookies[4 * i + 2], &p_error);
+      keep_error(p_info, p_error);
+      if (p_prop_reply != NULL && p_prop_reply->type == XCB_ATOM_STRING && p_prop_reply->format == 8)
+        class_to_utf8(xcb_get_property_value(p_prop_reply), xcb_get_property_value_length(p_prop_reply), p_info);
+      free(p_prop_reply);
+    }
+    if (p_args->fields & IMITATOR_INFO_PID)
+    {
+      p_prop_reply = xcb_get_property_reply(p_conn, p_prop_cookies[4 * i + 3], &p_error);
+      keep_error(p_info, p_error);
+      if (p_prop_reply != NULL && p_prop_reply->type == XCB_ATOM_CARDINAL && p_prop_reply->format == 32 && xcb_get_property_value_length(p_prop_reply) >= 4)
+        p_info->pid = *((uint32_t *) xcb_get_property_value(p_prop_reply));
+      free(p_prop_reply);
+    }
+    if (p_args->fields & IMITATOR_INFO_CHILDREN)
+      p_info->num_children = children_from_reply(xcb_query_tree_reply(p_conn, p_tree_cookies[i], NULL), &p_info->p_children);
+    if (p_args->fields & IMITATOR_INFO_ATTRIBUTES)
+    {
+      p_attr_reply = xcb_get_window_attributes_reply(p_conn, p_attr_cookies[i], NULL);
+      p_geometry_reply = xcb_get_geometry_reply(p_conn, p_geometry_cookies[i], NULL);
+      p_info->exists = p_attr_reply != NULL && p_geometry_reply != NULL;
+      if (p_info->exists)
+      {
+        p_info->attrs.x = p_geometry_reply->x;
+        p_info->attrs.y = p_geometry_reply->y;
+        p_info->attrs.width = p_geometry_reply->width;
+        p_info->attrs.height = p_geometry_reply->height;
+        p_info->attrs.border_width = p_geometry_reply->border_width;
+        p_info->attrs.depth = p_geometry_reply->depth;
+        p_info->attrs.root = p_geometry_reply->root;
+        p_info->attrs.class = p_attr_reply->_class;
+        p_info->attrs.map_state = p_attr_reply->map_state;
+        p_info->attrs.override_redirect = p_attr_reply->override_redirect;
+      }
+      free(p_attr_reply);
+      free(p_geometry_reply);
+    }
+  }
+  
+  free(p_prop_cookies);
+  free(p_tree_cookies);
+  free(p_attr_cookies);
+  free(p_geometry_cookies);
+  return NULL;
+}
+
+#else
+/***********************Xlib backend***************************/
+
+/*
+*Asks for one title after the other, _NET_WM_NAME first. 
+*/
+static void * get_titles_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  char ** pp_titles = (char **) p_args->pp_results;
+  XTextProperty xtext;
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char * p_value;
+  unsigned long serial;
+  unsigned int i;
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    pp_titles[i] = NULL;
+    p_value = NULL;
+    serial = NextRequest(p_args->p_display);
+    if (XGetWindowProperty(p_args->p_display, p_args->p_wins[i], p_args->net_wm_name, 0, MAX_TITLE_LENGTH, False, p_args->utf8_string, 
+                           &actual_type, &actual_format, &nitems, &bytes_after, &p_value) == Success && actual_type == p_args->utf8_string && actual_format == 8)
+      pp_titles[i] = title_to_utf8(p_value, nitems, True);
+    if (p_value != NULL)
+      XFree(p_value);
+    
+    xtext.value = NULL;
+    if (pp_titles[i] == NULL && XGetWMName(p_args->p_display, p_args->p_wins[i], &xtext) && xtext.value != NULL && xtext.format == 8)
+      pp_titles[i] = title_to_utf8(xtext.value, xtext.nitems, xtext.encoding == p_args->utf8_string);
+    if (xtext.value != NULL)
+      XFree(xtext.value);
+    /*Vanished windows are OK, unless the caller wants to know*/
+    if (p_args->p_errors != NULL)
+      p_args->p_errors[i].error_code = 0;
+    imitator_take_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display), p_args->p_errors == NULL ? NULL : &p_args->p_errors[i]);
+  }
+  return NULL;
+}
+
+/*
+*Asks for one window's children after the other. 
+*/
+static void * query_trees_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  Window ** pp_children = (Window **) p_args->pp_results;
+  Window root, parent;
+  Window * p_children;
+  unsigned long serial;
+  unsigned int i;
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    pp_children[i] = NULL;
+    p_args->p_sizes[i] = 0;
+    p_children = NULL;
+    serial = NextRequest(p_args->p_display);
+    if (XQueryTree(p_args->p_display, p_args->p_wins[i], &root, &parent, &p_children, &p_args->p_sizes[i]) && p_args->p_sizes[i] > 0)
+    {
+      /*Copy it, so everything can be free()d the same way*/
+      pp_children[i] = (Window *) malloc(sizeof(Window) * p_args->p_sizes[i]);
+      memcpy(pp_children[i], p_children, sizeof(Window) * p_args->p_sizes[i]);
+    }
+    else
+      p_args->p_sizes[i] = 0;
+    if (p_children != NULL)
+      XFree(p_children);
+    imitator_take_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display), NULL);
+  }
+  return NULL;
+}
+
+/*
+*Asks for one window's geometry after the other. 
+*/
+static void * windows_exist_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  Window root;
+  int x, y;
+  unsigned int width, height, border_width, depth;
+  unsigned long serial;
+  unsigned int i;
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    serial = NextRequest(p_args->p_display);
+    p_args->p_exist[i] = XGetGeometry(p_args->p_display, p_args->p_wins[i], &root, &x, &y, &width, &height, &border_width, &depth) != 0;
+    /*The error is the answer, nobody wants it raised*/
+    if (imitator_take_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display), NULL) > 0)
+      p_args->p_exist[i] = False;
+  }
+  return NULL;
+}
+
+/*
+*Asks for one window's attributes after the other. 
+*/
+static void * get_attributes_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  unsigned long serial;
+  unsigned int i;
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    serial = NextRequest(p_args->p_display);
+    p_args->p_exist[i] = XGetWindowAttributes(p_args->p_display, p_args->p_wins[i], &p_args->p_attrs[i]) != 0;
+    if (imitator_take_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display), NULL) > 0)
+      p_args->p_exist[i] = False;
+    if (!p_args->p_exist[i])
+      memset(&p_args->p_attrs[i], 0, sizeof(XWindowAttributes));
+  }
+  return NULL;
+}
+
+/*
+*Without XCB there's nothing to gain by mixing the requests. 
+*/
+static void * get_titles_and_children_without_gvl(void * ptr)
+{
+  struct level_args * p_args = (struct level_args *) ptr;
+  struct pipeline_args titles = {p_args->p_display, p_args->p_wins, p_args->count, (void **) p_args->pp_titles, NULL, NULL, NULL, p_args->net_wm_name, p_args->utf8_string};
+  struct pipeline_args trees = {p_args->p_display, p_args->p_wins, p_args->count, (void **) p_args->pp_children, p_args->p_num_children};
+  
+  get_titles_without_gvl(&titles);
+  query_trees_without_gvl(&trees);
+  return NULL;
+}
+
+/*
+*Asks for one field of one window after the other, reusing the functions above where possible. 
+*/
+static void * get_window_info_without_gvl(void * ptr)
+{
+  struct info_args * p_args = (struct info_args *) ptr;
+  struct pipeline_args single = {p_args->p_display, NULL, 1, NULL, NULL, NULL, NULL, p_args->net_wm_name, p_args->utf8_string};
+  imitator_window_info * p_info;
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char * p_value;
+  unsigned long serial;
+  unsigned int i;
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_info = &p_args->p_infos[i];
+    memset(p_info, 0, sizeof(imitator_window_info));
+    p_info->pid = -1;
+    single.p_wins = &p_args->p_wins[i];
+    if (p_args->fields & IMITATOR_INFO_TITLE)
+    {
+      single.pp_results = (void **) &p_info->p_title;
+      single.p_errors = &p_info->error;
+      get_titles_without_gvl(&single);
+    }
+    if (p_args->fields & IMITATOR_INFO_CHILDREN)
+    {
+      single.pp_results = (void **) &p_info->p_children;
+      single.p_sizes = &p_info->num_children;
+      query_trees_without_gvl(&single);
+    }
+    if (p_args->fields & IMITATOR_INFO_ATTRIBUTES)
+    {
+      single.p_attrs = &p_info->attrs;
+      single.p_exist = &p_info->exists;
+      get_attributes_without_gvl(&single);
+    }
+    
+    serial = NextRequest(p_args->p_display);
+    p_value = NULL;
+    if ((p_args->fields & IMITATOR_INFO_CLASS) && XGetWindowProperty(p_args->p_display, p_args->p_wins[i], XA_WM_CLASS, 0, MAX_TITLE_LENGTH, False, XA_STRING, 
+                                                                       &actual_type, &actual_format, &nitems, &bytes_after, &p_value) == Success && actual_type == XA_STRING && actual_format == 8)
+      class_to_utf8(p_value, nitems, p_info);
+    if (p_value != NULL)
+      XFree(p_value);
+    
+    p_value = NULL;
+    if ((p_args->fields & IMITATOR_INFO_PID) && XGetWindowProperty(p_args->p_display, p_args->p_wins[i], p_args->net_wm_pid, 0, 1, False, XA_CARDINAL, 
+                                                                     &actual_type, &actual_format, &nitems, &bytes_after, &p_value) == Success && actual_type == XA_CARDINAL && actual_format == 32 && nitems > 0)
+      p_info->pid = *((long *) p_value) & 0xFFFFFFFF; /*Xlib hands out format 32 as longs*/
+    if (p_value != NULL)
+      XFree(p_value);
+    imitator_take_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display), p_info->error.error_code == 0 ? &p_info->error : NULL);
+  }
+  return NULL;
+}
+
+#endif
+
+#ifdef IMITATOR_X_USE_XRES
+/***********************X-Resource extension***************************/
+
+/*
+*Asks the X-Resource extension for all clients and their PIDs, then gives every 
+*window whose PID is still -1 the PID of the client that created it. 
+*/
+static void * get_client_pids_without_gvl(void * ptr)
+{
+  struct pipeline_args * p_args = (struct pipeline_args *) ptr;
+  long * p_pids = (long *) p_args->pp_results;
+  XResClient * p_clients = NULL;
+  XResClientIdSpec * p_specs;
+  XResClientIdValue * p_ids = NULL;
+  long * p_client_pids;
+  int event_base, error_base, num_clients = 0, j;
+  long num_ids = 0, i;
+  
+  if (!XResQueryExtension(p_args->p_display, &event_base, &error_base))
+    return NULL;
+  /*Every client owns the resource IDs +resource_base+ | (anything in +resource_mask+)*/
+  if (!XResQueryClients(p_args->p_display, &num_clients, &p_clients) || num_clients == 0)
+    return NULL;
+  
+  /*The PIDs of all clients in one request (X-Resource 1.2)*/
+  p_specs = (XResClientIdSpec *) malloc(sizeof(XResClientIdSpec) * num_clients);
+  p_client_pids = (long *) malloc(sizeof(long) * num_clients);
+  for(j = 0; j < num_clients; j++)
+  {
+    p_specs[j].client = p_clients[j].resource_base;
+    p_specs[j].mask = XRES_CLIENT_ID_PID_MASK;
+    p_client_pids[j] = -1;
+  }
+  if (XResQueryClientIds(p_args->p_display, num_clients, p_specs, &num_ids, &p_ids))
+  {
+    for(i = 0; i < num_ids; i++)
+    {
+      if (XResGetClientIdType(&p_ids[i]) != XRES_CLIENT_ID_PID)
+        continue;
+      for(j = 0; j < num_clients; j++)
+      {
+        if (p_clients[j].resource_base == p_ids[i].spec.client)
+          p_client_pids[j] = XResGetClientPid(&p_ids[i]);
+      }
+    }
+    XResClientIdsDestroy(num_ids, p_ids);
+  }
+  
+  for(i = 0; i < p_args->count; i++)
+  {
+    if (p_pids[i] != -1)
+      continue;
+    for(j = 0; j < num_clients; j++)
+    {
+      if ((p_args->p_wins[i] & ~p_clients[j].resource_mask) == p_clients[j].resource_base)
+      {
+        p_pids[i] = p_client_pids[j];
+        break;
+      }
+    }
+  }
+  
+  free(p_client_pids);
+  free(p_specs);
+  XFree(p_clients);
+  return NULL;
+}
+
+#endif
+
+/***********************Interface***************************/
+
+void imitator_get_titles(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, imitator_x_error * p_errors)
+{
+  struct pipeline_args args = {p_display, p_wins, count, (void **) pp_titles, NULL, NULL, NULL, 
+                               imitator_atom(p_display, IMITATOR_ATOM_NET_WM_NAME), imitator_atom(p_display, IMITATOR_ATOM_UTF8_STRING), p_errors};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  unsigned int i;
+  
+  imitator_without_gvl(p_display, get_titles_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(count), imitator_stats_now() - start);
+  for(i = 0; i < count; i++)
+  {
+    if (pp_titles[i] != NULL)
+      imitator_stats_bytes(strlen(pp_titles[i]));
+  }
+  imitator_check_x_errors(p_display, serial);
+}
+
+void imitator_query_trees(Display * p_display, const Window * p_wins, unsigned int count, Window ** pp_children, unsigned int * p_num_children)
+{
+  struct pipeline_args args = {p_display, p_wins, count, (void **) pp_children, p_num_children};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  unsigned int i;
+  
+  imitator_without_gvl(p_display, query_trees_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(count), imitator_stats_now() - start);
+  for(i = 0; i < count; i++)
+    imitator_stats_bytes(4 * p_num_children[i]);
+  imitator_check_x_errors(p_display, serial);
+}
+
+void imitator_get_titles_and_children(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, Window ** pp_children, unsigned int * p_num_children)
+{
+  struct level_args args = {p_display, p_wins, count, pp_titles, pp_children, p_num_children, 
+                            imitator_atom(p_display, IMITATOR_ATOM_NET_WM_NAME), imitator_atom(p_display, IMITATOR_ATOM_UTF8_STRING)};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  unsigned int i;
+  
+  imitator_without_gvl(p_display, get_titles_and_children_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(2 * count), imitator_stats_now() - start);
+  for(i = 0; i < count; i++)
+  {
+    if (pp_titles[i] != NULL)
+      imitator_stats_bytes(strlen(pp_titles[i]));
+    imitator_stats_bytes(4 * p_num_children[i]);
+  }
+  imitator_check_x_errors(p_display, serial);
+}
+
+void imitator_windows_exist(Display * p_display, const Window * p_wins, unsigned int count, Bool * p_exist)
+{
+  struct pipeline_args args = {p_display, p_wins, count, NULL, NULL, p_exist};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  
+  imitator_without_gvl(p_display, windows_exist_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(count), imitator_stats_now() - start);
+  imitator_check_x_errors(p_display, serial);
+}
+
+void imitator_get_attributes(Display * p_display, const Window * p_wins, unsigned int count, XWindowAttributes * p_attrs, Bool * p_exist)
+{
+  struct pipeline_args args = {p_display, p_wins, count, NULL, NULL, p_exist, p_attrs};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  
+  imitator_without_gvl(p_display, get_attributes_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(count), imitator_stats_now() - start);
+  imitator_check_x_errors(p_display, serial);
+}
+
+void imitator_get_window_info(Display * p_display, const Window * p_wins, unsigned int count, unsigned int fields, imitator_window_info * p_infos)
+{
+  struct info_args args = {p_display, p_wins, count, fields, p_infos, 
+                           imitator_atom(p_display, IMITATOR_ATOM_NET_WM_NAME), imitator_atom(p_display, IMITATOR_ATOM_UTF8_STRING), 
+                           imitator_atom(p_display, IMITATOR_ATOM_NET_WM_PID)};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  unsigned int i, kinds = 0;
+  
+  for(i = fields; i != 0; i >>= 1) /*Without XCB each kind of request costs a round-trip per window*/
+    kinds += i & 1;
+  imitator_without_gvl(p_display, get_window_info_without_gvl, &args);
+  imitator_stats_round_trip(p_display, ROUND_TRIPS(kinds * count), imitator_stats_now() - start);
+  for(i = 0; i < count; i++)
+  {
+    if (p_infos[i].p_title != NULL)
+      imitator_stats_bytes(strlen(p_infos[i].p_title));
+    if (p_infos[i].p_res_name != NULL)
+      imitator_stats_bytes(strlen(p_infos[i].p_res_name));
+    if (p_infos[i].p_res_class != NULL)
+      imitator_stats_bytes(strlen(p_infos[i].p_res_class));
+    imitator_stats_bytes(4 * p_infos[i].num_children);
+  }
+  imitator_check_x_errors(p_display, serial);
+}
+
+/*
+*Arguments for fetch_pids() and free_pids_info(). 
+*/
+struct pids_args {
+  Display * p_display;
+  const Window * p_wins;
+  unsigned int count;
+  imitator_window_info * p_infos;
+  long * p_pids;
+  imitator_x_error * p_errors;
+};
+
+/*
+*Gets the _NET_WM_PIDs of imitator_get_pids(). Returns the number of windows without one. 
+*/
+static VALUE fetch_pids(VALUE arg)
+{
+  struct pids_args * p_args = (struct pids_args *) arg;
+  unsigned int i, num_missing = 0;
+  
+  imitator_get_window_info(p_args->p_display, p_args->p_wins, p_args->count, IMITATOR_INFO_PID, p_args->p_infos);
+  for(i = 0; i < p_args->count; i++)
+  {
+    p_args->p_pids[i] = p_args->p_infos[i].pid;
+    if (p_args->p_errors != NULL)
+      p_args->p_errors[i] = p_args->p_infos[i].error;
+    if (p_args->p_pids[i] == -1)
+      num_missing++;
+  }
+  return UINT2NUM(num_missing);
+}
+
+/*
+*Frees the window info of fetch_pids(), also if it raised. 
+*/
+static VALUE free_pids_info(VALUE arg)
+{
+  struct pids_args * p_args = (struct pids_args *) arg;
+  
+  imitator_free_window_info(p_args->p_infos, p_args->count);
+  xfree(p_args->p_infos);
+  return Qnil;
+}
+
+void imitator_get_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids, imitator_x_error * p_errors)
+{
+  struct pids_args args = {p_display, p_wins, count, NULL, p_pids, p_errors};
+  
+  args.p_infos = ALLOC_N(imitator_window_info, count);
+  memset(args.p_infos, 0, sizeof(imitator_window_info) * count);
+  if (NUM2UINT(rb_ensure(fetch_pids, (VALUE) &args, free_pids_info, (VALUE) &args)) > 0)
+    imitator_get_client_pids(p_display, p_wins, count, p_pids);
+}
+
+void imitator_get_client_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids)
+{
+#ifdef IMITATOR_X_USE_XRES
+  struct pipeline_args args = {p_display, p_wins, count, (void **) p_pids};
+  unsigned long serial = NextRequest(p_display);
+  double start = imitator_stats_now();
+  
+  imitator_without_gvl(p_display, get_client_pids_without_gvl, &args);
+  imitator_stats_round_trip(p_display, 2, imitator_stats_now() - start);
+  /*Servers before X-Resource 1.2 don't know XResQueryClientIds, that just means we don't know the PIDs*/
+  imitator_take_x_errors(p_display, serial, NextRequest(p_display), NULL);
+#endif
+}
+
+void imitator_free_window_info(imitator_window_info * p_infos, unsigned int count)
+{
+  unsigned int i;
+  
+  for(i = 0; i < count; i++)
+  {
+    free(p_infos[i].p_title);
+    free(p_infos[i].p_children);
+    free(p_infos[i].p_res_name);
+    free(p_infos[i].p_res_class);
+  }
+}
+
+void imitator_free_list(void ** pp_list, unsigned int count)
+{
+  unsigned int i;
+  
+  for(i = 0; i < count; i++)
+    free(pp_list[i]);
+}
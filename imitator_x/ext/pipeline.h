@@ -0,0 +1,96 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_PIPELINE_HEADER
+#define IMITATOR_PIPELINE_HEADER
+
+/*
+*Requests for many windows at once. If Imitator for X was compiled with XCB 
+*support, all requests are sent before the first reply is read, so asking 
+*about N windows costs about one round-trip to the X server instead of N. 
+*Without XCB the requests are made one by one through Xlib. Either way the 
+*GVL is released meanwhile. 
+*
+*Windows that vanish while we ask about them aren't an error here; they 
+*just get NULL entries. Everything returned is malloc()ed, free it with 
+*imitator_free_list(). 
+*/
+
+/*Stores the title of each of the +count+ windows in +p_wins+ in +pp_titles+, as UTF-8. 
+*That's _NET_WM_NAME or, if it isn't set, WM_NAME. Windows without a name get NULL. 
+*Unless +p_errors+ is NULL, it gets the error each window's requests caused, or an error_code of 0. */
+void imitator_get_titles(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, imitator_x_error * p_errors);
+/*Stores the children of each of the +count+ windows in +p_wins+ in +pp_children+ and 
+*their number in +p_num_children+. Vanished windows get NULL and 0. */
+void imitator_query_trees(Display * p_display, const Window * p_wins, unsigned int count, Window ** pp_children, unsigned int * p_num_children);
+/*Both of the above with the requests for all windows sent together, i.e. in one round-trip with XCB*/
+void imitator_get_titles_and_children(Display * p_display, const Window * p_wins, unsigned int count, char ** pp_titles, Window ** pp_children, unsigned int * p_num_children);
+/*Stores in +p_exist+ wheather each of the +count+ windows in +p_wins+ exists. 
+*Nonexistent windows don't raise anything. */
+void imitator_windows_exist(Display * p_display, const Window * p_wins, unsigned int count, Bool * p_exist);
+/*Stores the attributes of each of the +count+ windows in +p_wins+ in +p_attrs+. Only the geometry, 
+*depth, root, class, map_state and override_redirect are filled in. +p_exist+ is set to False for 
+*windows that don't exist (their attributes are zeroed). */
+void imitator_get_attributes(Display * p_display, const Window * p_wins, unsigned int count, XWindowAttributes * p_attrs, Bool * p_exist);
+
+/*What imitator_get_window_info() should fetch*/
+#define IMITATOR_INFO_TITLE      (1 << 0)
+#define IMITATOR_INFO_CHILDREN   (1 << 1)
+#define IMITATOR_INFO_CLASS      (1 << 2)
+#define IMITATOR_INFO_PID        (1 << 3)
+#define IMITATOR_INFO_ATTRIBUTES (1 << 4)
+
+/*What imitator_get_window_info() found out about a window. Only the fields asked for are set, 
+*the others are zero. */
+typedef struct {
+  /*UTF-8, as for imitator_get_titles()*/
+  char * p_title;
+  Window * p_children;
+  unsigned int num_children;
+  /*The two strings of WM_CLASS as UTF-8, or NULL*/
+  char * p_res_name;
+  char * p_res_class;
+  /*_NET_WM_PID, -1 if it isn't set*/
+  long pid;
+  /*As for imitator_get_attributes()*/
+  XWindowAttributes attrs;
+  Bool exists;
+  /*The first error the requests for the title, WM_CLASS or _NET_WM_PID caused, error_code 0 if none did*/
+  imitator_x_error error;
+} imitator_window_info;
+
+/*Stores the +fields+ (a combination of the IMITATOR_INFO_* flags) of each of the +count+ windows 
+*in +p_wins+ in +p_infos+. All requests for all windows are sent together. 
+*Free the results with imitator_free_window_info(). */
+void imitator_get_window_info(Display * p_display, const Window * p_wins, unsigned int count, unsigned int fields, imitator_window_info * p_infos);
+/*Stores the PID of each of the +count+ windows in +p_wins+ in +p_pids+. That's _NET_WM_PID or, for 
+*windows without it, the PID the X-Resource extension knows for the client that created the window. 
+*-1 if neither is known. Unless +p_errors+ is NULL, it gets the error asking for each window's 
+*_NET_WM_PID caused, or an error_code of 0. */
+void imitator_get_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids, imitator_x_error * p_errors);
+/*Fills in the entries of +p_pids+ that are -1 from the X-Resource extension, with two 
+*round-trips no matter how many windows there are. Does nothing if the server or 
+*Imitator for X lacks the extension. */
+void imitator_get_client_pids(Display * p_display, const Window * p_wins, unsigned int count, long * p_pids);
+/*Frees what the +count+ entries of +p_infos+ point to (not +p_infos+ itself)*/
+void imitator_free_window_info(imitator_window_info * p_infos, unsigned int count);
+/*Frees the +count+ entries of +pp_list+ (not +pp_list+ itself)*/
+void imitator_free_list(void ** pp_list, unsigned int count);
+
+#endif
@@ -0,0 +1,329 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include <time.h>
+#include "x.h"
+#include "connection.h"
+#include "stats.h"
+
+/*
+*Document-method: Imitator::X.stats
+*call-seq: 
+*  Imitator::X.stats() ==> aHash
+*
+*Tells you how much talking to the X server your code caused since the library 
+*was loaded or Imitator::X.reset_stats was called. Every X request, round-trip 
+*(waiting for the X server's answer) etc. is booked on the Imitator for X method 
+*that caused it, e.g. <tt>"XWindow.search"</tt> or <tt>"Keyboard.simulate"</tt>. 
+*===Return value
+*A hash of form 
+*  {
+*    :connections_opened => 1, #X server connections opened
+*    :requests => 120,         #X requests sent
+*    :round_trips => 8,        #Times we waited for the X server to answer
+*    :syncs => 2,              #Round-trips that waited for all requests to be processed
+*    :flushes => 5,            #Times requests were sent without waiting
+*    :bytes_received => 4711,  #Payload of the answers (window titles, properties, etc.)
+*    :events_journaled => 30,  #Events recorded for Imitator::X.events
+*    :events_dropped => 0,     #Journaled events overwritten before anybody read them
+*    :methods => {"XWindow.search" => {...}, ...}
+*  }
+*Each value of <tt>:methods</tt> contains the counters above (except :connections_opened) 
+*for that method, plus <tt>:latency</tt>, the time spent in round-trips: 
+*  {:count => 8, :total => 0.0042, :max => 0.0013, :histogram => {1.0e-05 => 0, 2.0e-05 => 3, ..., Infinity => 0}}
+*The histogram maps upper bounds (in seconds) to the number of round-trips that took 
+*less than that, but longer than the previous bound. 
+*===Example
+*  Imitator::X::XWindow.search(/imitator/)
+*  p Imitator::X.stats[:methods]["XWindow.search"][:round_trips] #=> 2
+*===Remarks
+*Xlib doesn't tell how many bytes go over the wire, so <tt>:bytes_received</tt> 
+*only counts the data of the answers Imitator for X evaluates. 
+*
+*If <tt>:events_dropped</tt> grows, Imitator::X.events isn't called often enough 
+*for the journal's capacity. 
+*/
+
+/*
+*Document-method: Imitator::X.reset_stats
+*call-seq: 
+*  Imitator::X.reset_stats() ==> nil
+*
+*Sets all counters of Imitator::X.stats back to zero. 
+*===Return value
+*nil. 
+*===Example
+*  Imitator::X.reset_stats
+*  Imitator::X::Keyboard.simulate("Hello")
+*  p Imitator::X.stats[:requests] #=> 10
+*/
+
+/*The counters of one method*/
+typedef struct imitator_method_stats_s {
+  /*Which method, see current_method_stats()*/
+  ID method;
+  VALUE owner;
+  int singleton;
+  unsigned long requests;
+  unsigned long round_trips;
+  unsigned long syncs;
+  unsigned long flushes;
+  unsigned long bytes_received;
+  /*Time spent in round-trips*/
+  unsigned long latency_count;
+  double latency_total;
+  double latency_max;
+  unsigned long histogram[IMITATOR_STATS_BUCKETS];
+  struct imitator_method_stats_s * p_next;
+} imitator_method_stats;
+
+/*Linked list of the counters of all methods that talked to X so far*/
+static imitator_method_stats * p_method_stats = NULL;
+static unsigned long connections_opened = 0;
+/*The +owner+s of p_method_stats, so the GC neither frees nor moves them*/
+static VALUE stats_owners = Qnil;
+static unsigned long events_journaled = 0;
+static unsigned long events_dropped = 0;
+
+/*******************Helper functions**************************/
+
+/*
+*Returns the counters of the Ruby method that's currently running, 
+*creating them if the method didn't talk to X before. 
+*/
+static imitator_method_stats * current_method_stats(void)
+{
+  imitator_method_stats * p_stats;
+  ID method = rb_frame_this_func();
+  VALUE owner = Qnil;
+  int singleton = 0;
+#ifdef HAVE_RB_CURRENT_RECEIVER
+  VALUE receiver = rb_current_receiver();
+  
+  if (TYPE(receiver) == T_CLASS || TYPE(receiver) == T_MODULE) /*Class method*/
+  {
+    owner = receiver;
+    singleton = 1;
+  }
+  else
+    owner = rb_obj_class(receiver);
+#endif
+  
+  for(p_stats = p_method_stats; p_stats != NULL; p_stats = p_stats->p_next)
+  {
+    if (p_stats->method == method && p_stats->owner == owner && p_stats->singleton == singleton)
+      return p_stats;
+  }
+  
+  p_stats = ALLOC(imitator_method_stats);
+  MEMZERO(p_stats, imitator_method_stats, 1);
+  p_stats->method = method;
+  p_stats->owner = owner;
+  p_stats->singleton = singleton;
+  if (!NIL_P(owner))
+    rb_ary_push(stats_owners, owner);
+  p_stats->p_next = p_method_stats;
+  p_method_stats = p_stats;
+  return p_stats;
+}
+
+/*
+*Books the requests sent over +p_display+ since the last time on +p_stats+. 
+*/
+static void count_requests(Display * p_display, imitator_method_stats * p_stats)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn == NULL)
+    return;
+  p_stats->requests += NextRequest(p_display) - p_conn->stats_serial;
+  p_conn->stats_serial = NextRequest(p_display);
+}
+
+/*
+*Returns the name of the method +p_stats+ belongs to, e.g. "XWindow.search". 
+*/
+static VALUE method_name(imitator_method_stats * p_stats)
+{
+  VALUE rname;
+  
+  if (p_stats->method == 0)
+    return rb_str_new2("(unknown)");
+  if (NIL_P(p_stats->owner))
+    return rb_str_new2(rb_id2name(p_stats->method));
+  
+  /*Imitator::X:: is the same for all of them*/
+  rname = rb_str_dup(rb_class_name(p_stats->owner));
+  if (strncmp(RSTRING_PTR(rname), "Imitator::X::", 13) == 0)
+    rname = rb_str_substr(rname, 13, RSTRING_LEN(rname) - 13);
+  rb_str_cat2(rname, p_stats->singleton ? "." : "#");
+  rb_str_cat2(rname, rb_id2name(p_stats->method));
+  return rname;
+}
+
+/*
+*Stores the counters of +p_stats+ in the hash +rhash+. 
+*/
+static void add_counters(VALUE rhash, imitator_method_stats * p_stats)
+{
+  rb_hash_aset(rhash, ID2SYM(rb_intern("requests")), ULONG2NUM(p_stats->requests));
+  rb_hash_aset(rhash, ID2SYM(rb_intern("round_trips")), ULONG2NUM(p_stats->round_trips));
+  rb_hash_aset(rhash, ID2SYM(rb_intern("syncs")), ULONG2NUM(p_stats->syncs));
+  rb_hash_aset(rhash, ID2SYM(rb_intern("flushes")), ULONG2NUM(p_stats->flushes));
+  rb_hash_aset(rhash, ID2SYM(rb_intern("bytes_received")), ULONG2NUM(p_stats->bytes_received));
+}
+
+/*
+*Converts the latency data of +p_stats+ to a hash. 
+*/
+static VALUE latency_to_hash(imitator_method_stats * p_stats)
+{
+  VALUE rlatency = rb_hash_new();
+  VALUE rhistogram = rb_hash_new();
+  double bound = 0.00001;
+  int i;
+  
+  for(i = 0; i < IMITATOR_STATS_BUCKETS - 1; i++, bound *= 2)
+    rb_hash_aset(rhistogram, rb_float_new(bound), ULONG2NUM(p_stats->histogram[i]));
+  rb_hash_aset(rhistogram, rb_const_get(rb_cFloat, rb_intern("INFINITY")), ULONG2NUM(p_stats->histogram[IMITATOR_STATS_BUCKETS - 1]));
+  
+  rb_hash_aset(rlatency, ID2SYM(rb_intern("count")), ULONG2NUM(p_stats->latency_count));
+  rb_hash_aset(rlatency, ID2SYM(rb_intern("total")), rb_float_new(p_stats->latency_total));
+  rb_hash_aset(rlatency, ID2SYM(rb_intern("max")), rb_float_new(p_stats->latency_max));
+  rb_hash_aset(rlatency, ID2SYM(rb_intern("histogram")), rhistogram);
+  return rlatency;
+}
+
+/*******************Recording**************************/
+
+double imitator_stats_now(void)
+{
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void imitator_stats_round_trip(Display * p_display, unsigned int round_trips, double seconds)
+{
+  imitator_method_stats * p_stats = current_method_stats();
+  double bound = 0.00001;
+  int i;
+  
+  count_requests(p_display, p_stats);
+  p_stats->round_trips += round_trips;
+  p_stats->latency_count++;
+  p_stats->latency_total += seconds;
+  if (seconds > p_stats->latency_max)
+    p_stats->latency_max = seconds;
+  
+  for(i = 0; i < IMITATOR_STATS_BUCKETS - 1 && seconds >= bound; i++)
+    bound *= 2;
+  p_stats->histogram[i]++;
+}
+
+void imitator_stats_sync(Display * p_display)
+{
+  current_method_stats()->syncs++;
+}
+
+void imitator_stats_flush(Display * p_display)
+{
+  imitator_method_stats * p_stats = current_method_stats();
+  
+  count_requests(p_display, p_stats);
+  p_stats->flushes++;
+}
+
+void imitator_stats_bytes(unsigned long bytes)
+{
+  current_method_stats()->bytes_received += bytes;
+}
+
+void imitator_stats_connection_opened(void)
+{
+  connections_opened++;
+}
+
+void imitator_stats_journaled(Bool dropped)
+{
+  events_journaled++;
+  if (dropped)
+    events_dropped++;
+}
+
+/*******************Module functions**************************/
+
+static VALUE m_stats(VALUE self)
+{
+  VALUE rresult = rb_hash_new();
+  VALUE rmethods = rb_hash_new();
+  VALUE rmethod;
+  imitator_method_stats * p_stats;
+  imitator_method_stats totals;
+  
+  MEMZERO(&totals, imitator_method_stats, 1);
+  for(p_stats = p_method_stats; p_stats != NULL; p_stats = p_stats->p_next)
+  {
+    rmethod = rb_hash_new();
+    add_counters(rmethod, p_stats);
+    rb_hash_aset(rmethod, ID2SYM(rb_intern("latency")), latency_to_hash(p_stats));
+    rb_hash_aset(rmethods, method_name(p_stats), rmethod);
+    
+    totals.requests += p_stats->requests;
+    totals.round_trips += p_stats->round_trips;
+    totals.syncs += p_stats->syncs;
+    totals.flushes += p_stats->flushes;
+    totals.bytes_received += p_stats->bytes_received;
+  }
+  
+  rb_hash_aset(rresult, ID2SYM(rb_intern("connections_opened")), ULONG2NUM(connections_opened));
+  add_counters(rresult, &totals);
+  rb_hash_aset(rresult, ID2SYM(rb_intern("events_journaled")), ULONG2NUM(events_journaled));
+  rb_hash_aset(rresult, ID2SYM(rb_intern("events_dropped")), ULONG2NUM(events_dropped));
+  rb_hash_aset(rresult, ID2SYM(rb_intern("methods")), rmethods);
+  return rresult;
+}
+
+static VALUE m_reset_stats(VALUE self)
+{
+  imitator_method_stats * p_stats;
+  
+  while (p_method_stats != NULL)
+  {
+    p_stats = p_method_stats;
+    p_method_stats = p_stats->p_next;
+    xfree(p_stats);
+  }
+  rb_ary_clear(stats_owners);
+  connections_opened = 0;
+  events_journaled = 0;
+  events_dropped = 0;
+  return Qnil;
+}
+
+/***********************Init-Function*******************************/
+
+void Init_stats(void)
+{
+  stats_owners = rb_ary_new();
+  rb_gc_register_address(&stats_owners);
+  rb_define_module_function(X, "stats", m_stats, 0);
+  rb_define_module_function(X, "reset_stats", m_reset_stats, 0);
+}
@@ -0,0 +1,46 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_STATS_HEADER
+#define IMITATOR_STATS_HEADER
+
+/*Number of buckets of the latency histograms. Bucket i counts round-trips 
+*that took less than 10us * 2^i, the last one all slower ones. */
+#define IMITATOR_STATS_BUCKETS 16
+
+/*Returns a monotonic timestamp in seconds*/
+double imitator_stats_now(void);
+/*Counts +round_trips+ round-trips over +p_display+ that took +seconds+ together, 
+*and the requests sent since the last count. Needs the GVL, as all of these. */
+void imitator_stats_round_trip(Display * p_display, unsigned int round_trips, double seconds);
+/*Counts a XSync() (the round-trip itself is counted by imitator_stats_round_trip())*/
+void imitator_stats_sync(Display * p_display);
+/*Counts a XFlush() and the requests sent since the last count*/
+void imitator_stats_flush(Display * p_display);
+/*Counts +bytes+ of reply data*/
+void imitator_stats_bytes(unsigned long bytes);
+/*Counts a new X server connection*/
+void imitator_stats_connection_opened(void);
+/*Counts an event written to an event journal, and whether it overwrote one nobody read*/
+void imitator_stats_journaled(Bool dropped);
+
+/*Stats initialization function*/
+void Init_stats(void);
+
+#endif
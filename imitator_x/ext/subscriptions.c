@@ -0,0 +1,415 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#include "x.h"
+#include "connection.h"
+#include "events.h"
+#include "subscriptions.h"
+#include "xwindow.h"
+
+/*Indexed by enum imitator_subscription_kind*/
+static const char * kind_names[IMITATOR_SUBSCRIBE_COUNT] = {"configure", "property", "map", "unmap", "destroy", "focus"};
+
+/*******************Helper functions**************************/
+
+/*
+*Returns the subscription kind +p_evt+ is for, -1 if none. 
+*/
+static int kind_of_event(const imitator_event * p_evt)
+{
+  switch (p_evt->type)
+  {
+    case ConfigureNotify:
+      return IMITATOR_SUBSCRIBE_CONFIGURE;
+    case PropertyNotify:
+      return IMITATOR_SUBSCRIBE_PROPERTY;
+    case MapNotify:
+      return IMITATOR_SUBSCRIBE_MAP;
+    case UnmapNotify:
+      return IMITATOR_SUBSCRIBE_UNMAP;
+    case DestroyNotify:
+      return IMITATOR_SUBSCRIBE_DESTROY;
+    case FocusIn:
+    case FocusOut:
+      return IMITATOR_SUBSCRIBE_FOCUS;
+    default:
+      return -1;
+  }
+}
+
+/*
+*Returns the event mask +kind+ needs on the window, or on the 
+*parent if +children+ is True. 
+*/
+static long mask_for(enum imitator_subscription_kind kind, Bool children)
+{
+  switch (kind)
+  {
+    case IMITATOR_SUBSCRIBE_PROPERTY:
+      return PropertyChangeMask;
+    case IMITATOR_SUBSCRIBE_FOCUS:
+      return FocusChangeMask;
+    default:
+      return children ? SubstructureNotifyMask : StructureNotifyMask;
+  }
+}
+
+/*
+*True if +p_sub+ wants +p_evt+, whose kind is +kind+. The window cache selects 
+*SubstructureNotifyMask on every window it tracks, so a window's own 
+*subscriptions must not take the events about its children. 
+*/
+static Bool sub_matches(const imitator_subscription * p_sub, const imitator_event * p_evt, int kind)
+{
+  if ((int) p_sub->kind != kind || p_evt->event_window != p_sub->win)
+    return False;
+  return p_sub->children || p_evt->window == p_sub->win;
+}
+
+static imitator_subscriptions * get_subscriptions(imitator_connection * p_conn)
+{
+  imitator_subscriptions * p_subs;
+  
+  if (p_conn->p_subscriptions == NULL)
+  {
+    p_subs = ALLOC(imitator_subscriptions);
+    MEMZERO(p_subs, imitator_subscriptions, 1);
+    p_subs->pump = Qnil;
+    p_subs->atom_names = Qnil;
+    p_conn->p_subscriptions = p_subs;
+  }
+  return p_conn->p_subscriptions;
+}
+
+/*
+*Returns the name of +atom+ for the events' +property+. Each name is only asked for once. 
+*/
+static VALUE atom_name(imitator_connection * p_conn, Atom atom)
+{
+  VALUE rname;
+  char * p_name;
+  
+  if (NIL_P(p_conn->p_subscriptions->atom_names))
+    p_conn->p_subscriptions->atom_names = rb_hash_new();
+  rname = rb_hash_lookup(p_conn->p_subscriptions->atom_names, ULONG2NUM(atom));
+  if (!NIL_P(rname))
+    return rname;
+  
+  p_name = imitator_get_atom_name(p_conn->p_display, atom);
+  rname = rb_str_new2(p_name);
+  XFree(p_name);
+  OBJ_FREEZE(rname);
+  if (p_conn->p_subscriptions != NULL) /*Closed while we waited?*/
+    rb_hash_aset(p_conn->p_subscriptions->atom_names, ULONG2NUM(atom), rname);
+  return rname;
+}
+
+/*
+*Converts +p_evt+ to a XWindow::Event. May release the GVL. 
+*/
+static VALUE event_to_ruby(VALUE rconn, imitator_connection * p_conn, const imitator_event * p_evt)
+{
+  VALUE rtype, rx = Qnil, ry = Qnil, rwidth = Qnil, rheight = Qnil, rproperty = Qnil;
+  
+  switch (p_evt->type)
+  {
+    case ConfigureNotify:
+      rtype = ID2SYM(rb_intern("configure"));
+      rx = INT2NUM(p_evt->x);
+      ry = INT2NUM(p_evt->y);
+      rwidth = UINT2NUM(p_evt->width);
+      rheight = UINT2NUM(p_evt->height);
+      break;
+    case PropertyNotify:
+      rtype = ID2SYM(rb_intern("property"));
+      rproperty = atom_name(p_conn, p_evt->atom);
+      break;
+    case FocusIn:
+      rtype = ID2SYM(rb_intern("focus_in"));
+      break;
+    case FocusOut:
+      rtype = ID2SYM(rb_intern("focus_out"));
+      break;
+    default:
+      rtype = ID2SYM(rb_intern(kind_names[kind_of_event(p_evt)]));
+  }
+  return rb_struct_new(WindowEvent, rtype, imitator_xwindow_for(rconn, p_evt->window), rx, ry, rwidth, rheight, rproperty);
+}
+
+/*
+*Removes the subscriptions of +win+ itself, which was destroyed. 
+*/
+static void forget_destroyed(imitator_subscriptions * p_subs, Window win)
+{
+  imitator_subscription ** pp_link = &p_subs->p_first;
+  imitator_subscription * p_sub;
+  
+  while (*pp_link != NULL)
+  {
+    p_sub = *pp_link;
+    if (p_sub->win == win && !p_sub->children)
+    {
+      *pp_link = p_sub->p_next;
+      xfree(p_sub);
+    }
+    else
+      pp_link = &p_sub->p_next;
+  }
+}
+
+static VALUE call_proc(VALUE arg)
+{
+  VALUE * p_proc_and_event = (VALUE *) arg;
+  
+  return rb_funcall(p_proc_and_event[0], rb_intern("call"), 1, p_proc_and_event[1]);
+}
+
+/*
+*Calls the blocks for all pending events of +p_conn+. The events are converted 
+*first, so the blocks may do whatever they like, even close the connection. 
+*An exception in a block is shown as a warning and doesn't stop the others. 
+*/
+static void dispatch_pending(VALUE rconn, imitator_connection * p_conn)
+{
+  imitator_subscription * p_sub;
+  imitator_event evt;
+  VALUE rbuffer, revt, proc_and_event[2];
+  VALUE calls = rb_ary_new(); /*proc, event, proc, event, ...*/
+  unsigned int i, num;
+  long j, first_call;
+  int kind, state;
+  
+  if (p_conn->p_subscriptions == NULL || p_conn->p_subscriptions->num_pending == 0)
+    return;
+  
+  /*Take the pending events. Looking up an atom name releases the GVL, so other 
+  *threads may append events or even close the connection meanwhile. */
+  num = p_conn->p_subscriptions->num_pending;
+  rbuffer = rb_str_new((const char *) p_conn->p_subscriptions->p_pending, sizeof(imitator_event) * num);
+  p_conn->p_subscriptions->num_pending = 0;
+  
+  for(i = 0; i < num && p_conn->p_subscriptions != NULL && p_conn->p_display != NULL; i++)
+  {
+    memcpy(&evt, RSTRING_PTR(rbuffer) + i * sizeof(imitator_event), sizeof(imitator_event));
+    kind = kind_of_event(&evt);
+    first_call = RARRAY_LEN(calls);
+    for(p_sub = p_conn->p_subscriptions->p_first; p_sub != NULL; p_sub = p_sub->p_next)
+    {
+      if (sub_matches(p_sub, &evt, kind))
+      {
+        rb_ary_push(calls, p_sub->proc);
+        rb_ary_push(calls, Qnil); /*The event, see below*/
+      }
+    }
+    if (evt.type == DestroyNotify)
+      forget_destroyed(p_conn->p_subscriptions, evt.window);
+    if (RARRAY_LEN(calls) > first_call)
+    {
+      revt = event_to_ruby(rconn, p_conn, &evt);
+      for(j = first_call + 1; j < RARRAY_LEN(calls); j += 2)
+        rb_ary_store(calls, j, revt);
+    }
+  }
+  
+  for(j = 0; j + 1 < RARRAY_LEN(calls); j += 2)
+  {
+    proc_and_event[0] = rb_ary_entry(calls, j);
+    proc_and_event[1] = rb_ary_entry(calls, j + 1);
+    if (NIL_P(proc_and_event[1])) /*The connection was closed while converting*/
+      break;
+    state = 0;
+    rb_protect(call_proc, (VALUE) proc_and_event, &state);
+    if (state)
+    {
+      if (!rb_obj_is_kind_of(rb_errinfo(), rb_eStandardError)) /*E.g. Thread#kill*/
+        rb_jump_tag(state);
+      rb_warn("Exception in an event block: %s", RSTRING_PTR(rb_inspect(rb_errinfo())));
+      rb_set_errinfo(Qnil);
+    }
+  }
+}
+
+/*
+*The event pump of a connection: waits for the X server without holding the GVL, 
+*reads the events and dispatches them. Runs until the last subscription is gone 
+*or the connection is closed. +arg+ is the Connection. 
+*/
+static VALUE run_pump(void * arg)
+{
+  volatile VALUE rconn = (VALUE) arg; /*On our stack, so it isn't collected*/
+  imitator_connection * p_conn = imitator_get_connection(rconn);
+  
+  while (p_conn->p_display != NULL && p_conn->p_subscriptions != NULL && p_conn->p_subscriptions->p_first != NULL)
+  {
+    imitator_process_events(p_conn->p_display);
+    dispatch_pending(rconn, p_conn);
+    if (p_conn->p_display != NULL && p_conn->p_subscriptions != NULL && p_conn->p_subscriptions->num_pending == 0)
+      imitator_wait_for_events(p_conn->p_display, 1); /*The loop notices if it closes*/
+  }
+  if (p_conn->p_subscriptions != NULL)
+    p_conn->p_subscriptions->pump = Qnil;
+  return Qnil;
+}
+
+/*******************Interface**************************/
+
+void imitator_subscriptions_mark(imitator_subscriptions * p_subs)
+{
+  imitator_subscription * p_sub;
+  
+  if (p_subs == NULL)
+    return;
+  rb_gc_mark(p_subs->pump);
+  rb_gc_mark(p_subs->atom_names);
+  for(p_sub = p_subs->p_first; p_sub != NULL; p_sub = p_sub->p_next)
+    rb_gc_mark(p_sub->proc);
+}
+
+void imitator_subscriptions_free(imitator_subscriptions * p_subs)
+{
+  imitator_subscription * p_sub;
+  
+  if (p_subs == NULL)
+    return;
+  while (p_subs->p_first != NULL)
+  {
+    p_sub = p_subs->p_first;
+    p_subs->p_first = p_sub->p_next;
+    xfree(p_sub);
+  }
+  if (p_subs->p_pending != NULL)
+    xfree(p_subs->p_pending);
+  xfree(p_subs);
+}
+
+enum imitator_subscription_kind imitator_subscription_kind_of(VALUE rkind)
+{
+  int i;
+  
+  if (SYMBOL_P(rkind))
+  {
+    for(i = 0; i < IMITATOR_SUBSCRIBE_COUNT; i++)
+    {
+      if (SYM2ID(rkind) == rb_intern(kind_names[i]))
+        return (enum imitator_subscription_kind) i;
+    }
+  }
+  rb_raise(rb_eArgError, "Unknown event %s!", RSTRING_PTR(rb_inspect(rkind)));
+  return IMITATOR_SUBSCRIBE_CONFIGURE; /*Never reached*/
+}
+
+void imitator_subscribe(VALUE rconn, Window win, enum imitator_subscription_kind kind, Bool children, VALUE proc)
+{
+  imitator_connection * p_conn = imitator_get_connection(rconn);
+  Display * p_display = imitator_connection_display(p_conn);
+  imitator_subscriptions * p_subs;
+  imitator_subscription * p_sub;
+  unsigned long serial = NextRequest(p_display);
+  
+  /*Raises a BadWindow before anything is registered*/
+  XSelectInput(p_display, win, imitator_event_mask(p_display, win) | mask_for(kind, children));
+  imitator_sync(p_display, serial);
+  imitator_connection_display(p_conn); /*Somebody may have closed it meanwhile*/
+  
+  p_subs = get_subscriptions(p_conn);
+  p_sub = ALLOC(imitator_subscription);
+  p_sub->win = win;
+  p_sub->kind = kind;
+  p_sub->children = children;
+  p_sub->proc = proc;
+  p_sub->p_next = p_subs->p_first;
+  p_subs->p_first = p_sub;
+  
+  if (NIL_P(p_subs->pump))
+    p_subs->pump = rb_thread_create(run_pump, (void *) rconn);
+}
+
+int imitator_unsubscribe(VALUE rconn, Window win, int kind, Bool children, VALUE proc)
+{
+  imitator_connection * p_conn = imitator_get_connection(rconn);
+  imitator_subscription ** pp_link;
+  imitator_subscription * p_sub;
+  unsigned long serial;
+  int removed = 0;
+  
+  if (p_conn->p_subscriptions == NULL)
+    return 0;
+  pp_link = &p_conn->p_subscriptions->p_first;
+  while (*pp_link != NULL)
+  {
+    p_sub = *pp_link;
+    if (p_sub->win == win && p_sub->children == children && (kind < 0 || (int) p_sub->kind == kind) && (NIL_P(proc) || p_sub->proc == proc))
+    {
+      *pp_link = p_sub->p_next;
+      xfree(p_sub);
+      removed++;
+    }
+    else
+      pp_link = &p_sub->p_next;
+  }
+  
+  /*Stop the events nobody wants anymore. The window may be gone already. */
+  if (removed > 0 && p_conn->p_display != NULL)
+  {
+    serial = NextRequest(p_conn->p_display);
+    XSelectInput(p_conn->p_display, win, imitator_event_mask(p_conn->p_display, win));
+    imitator_ignore_x_errors(p_conn->p_display, serial, NextRequest(p_conn->p_display));
+    imitator_flush(p_conn->p_display);
+  }
+  return removed;
+}
+
+long imitator_subscriptions_mask(Display * p_display, Window win)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  imitator_subscription * p_sub;
+  long mask = NoEventMask;
+  
+  if (p_conn == NULL || p_conn->p_subscriptions == NULL)
+    return mask;
+  for(p_sub = p_conn->p_subscriptions->p_first; p_sub != NULL; p_sub = p_sub->p_next)
+  {
+    if (p_sub->win == win)
+      mask |= mask_for(p_sub->kind, p_sub->children);
+  }
+  return mask;
+}
+
+void imitator_subscriptions_handle_event(imitator_subscriptions * p_subs, const imitator_event * p_evt)
+{
+  imitator_subscription * p_sub;
+  int kind = kind_of_event(p_evt);
+  
+  if (kind < 0)
+    return;
+  for(p_sub = p_subs->p_first; p_sub != NULL; p_sub = p_sub->p_next)
+  {
+    if (sub_matches(p_sub, p_evt, kind))
+      break;
+  }
+  if (p_sub == NULL) /*Nobody wants it*/
+    return;
+  
+  if (p_subs->num_pending == p_subs->pending_capacity)
+  {
+    p_subs->pending_capacity = p_subs->pending_capacity == 0 ? 16 : 2 * p_subs->pending_capacity;
+    REALLOC_N(p_subs->p_pending, imitator_event, p_subs->pending_capacity);
+  }
+  p_subs->p_pending[p_subs->num_pending++] = *p_evt;
+}
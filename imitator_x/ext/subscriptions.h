@@ -0,0 +1,80 @@
+/*********************************************************************************
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright  2010 Marvin Glker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************************/
+#ifndef IMITATOR_SUBSCRIPTIONS_HEADER
+#define IMITATOR_SUBSCRIPTIONS_HEADER
+
+/*
+*The blocks registered with XWindow#on and XWindow.on. imitator_process_events() 
+*queues the events they want, whichever thread reads them, and the event pump 
+*thread of the connection calls the blocks with all queued events at once. 
+*/
+
+/*What a subscription is for*/
+enum imitator_subscription_kind {
+  IMITATOR_SUBSCRIBE_CONFIGURE,
+  IMITATOR_SUBSCRIBE_PROPERTY,
+  IMITATOR_SUBSCRIBE_MAP,
+  IMITATOR_SUBSCRIBE_UNMAP,
+  IMITATOR_SUBSCRIBE_DESTROY,
+  IMITATOR_SUBSCRIBE_FOCUS,
+  IMITATOR_SUBSCRIBE_COUNT
+};
+
+typedef struct imitator_subscription_s {
+  Window win;
+  enum imitator_subscription_kind kind;
+  /*True for XWindow.on, which also hears about the children of +win+*/
+  Bool children;
+  /*The block*/
+  VALUE proc;
+  struct imitator_subscription_s * p_next;
+} imitator_subscription;
+
+typedef struct imitator_subscriptions_s {
+  /*Newest first*/
+  imitator_subscription * p_first;
+  /*Events read but not dispatched yet, oldest first*/
+  imitator_event * p_pending;
+  unsigned int num_pending;
+  unsigned int pending_capacity;
+  /*The pump thread, Qnil if it isn't running*/
+  VALUE pump;
+  /*Atom -> name String for the events' +property+, 0 until needed*/
+  VALUE atom_names;
+} imitator_subscriptions;
+
+/*Marks the Ruby objects of +p_subs+ (may be NULL)*/
+void imitator_subscriptions_mark(imitator_subscriptions * p_subs);
+/*Frees +p_subs+ (may be NULL), e.g. when the connection is closed. A running pump stops by itself. */
+void imitator_subscriptions_free(imitator_subscriptions * p_subs);
+/*Returns the event kind called +rkind+ (a Symbol like :configure). Raises an ArgumentError for unknown ones. */
+enum imitator_subscription_kind imitator_subscription_kind_of(VALUE rkind);
+/*Calls +proc+ for +kind+ events of +win+ on +rconn+, and with +children+ for those of its children. 
+*Selects the needed events and starts the pump if it isn't running. */
+void imitator_subscribe(VALUE rconn, Window win, enum imitator_subscription_kind kind, Bool children, VALUE proc);
+/*Removes the subscriptions of +win+ with the same +children+ that are for +kind+ (all if negative) 
+*and call +proc+ (all if nil). Returns their number. The pump stops when none are left. */
+int imitator_unsubscribe(VALUE rconn, Window win, int kind, Bool children, VALUE proc);
+/*Returns the events the subscriptions of +p_display+'s connection need from +win+*/
+long imitator_subscriptions_mask(Display * p_display, Window win);
+/*Queues +p_evt+ (read from +p_display+) for the pump if somebody subscribed to it*/
+void imitator_subscriptions_handle_event(imitator_subscriptions * p_subs, const imitator_event * p_evt);
+
+#endif
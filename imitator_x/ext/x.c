@@ -18,6 +18,10 @@ You should have received a copy of the GNU Lesser General Public License
 along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************************/
 #include "x.h"
+#include "connection.h"
+#include "stats.h"
+#include "events.h"
+#include "journal.h"
 #include "xwindow.h"
 #include "mouse.h"
 #include "keyboard.h"
@@ -41,6 +45,16 @@ VALUE XError;
 /*
 *Document-class: Imitator::X::XProtocolError
 *A Protocol Error as thrown by X. This class uses X's error messages. 
+*
+*X reports errors asynchronously, so they're collected per connection and raised 
+*by the method that sent the failing request as soon as it knows the outcome. Errors 
+*of requests nobody waits for (e.g. Mouse.move) are raised by Connection#sync. 
+*The attributes identify the failed request: 
+*[error_code] The X error code, e.g. 3 for BadWindow. 
+*[request_code] The major opcode of the failed request. 
+*[minor_code] The minor opcode (for requests of extensions). 
+*[serial] The sequence number of the failed request. 
+*[resource_id] The resource (e.g. window ID) the request referred to. 
 */
 
 /*
@@ -52,31 +66,437 @@ VALUE XError;
 /*
 *This function handles X server protocol errors. That allows us to throw Ruby 
 *exceptions instead of having X terminate the program and print it's 
-*own error message. 
+*own error message. It's installed once by Init_x() and stays installed. 
+*
+*Xlib calls this function while reading from the connection, possibly in a thread 
+*that doesn't hold the GVL, so we must neither raise nor longjmp here. The error 
+*is put into the connection's error queue instead, tagged with the sequence number 
+*of the failed request. Whoever sent that request raises it via imitator_check_x_errors() 
+*or imitator_sync(). 
 */
 int handle_x_errors(Display *p_display, XErrorEvent *x_errevt)
+{
+  imitator_x_error err;
+  
+  err.serial = x_errevt->serial;
+  err.error_code = x_errevt->error_code;
+  err.request_code = x_errevt->request_code;
+  err.minor_code = x_errevt->minor_code;
+  err.resource_id = x_errevt->resourceid;
+  imitator_record_x_error(p_display, &err);
+  return 0;
+}
+
+void imitator_check_x_errors(Display * p_display, unsigned long first_serial)
+{
+  imitator_x_error err;
+  
+  if (imitator_take_x_errors(p_display, first_serial, NextRequest(p_display), &err) > 0)
+    imitator_raise_x_error(p_display, &err);
+}
+
+VALUE imitator_x_error_new(Display * p_display, const imitator_x_error * p_err)
 {
   char msg[1000];
+  VALUE rerror;
+  
+  XGetErrorText(p_display, p_err->error_code, msg, 1000); /*This is OK, I get the error message from X*/
+  rerror = rb_exc_new2(ProtocolError, msg);
+  rb_iv_set(rerror, "@error_code", INT2FIX(p_err->error_code));
+  rb_iv_set(rerror, "@request_code", INT2FIX(p_err->request_code));
+  rb_iv_set(rerror, "@minor_code", INT2FIX(p_err->minor_code));
+  rb_iv_set(rerror, "@serial", ULONG2NUM(p_err->serial));
+  rb_iv_set(rerror, "@resource_id", ULONG2NUM(p_err->resource_id));
+  return rerror;
+}
+
+void imitator_raise_x_error(Display * p_display, const imitator_x_error * p_err)
+{
+  rb_exc_raise(imitator_x_error_new(p_display, p_err));
+}
+
+void imitator_without_gvl(Display * p_display, void * (*func)(void *), void * data)
+{
+  imitator_connection * p_conn = imitator_begin_call(p_display);
+  
+  /*RUBY_UBF_IO interrupts the poll() Xlib waits in; Xlib just retries then, 
+  *and Ruby handles the interrupt after the reply arrived. */
+  rb_thread_call_without_gvl(func, data, RUBY_UBF_IO, NULL);
+  if (!imitator_end_call(p_conn))
+    imitator_raise_closed();
+}
+
+void imitator_round_trip(Display * p_display, void * (*func)(void *), void * data)
+{
+  double start = imitator_stats_now();
+  
+  imitator_without_gvl(p_display, func, data);
+  imitator_stats_round_trip(p_display, 1, imitator_stats_now() - start);
+}
+
+/*
+*Raises a XError if the request +name+ sent since +first_serial+ failed (+status+ is 0). 
+*Call imitator_check_x_errors() before, so the XProtocolError is raised if X reported one. 
+*This is for the errors that got lost, e.g. because the queue overflowed. 
+*/
+static void check_status(Status status, unsigned long first_serial, const char * name)
+{
+  if (!status)
+    rb_raise(XError, "%s failed (request %lu)!", name, first_serial);
+}
+
+/***********************Blocking X requests***************************/
+/*Each of these consists of a struct holding the parameters, a function 
+*that calls Xlib with them (run without the GVL) and the function 
+*declared in x.h. */
+
+struct query_tree_args {
+  Display * p_display;
+  Window win;
+  Window * p_root;
+  Window * p_parent;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+  Status result;
+};
+
+static void * query_tree_without_gvl(void * ptr)
+{
+  struct query_tree_args * p_args = (struct query_tree_args *) ptr;
+  
+  p_args->result = XQueryTree(p_args->p_display, p_args->win, p_args->p_root, p_args->p_parent, p_args->pp_children, p_args->p_num_children);
+  return NULL;
+}
+
+Status imitator_query_tree(Display * p_display, Window win, Window * p_root, Window * p_parent, Window ** pp_children, unsigned int * p_num_children)
+{
+  struct query_tree_args args = {p_display, win, p_root, p_parent, pp_children, p_num_children, 0};
+  unsigned long serial = NextRequest(p_display);
+  
+  *pp_children = NULL; /*Xlib leaves it untouched on errors*/
+  imitator_round_trip(p_display, query_tree_without_gvl, &args);
+  if (args.result)
+    imitator_stats_bytes(4 * *p_num_children);
+  imitator_check_x_errors(p_display, serial);
+  check_status(args.result, serial, "XQueryTree");
+  return args.result;
+}
+
+struct get_window_attributes_args {
+  Display * p_display;
+  Window win;
+  XWindowAttributes * p_xattr;
+  Status result;
+};
+
+static void * get_window_attributes_without_gvl(void * ptr)
+{
+  struct get_window_attributes_args * p_args = (struct get_window_attributes_args *) ptr;
+  
+  p_args->result = XGetWindowAttributes(p_args->p_display, p_args->win, p_args->p_xattr);
+  return NULL;
+}
+
+Status imitator_get_window_attributes(Display * p_display, Window win, XWindowAttributes * p_xattr)
+{
+  struct get_window_attributes_args args = {p_display, win, p_xattr, 0};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, get_window_attributes_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  check_status(args.result, serial, "XGetWindowAttributes");
+  return args.result;
+}
+
+struct get_wm_name_args {
+  Display * p_display;
+  Window win;
+  XTextProperty * p_xtext;
+  Status result;
+};
+
+static void * get_wm_name_without_gvl(void * ptr)
+{
+  struct get_wm_name_args * p_args = (struct get_wm_name_args *) ptr;
+  
+  p_args->result = XGetWMName(p_args->p_display, p_args->win, p_args->p_xtext);
+  return NULL;
+}
+
+Status imitator_get_wm_name(Display * p_display, Window win, XTextProperty * p_xtext)
+{
+  struct get_wm_name_args args = {p_display, win, p_xtext, 0};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, get_wm_name_without_gvl, &args);
+  if (args.result)
+    imitator_stats_bytes(p_xtext->nitems * (p_xtext->format / 8));
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct get_window_property_args {
+  Display * p_display;
+  Window win;
+  Atom property;
+  long offset;
+  long length;
+  Bool delete;
+  Atom req_type;
+  Atom * p_actual_type;
+  int * p_actual_format;
+  unsigned long * p_nitems;
+  unsigned long * p_bytes_after;
+  unsigned char ** pp_prop;
+  int result;
+};
+
+static void * get_window_property_without_gvl(void * ptr)
+{
+  struct get_window_property_args * p_args = (struct get_window_property_args *) ptr;
+  
+  p_args->result = XGetWindowProperty(p_args->p_display, p_args->win, p_args->property, p_args->offset, p_args->length, p_args->delete, p_args->req_type, 
+                                      p_args->p_actual_type, p_args->p_actual_format, p_args->p_nitems, p_args->p_bytes_after, p_args->pp_prop);
+  return NULL;
+}
+
+int imitator_get_window_property(Display * p_display, Window win, Atom property, long offset, long length, Bool delete, Atom req_type, Atom * p_actual_type, int * p_actual_format, unsigned long * p_nitems, unsigned long * p_bytes_after, unsigned char ** pp_prop)
+{
+  struct get_window_property_args args = {p_display, win, property, offset, length, delete, req_type, p_actual_type, p_actual_format, p_nitems, p_bytes_after, pp_prop, 0};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, get_window_property_without_gvl, &args);
+  if (args.result == Success)
+    imitator_stats_bytes(*p_nitems * (*p_actual_format / 8));
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct get_input_focus_args {
+  Display * p_display;
+  Window * p_focus;
+  int * p_revert_to;
+};
+
+static void * get_input_focus_without_gvl(void * ptr)
+{
+  struct get_input_focus_args * p_args = (struct get_input_focus_args *) ptr;
+  
+  XGetInputFocus(p_args->p_display, p_args->p_focus, p_args->p_revert_to);
+  return NULL;
+}
+
+int imitator_get_input_focus(Display * p_display, Window * p_focus, int * p_revert_to)
+{
+  struct get_input_focus_args args = {p_display, p_focus, p_revert_to};
+  unsigned long serial = NextRequest(p_display);
   
-  XGetErrorText(p_display, x_errevt->error_code, msg, 1000);
-  XCloseDisplay(p_display); /*Ensure the X Server connection is closed*/
-  rb_raise(ProtocolError, msg); /*This is OK, I get the error message from X*/
+  imitator_round_trip(p_display, get_input_focus_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
   return 1;
 }
 
+struct query_pointer_args {
+  Display * p_display;
+  Window win;
+  Window * p_root;
+  Window * p_child;
+  int * p_root_x;
+  int * p_root_y;
+  int * p_win_x;
+  int * p_win_y;
+  unsigned int * p_mask;
+  Bool result;
+};
+
+static void * query_pointer_without_gvl(void * ptr)
+{
+  struct query_pointer_args * p_args = (struct query_pointer_args *) ptr;
+  
+  p_args->result = XQueryPointer(p_args->p_display, p_args->win, p_args->p_root, p_args->p_child, p_args->p_root_x, p_args->p_root_y, p_args->p_win_x, p_args->p_win_y, p_args->p_mask);
+  return NULL;
+}
+
+Bool imitator_query_pointer(Display * p_display, Window win, Window * p_root, Window * p_child, int * p_root_x, int * p_root_y, int * p_win_x, int * p_win_y, unsigned int * p_mask)
+{
+  struct query_pointer_args args = {p_display, win, p_root, p_child, p_root_x, p_root_y, p_win_x, p_win_y, p_mask, False};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, query_pointer_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct get_selection_owner_args {
+  Display * p_display;
+  Atom selection;
+  Window result;
+};
+
+static void * get_selection_owner_without_gvl(void * ptr)
+{
+  struct get_selection_owner_args * p_args = (struct get_selection_owner_args *) ptr;
+  
+  p_args->result = XGetSelectionOwner(p_args->p_display, p_args->selection);
+  return NULL;
+}
+
+Window imitator_get_selection_owner(Display * p_display, Atom selection)
+{
+  struct get_selection_owner_args args = {p_display, selection, None};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, get_selection_owner_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct intern_atom_args {
+  Display * p_display;
+  const char * name;
+  Bool only_if_exists;
+  Atom result;
+};
+
+static void * intern_atom_without_gvl(void * ptr)
+{
+  struct intern_atom_args * p_args = (struct intern_atom_args *) ptr;
+  
+  p_args->result = XInternAtom(p_args->p_display, p_args->name, p_args->only_if_exists);
+  return NULL;
+}
+
+Atom imitator_intern_atom(Display * p_display, const char * name, Bool only_if_exists)
+{
+  struct intern_atom_args args = {p_display, name, only_if_exists, None};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, intern_atom_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct get_atom_name_args {
+  Display * p_display;
+  Atom atom;
+  char * result;
+};
+
+static void * get_atom_name_without_gvl(void * ptr)
+{
+  struct get_atom_name_args * p_args = (struct get_atom_name_args *) ptr;
+  
+  p_args->result = XGetAtomName(p_args->p_display, p_args->atom);
+  return NULL;
+}
+
+char * imitator_get_atom_name(Display * p_display, Atom atom)
+{
+  struct get_atom_name_args args = {p_display, atom, NULL};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, get_atom_name_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  return args.result;
+}
+
+struct intern_atoms_args {
+  Display * p_display;
+  char ** names;
+  int count;
+  Bool only_if_exists;
+  Atom * p_atoms;
+  Status result;
+};
+
+static void * intern_atoms_without_gvl(void * ptr)
+{
+  struct intern_atoms_args * p_args = (struct intern_atoms_args *) ptr;
+  
+  p_args->result = XInternAtoms(p_args->p_display, p_args->names, p_args->count, p_args->only_if_exists, p_args->p_atoms);
+  return NULL;
+}
+
+Status imitator_intern_atoms(Display * p_display, char ** names, int count, Bool only_if_exists, Atom * p_atoms)
+{
+  struct intern_atoms_args args = {p_display, names, count, only_if_exists, p_atoms, 0};
+  unsigned long serial = NextRequest(p_display);
+  
+  imitator_round_trip(p_display, intern_atoms_without_gvl, &args);
+  imitator_check_x_errors(p_display, serial);
+  if (!only_if_exists) /*Otherwise 0 just means some atom doesn't exist*/
+    check_status(args.result, serial, "XInternAtoms");
+  return args.result;
+}
+
+static void * sync_without_gvl(void * ptr)
+{
+  XSync((Display *) ptr, False);
+  return NULL;
+}
+
+void imitator_sync(Display * p_display, unsigned long first_serial)
+{
+  imitator_round_trip(p_display, sync_without_gvl, p_display);
+  imitator_stats_sync(p_display);
+  imitator_check_x_errors(p_display, first_serial);
+}
+
+void imitator_flush(Display * p_display)
+{
+  XFlush(p_display);
+  imitator_stats_flush(p_display);
+}
+
+void imitator_if_event(Display * p_display, XEvent * p_xevt, Bool (*predicate)(Display *, XEvent *, XPointer), XPointer arg, unsigned long first_serial)
+{
+  struct timeval timeout;
+  imitator_connection * p_conn;
+  
+  /*XCheckIfEvent() doesn't block, it reads what's there and looks through the queue. 
+  *If nothing matched, wait until the X server sends something new. Ruby's fd waiting 
+  *releases the GVL and allows interrupts, e.g. Thread#kill. The timeout is needed since 
+  *another thread may read our event from the connection while we're waiting. */
+  while (!XCheckIfEvent(p_display, p_xevt, predicate, arg))
+  {
+    imitator_check_x_errors(p_display, first_serial);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    p_conn = imitator_begin_call(p_display);
+    rb_wait_for_single_fd(ConnectionNumber(p_display), RB_WAITFD_IN, &timeout);
+    if (!imitator_end_call(p_conn))
+      imitator_raise_closed();
+  }
+  imitator_check_x_errors(p_display, first_serial);
+}
+
 /************************Init-Function****************************/
 
 void Init_x(void)
 {
+  /*Must be the first Xlib call, the connections are used by many Ruby threads*/
+  XInitThreads();
+  
   Imitator = rb_define_module("Imitator");
   X = rb_define_module_under(Imitator, "X");
   ProtocolError = rb_define_class_under(X, "XProtocolError", rb_eStandardError);
   XError = rb_define_class_under(X, "XError", rb_eStandardError);
+  rb_define_attr(ProtocolError, "error_code", 1, 0);
+  rb_define_attr(ProtocolError, "request_code", 1, 0);
+  rb_define_attr(ProtocolError, "minor_code", 1, 0);
+  rb_define_attr(ProtocolError, "serial", 1, 0);
+  rb_define_attr(ProtocolError, "resource_id", 1, 0);
   
   /*The version of this library. */
   rb_define_const(X, "VERSION", rb_str_new2("0.0.1"));
   
+  /*Let Ruby handle X's protocol errors*/
+  XSetErrorHandler(handle_x_errors);
+  
   /*Load the parts of Imitator for X*/
+  Init_stats();
+  Init_connection();
+  Init_journal();
   Init_xwindow();
   Init_mouse();
   Init_keyboard();
@@ -25,15 +25,83 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
+#include <X11/Xproto.h>
 #include <X11/extensions/XTest.h>
 #include "ruby.h"
 #include "ruby/encoding.h"
+#include "ruby/re.h"
+#include "ruby/io.h"
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+
+/*Ruby 1.9 doesn't have these two, but has equivalents*/
+#ifndef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#define rb_thread_call_without_gvl(func, data, ubf, data2) (void *) rb_thread_blocking_region((rb_blocking_function_t *) (func), (data), (ubf), (data2))
+#endif
+#ifndef HAVE_RB_WAIT_FOR_SINGLE_FD
+#define RB_WAITFD_IN 1
+#define rb_wait_for_single_fd(fd, events, tv) rb_thread_wait_fd(fd)
+#endif
 
 #ifndef IMITATOR_X_HEADER
 #define IMITATOR_X_HEADER
 
+/*An X protocol error, as recorded by handle_x_errors()*/
+typedef struct {
+  /*Sequence number of the request that failed*/
+  unsigned long serial;
+  unsigned char error_code;
+  unsigned char request_code;
+  unsigned char minor_code;
+  XID resource_id;
+} imitator_x_error;
+
 /*Maps XProtocolErrors to Ruby errors*/
 int handle_x_errors(Display *p_display, XErrorEvent *x_errevt);
+/*
+*Raises the first error caused by a request sent over +p_display+ since +first_serial+, 
+*which should be NextRequest(p_display) from before the requests were sent. 
+*Only errors the X server already reported are found, so call this after a round-trip. 
+*/
+void imitator_check_x_errors(Display * p_display, unsigned long first_serial);
+/*Returns +p_err+ as a XProtocolError, without raising it*/
+VALUE imitator_x_error_new(Display * p_display, const imitator_x_error * p_err);
+/*Raises +p_err+ as a XProtocolError*/
+void imitator_raise_x_error(Display * p_display, const imitator_x_error * p_err);
+/*Calls +func+ with +data+ while the GVL is released. +func+ may use +p_display+, 
+*which isn't closed meanwhile. Raises a XError if Connection#close ran while waiting. */
+void imitator_without_gvl(Display * p_display, void * (*func)(void *), void * data);
+/*Like imitator_without_gvl(), for a +func+ that makes one round-trip to the X server 
+*over +p_display+. Counts it in Imitator::X.stats. */
+void imitator_round_trip(Display * p_display, void * (*func)(void *), void * data);
+
+/*
+*Replacements for the Xlib functions that wait for the X server. They take the same 
+*parameters as the Xlib function of the same name, but release the GVL while 
+*waiting, so other Ruby threads keep running. Afterwards they raise the 
+*XProtocolError the request caused, if any. If a request whose failure Xlib 
+*reports as a Status of 0 failed without an error being recorded (e.g. XQueryTree() 
+*or XGetWindowAttributes()), they raise a XError, so the results are never garbage. 
+*/
+Status imitator_query_tree(Display * p_display, Window win, Window * p_root, Window * p_parent, Window ** pp_children, unsigned int * p_num_children);
+Status imitator_get_window_attributes(Display * p_display, Window win, XWindowAttributes * p_xattr);
+Status imitator_get_wm_name(Display * p_display, Window win, XTextProperty * p_xtext);
+int imitator_get_window_property(Display * p_display, Window win, Atom property, long offset, long length, Bool delete, Atom req_type, Atom * p_actual_type, int * p_actual_format, unsigned long * p_nitems, unsigned long * p_bytes_after, unsigned char ** pp_prop);
+int imitator_get_input_focus(Display * p_display, Window * p_focus, int * p_revert_to);
+Bool imitator_query_pointer(Display * p_display, Window win, Window * p_root, Window * p_child, int * p_root_x, int * p_root_y, int * p_win_x, int * p_win_y, unsigned int * p_mask);
+Window imitator_get_selection_owner(Display * p_display, Atom selection);
+Atom imitator_intern_atom(Display * p_display, const char * name, Bool only_if_exists);
+Status imitator_intern_atoms(Display * p_display, char ** names, int count, Bool only_if_exists, Atom * p_atoms);
+char * imitator_get_atom_name(Display * p_display, Atom atom);
+/*Like XSync(), but raises the first error caused by the requests since +first_serial+. 
+*Pass 0 to raise any pending error. */
+void imitator_sync(Display * p_display, unsigned long first_serial);
+/*Like XFlush(), but counts it in Imitator::X.stats*/
+void imitator_flush(Display * p_display);
+/*Like XIfEvent(), but waits for the X server without holding the GVL and can be interrupted. 
+*Raises errors caused by the requests since +first_serial+ while waiting. */
+void imitator_if_event(Display * p_display, XEvent * p_xevt, Bool (*predicate)(Display *, XEvent *, XPointer), XPointer arg, unsigned long first_serial);
 /*Main initialization function*/
 void Init_x(void);
 /*Imitator module*/
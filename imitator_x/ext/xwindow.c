@@ -18,6 +18,14 @@ You should have received a copy of the GNU Lesser General Public License
 along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *********************************************************************************/
 #include "x.h"
+#include "connection.h"
+#include "pipeline.h"
+#include "events.h"
+#include "cache.h"
+#include "ewmh.h"
+#include "batch.h"
+#include "subscriptions.h"
+#include "stats.h"
 #include "xwindow.h"
 #include "keyboard.h"
 
@@ -36,109 +44,318 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 *Every method in this class will raise XProtocolErrors if you try to operate on non-existant windows, e.g. trying to 
 *retrieve a killed window's position. 
 *
-*All methods of this class that return strings return them encoded in UTF-8. However, it's assumed that your 
-*X Server's locale is ISO-8859-1 (that's Latin-1), since I couldn't figure out how to query X for that information. 
-*Change the value of XSTR_TO_RSTR (in xwindow.h) to your X Server's locale, than recompile this library if 
-*it's incorrect. If you know how to obtain X's locale, please tell me at sutniuq$gmx:net. A patch would be nice, too. 
+*All methods of this class that return strings return them encoded in UTF-8. Window titles are taken from 
+*the EWMH property _NET_WM_NAME, which is UTF-8. Only if a window doesn't set it, the old WM_NAME property 
+*is used, whose text is assumed to be ISO-8859-1 (that's Latin-1) unless it's marked as UTF-8. 
+*
+*Wherever a method takes a +display+ number, you may pass an Imitator::X::Connection 
+*instead; the +screen+ argument is ignored then. Every XWindow keeps the connection it 
+*was created with, so calling its methods doesn't connect to the X server again. 
 *
 *The methods covering EWMH standard may be not available on every system. If such a method is called on a 
 *system that doesn't support that part of EWMH or doesn't support EWMH at all, a NotImplementedError is raised. 
 *The corresponding EWMH standard of a method is mentioned in it's _Remarks_ section. 
 */
 
+/*ObjectSpace::WeakMap, if it takes window IDs as keys (Ruby 2.7 and later). nil otherwise. */
+static VALUE weak_map_class = Qnil;
+
 /*******************Helper functions**************************/
 
+static void xwindow_mark(void * ptr)
+{
+  rb_gc_mark(((imitator_xwindow *) ptr)->rconn);
+}
+
+static size_t xwindow_memsize(const void * ptr)
+{
+  return sizeof(imitator_xwindow);
+}
+
+static const rb_data_type_t xwindow_type = {
+  "Imitator::X::XWindow",
+  {xwindow_mark, RUBY_DEFAULT_FREE, xwindow_memsize,},
+};
+
 /*
 *This function retrieves the display of the calling 
-*window. It's just shorthand for the two lines included in it. 
+*window from the connection it was created with. 
 */
 static Display * get_win_display(VALUE self)
 {
-  Display * p_display;
-  VALUE rstr;
+  return imitator_connection_display(imitator_get_xwindow(self)->p_conn);
+}
+
+/*
+*Sets up the native part of +self+. Doesn't touch the window map. 
+*/
+static void set_window(VALUE self, VALUE rconn, Window win)
+{
+  imitator_xwindow * p_xwin;
+  
+  TypedData_Get_Struct(self, imitator_xwindow, &xwindow_type, p_xwin);
+  p_xwin->p_conn = imitator_get_connection(rconn);
+  imitator_connection_display(p_xwin->p_conn); /*Don't accept closed connections*/
+  p_xwin->win = win;
+  p_xwin->rconn = rconn;
+}
+
+/*
+*Returns the window map of +rconn+, creating it if needed. nil without a usable ObjectSpace::WeakMap. 
+*/
+static VALUE get_window_map(VALUE rconn)
+{
+  imitator_connection * p_conn = imitator_get_connection(rconn);
+  
+  if (NIL_P(weak_map_class))
+    return Qnil;
+  if (!p_conn->window_map)
+    p_conn->window_map = rb_class_new_instance(0, NULL, weak_map_class);
+  return p_conn->window_map;
+}
+
+/*
+*Used by Init_xwindow() to check if ObjectSpace::WeakMap exists and takes integer keys. 
+*/
+static VALUE probe_weak_map(VALUE arg)
+{
+  VALUE klass = rb_path2class("ObjectSpace::WeakMap");
+  
+  rb_funcall(rb_class_new_instance(0, NULL, klass), rb_intern("[]="), 2, LONG2NUM(1), rb_obj_alloc(rb_cObject));
+  return klass;
+}
+
+/*
+*Tells the window cache of +p_display+'s connection (if any) that +win+'s 
+*geometry will change, so it's queried again instead of waiting for the event. 
+*/
+static void forget_geometry(Display * p_display, Window win)
+{
+  imitator_connection * p_conn = imitator_connection_of(p_display);
+  
+  if (p_conn != NULL && p_conn->p_window_cache != NULL)
+    imitator_cache_forget_geometry(p_conn->p_window_cache, win);
+}
+
+/*
+*Returns the shared connection for the +screen+ and +display+ arguments 
+*most methods take. Both default to 0. If +display+ is a Connection, it's 
+*returned and +screen+ is ignored. 
+*/
+static VALUE get_connection(VALUE screen, VALUE display)
+{
+  char display_string[100];
   
-  rstr = rb_ivar_get(self, rb_intern("@display_string"));
-  p_display =  XOpenDisplay(StringValuePtr(rstr));
-  return p_display;
+  if (rb_obj_is_kind_of(display, Connection))
+    return display;
+  /*Assign the display or default to 0*/
+  if (NIL_P(display))
+    display = INT2FIX(0);
+  /*Assign the screen or default to 0*/
+  if (NIL_P(screen))
+    screen = INT2FIX(0);
+  /*Get the display string, form ":display.screen"*/
+  sprintf(display_string, ":%i.%i", NUM2INT(display), NUM2INT(screen));
+  return imitator_connection_for(rb_str_new2(display_string));
 }
 
 /*
 *This function checks whather the specified EWMH standard is supported 
 *by the system's window manager. If not, it raises a NotImplementedError 
-*exception. 
+*exception. +ewmh+ is one of the IMITATOR_ATOM_NET_* constants. 
 */
-static void check_for_ewmh(Display * p_display, const char * ewmh)
+static void check_for_ewmh(Display * p_display, int ewmh)
 {
-  Window root = XRootWindow(p_display, 0);
-  Atom atom, actual_type, support_atom;
-  int actual_format;
-  unsigned long nitems, bytes;
-  unsigned char * props;
-  Atom * props2;
-  int ret, i, result = 0;
-  /*We don't use actual_type, actual_format and bytes. */
-  
-  /*To check wheather any EWMH is supported*/
-  atom = XInternAtom(p_display, "_NET_SUPPORTED", False);
-  /*To check if the specified EWMH is supported*/
-  support_atom = XInternAtom(p_display, ewmh, False);
-  
-  /*GetWindowProperty(_NET_SUPPORTED) gives us an array of supported EWMH standards 
-  *or fails if no EWMH is supported. 
-  *Many great thanks to Jordan Sissel whose xdotool code 
-  *showed me how this function works. */
-  ret = XGetWindowProperty(p_display, root, atom, 0, (~0L), False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &props);
-  if (ret != Success)
-  {
-    XSetErrorHandler(NULL); /*Ensure the connection...*/
-    XCloseDisplay(p_display); /*...is properly closed. */
+  /*The connection keeps _NET_SUPPORTED until the window manager changes it*/
+  if (imitator_ewmh_supports(p_display, ewmh))
+    return;
+  if (!imitator_ewmh_present(p_display))
     rb_raise(rb_eNotImpError, "EWMH is not supported by this window manager!");
-  }
+  rb_raise(rb_eNotImpError, "EWMH '%s' is not supported by this window manager!", imitator_atom_name(ewmh));
+}
+
+/*
+*How #move and #resize wait for their change. 
+*/
+enum configure_mode {
+  /*Ask X for the new geometry afterwards*/
+  CONFIGURE_QUERY,
+  /*Just send the request*/
+  CONFIGURE_ASYNC,
+  /*Wait for the ConfigureNotify*/
+  CONFIGURE_CONFIRM
+};
+
+/*
+*Converts the +mode+ argument of #move and #resize (nil, :query, :async or :confirm). 
+*/
+static int get_configure_mode(VALUE rmode)
+{
+  ID id;
   
-  /*Cast props to an Atom array, otherwise we get BadAtom errors. */
-  props2 = (Atom *) props;
-  for(i = 0L; ((i < nitems) && (result == 0)); i++)
+  if (NIL_P(rmode))
+    return CONFIGURE_QUERY;
+  if (SYMBOL_P(rmode))
   {
-    if(props2[i] == support_atom)
-      result = 1; /*Found the atom.*/
+    id = SYM2ID(rmode);
+    if (id == rb_intern("query"))
+      return CONFIGURE_QUERY;
+    if (id == rb_intern("async"))
+      return CONFIGURE_ASYNC;
+    if (id == rb_intern("confirm"))
+      return CONFIGURE_CONFIRM;
   }
-  XFree(props);
+  rb_raise(rb_eArgError, "Unknown mode %s!", RSTRING_PTR(rb_inspect(rmode)));
+  return CONFIGURE_QUERY; /*Never reached*/
+}
+
+/*
+*Arguments for send_and_confirm(). 
+*/
+struct confirm_args {
+  Display * p_display;
+  Window win;
+  unsigned int value_mask;
+  XWindowChanges * p_changes;
+  double timeout;
+  /*True if we asked X for the window's events ourselves*/
+  Bool selected;
+  /*The ConfigureNotify, if it came*/
+  imitator_event evt;
+  Bool confirmed;
+};
+
+/*
+*Sends the configure request and waits for the ConfigureNotify about it. 
+*/
+static VALUE send_and_confirm(VALUE arg)
+{
+  struct confirm_args * p_args = (struct confirm_args *) arg;
+  imitator_connection * p_conn = imitator_connection_of(p_args->p_display);
+  unsigned long serial = NextRequest(p_args->p_display);
   
-  if (result == 0)
+  /*A window the cache tracks already sends us its ConfigureNotify events*/
+  if (p_conn == NULL || p_conn->p_window_cache == NULL || !imitator_cache_tracks(p_conn->p_window_cache, p_args->win))
   {
-    XSetErrorHandler(NULL);
-    XCloseDisplay(p_display);
-    rb_raise(rb_eNotImpError, "EWMH '%s' is not supported by this window manager!", ewmh);
+    XSelectInput(p_args->p_display, p_args->win, imitator_idle_event_mask(p_args->p_display, p_args->win) | StructureNotifyMask);
+    imitator_ignore_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display)); /*XConfigureWindow() reports a BadWindow*/
+    p_args->selected = True;
+    serial = NextRequest(p_args->p_display);
   }
+  XConfigureWindow(p_args->p_display, p_args->win, p_args->value_mask, p_args->p_changes);
+  imitator_flush(p_args->p_display);
+  p_args->confirmed = imitator_wait_for_configure(p_args->p_display, p_args->win, serial, p_args->timeout, &p_args->evt);
+  return Qnil;
 }
 
-/*************************Class methods***********************************/
+/*
+*Stops the events send_and_confirm() asked for. Events that arrive 
+*afterwards are dropped by imitator_process_events(). 
+*/
+static VALUE restore_event_mask(VALUE arg)
+{
+  struct confirm_args * p_args = (struct confirm_args *) arg;
+  imitator_connection * p_conn = imitator_connection_of(p_args->p_display);
+  unsigned long serial = NextRequest(p_args->p_display);
+  
+  if (!p_args->selected)
+    return Qnil;
+  if (p_conn != NULL && p_conn->p_window_cache != NULL && imitator_cache_tracks(p_conn->p_window_cache, p_args->win))
+    return Qnil; /*The cache took over meanwhile*/
+  XSelectInput(p_args->p_display, p_args->win, imitator_idle_event_mask(p_args->p_display, p_args->win));
+  imitator_ignore_x_errors(p_args->p_display, serial, NextRequest(p_args->p_display));
+  imitator_flush(p_args->p_display);
+  return Qnil;
+}
 
 /*
-*call-seq: 
-*  XWindow.xquery(display_string, window_id) ==> true
-*
-*<b>Don't call this method, it's used internally. </b>
-*
-*Raises a XProtocolError if the specified window doesn't exist on the specified +display_string+. 
+*Sends #move's or #resize's XConfigureWindow request for +value_mask+ and +p_changes+ 
+*to +self+, as +rmode+ says. Returns CONFIGURE_ASYNC if there's nothing to return (in 
+*XWindow.batch, too), CONFIGURE_QUERY if the caller has to ask X for the new geometry and 
+*CONFIGURE_CONFIRM if +p_changes+ holds the geometry from the ConfigureNotify. 
+*For CONFIGURE_QUERY, the caller must raise the errors of the requests since +p_serial+ 
+*after the query (see query_configured()). 
 */
-static VALUE cm_xquery(VALUE self, VALUE display_string, VALUE window_id)
+static int configure_window(VALUE self, unsigned int value_mask, XWindowChanges * p_changes, VALUE rmode, VALUE rtimeout, unsigned long * p_serial)
 {
-  Display * p_display = XOpenDisplay(StringValuePtr(display_string));
-  Window win = (Window)NUM2LONG(window_id);
-  Window dummy, dummy2, *children = NULL;
-  unsigned int child_num;
+  struct confirm_args args;
+  int mode = get_configure_mode(rmode);
+  imitator_batch * p_batch;
+  
+  memset(&args, 0, sizeof(struct confirm_args));
+  args.p_display = get_win_display(self);
+  args.win = GET_WINDOW;
+  args.value_mask = value_mask;
+  args.p_changes = p_changes;
+  args.timeout = NIL_P(rtimeout) ? 1 : NUM2DBL(rtimeout);
+  
+  if ((p_batch = imitator_current_batch(args.p_display)) != NULL)
+  {
+    imitator_batch_configure(p_batch, args.win, value_mask, p_changes);
+    return CONFIGURE_ASYNC;
+  }
+  forget_geometry(args.p_display, args.win);
+  *p_serial = NextRequest(args.p_display);
+  if (mode != CONFIGURE_CONFIRM)
+  {
+    XConfigureWindow(args.p_display, args.win, value_mask, p_changes);
+    if (mode == CONFIGURE_ASYNC)
+      imitator_flush(args.p_display); /*Errors wait for the next Connection#sync*/
+    return mode;
+  }
   
-  XSetErrorHandler(handle_x_errors); /*Let Ruby handle the errors*/
-  XQueryTree(p_display, win, &dummy, &dummy2, &children, &child_num);
+  rb_ensure(send_and_confirm, (VALUE) &args, restore_event_mask, (VALUE) &args);
+  if (!args.confirmed) /*The window manager refused or the window didn't change*/
+    return CONFIGURE_QUERY;
+  p_changes->x = args.evt.x;
+  p_changes->y = args.evt.y;
+  p_changes->width = args.evt.width;
+  p_changes->height = args.evt.height;
+  return CONFIGURE_CONFIRM;
+}
+
+/*
+*Returns +query+(+self+) (#position or #size) after a configure_window() that returned 
+*CONFIGURE_QUERY, and raises the error the ConfigureWindow request sent since +serial+ caused. 
+*The query is a round-trip, so X has processed the request when it returns. 
+*/
+static VALUE query_configured(VALUE self, VALUE (*query)(VALUE), unsigned long serial)
+{
+  VALUE result = query(self);
   
-  XSetErrorHandler(NULL); /*Let X handle the errors again*/
+  imitator_check_x_errors(get_win_display(self), serial);
+  return result;
+}
+
+/*************************Interface***********************************/
+
+imitator_xwindow * imitator_get_xwindow(VALUE rxwin)
+{
+  imitator_xwindow * p_xwin;
   
-  XFree(children);
-  XCloseDisplay(p_display);
-  return Qtrue;
+  TypedData_Get_Struct(rxwin, imitator_xwindow, &xwindow_type, p_xwin);
+  if (p_xwin->p_conn == NULL)
+    rb_raise(rb_eTypeError, "Uninitialized XWindow!");
+  return p_xwin;
+}
+
+VALUE imitator_xwindow_for(VALUE rconn, Window win)
+{
+  VALUE rmap = get_window_map(rconn);
+  VALUE rid = LONG2NUM(win);
+  VALUE rxwin;
+  
+  if (!NIL_P(rmap) && !NIL_P(rxwin = rb_funcall(rmap, rb_intern("[]"), 1, rid)))
+    return rxwin;
+  rxwin = rb_obj_alloc(XWindow);
+  set_window(rxwin, rconn, win);
+  if (!NIL_P(rmap))
+    rb_funcall(rmap, rb_intern("[]="), 2, rid, rxwin);
+  return rxwin;
 }
 
+/*************************Class methods***********************************/
+
 /*
 *call-seq: 
 *  XWindow.default_root_window() ==> aXWindow
@@ -151,15 +368,40 @@ static VALUE cm_xquery(VALUE self, VALUE display_string, VALUE window_id)
 */
 static VALUE cm_default_root_window(VALUE self)
 {
-  Display * p_display = XOpenDisplay(NULL);
-  Window root_win;
-  VALUE args[1];
+  VALUE rconn = imitator_default_connection();
+  
+  return imitator_xwindow_for(rconn, XDefaultRootWindow(imitator_get_display(rconn)));
+}
+
+/*
+*call-seq: 
+*  XWindow.ewmh_supported?(name, screen = 0, display = 0) ==> true or false
+*
+*Checks wheather the window manager supports a part of the EWMH standard. 
+*===Parameters
+*[+name+] The name of the atom to look for, e.g. "_NET_ACTIVE_WINDOW". 
+*[+screen+] (0) The screen whose window manager to ask. 
+*[+display+] (0) The display to look for the screen. 
+*===Return value
+*true or false. Also false if the window manager doesn't support EWMH at all. 
+*===Example
+*  Imitator::X::XWindow.ewmh_supported?("_NET_ACTIVE_WINDOW") #=> true
+*  Imitator::X::XWindow.ewmh_supported?("_NET_NONEXISTANT") #=> false
+*===Remarks
+*The window manager's _NET_SUPPORTED list is read once per connection and 
+*kept until the window manager changes it, so asking again costs nothing. 
+*/
+static VALUE cm_ewmh_supported(int argc, VALUE argv[], VALUE self)
+{
+  VALUE name, screen, display;
+  Display * p_display;
   
-  root_win = XDefaultRootWindow(p_display);
-  args[0] = LONG2NUM(root_win);
+  rb_scan_args(argc, argv, "12", &name, &screen, &display);
+  if (SYMBOL_P(name))
+    name = rb_id2str(SYM2ID(name));
+  p_display = imitator_get_display(get_connection(screen, display));
   
-  XCloseDisplay(p_display);
-  return rb_class_new_instance(1, args, XWindow);
+  return imitator_ewmh_supported_name(p_display, StringValueCStr(name)) ? Qtrue : Qfalse;
 }
 
 /*
@@ -178,365 +420,1590 @@ static VALUE cm_default_root_window(VALUE self)
 *  puts Imitator::X::XWindow.exists?(root_win.window_id) #=> true
 *  puts Imitator::X::XWindow.exists?(12345) #=> false
 *===Remarks
-*This method rescues a XProtocolError exception you'll see when running 
-*under $DEBUG and get a +false+ result. 
+*The X error for a nonexistent window is taken out of the connection's error 
+*queue, no XProtocolError is raised (not even under $DEBUG). 
 */
 static VALUE cm_exists(int argc, VALUE argv[], VALUE self)
 {
   VALUE window_id;
   VALUE screen;
   VALUE display;
-  VALUE result;
-  char display_string[100];
-  char eval_str[1000];
+  Display * p_display;
   
   rb_scan_args(argc, argv, "12", &window_id, &screen, &display);
+  p_display = imitator_get_display(get_connection(screen, display));
   
-  /*Assign the display or default to 0*/
-  if (NIL_P(display))
-    display = INT2FIX(0);
-  /*Assign the screen or default to 0*/
-  if (NIL_P(screen))
-    screen = INT2FIX(0);
-  
-  /*Get the display string, form ":display.screen"*/
-  sprintf(display_string, ":%i.%i", FIX2INT(display), FIX2INT(screen));
-  /*
-  *eval is awful. rb_rescue too. I evaluate this string due to rb_rescue's inusability. 
-  *This eval is quite safe, because before I put the two parts together in display_string, I convert 
-  *screen and display into integers. 
-  */
-  sprintf(eval_str, "begin; Imitator::X::XWindow.xquery('%s', %i);true;rescue Imitator::X::XProtocolError;false;end", display_string, NUM2INT(window_id));
-  result = rb_eval_string(eval_str);
-  
+  if (imitator_cached_exists(p_display, (Window) NUM2LONG(window_id)))
+    return Qtrue;
+  return Qfalse;
+}
+
+/*
+*call-seq: 
+*  XWindow.exists_many?(window_ids, screen = 0, display = 0) ==> anArray
+*
+*Checks many window IDs at once. 
+*===Parameters
+*[+window_ids+] An array of window IDs to check. 
+*[+screen+] (0) The screen to check. 
+*[+display+] (0) The display to check. 
+*===Return value
+*An array of true or false values, one for each window ID. 
+*===Example
+*  root_win = Imitator::X::XWindow.default_root_window
+*  Imitator::X::XWindow.exists_many?([root_win.window_id, 12345]) #=> [true, false]
+*===Remarks
+*The requests for all windows are sent together, so with XCB support 
+*this costs about one round-trip to the X server. 
+*/
+static VALUE cm_exists_many(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rids, screen, display;
+  VALUE result;
+  Display * p_display;
+  Window * p_wins;
+  Bool * p_exist;
+  long i, count;
+  
+  rb_scan_args(argc, argv, "12", &rids, &screen, &display);
+  Check_Type(rids, T_ARRAY);
+  if (RARRAY_LEN(rids) < 0 || (unsigned long) RARRAY_LEN(rids) > UINT_MAX)
+    rb_raise(rb_eArgError, "Too many windows!");
+  p_display = imitator_get_display(get_connection(screen, display));
+  
+  count = RARRAY_LEN(rids);
+  for(i = 0; i < count; i++)
+    NUM2LONG(rb_ary_entry(rids, i)); /*Raise a TypeError now and not while we hold the buffers*/
+  p_wins = ALLOC_N(Window, count);
+  for(i = 0; i < count; i++)
+    p_wins[i] = (Window) NUM2LONG(rb_ary_entry(rids, i));
+  p_exist = ALLOC_N(Bool, count);
+  imitator_cached_windows_exist(p_display, p_wins, (unsigned int) count, p_exist);
+  
+  result = rb_ary_new2(count);
+  for(i = 0; i < count; i++)
+    rb_ary_push(result, p_exist[i] ? Qtrue : Qfalse);
+  
+  xfree(p_exist);
+  xfree(p_wins);
   return result;
 }
 
 /*
 *call-seq: 
-*  XWindow.search(str , screen = 0 , display = 0) ==> anArray
-*  XWindow.search(regexp , screen = 0 , display = 0 ) ==> anArray
+*  XWindow.attributes_for(windows, screen = 0, display = 0) ==> anArray
 *
-*Searches for a special window title. 
+*Gets the geometry and state of many windows at once. 
 *===Parameters
-*[+str+] The title to look for. This will only match *exactly*. 
-*[+regexp+] The title to look for, as a Regular Expression to match. 
-*[+screen+] (0) The screen to look for the window. 
-*[+display+] (0) The display to look for the screen. 
+*[+windows+] An array of XWindow objects or window IDs. 
+*[+screen+] (0) The screen the windows reside on. 
+*[+display+] (0) The screen's display. If you omit both +screen+ and +display+ and 
+*the first element of +windows+ is a XWindow, its connection is used. 
 *===Return value
-*An array containing the window IDs of all windows whose titles matched the string 
-*or Regular Expression. This may be empty if nothing matches. 
+*An array of XWindow::Attributes structs, one for each window, or +nil+ 
+*for windows that don't exist. The members are: 
+*[window_id] The window's ID. 
+*[x, y] The position, relative to the parent window. 
+*[width, height, border_width] The size, in pixels. 
+*[map_state] :unmapped, :unviewable (mapped, but an ancestor isn't) or :viewable. 
+*[window_class] :input_output or :input_only. 
+*[root] The ID of the window's root window. 
 *===Example
-*  #Search for a window whose name is exactly "x-nautilus-desktop"
-*  Imitator::X::XWindow.search("x-nautilus-desktop") #=> [33554464]
-*  #Search for a window whose name contains the string "imitator". 
-*  Imitator::X::XWindow.search(/imitator/) #=> [...]
-*  #If a window isn't found, you get an empty array. 
-*  Imitator::X::XWindow.search("nonexistant") #=> []
+*  root = Imitator::X::XWindow.default_root_window
+*  attrs = Imitator::X::XWindow.attributes_for(root.children)
+*  attrs.compact.select{|a| a.map_state == :viewable}.map(&:window_id) #=> [...]
 *===Remarks
-*This method just searches the first children layer, i.e. the child windows of the root window. 
-*You can't find windows in windows with this method. 
+*One reply contains what #position, #size, #visible?, #mapped? and #root_win 
+*would ask for one by one. With XCB support, the requests for all windows 
+*are sent together, which costs about one round-trip to the X server. 
 */
-static VALUE cm_search(int argc, VALUE argv[], VALUE self) /*title as string or regexp*/
+static VALUE cm_attributes_for(int argc, VALUE argv[], VALUE self)
 {
-  VALUE title, screen, display;
-  char display_string[100];
+  VALUE rwindows, screen, display;
+  VALUE rconn, rwin, result, map_state;
   Display * p_display;
-  Window root_win, parent_win, temp_win;
-  Window * p_children;
-  unsigned int num_children;
-  XTextProperty xtext;
-  char * p_title;
-  int i;
-  short is_regexp;
-  VALUE result = rb_ary_new();
-  
-  rb_scan_args(argc, argv, "12", &title, &screen, &display);
-  /*Check wheather we're operating on a Regular Expression or a String. Strings mean exact matching later on. */
-  if (TYPE(title) == T_REGEXP)
-    is_regexp = 1;
+  Window * p_wins;
+  XWindowAttributes * p_attrs;
+  Bool * p_exist;
+  unsigned long i, count;
+  
+  rb_scan_args(argc, argv, "12", &rwindows, &screen, &display);
+  Check_Type(rwindows, T_ARRAY);
+  if (RARRAY_LEN(rwindows) < 0 || (unsigned long) RARRAY_LEN(rwindows) > UINT_MAX)
+    rb_raise(rb_eArgError, "Too many windows!");
+  count = (unsigned long) RARRAY_LEN(rwindows);
+  if (argc == 1 && count > 0 && rb_obj_is_kind_of(rb_ary_entry(rwindows, 0), XWindow))
+    rconn = imitator_get_xwindow(rb_ary_entry(rwindows, 0))->rconn;
   else
-    is_regexp = 0;
-  /*Assign the display or default to 0*/
-  if (NIL_P(display))
-    display = INT2FIX(0);
-  /*Assign the screen or default to 0*/
-  if (NIL_P(screen))
-    screen = INT2FIX(0);
-  /*Get the display string, form ":display.screen"*/
-  sprintf(display_string, ":%i.%i", FIX2INT(display), FIX2INT(screen));
+    rconn = get_connection(screen, display);
+  p_display = imitator_get_display(rconn);
   
-  p_display = XOpenDisplay(display_string);
-  XSetErrorHandler(handle_x_errors); /*Let Ruby handle the errors*/
-  root_win = XDefaultRootWindow(p_display);
+  /*Raise a TypeError now and not while we hold the buffers*/
+  rwindows = rb_ary_dup(rwindows);
+  for(i = 0; i < count; i++)
+  {
+    rwin = rb_ary_entry(rwindows, (long) i);
+    if (rb_obj_is_kind_of(rwin, XWindow))
+      rwin = LONG2NUM(imitator_get_xwindow(rwin)->win);
+    NUM2LONG(rwin);
+    rb_ary_store(rwindows, (long) i, rwin);
+  }
+  p_wins = ALLOC_N(Window, count);
+  for(i = 0; i < count; i++)
+    p_wins[i] = (Window) NUM2LONG(rb_ary_entry(rwindows, (long) i));
+  p_attrs = ALLOC_N(XWindowAttributes, count);
+  p_exist = ALLOC_N(Bool, count);
   
-  XQueryTree(p_display, root_win, &root_win, &parent_win, &p_children, &num_children);
+  imitator_get_attributes(p_display, p_wins, (unsigned int) count, p_attrs, p_exist);
   
-  if (p_children != NULL) /*This means there are child windows*/
+  result = rb_ary_new2(count);
+  for(i = 0; i < count; i++)
   {
-    for(i = 0; i < num_children; i++)
+    if (!p_exist[i])
     {
-      temp_win = *(p_children + i);
-      XGetWMName(p_display, temp_win, &xtext); /*We want to match against the title later*/
-      p_title = (char *) malloc(sizeof(char) * (xtext.nitems + 1)); /*Allocate one char more than neccassary, because we get an "invalid pointer" otherwise*/
-      sprintf(p_title, "%s", xtext.value);
-      
-      if (is_regexp)
-      {
-        if (!NIL_P(rb_reg_match(title, XSTR_TO_RSTR(p_title)))) /*This performs the regexp match*/
-          rb_ary_push(result, LONG2NUM(temp_win)); 
-      }
-      else /*Not using a regular expression*/
-      {
-        if (strcmp(StringValuePtr(title), p_title) == 0)
-          rb_ary_push(result, LONG2NUM(temp_win));
-      }
-      XFree(xtext.value);
-      free(p_title);
+      rb_ary_push(result, Qnil);
+      continue;
     }
-    XFree(p_children);
+    if (p_attrs[i].map_state == IsViewable)
+      map_state = ID2SYM(rb_intern("viewable"));
+    else if (p_attrs[i].map_state == IsUnviewable)
+      map_state = ID2SYM(rb_intern("unviewable"));
+    else
+      map_state = ID2SYM(rb_intern("unmapped"));
+    rb_ary_push(result, rb_struct_new(WindowAttributes, 
+      LONG2NUM(p_wins[i]), 
+      INT2NUM(p_attrs[i].x), 
+      INT2NUM(p_attrs[i].y), 
+      INT2NUM(p_attrs[i].width), 
+      INT2NUM(p_attrs[i].height), 
+      INT2NUM(p_attrs[i].border_width), 
+      map_state, 
+      ID2SYM(rb_intern(p_attrs[i].class == InputOnly ? "input_only" : "input_output")), 
+      LONG2NUM(p_attrs[i].root)));
   }
   
-  XSetErrorHandler(NULL); /*Let X handle it's errors again*/
-  XCloseDisplay(p_display);
+  xfree(p_exist);
+  xfree(p_attrs);
+  xfree(p_wins);
   return result;
 }
 
+/*
+*Returns +regexp+ compiled for UTF-8 strings. This is either the Regexp's own 
+*pattern or a copy, which you have to onig_free(). Raises Encoding::CompatibilityError 
+*if +regexp+ is fixed to an encoding that can't match UTF-8 titles, just like 
+*Regexp#=~ would. 
+*/
+static regex_t * utf8_regex(VALUE regexp)
+{
+  /*A non-ASCII UTF-8 string, so Ruby won't hand us a US-ASCII pattern*/
+  static const char probe[] = "\xc3\xa4";
+  
+  return rb_reg_prepare_re(regexp, rb_enc_str_new(probe, sizeof(probe) - 1, rb_utf8_encoding()));
+}
+
+/*
+*Returns true if the pattern +p_regex+ matches anywhere in the UTF-8 string +p_title+. 
+*Unlike Regexp#=~ this creates no Ruby objects. 
+*/
+static int regex_matches(regex_t * p_regex, const char * p_title)
+{
+  const UChar * p_start = (const UChar *) p_title;
+  const UChar * p_end = p_start + strlen(p_title);
+  
+  return onig_search(p_regex, p_start, p_end, p_start, p_end, NULL, ONIG_OPTION_NONE) >= 0;
+}
+
+/*
+*True if +rdepth+ is the depth :clients. 
+*/
+static int is_clients_depth(VALUE rdepth)
+{
+  return SYMBOL_P(rdepth) && SYM2ID(rdepth) == rb_intern("clients");
+}
+
+/*
+*Stores the client windows of the window manager in +pp_wins+ (malloc()ed), in stacking 
+*order (bottom-most first) if +stacking+ is True. If the window manager doesn't tell 
+*us, these are the children of the root window, always in stacking order. Returns 
+*False in that case. 
+*/
+static Bool get_clients(Display * p_display, Bool stacking, Window ** pp_wins, unsigned int * p_count)
+{
+  Window root_win = XDefaultRootWindow(p_display);
+  Window parent_win;
+  
+  if (imitator_cached_get_client_list(p_display, root_win, stacking, pp_wins, p_count))
+    return True;
+  imitator_cached_query_tree(p_display, root_win, &parent_win, pp_wins, p_count);
+  return False;
+}
+
 /*
 *call-seq: 
-*  XWindow.from_title(str [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
-*  XWindow.from_title(regexp [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*  XWindow.clients(screen = 0 , display = 0 , stacking = false) ==> anArray
 *
-*Creates a new XWindow object by passing on the given parameters to XWindow.search and 
-*using the first found window ID to make the XWindow object. 
+*Lists the windows managed by the window manager. 
 *===Parameters
-*See the XWindow.search parameter description. 
+*[+screen+] (0) The screen to look for the windows. 
+*[+display+] (0) The display to look for the screen. 
+*[+stacking+] (false) If true, the windows are ordered from the bottom-most to the top-most one. 
+*Otherwise they're in the order the window manager started to manage them. 
 *===Return value
-*The first matching window as a XWindow object. 
-*===Raises
-*[ArgumentError] No matching window was found. 
+*An array of window IDs. 
 *===Example
-*  #Get the first found window which name includes the string "imitator". 
-*  xwin = Imitator::X::XWindow.from_title(/imitator/)
+*  Imitator::X::XWindow.clients #=> [33554464, 65011719, ...]
+*  #The window on top
+*  Imitator::X::XWindow.clients(0, 0, true).last #=> 65011719
+*===Remarks
+*This reads the EWMH root window properties _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING 
+*in a single request (none with the window cache on). If the window manager doesn't 
+*set them, you get the children of the root window instead, which are always in 
+*stacking order. Under a reparenting window manager those are the frames, not the clients. 
 */
-static VALUE cm_from_title(int argc, VALUE argv[], VALUE self)
+static VALUE cm_clients(int argc, VALUE argv[], VALUE self)
 {
-  VALUE args[1];
+  VALUE screen, display, stacking;
+  Display * p_display;
+  Window * p_wins;
+  unsigned int i, count;
+  VALUE result = rb_ary_new();
   
-  args[0] = rb_ary_entry(cm_search(argc, argv, self), 0);
-  if (NIL_P(args[0]))
-    rb_raise(rb_eArgError, "No matching window found!");
+  rb_scan_args(argc, argv, "03", &screen, &display, &stacking);
+  p_display = imitator_get_display(get_connection(screen, display));
+  
+  get_clients(p_display, RTEST(stacking), &p_wins, &count);
+  for(i = 0; i < count; i++)
+    rb_ary_push(result, LONG2NUM(p_wins[i]));
+  free(p_wins);
+  
+  return result;
+}
+
+/*
+*The state of XWindow.for_pid, so end_find_pid() can free it if something raises. 
+*/
+struct for_pid_args {
+  Display * p_display;
+  long pid;
+  Window * p_wins;
+  long * p_pids;
+  VALUE result;
+};
+
+/*
+*Collects the clients of XWindow.for_pid. 
+*/
+static VALUE find_pid(VALUE arg)
+{
+  struct for_pid_args * p_args = (struct for_pid_args *) arg;
+  unsigned int i, count;
+  
+  get_clients(p_args->p_display, False, &p_args->p_wins, &count);
+  p_args->p_pids = ALLOC_N(long, count);
+  imitator_cached_get_pids(p_args->p_display, p_args->p_wins, count, p_args->p_pids, NULL);
+  for(i = 0; i < count; i++)
+  {
+    if (p_args->p_pids[i] == p_args->pid)
+      rb_ary_push(p_args->result, LONG2NUM(p_args->p_wins[i]));
+  }
+  return p_args->result;
+}
+
+/*
+*Frees what find_pid() allocated, also if it raised. 
+*/
+static VALUE end_find_pid(VALUE arg)
+{
+  struct for_pid_args * p_args = (struct for_pid_args *) arg;
   
-  return rb_class_new_instance(1, args, XWindow);
+  if (p_args->p_pids != NULL)
+    xfree(p_args->p_pids);
+  free(p_args->p_wins);
+  return Qnil;
 }
 
 /*
 *call-seq: 
-*  XWindow.from_focused( [screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*  XWindow.for_pid(pid , screen = 0 , display = 0) ==> anArray
 *
-*Creates a new XWindow from the actually focused window. 
+*Finds the windows of a process. 
 *===Parameters
-*[screen] (0) The screen to look for the window. 
-*[display] (0) The display to look for the screen. 
+*[+pid+] The process identification number. 
+*[+screen+] (0) The screen to look for the windows. 
+*[+display+] (0) The display to look for the screen. 
 *===Return value
-*The window having the input focus. 
+*An array of the IDs of the client windows (see XWindow.clients) whose #pid is +pid+. 
+*May be empty. 
 *===Example
-*  xwin = Imitator::X::XWindow.from_focused
+*  Imitator::X::XWindow.for_pid(4478) #=> [65011719]
 *===Remarks
-*This method is not reliable, since it's likely to find one of those 
-*invisible "InputOnly" windows. Have a look at XWindow.from_active 
-*for a more reliable variant. 
+*The PIDs of all windows are requested together: one request per window with XCB 
+*support, sent at once, and two more for the windows without _NET_WM_PID if the 
+*X server has the X-Resource extension. With the window cache on, the PIDs are 
+*remembered and this is a lookup in memory. 
 */
-static VALUE cm_from_focused(int argc, VALUE argv[], VALUE self)
+static VALUE cm_for_pid(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rpid, screen, display;
+  struct for_pid_args args;
+  
+  rb_scan_args(argc, argv, "12", &rpid, &screen, &display);
+  memset(&args, 0, sizeof(struct for_pid_args));
+  args.pid = NUM2LONG(rpid);
+  args.p_display = imitator_get_display(get_connection(screen, display));
+  args.result = rb_ary_new();
+  
+  return rb_ensure(find_pid, (VALUE) &args, end_find_pid, (VALUE) &args);
+}
+
+/*
+*The state of XWindow.search, so end_search() can free it if something raises. 
+*/
+struct search_args {
+  /*String or Regexp*/
+  VALUE title;
+  int is_regexp;
+  int max_depth;
+  int first_only;
+  int use_clients;
+  Display * p_display;
+  /*The layer of the tree being searched*/
+  Window * p_layer;
+  unsigned int layer_size;
+  /*Its titles and (if we descend) children*/
+  char ** pp_titles;
+  Window ** pp_children;
+  unsigned int * p_num_children;
+  /*+title+ compiled for UTF-8, see utf8_regex()*/
+  regex_t * p_regex;
+  VALUE result;
+};
+
+/*
+*Frees the titles and children of the current layer of +p_args+. 
+*/
+static void free_search_layer(struct search_args * p_args)
+{
+  if (p_args->pp_titles != NULL)
+  {
+    imitator_free_list((void **) p_args->pp_titles, p_args->layer_size);
+    xfree(p_args->pp_titles);
+    p_args->pp_titles = NULL;
+  }
+  if (p_args->pp_children != NULL)
+  {
+    imitator_free_list((void **) p_args->pp_children, p_args->layer_size);
+    xfree(p_args->pp_children);
+    xfree(p_args->p_num_children);
+    p_args->pp_children = NULL;
+    p_args->p_num_children = NULL;
+  }
+}
+
+/*
+*Searches the tree layer by layer for XWindow.search. 
+*/
+static VALUE search_tree(VALUE arg)
+{
+  struct search_args * p_args = (struct search_args *) arg;
+  Window parent_win;
+  Window * p_next_layer;
+  unsigned int next_layer_size, i;
+  const char * p_title;
+  int depth;
+  short done = 0;
+  
+  /*Titles are matched in place, so we need the pattern compiled for UTF-8. Once, end_search() frees it. */
+  if (p_args->is_regexp)
+    p_args->p_regex = utf8_regex(p_args->title);
+  if (p_args->use_clients)
+    get_clients(p_args->p_display, False, &p_args->p_layer, &p_args->layer_size);
+  else
+    imitator_cached_query_tree(p_args->p_display, XDefaultRootWindow(p_args->p_display), &parent_win, &p_args->p_layer, &p_args->layer_size);
+  
+  for(depth = 1; p_args->layer_size > 0 && !done; depth++)
+  {
+    /*Get all titles of this layer at once, we want to match against them. 
+    *If we'll descend, get the children as well. Zeroed, so end_search() 
+    *can free them if the request raises. */
+    p_args->pp_titles = ALLOC_N(char *, p_args->layer_size);
+    MEMZERO(p_args->pp_titles, char *, p_args->layer_size);
+    if (p_args->max_depth < 0 || depth < p_args->max_depth)
+    {
+      p_args->pp_children = ALLOC_N(Window *, p_args->layer_size);
+      p_args->p_num_children = ALLOC_N(unsigned int, p_args->layer_size);
+      MEMZERO(p_args->pp_children, Window *, p_args->layer_size);
+      MEMZERO(p_args->p_num_children, unsigned int, p_args->layer_size);
+      imitator_cached_get_titles_and_children(p_args->p_display, p_args->p_layer, p_args->layer_size, p_args->pp_titles, p_args->pp_children, p_args->p_num_children);
+    }
+    else
+      imitator_cached_get_titles(p_args->p_display, p_args->p_layer, p_args->layer_size, p_args->pp_titles, NULL);
+    
+    for(i = 0; i < p_args->layer_size && !done; i++)
+    {
+      p_title = p_args->pp_titles[i];
+      if (p_title == NULL) /*No name, XWindow#title gives "(null)" for these*/
+        p_title = "(null)";
+      
+      if (p_args->is_regexp)
+      {
+        if (regex_matches(p_args->p_regex, p_title))
+        {
+          rb_ary_push(p_args->result, LONG2NUM(p_args->p_layer[i]));
+          done = p_args->first_only;
+        }
+      }
+      else /*Not using a regular expression*/
+      {
+        if (strcmp(RSTRING_PTR(p_args->title), p_title) == 0)
+        {
+          rb_ary_push(p_args->result, LONG2NUM(p_args->p_layer[i]));
+          done = p_args->first_only;
+        }
+      }
+    }
+    /*The children of this layer form the next one*/
+    next_layer_size = 0;
+    p_next_layer = NULL;
+    if (p_args->pp_children != NULL)
+    {
+      for(i = 0; i < p_args->layer_size; i++)
+        next_layer_size += p_args->p_num_children[i];
+      if (next_layer_size > 0 && !done)
+      {
+        p_next_layer = (Window *) malloc(sizeof(Window) * next_layer_size);
+        next_layer_size = 0;
+        for(i = 0; i < p_args->layer_size; i++)
+        {
+          if (p_args->p_num_children[i] > 0)
+            memcpy(p_next_layer + next_layer_size, p_args->pp_children[i], sizeof(Window) * p_args->p_num_children[i]);
+          next_layer_size += p_args->p_num_children[i];
+        }
+      }
+    }
+    free_search_layer(p_args);
+    free(p_args->p_layer);
+    p_args->p_layer = p_next_layer;
+    p_args->layer_size = p_next_layer == NULL ? 0 : next_layer_size;
+  }
+  
+  return p_args->result;
+}
+
+/*
+*Frees whatever search_tree() left behind, also if it raised. 
+*/
+static VALUE end_search(VALUE arg)
+{
+  struct search_args * p_args = (struct search_args *) arg;
+  
+  if (p_args->p_regex != NULL && p_args->p_regex != RREGEXP_PTR(p_args->title)) /*A copy made by utf8_regex()*/
+    onig_free(p_args->p_regex);
+  free_search_layer(p_args);
+  free(p_args->p_layer);
+  return Qnil;
+}
+
+/*
+*call-seq: 
+*  XWindow.search(str , screen = 0 , display = 0 , depth = :clients , first = false) ==> anArray
+*  XWindow.search(regexp , screen = 0 , display = 0 , depth = :clients , first = false) ==> anArray
+*
+*Searches for a special window title. 
+*===Parameters
+*[+str+] The title to look for. This will only match *exactly*. 
+*[+regexp+] The title to look for, as a Regular Expression to match. 
+*[+screen+] (0) The screen to look for the window. 
+*[+display+] (0) The display to look for the screen. 
+*[+depth+] (:clients) How many layers of the window tree to search. 1 means the children of the 
+*root window, 2 includes their children and so on. Pass +nil+ to search the whole tree. 
+*:clients searches only the windows the window manager manages, see XWindow.clients.  
+*[+first+] (false) If true, stop at the first matching window. 
+*===Return value
+*An array containing the window IDs of all windows whose titles matched the string 
+*or Regular Expression. This may be empty if nothing matches. Windows of upper 
+*layers come first. 
+*===Example
+*  #Search for a window whose name is exactly "x-nautilus-desktop"
+*  Imitator::X::XWindow.search("x-nautilus-desktop") #=> [33554464]
+*  #Search for a window whose name contains the string "imitator". 
+*  Imitator::X::XWindow.search(/imitator/) #=> [...]
+*  #If a window isn't found, you get an empty array. 
+*  Imitator::X::XWindow.search("nonexistant") #=> []
+*  #Find the client window inside the frame of a reparenting window manager
+*  Imitator::X::XWindow.search(/gedit/, 0, 0, nil, true) #=> [65011719]
+*===Remarks
+*If your window manager supports EWMH, searching its client list is cheaper than walking 
+*the tree and skips frames and other windows of no interest. Otherwise :clients is the 
+*same as 1. 
+*
+*The tree is searched layer by layer. The titles and children of all windows in 
+*one layer are requested together, so with XCB support a search costs 
+*about one round-trip per layer, no matter how many windows there are. 
+*Regular Expressions are matched against the titles natively, so only 
+*matching windows cost any Ruby objects. 
+*
+*With the window cache on (see Connection#window_cache=), the cache keeps an 
+*index of all titles up to the deepest layer searched so far and of the clients, 
+*so searching for an exact title is a single hash lookup. 
+*/
+static VALUE cm_search(int argc, VALUE argv[], VALUE self) /*title as string or regexp*/
+{
+  VALUE title, screen, display, rdepth, rfirst;
+  struct search_args args;
+  unsigned int i, count;
+  Window * p_wins;
+  Bool found;
+  
+  rb_scan_args(argc, argv, "14", &title, &screen, &display, &rdepth, &rfirst);
+  memset(&args, 0, sizeof(struct search_args));
+  /*Check wheather we're operating on a Regular Expression or a String. Strings mean exact matching later on. */
+  if (TYPE(title) == T_REGEXP)
+    args.is_regexp = 1;
+  else
+    StringValue(title); /*Raise a TypeError now and not while we hold the titles*/
+  args.title = title;
+  /*An omitted depth means the clients, or the first layer like it always did; nil means everything*/
+  if (argc < 4 || is_clients_depth(rdepth))
+  {
+    args.use_clients = 1;
+    args.max_depth = 1;
+  }
+  else if (NIL_P(rdepth))
+    args.max_depth = -1;
+  else
+    args.max_depth = NUM2INT(rdepth);
+  args.first_only = RTEST(rfirst);
+  args.p_display = imitator_get_display(get_connection(screen, display));
+  args.result = rb_ary_new();
+  
+  if (args.max_depth == 0)
+    return args.result;
+  
+  /*Exact titles are in the cache's title index*/
+  if (!args.is_regexp)
+  {
+    found = False;
+    if (args.use_clients)
+      found = imitator_cached_find_client_title(args.p_display, XDefaultRootWindow(args.p_display), StringValueCStr(title), &p_wins, &count);
+    else if (imitator_cached_explore(args.p_display, args.max_depth))
+    {
+      count = imitator_cached_find_title(args.p_display, XDefaultRootWindow(args.p_display), StringValueCStr(title), args.max_depth, &p_wins);
+      found = True;
+    }
+    if (found)
+    {
+      for(i = 0; i < count && (i == 0 || !args.first_only); i++)
+        rb_ary_push(args.result, LONG2NUM(p_wins[i]));
+      free(p_wins);
+      return args.result;
+    }
+  }
+  
+  return rb_ensure(search_tree, (VALUE) &args, end_search, (VALUE) &args);
+}
+
+/*
+*A criteria hash of XWindow.select, compiled. 
+*/
+struct selector {
+  /*The IMITATOR_INFO_* fields needed to check the criteria*/
+  unsigned int fields;
+  /*String or Regexp, Qnil if not given*/
+  VALUE title;
+  regex_t * p_title_regex;
+  VALUE class_name;
+  regex_t * p_class_regex;
+  /*-1 for the ones not given*/
+  long pid;
+  int visible;
+  int mapped;
+  long min_width, min_height;
+  long max_width, max_height;
+  int max_depth;
+  int use_clients;
+  int first_only;
+};
+
+/*
+*Arguments for select_windows() and the things it has to clean up. 
+*/
+struct select_args {
+  VALUE criteria;
+  Display * p_display;
+  struct selector sel;
+  Window * p_layer;
+  imitator_window_info * p_infos;
+  unsigned int num_infos;
+  VALUE result;
+};
+
+/*
+*Compiles a title or class criterion. Regexps are prepared for UTF-8 once, 
+*strings must not contain NUL. 
+*/
+static regex_t * compile_text_criterion(VALUE value)
+{
+  if (TYPE(value) == T_REGEXP)
+    return utf8_regex(value);
+  StringValueCStr(value);
+  return NULL;
+}
+
+/*
+*Reads a <tt>[width, height]</tt> criterion into +p_width+ and +p_height+. 
+*/
+static void compile_size_criterion(VALUE value, long * p_width, long * p_height)
+{
+  Check_Type(value, T_ARRAY);
+  if (RARRAY_LEN(value) != 2)
+    rb_raise(rb_eArgError, "Expected [width, height], got an array of %ld elements!", (long) RARRAY_LEN(value));
+  *p_width = NUM2LONG(rb_ary_entry(value, 0));
+  *p_height = NUM2LONG(rb_ary_entry(value, 1));
+}
+
+/*
+*rb_hash_foreach() callback, adds the criterion +key+ => +value+ to the selector in +arg+. 
+*/
+static int compile_criterion(VALUE key, VALUE value, VALUE arg)
+{
+  struct selector * p_sel = &((struct select_args *) arg)->sel;
+  ID id;
+  
+  if (!SYMBOL_P(key))
+    rb_raise(rb_eArgError, "Selector keys must be symbols!");
+  id = SYM2ID(key);
+  
+  if (id == rb_intern("title"))
+  {
+    p_sel->title = value;
+    p_sel->p_title_regex = compile_text_criterion(value);
+    p_sel->fields |= IMITATOR_INFO_TITLE;
+  }
+  else if (id == rb_intern("class"))
+  {
+    p_sel->class_name = value;
+    p_sel->p_class_regex = compile_text_criterion(value);
+    p_sel->fields |= IMITATOR_INFO_CLASS;
+  }
+  else if (id == rb_intern("pid"))
+  {
+    p_sel->pid = NUM2LONG(value);
+    p_sel->fields |= IMITATOR_INFO_PID;
+  }
+  else if (id == rb_intern("visible"))
+  {
+    p_sel->visible = RTEST(value) ? 1 : 0;
+    p_sel->fields |= IMITATOR_INFO_ATTRIBUTES;
+  }
+  else if (id == rb_intern("mapped"))
+  {
+    p_sel->mapped = RTEST(value) ? 1 : 0;
+    p_sel->fields |= IMITATOR_INFO_ATTRIBUTES;
+  }
+  else if (id == rb_intern("min_size"))
+  {
+    compile_size_criterion(value, &p_sel->min_width, &p_sel->min_height);
+    p_sel->fields |= IMITATOR_INFO_ATTRIBUTES;
+  }
+  else if (id == rb_intern("max_size"))
+  {
+    compile_size_criterion(value, &p_sel->max_width, &p_sel->max_height);
+    p_sel->fields |= IMITATOR_INFO_ATTRIBUTES;
+  }
+  else if (id == rb_intern("depth"))
+  {
+    p_sel->use_clients = is_clients_depth(value);
+    p_sel->max_depth = NIL_P(value) ? -1 : (p_sel->use_clients ? 1 : NUM2INT(value));
+  }
+  else if (id == rb_intern("first"))
+    p_sel->first_only = RTEST(value);
+  else
+    rb_raise(rb_eArgError, "Unknown selector key :%s!", rb_id2name(id));
+  
+  return ST_CONTINUE;
+}
+
+/*
+*Checks a title or class criterion against the UTF-8 string +p_text+. 
+*/
+static int text_matches(VALUE criterion, regex_t * p_regex, const char * p_text)
+{
+  if (p_text == NULL)
+    return 0;
+  if (p_regex != NULL)
+    return regex_matches(p_regex, p_text);
+  return strcmp(RSTRING_PTR(criterion), p_text) == 0;
+}
+
+/*
+*The native predicate: true if the window described by +p_info+ meets all criteria of +p_sel+. 
+*/
+static int selector_matches(const struct selector * p_sel, const imitator_window_info * p_info)
+{
+  int viewable;
+  
+  if ((p_sel->fields & IMITATOR_INFO_TITLE) && !text_matches(p_sel->title, p_sel->p_title_regex, p_info->p_title == NULL ? "(null)" : p_info->p_title))
+    return 0;
+  if ((p_sel->fields & IMITATOR_INFO_CLASS) && !text_matches(p_sel->class_name, p_sel->p_class_regex, p_info->p_res_name) 
+      && !text_matches(p_sel->class_name, p_sel->p_class_regex, p_info->p_res_class))
+    return 0;
+  if ((p_sel->fields & IMITATOR_INFO_PID) && p_info->pid != p_sel->pid)
+    return 0;
+  if (p_sel->fields & IMITATOR_INFO_ATTRIBUTES)
+  {
+    if (!p_info->exists)
+      return 0;
+    /*The same as #mapped? and #visible?*/
+    viewable = p_info->attrs.map_state == IsViewable;
+    if (p_sel->mapped >= 0 && p_sel->mapped != viewable)
+      return 0;
+    if (p_sel->visible >= 0 && p_sel->visible != (viewable && p_info->attrs.class != InputOnly))
+      return 0;
+    if ((p_sel->min_width >= 0 && p_info->attrs.width < p_sel->min_width) || (p_sel->min_height >= 0 && p_info->attrs.height < p_sel->min_height))
+      return 0;
+    if ((p_sel->max_width >= 0 && p_info->attrs.width > p_sel->max_width) || (p_sel->max_height >= 0 && p_info->attrs.height > p_sel->max_height))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+*Asks the X-Resource extension for the PIDs of the windows in +p_infos+ without _NET_WM_PID. 
+*/
+static void fill_client_pids(Display * p_display, const Window * p_wins, unsigned int count, imitator_window_info * p_infos)
+{
+  long * p_pids = ALLOC_N(long, count);
+  unsigned int i;
+  
+  for(i = 0; i < count; i++)
+    p_pids[i] = p_infos[i].pid;
+  imitator_get_client_pids(p_display, p_wins, count, p_pids);
+  for(i = 0; i < count; i++)
+    p_infos[i].pid = p_pids[i];
+  xfree(p_pids);
+}
+
+/*
+*Compiles the criteria and walks the window tree layer by layer, fetching 
+*only what the criteria need. 
+*/
+static VALUE select_windows(VALUE arg)
+{
+  struct select_args * p_args = (struct select_args *) arg;
+  struct selector * p_sel = &p_args->sel;
+  Window parent_win;
+  Window * p_next_layer;
+  unsigned int i, layer_size, next_layer_size, fields;
+  int depth, done = 0;
+  
+  rb_hash_foreach(p_args->criteria, compile_criterion, arg);
+  if (p_sel->max_depth == 0)
+    return p_args->result;
+  
+  if (p_sel->use_clients)
+    get_clients(p_args->p_display, False, &p_args->p_layer, &layer_size);
+  else
+    imitator_cached_query_tree(p_args->p_display, XDefaultRootWindow(p_args->p_display), &parent_win, &p_args->p_layer, &layer_size);
+  for(depth = 1; layer_size > 0 && !done; depth++)
+  {
+    fields = p_sel->fields;
+    if (p_sel->max_depth < 0 || depth < p_sel->max_depth)
+      fields |= IMITATOR_INFO_CHILDREN;
+    p_args->p_infos = ALLOC_N(imitator_window_info, layer_size);
+    memset(p_args->p_infos, 0, sizeof(imitator_window_info) * layer_size);
+    p_args->num_infos = layer_size;
+    imitator_get_window_info(p_args->p_display, p_args->p_layer, layer_size, fields, p_args->p_infos);
+    if (fields & IMITATOR_INFO_PID)
+      fill_client_pids(p_args->p_display, p_args->p_layer, layer_size, p_args->p_infos);
+    
+    next_layer_size = 0;
+    for(i = 0; i < layer_size && !done; i++)
+    {
+      if (selector_matches(p_sel, &p_args->p_infos[i]))
+      {
+        rb_ary_push(p_args->result, LONG2NUM(p_args->p_layer[i]));
+        done = p_sel->first_only;
+      }
+      next_layer_size += p_args->p_infos[i].num_children;
+    }
+    
+    /*The children of this layer form the next one*/
+    p_next_layer = NULL;
+    if (next_layer_size > 0 && !done)
+    {
+      p_next_layer = (Window *) malloc(sizeof(Window) * next_layer_size);
+      next_layer_size = 0;
+      for(i = 0; i < layer_size; i++)
+      {
+        if (p_args->p_infos[i].num_children > 0)
+          memcpy(p_next_layer + next_layer_size, p_args->p_infos[i].p_children, sizeof(Window) * p_args->p_infos[i].num_children);
+        next_layer_size += p_args->p_infos[i].num_children;
+      }
+    }
+    imitator_free_window_info(p_args->p_infos, p_args->num_infos);
+    xfree(p_args->p_infos);
+    p_args->p_infos = NULL;
+    p_args->num_infos = 0;
+    free(p_args->p_layer);
+    p_args->p_layer = p_next_layer;
+    layer_size = p_next_layer == NULL ? 0 : next_layer_size;
+  }
+  
+  return p_args->result;
+}
+
+/*
+*Frees whatever select_windows() left behind, also if it raised. 
+*/
+static VALUE free_selection(VALUE arg)
+{
+  struct select_args * p_args = (struct select_args *) arg;
+  
+  if (p_args->sel.p_title_regex != NULL && p_args->sel.p_title_regex != RREGEXP_PTR(p_args->sel.title))
+    onig_free(p_args->sel.p_title_regex);
+  if (p_args->sel.p_class_regex != NULL && p_args->sel.p_class_regex != RREGEXP_PTR(p_args->sel.class_name))
+    onig_free(p_args->sel.p_class_regex);
+  if (p_args->p_infos != NULL)
+  {
+    imitator_free_window_info(p_args->p_infos, p_args->num_infos);
+    xfree(p_args->p_infos);
+  }
+  free(p_args->p_layer);
+  return Qnil;
+}
+
+/*
+*call-seq: 
+*  XWindow.select(criteria , screen = 0 , display = 0) ==> anArray
+*
+*Searches for windows meeting all of the given criteria. 
+*===Parameters
+*[+criteria+] A hash of criteria, see below. 
+*[+screen+] (0) The screen to look for the windows. 
+*[+display+] (0) The display to look for the screen. 
+*
+*These are the possible criteria: 
+*[:title] A string to match the window title exactly or a Regular Expression to match it. 
+*[:class] Like :title, but for the instance or the class name in the WM_CLASS property. 
+*[:pid] The PID of the window, like #pid tells it. 
+*[:visible] true or false, compared to what #visible? would say. 
+*[:mapped] true or false, compared to what #mapped? would say. 
+*[:min_size] <tt>[width, height]</tt> the window must at least have. 
+*[:max_size] <tt>[width, height]</tt> the window must at most have. 
+*[:depth] (:clients) How many layers of the window tree to search, like for XWindow.search. 
+*[:first] (false) If true, stop at the first matching window. 
+*===Return value
+*An array containing the window IDs of all matching windows. Windows of upper 
+*layers come first. 
+*===Raises
+*[ArgumentError] Unknown criterion. 
+*===Example
+*  #All visible Firefox windows larger than 100x100 pixels
+*  Imitator::X::XWindow.select(:class => /firefox/i, :visible => true, :min_size => [100, 100]) #=> [...]
+*  #The window of process 1234
+*  Imitator::X::XWindow.select(:pid => 1234, :first => true) #=> [65011719]
+*  #Also windows the window manager doesn't manage
+*  Imitator::X::XWindow.select(:pid => 1234, :depth => nil) #=> [65011719, 65011713]
+*===Remarks
+*The criteria are checked in native code. Only the properties they need 
+*are requested, for all windows of a layer at once, so with XCB support 
+*a selection costs about one round-trip per layer. 
+*/
+static VALUE cm_select(int argc, VALUE argv[], VALUE self)
+{
+  VALUE criteria, screen, display;
+  struct select_args args;
+  
+  rb_scan_args(argc, argv, "12", &criteria, &screen, &display);
+  Check_Type(criteria, T_HASH);
+  
+  memset(&args, 0, sizeof(struct select_args));
+  args.criteria = criteria;
+  args.p_display = imitator_get_display(get_connection(screen, display));
+  args.sel.title = Qnil;
+  args.sel.class_name = Qnil;
+  args.sel.pid = -1;
+  args.sel.visible = -1;
+  args.sel.mapped = -1;
+  args.sel.min_width = args.sel.min_height = -1;
+  args.sel.max_width = args.sel.max_height = -1;
+  args.sel.max_depth = 1;
+  args.sel.use_clients = 1;
+  args.result = rb_ary_new();
+  
+  return rb_ensure(select_windows, (VALUE) &args, free_selection, (VALUE) &args);
+}
+
+/*
+*Arguments for the waiting class methods. 
+*/
+struct wait_args {
+  VALUE self;
+  VALUE search_args[3];
+  imitator_connection * p_conn;
+  Display * p_display;
+  /*imitator_stats_now() to give up at, negative means never*/
+  double deadline;
+  /*True if with_window_cache() turned the cache on for us*/
+  Bool temporary_cache;
+};
+
+/*
+*Turns the window cache off again if it was only turned on for waiting. 
+*/
+static VALUE drop_temporary_cache(VALUE arg)
+{
+  struct wait_args * p_args = (struct wait_args *) arg;
+  
+  if (p_args->temporary_cache && p_args->p_conn->p_window_cache != NULL)
+  {
+    imitator_cache_free(p_args->p_conn->p_window_cache, True);
+    p_args->p_conn->p_window_cache = NULL;
+  }
+  return Qnil;
+}
+
+/*
+*Calls +func+ with +p_args+ while the window cache of +p_args->p_conn+ is on. 
+*The cache listens to the window events we wait for. 
+*/
+static VALUE with_window_cache(struct wait_args * p_args, VALUE (*func)(VALUE))
+{
+  p_args->temporary_cache = False;
+  if (p_args->p_conn->p_window_cache == NULL)
+  {
+    p_args->p_conn->p_window_cache = imitator_cache_new(p_args->p_display);
+    p_args->temporary_cache = True;
+  }
+  return rb_ensure(func, (VALUE) p_args, drop_temporary_cache, (VALUE) p_args);
+}
+
+/*
+*Waits for the next change of the window tree. Returns False if the deadline passed. 
+*/
+static Bool wait_for_change(struct wait_args * p_args)
+{
+  unsigned long generation = p_args->p_conn->p_window_cache->generation;
+  double remaining = 1;
+  
+  while (p_args->p_conn->p_window_cache->generation == generation)
+  {
+    if (p_args->deadline >= 0)
+    {
+      remaining = p_args->deadline - imitator_stats_now();
+      if (remaining <= 0)
+        return False;
+    }
+    if (!imitator_wait_for_events(p_args->p_display, remaining))
+      imitator_raise_closed();
+    imitator_process_events(p_args->p_display);
+  }
+  return True;
+}
+
+static VALUE is_mapped(VALUE arg)
+{
+  VALUE * p_id_and_display = (VALUE *) arg;
+  
+  return imitator_cached_is_mapped((Display *) p_id_and_display[1], (Window) NUM2LONG(p_id_and_display[0])) ? Qtrue : Qfalse;
+}
+
+/*
+*Returns the first window ID in +rids+ that belongs to a mapped window, nil if there's none. 
+*/
+static VALUE first_mapped(struct wait_args * p_args, VALUE rids)
+{
+  VALUE id_and_display[2];
+  int i, state;
+  
+  for(i = 0; i < RARRAY_LEN(rids); i++)
+  {
+    /*A window that vanished meanwhile just isn't mapped*/
+    id_and_display[0] = rb_ary_entry(rids, i);
+    id_and_display[1] = (VALUE) p_args->p_display;
+    state = 0;
+    if (RTEST(rb_protect(is_mapped, (VALUE) id_and_display, &state)) && !state)
+      return id_and_display[0];
+    if (state)
+    {
+      if (!rb_obj_is_kind_of(rb_errinfo(), ProtocolError)) /*E.g. Thread#kill*/
+        rb_jump_tag(state);
+      rb_set_errinfo(Qnil);
+    }
+  }
+  return Qnil;
+}
+
+/*
+*Searches until there's a mapped window matching +p_args->search_args+. 
+*/
+static VALUE wait_for_window(VALUE arg)
+{
+  struct wait_args * p_args = (struct wait_args *) arg;
+  VALUE rid;
+  
+  do
+  {
+    rid = first_mapped(p_args, cm_search(3, p_args->search_args, p_args->self));
+    if (!NIL_P(rid))
+      return imitator_xwindow_for(get_connection(p_args->search_args[1], p_args->search_args[2]), (Window) NUM2LONG(rid));
+  } while (wait_for_change(p_args));
+  
+  return Qnil;
+}
+
+/*
+*Searches until no window matching +p_args->search_args+ is mapped anymore. 
+*/
+static VALUE wait_for_window_termination(VALUE arg)
+{
+  struct wait_args * p_args = (struct wait_args *) arg;
+  
+  do
+  {
+    if (NIL_P(first_mapped(p_args, cm_search(3, p_args->search_args, p_args->self))))
+      return Qtrue;
+  } while (wait_for_change(p_args));
+  
+  return Qfalse;
+}
+
+/*
+*Waits until the window +p_args->search_args[0]+ is destroyed. 
+*/
+static VALUE wait_until_destroyed(VALUE arg)
+{
+  struct wait_args * p_args = (struct wait_args *) arg;
+  Window win = (Window) NUM2LONG(p_args->search_args[0]);
+  
+  do
+  {
+    if (!imitator_cached_exists(p_args->p_display, win))
+      return Qtrue;
+  } while (wait_for_change(p_args));
+  
+  return Qfalse;
+}
+
+/*
+*call-seq: 
+*  XWindow.from_title(str [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*  XWindow.from_title(regexp [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*
+*Creates a new XWindow object by passing on the given parameters to XWindow.search and 
+*using the first found window ID to make the XWindow object. 
+*===Parameters
+*See the XWindow.search parameter description. 
+*===Return value
+*The first matching window as a XWindow object. 
+*===Raises
+*[ArgumentError] No matching window was found. 
+*===Example
+*  #Get the first found window which name includes the string "imitator". 
+*  xwin = Imitator::X::XWindow.from_title(/imitator/)
+*/
+static VALUE cm_from_title(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rid;
+  VALUE search_args[5] = {Qnil, Qnil, Qnil, Qnil, Qtrue}; /*The default depth, and we need only one*/
+  
+  rb_scan_args(argc, argv, "12", &search_args[0], &search_args[1], &search_args[2]);
+  search_args[3] = ID2SYM(rb_intern("clients"));
+  rid = rb_ary_entry(cm_search(5, search_args, self), 0);
+  if (NIL_P(rid))
+    rb_raise(rb_eArgError, "No matching window found!");
+  
+  return imitator_xwindow_for(get_connection(search_args[1], search_args[2]), (Window) NUM2LONG(rid));
+}
+
+/*
+*call-seq: 
+*  XWindow.from_focused( [screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*
+*Creates a new XWindow from the actually focused window. 
+*===Parameters
+*[screen] (0) The screen to look for the window. 
+*[display] (0) The display to look for the screen. 
+*===Return value
+*The window having the input focus. 
+*===Example
+*  xwin = Imitator::X::XWindow.from_focused
+*===Remarks
+*This method is not reliable, since it's likely to find one of those 
+*invisible "InputOnly" windows. Have a look at XWindow.from_active 
+*for a more reliable variant. 
+*/
+static VALUE cm_from_focused(int argc, VALUE argv[], VALUE self)
+{
+  VALUE screen, display, rconn;
+  Display * p_display;
+  Window win;
+  int revert;
+  
+  rb_scan_args(argc, argv, "02", &screen, &display);
+  
+  rconn = get_connection(screen, display);
+  p_display = imitator_get_display(rconn);
+  
+  imitator_get_input_focus(p_display, &win, &revert);
+  return imitator_xwindow_for(rconn, win);
+}
+
+/*
+*call-seq: 
+*  XWindow.from_active( [screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*
+*Creates a new XWindow from the currently active window. 
+*===Parameters
+*[screen] (0) The screen to look for the window. 
+*[display] (0) The display to look for the screen. 
+*===Return value
+*The found window as a XWindow object. 
+*===Raises
+*[NotImplementedError] The EWMH standard _NET_ACTIVE_WINDOW isn't supported. 
+*[XError] Failed to retrieve the active window from the X server. Did you specify a correct screen and display?
+*===Example
+*  xwin = Imitator::X::XWindow.from_active
+*  #Active window of screen 3
+*  xwin = Imitator::X::XWindow.from_active(3)
+*  #Active window of screen 0 on display 2
+*  xwin = Imitator::X::XWindow.from_active(0, 2)
+*===Remarks
+*This method is part of the EWMH standard _NET_ACTIVE_WINDOW. 
+*
+*If you can choose between this method and XWindow.from_focused, choose this one, 
+*because it doesn't find invisible windows. 
+*/
+static VALUE cm_from_active(int argc, VALUE argv[], VALUE self)
+{
+  Display * p_display;
+  VALUE screen, display, rconn;
+  Atom atom, actual_type;
+  Window root, active_win;
+  int actual_format;
+  unsigned long nitems, bytes;
+  unsigned char * prop;
+  
+  rb_scan_args(argc, argv, "02", &screen, &display);
+  rconn = get_connection(screen, display);
+  p_display = imitator_get_display(rconn);
+  check_for_ewmh(p_display, IMITATOR_ATOM_NET_ACTIVE_WINDOW);
+  
+  atom = imitator_atom(p_display, IMITATOR_ATOM_NET_ACTIVE_WINDOW);
+  root = XDefaultRootWindow(p_display);
+  
+  imitator_get_window_property(p_display, root, atom, 0, (~0L), False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
+  if (nitems > 0)
+    active_win = *((Window *) prop); /*We got a Window*/
+  else /*Shouldn't be the case*/
+  {
+    XFree(prop);
+    rb_raise(XError, "Couldn't retrieve the active window for some reason!");
+  }
+  
+  XFree(prop);
+  return imitator_xwindow_for(rconn, active_win);
+}
+
+/*
+*call-seq: 
+*  XWindow.wait_for_window( str [, screen = 0 [, display = 0 [, timeout = nil ] ] ] ) ==> aXWindow or nil
+*  XWindow.wait_for_window(regexp [, screen = 0 [, display = 0 [, timeout = nil ] ] ] ) ==> aXWindow or nil
+*
+*Pauses execution until a mapped window matching the given criteria is found. 
+*===Parameters
+*[+str+] The *exact* title of the window you want to to wait for. 
+*[+regexp+] A Regular Expression matching the window title you want to wait for. 
+*[+screen+] (0) The screen the window will be mapped to. 
+*[+display+] (0) The display the window will be mapped to. 
+*[+timeout+] (nil) The maximum number of seconds to wait. +nil+ means forever. 
+*===Return value
+*The XWindow object of the matching window or +nil+ if the timeout expired. 
+*===Example
+*  #Wait until a window with "gedit" in it's title exists
+*  gedit_win = Imitator::X::XWindow.wait_for_window(/gedit/)
+*  #Give Firefox 30 seconds
+*  ff_win = Imitator::X::XWindow.wait_for_window(/Mozilla Firefox/, 0, 0, 30)
+*===Remarks
+*Instead of searching again and again, this method listens for windows being 
+*created, mapped and renamed (using the connection's window cache, see 
+*Connection#window_cache=), so it returns as soon as the window appears. 
+*/
+static VALUE cm_wait_for_window(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rstr, rscreen, rdisplay, rtimeout;
+  struct wait_args args;
+  
+  rb_scan_args(argc, argv, "13", &rstr, &rscreen, &rdisplay, &rtimeout);
+  args.self = self;
+  args.search_args[0] = rstr;
+  args.search_args[1] = rscreen;
+  args.search_args[2] = rdisplay;
+  args.p_conn = imitator_get_connection(get_connection(rscreen, rdisplay));
+  args.p_display = imitator_get_display(get_connection(rscreen, rdisplay));
+  args.deadline = NIL_P(rtimeout) ? -1 : imitator_stats_now() + NUM2DBL(rtimeout);
+  
+  return with_window_cache(&args, wait_for_window);
+}
+
+/*
+*call-seq: 
+*  XWindow.wait_for_window_termination( str [, screen = 0 [, display = 0 [, timeout = nil ] ] ] ) ==> true or false
+*  XWindow.wait_for_window_termination( regexp [, streen = 0 [, display = 0 [, timeout = nil ] ] ] ) ==> true or false
+*
+*Pauses execution flow until *every* window matching the given criteria disappeared, 
+*i.e. was destroyed, unmapped or renamed. 
+*===Parameters
+*[+str+] The window's title. This must match *excatly*. 
+*[+regexp+] The window's title, as a Regular Expression to match. 
+*[+screen+] (0) The screen the window resides on. 
+*[+display+] (0) The screen's display. 
+*[+timeout+] (nil) The maximum number of seconds to wait. +nil+ means forever. 
+*===Return value
+*true if the windows are gone, false if the timeout expired. 
+*===Example
+*  #Wait until all gedit windows are closed
+*  Imitator::X::XWindow.wait_for_window_termination(/gedit/)
+*  #Wait until Firefox on screen 1 closes
+*  Imitator::X::XWindow.wait_for_window_termination(/Mozilla Firefox/, 1)
+*===Remarks
+*Like XWindow.wait_for_window, this method listens for X events 
+*and returns as soon as the X server reports the last window gone. 
+*
+*If you want to wait for a specific window's termination and you already have 
+*a XWindow object for that one, use XWindow#wait_until_destroyed. 
+*/
+static VALUE cm_wait_for_window_termination(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rstr, rscreen, rdisplay, rtimeout;
+  struct wait_args args;
+  
+  rb_scan_args(argc, argv, "13", &rstr, &rscreen, &rdisplay, &rtimeout);
+  args.self = self;
+  args.search_args[0] = rstr;
+  args.search_args[1] = rscreen;
+  args.search_args[2] = rdisplay;
+  args.p_conn = imitator_get_connection(get_connection(rscreen, rdisplay));
+  args.p_display = imitator_get_display(get_connection(rscreen, rdisplay));
+  args.deadline = NIL_P(rtimeout) ? -1 : imitator_stats_now() + NUM2DBL(rtimeout);
+  
+  return with_window_cache(&args, wait_for_window_termination);
+}
+
+/*
+*A lazy walk through the window tree, see walk_tree(). 
+*/
+struct walk_args {
+  VALUE rconn;
+  Display * p_display;
+  /*Number of layers to walk, negative for all*/
+  int max_depth;
+  /*The layer being yielded (malloc()ed)*/
+  Window * p_layer;
+  unsigned int layer_size;
+  /*The children of the layer while the next one is built*/
+  Window ** pp_children;
+  unsigned int * p_num_children;
+};
+
+/*
+*Frees the children of +p_args->p_layer+. 
+*/
+static void free_walk_children(struct walk_args * p_args)
+{
+  if (p_args->pp_children != NULL)
+  {
+    imitator_free_list((void **) p_args->pp_children, p_args->layer_size);
+    xfree(p_args->pp_children);
+    p_args->pp_children = NULL;
+  }
+  if (p_args->p_num_children != NULL)
+  {
+    xfree(p_args->p_num_children);
+    p_args->p_num_children = NULL;
+  }
+}
+
+/*
+*Yields the windows of +p_args->p_layer+ as XWindows, then those of the layers below it. 
+*A layer's children are only asked for (all at once) when the block took the whole layer, 
+*so breaking out of the block ends the walk without further requests. 
+*/
+static VALUE walk_tree(VALUE arg)
+{
+  struct walk_args * p_args = (struct walk_args *) arg;
+  Window * p_next_layer;
+  unsigned int i, next_layer_size;
+  int depth;
+  
+  for(depth = 1; p_args->layer_size > 0; depth++)
+  {
+    for(i = 0; i < p_args->layer_size; i++)
+      rb_yield(imitator_xwindow_for(p_args->rconn, p_args->p_layer[i]));
+    if (p_args->max_depth >= 0 && depth >= p_args->max_depth)
+      break;
+    
+    p_args->p_num_children = ALLOC_N(unsigned int, p_args->layer_size);
+    p_args->pp_children = ALLOC_N(Window *, p_args->layer_size);
+    MEMZERO(p_args->pp_children, Window *, p_args->layer_size);
+    imitator_cached_query_trees(p_args->p_display, p_args->p_layer, p_args->layer_size, p_args->pp_children, p_args->p_num_children);
+    
+    /*The children of this layer form the next one*/
+    next_layer_size = 0;
+    for(i = 0; i < p_args->layer_size; i++)
+      next_layer_size += p_args->p_num_children[i];
+    p_next_layer = NULL;
+    if (next_layer_size > 0)
+    {
+      p_next_layer = (Window *) malloc(sizeof(Window) * next_layer_size);
+      next_layer_size = 0;
+      for(i = 0; i < p_args->layer_size; i++)
+      {
+        if (p_args->p_num_children[i] > 0)
+          memcpy(p_next_layer + next_layer_size, p_args->pp_children[i], sizeof(Window) * p_args->p_num_children[i]);
+        next_layer_size += p_args->p_num_children[i];
+      }
+    }
+    free_walk_children(p_args);
+    free(p_args->p_layer);
+    p_args->p_layer = p_next_layer;
+    p_args->layer_size = next_layer_size;
+  }
+  return Qnil;
+}
+
+/*
+*Frees what walk_tree() left over, e.g. after a +break+. 
+*/
+static VALUE end_walk(VALUE arg)
+{
+  struct walk_args * p_args = (struct walk_args *) arg;
+  
+  free_walk_children(p_args);
+  free(p_args->p_layer);
+  p_args->p_layer = NULL;
+  return Qnil;
+}
+
+/*
+*call-seq: 
+*  XWindow.each( [ screen = 0 [, display = 0 [, depth = :clients ] ] ] ){|xwin| ...} ==> XWindow
+*  XWindow.each( [ screen = 0 [, display = 0 [, depth = :clients ] ] ] ) ==> anEnumerator
+*
+*Walks through the windows of a screen, layer by layer, and yields them as 
+*XWindow objects. 
+*===Parameters
+*[+screen+] (0) The screen to look for the windows. 
+*[+display+] (0) The display to look for the screen. 
+*[+depth+] (:clients) The window layers to walk, as for XWindow.search: :clients for the 
+*          windows of the window manager, a number for that many layers below the root 
+*          window or +nil+ for the whole tree. 
+*===Return value
+*XWindow, or an Enumerator if you don't give a block. 
+*===Example
+*  #The first five windows with a title
+*  Imitator::X::XWindow.each(0, 0, nil).lazy.reject{|xwin| xwin.title == "(null)"}.first(5)
+*  #Stops at the first match
+*  Imitator::X::XWindow.each(0, 0, nil).find{|xwin| xwin.title =~ /imitator/}
+*===Remarks
+*The children of a layer are requested together when you're through with the layer (in one 
+*round-trip with XCB support), so if you stop early, the layers below are never asked for. 
+*Only two layers are in memory at once. 
+*/
+static VALUE cm_each(int argc, VALUE argv[], VALUE self)
 {
-  VALUE screen, display;
-  Display * p_display;
-  char display_string[100];
-  Window win;
-  int revert;
-  VALUE result;
-  VALUE args[1];
-  
-  rb_scan_args(argc, argv, "02", &screen, &display);
-  
-  /*Assign the display or default to 0*/
-  if (NIL_P(display))
-    display = INT2FIX(0);
-  /*Assign the screen or default to 0*/
-  if (NIL_P(screen))
-    screen = INT2FIX(0);
-  /*Get the display string, form ":display.screen"*/
-  sprintf(display_string, ":%i.%i", FIX2INT(display), FIX2INT(screen));
+  VALUE screen, display, rdepth;
+  struct walk_args args;
+  Window parent_win;
   
-  p_display = XOpenDisplay(display_string);
-  XSetErrorHandler(handle_x_errors);
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "03", &screen, &display, &rdepth);
   
-  XGetInputFocus(p_display, &win, &revert);
-  args[0] = LONG2NUM(win);
-  result = rb_class_new_instance(1, args, XWindow);
+  memset(&args, 0, sizeof(struct walk_args));
+  args.rconn = get_connection(screen, display);
+  args.p_display = imitator_get_display(args.rconn);
+  if (argc < 3 || is_clients_depth(rdepth))
+  {
+    args.max_depth = 1;
+    get_clients(args.p_display, False, &args.p_layer, &args.layer_size);
+  }
+  else
+  {
+    args.max_depth = NIL_P(rdepth) ? -1 : NUM2INT(rdepth);
+    if (args.max_depth == 0)
+      return self;
+    imitator_cached_query_tree(args.p_display, XDefaultRootWindow(args.p_display), &parent_win, &args.p_layer, &args.layer_size);
+  }
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return result;
+  rb_ensure(walk_tree, (VALUE) &args, end_walk, (VALUE) &args);
+  return self;
 }
 
 /*
 *call-seq: 
-*  XWindow.from_active( [screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*  XWindow.on(event [, screen = 0 [, display = 0 ] ] ){|evt| ...} ==> aProc
 *
-*Creates a new XWindow from the currently active window. 
+*Calls the block for each +event+ of the root window and its children, i.e. the 
+*top-level windows. See #on for the events. 
 *===Parameters
-*[screen] (0) The screen to look for the window. 
-*[display] (0) The display to look for the screen. 
+*[+event+] The kind of events to listen for. 
+*[+screen+] (0) The screen whose root window to listen on. 
+*[+display+] (0) The display to look for the screen. 
 *===Return value
-*The found window as a XWindow object. 
+*The block as a Proc, for XWindow.off. 
 *===Raises
-*[NotImplementedError] The EWMH standard _NET_ACTIVE_WINDOW isn't supported. 
-*[XError] Failed to retrieve the active window from the X server. Did you specify a correct screen and display?
+*[ArgumentError] Unknown +event+ or no block given. 
 *===Example
-*  xwin = Imitator::X::XWindow.from_active
-*  #Active window of screen 3
-*  xwin = Imitator::X::XWindow.from_active(3)
-*  #Active window of screen 0 on display 2
-*  xwin = Imitator::X::XWindow.from_active(0, 2)
+*  #Tell about every new top-level window
+*  Imitator::X::XWindow.on(:map){|evt| puts "#{evt.window.window_id} appeared"}
+*  #And whenever the active window changes
+*  Imitator::X::XWindow.on(:property){|evt| p evt.window.root_win.title if evt.property == "_NET_ACTIVE_WINDOW"}
 *===Remarks
-*This method is part of the EWMH standard _NET_ACTIVE_WINDOW. 
-*
-*If you can choose between this method and XWindow.from_focused, choose this one, 
-*because it doesn't find invisible windows. 
+*Under a reparenting window manager, the children of the root window are the frames 
+*the window manager made, not the client windows. 
 */
-static VALUE cm_from_active(int argc, VALUE argv[], VALUE self)
+static VALUE cm_on(int argc, VALUE argv[], VALUE self)
 {
-  Display * p_display;
-  VALUE screen, display, result;
-  VALUE args[1];
-  char display_string[100];
-  Atom atom, actual_type;
-  Window root, active_win;
-  int actual_format;
-  unsigned long nitems, bytes;
-  unsigned char * prop;
-  
-  rb_scan_args(argc, argv, "02", &screen, &display);
-  /*Assign the display or default to 0*/
-  if (NIL_P(display))
-    display = INT2FIX(0);
-  /*Assign the screen or default to 0*/
-  if (NIL_P(screen))
-    screen = INT2FIX(0);
-  /*Get the display string, form ":display.screen"*/
-  sprintf(display_string, ":%i.%i", FIX2INT(display), FIX2INT(screen));
-  
-  p_display = XOpenDisplay(display_string);
-  XSetErrorHandler(handle_x_errors);
-  check_for_ewmh(p_display, "_NET_ACTIVE_WINDOW");
-  
-  atom = XInternAtom(p_display, "_NET_ACTIVE_WINDOW", False);
-  root = XDefaultRootWindow(p_display);
-  
-  XGetWindowProperty(p_display, root, atom, 0, (~0L), False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &prop);
-  if (nitems > 0)
-    active_win = *((Window *) prop); /*We got a Window*/
-  else /*Shouldn't be the case*/
-    rb_raise(XError, "Couldn't retrieve the active window for some reason!");
-  args[0] = LONG2NUM(active_win);
-  result = rb_class_new_instance(1, args, XWindow);
-  
-  XFree(prop);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return result;
+  VALUE revent, screen, display, rconn, proc;
+  enum imitator_subscription_kind kind;
+  
+  rb_scan_args(argc, argv, "12", &revent, &screen, &display);
+  kind = imitator_subscription_kind_of(revent);
+  if (!rb_block_given_p())
+    rb_raise(rb_eArgError, "No block given!");
+  proc = rb_block_proc();
+  rconn = get_connection(screen, display);
+  
+  imitator_subscribe(rconn, XDefaultRootWindow(imitator_get_display(rconn)), kind, True, proc);
+  return proc;
 }
 
 /*
 *call-seq: 
-*  XWindow.wait_for_window( str [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
-*  XWindow.wait_for_window(regexp [, screen = 0 [, display = 0 ] ] ) ==> aXWindow
+*  XWindow.off( [ event = nil [, proc = nil [, screen = 0 [, display = 0 ] ] ] ] ) ==> anInteger
 *
-*Pauses execution until a window matching the given criteria is found. 
+*Removes blocks registered with XWindow.on. 
 *===Parameters
-*[+str+] The *exact* title of the window you want to to wait for. 
-*[+regexp+] A Regular Expression matching the window title you want to wait for. 
-*[+screen+] (0) The screen the window will be mapped to. 
-*[+display+] (0) The display the window will be mapped to. 
+*[+event+] (nil) Only remove the blocks for this kind of events. +nil+ means all. 
+*[+proc+] (nil) Only remove this block, as returned by XWindow.on. +nil+ means all. 
+*[+screen+] (0) The screen whose root window was listened on. 
+*[+display+] (0) The display to look for the screen. 
 *===Return value
-*The XWindow object of the matching window. 
+*The number of blocks removed. 
 *===Example
-*  #Wait until a window with "gedit" in it's title exists
-*  gedit_win = Imitator::X::XWindow.wait_for_window(/gedit/)
+*  block = Imitator::X::XWindow.on(:map){|evt| p evt}
+*  Imitator::X::XWindow.off(:map, block) #=> 1
 */
-static VALUE cm_wait_for_window(int argc, VALUE argv[], VALUE self)
+static VALUE cm_off(int argc, VALUE argv[], VALUE self)
 {
-  VALUE rstr;
-  VALUE rscreen;
-  VALUE rdisplay;
-  VALUE args[3];
+  VALUE revent, proc, screen, display, rconn;
   
-  rb_scan_args(argc, argv, "12", &rstr, &rscreen, &rdisplay);
-  args[0] = rstr;
-  args[1] = rscreen;
-  args[2] = rdisplay;
+  rb_scan_args(argc, argv, "04", &revent, &proc, &screen, &display);
+  rconn = get_connection(screen, display);
   
-  /*Hang around until we see a window matching the cirteria*/
-  while (RTEST(rb_funcall(cm_search(3, args, self), rb_intern("empty?"), 0)))
-    rb_thread_sleep(1);
+  return INT2NUM(imitator_unsubscribe(rconn, XDefaultRootWindow(imitator_get_display(rconn)), 
+                                      NIL_P(revent) ? -1 : (int) imitator_subscription_kind_of(revent), True, proc));
+}
+
+/*
+*Arguments for run_batch() and end_batch(). 
+*/
+struct batch_args {
+  VALUE rconn;
+  imitator_connection * p_conn;
+  imitator_batch * p_batch;
+};
+
+/*
+*Yields and sends what the block queued. 
+*/
+static VALUE run_batch(VALUE arg)
+{
+  struct batch_args * p_args = (struct batch_args *) arg;
   
-  /*Wait another second to be sure that the window can be worked with*/
-  rb_thread_sleep(1);
+  rb_yield(Qnil);
+  return imitator_batch_flush(imitator_get_display(p_args->rconn), p_args->p_batch); /*Raises if the block closed the connection*/
+}
+
+static VALUE end_batch(VALUE arg)
+{
+  struct batch_args * p_args = (struct batch_args *) arg;
   
-  return cm_from_title(3, args, self);
+  imitator_batch_end(p_args->p_conn, p_args->p_batch);
+  return Qnil;
 }
 
 /*
 *call-seq: 
-*  XWindow.wait_for_window_termination( str [, screen = 0 [, display = 0 ] ] ) ==> nil
-*  XWindow.wait_for_window_termination( regexp [, streen = 0 [, display = 0 ] ] ) ==> nil
+*  XWindow.batch(screen = 0 , display = 0){...} ==> anArray
 *
-*Pauses execution flow until *every* window matching the given criteria disappeared. 
+*Queues the window operations made in the block and sends them all at once 
+*when the block ends. 
 *===Parameters
-*[+str+] The window's title. This must match *excatly*. 
-*[+regexp+] The window's title, as a Regular Expression to match. 
-*[+screen+] (0) The screen the window resides on. 
-*[+display+] (0) The screen's display. 
+*[+screen+] (0) The screen whose windows to batch. 
+*[+display+] (0) The display to look for the screen. 
 *===Return value
-*nil. 
+*An array with an element for every queued method call, in the order of the calls: 
+*nil if the operation succeeded, otherwise the XProtocolError it caused. 
+*Nothing is raised for failed operations. 
 *===Example
-*  #Wait until all gedit windows are closed
-*  Imitator::X::XWindow.wait_for_window_termination(/gedit/)
-*  #Wait until Firefox on screen 1 closes
-*  Imitator::X::XWindow.wait_for_window_termination(/Mozilla Firefox/, 1)
+*  #Tile 50 windows with a single round-trip
+*  errors = Imitator::X::XWindow.batch do
+*    windows.each_with_index do |xwin, i|
+*      xwin.move(100 * (i % 10), 100 * (i / 10))
+*      xwin.resize(100, 100)
+*    end
+*  end
+*  p errors.compact #=> []
 *===Remarks
-*If you want to wait for a specific window's termination and you already have 
-*a XWindow object for that one, you can also use the following code which is 
-*probably shorter: 
-*  #... (Get your XWindow instance somewhere)
-*  sleep 0.1 while xwin.exists?
-*This causes Ruby to check every tenth of a second to check if the reference 
-*hold by +xwin+ is still valid, and if not, the loop exits and program flow continues. 
+*These methods are queued: #move, #resize, #raise_win, #map, #unmap, #focus 
+*and #activate. Inside the block they return nil instead of what they usually 
+*return, and nothing has happened yet when they return. Everything else works 
+*as usual, so e.g. #position still tells you the old position. 
+*
+*The operations are sent in the order of the calls. Changes to the position, size 
+*and stacking order of a window right after each other are merged into one 
+*ConfigureWindow request. All requests are sent together, and Imitator for X 
+*waits a single time for the X server to process them. 
+*
+*Only the calls of the current thread on windows of the batch's connection 
+*are queued. Nested batches of the same thread join the outer one and return 
+*an empty array. If the block raises, nothing of what it queued is sent. 
 */
-static VALUE cm_wait_for_window_termination(int argc, VALUE argv[], VALUE self)
+static VALUE cm_batch(int argc, VALUE argv[], VALUE self)
 {
-  VALUE rstr;
-  VALUE rscreen;
-  VALUE rdisplay;
-  VALUE args[3];
-  
-  rb_scan_args(argc, argv, "12", &rstr, &rscreen, &rdisplay);
-  args[0] = rstr;
-  args[1] = rscreen;
-  args[2] = rdisplay;
-  
-  /*Hang around until every window matching the criteria has gone*/
-  while (!RTEST(rb_funcall(cm_search(3, args, self), rb_intern("empty?"), 0)))
-    rb_thread_sleep(1);
+  VALUE screen, display;
+  struct batch_args args;
+  Display * p_display;
   
-  /*Wait another second to be sure that the window can't be worked with*/
-  rb_thread_sleep(1);
+  rb_scan_args(argc, argv, "02", &screen, &display);
+  rb_need_block();
+  args.rconn = get_connection(screen, display);
+  args.p_conn = imitator_get_connection(args.rconn);
+  p_display = imitator_get_display(args.rconn);
   
-  return Qnil;
+  if (imitator_current_batch(p_display) != NULL)
+  {
+    rb_yield(Qnil);
+    return rb_ary_new();
+  }
+  args.p_batch = imitator_batch_begin(args.p_conn);
+  return rb_ensure(run_batch, (VALUE) &args, end_batch, (VALUE) &args);
 }
+
 /****************************Instance methods*************************************/
 
+static VALUE xwindow_alloc(VALUE klass)
+{
+  imitator_xwindow * p_xwin;
+  VALUE self = TypedData_Make_Struct(klass, imitator_xwindow, &xwindow_type, p_xwin);
+  
+  p_xwin->rconn = Qnil;
+  return self;
+}
+
 /*
 *call-seq: 
 *  XWindow.new(window_id, screen = 0, display = 0) ==> aXWindow
@@ -545,7 +2012,7 @@ static VALUE cm_wait_for_window_termination(int argc, VALUE argv[], VALUE self)
 *===Parameters
 *[+window_id+] The ID of the window to get a reference to. 
 *[+screen+] (0) The number of the screen the window is shown on. 
-*[+display+] (0) The number of the display that contains the screen the window is mapped to. 
+*[+display+] (0) The number of the display that contains the screen the window is mapped to, or a Connection. 
 *===Return value
 *A brand new XWindow object. 
 *===Raises
@@ -557,31 +2024,42 @@ static VALUE cm_wait_for_window_termination(int argc, VALUE argv[], VALUE self)
 *  xwin = Imitator::X::XWindow.new(12345, 2)
 *  #Or on screen 3 on display 1 (you almost never need this)
 *  xwin = Imitator::X::XWindow.new(12345, 3, 1)
+*===Remarks
+*The methods returning XWindows, like XWindow.from_title and #parent, give you the 
+*same object for the same window as long as you keep a reference to it (Ruby 2.7 
+*and later). That includes the first XWindow.new object for a window. 
 */
-static VALUE m_initialize(VALUE argc, VALUE argv[], VALUE self)
+static VALUE m_initialize(int argc, VALUE argv[], VALUE self)
 {
   VALUE window_id;
   VALUE screen;
   VALUE display;
-  VALUE display_string = rb_class_new_instance(0, 0, rb_cString);
+  VALUE rconn, rmap, rid;
+  Window win;
   
   rb_scan_args(argc, argv, "12", &window_id, &screen, &display);
   
-  rb_str_concat(display_string, rb_str_new2(":")); /*Ommit hostname, we're only operating locally*/
-  /*Assign the display or default to 0*/
-  if (NIL_P(display))
-    rb_str_concat(display_string, rb_str_new2("0")); 
-  else
-    rb_str_concat(display_string, display);
-  rb_str_concat(display_string, rb_str_new2(".")); /*Screen delimiter*/
-  /*Assign the screen or default to 0*/
-  if (NIL_P(screen))
-    rb_str_concat(display_string, rb_str_new2("0"));
-  else
-    rb_str_concat(display_string, screen);
+  /*Keep the connection, so we don't have to connect again for every method call*/
+  rconn = get_connection(screen, display);
+  win = (Window) NUM2LONG(window_id);
+  set_window(self, rconn, win);
+  
+  /*The key imitator_xwindow_for() looks for, e.g. 5 and not 5.0*/
+  rid = LONG2NUM(win);
+  rmap = get_window_map(rconn);
+  if (!NIL_P(rmap) && NIL_P(rb_funcall(rmap, rb_intern("[]"), 1, rid)))
+    rb_funcall(rmap, rb_intern("[]="), 2, rid, self);
+  return self;
+}
+
+/*
+*Makes +self+ refer to the same window as +other+, for #dup and #clone. 
+*/
+static VALUE m_initialize_copy(VALUE self, VALUE other)
+{
+  imitator_xwindow * p_other = imitator_get_xwindow(other);
   
-  rb_ivar_set(self, rb_intern("@window_id"), window_id);
-  rb_ivar_set(self, rb_intern("@display_string"), display_string);
+  set_window(self, p_other->rconn, p_other->win);
   return self;
 }
 
@@ -592,11 +2070,9 @@ static VALUE m_inspect(VALUE self)
 {
   char str[1000];
   VALUE rstr;
-  VALUE handle;
   
   rstr = rb_funcall(self, rb_intern("title"), 0);
-  handle = rb_funcall(rb_ivar_get(self, rb_intern("@window_id")), rb_intern("to_s"), 1, INT2NUM(16));
-  sprintf(str, "<Imitator::X::XWindow '%s' (0x%s)>", StringValuePtr(rstr), StringValuePtr(handle));
+  snprintf(str, 1000, "<Imitator::X::XWindow '%s' (0x%lx)>", StringValuePtr(rstr), (unsigned long) GET_WINDOW);
   rstr = rb_enc_str_new(str, strlen(str), rb_utf8_encoding());
   return rstr;
 }
@@ -605,6 +2081,8 @@ static VALUE m_inspect(VALUE self)
 *Returns the window's title. 
 *===Return value
 *The window's title. 
+*===Raises
+*[XProtocolError] The window doesn't exist. 
 *===Example
 *  #Get the root window's title. This is not very useful, it's always "(null)". 
 *  puts Imitator::X::XWindow.default_root_window.title #=> (null)
@@ -613,22 +2091,25 @@ static VALUE m_title(VALUE self)
 {
   Display * p_display;
   Window win;
-  XTextProperty xtext;
-  char * cp;
+  char * p_title;
+  imitator_x_error err;
   VALUE rstr;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  win = NUM2LONG(rb_ivar_get(self, rb_intern("@window_id")));
-  XGetWMName(p_display, win, &xtext);
-  cp = malloc(sizeof(char) * xtext.nitems);
-  sprintf(cp, "%s", xtext.value);
-  rstr = XSTR_TO_RSTR(cp);
+  win = GET_WINDOW;
+  imitator_cached_get_titles(p_display, &win, 1, &p_title, &err);
+  /*A window that doesn't exist is an error as always, one without a name isn't*/
+  if (err.error_code != 0)
+  {
+    free(p_title);
+    imitator_raise_x_error(p_display, &err);
+  }
+  if (p_title == NULL)
+    return rb_str_new2("(null)");
+  rstr = UTF8_TO_RSTR(p_title);
   
-  XFree(xtext.value);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  free(p_title);
   return rstr;
 }
 
@@ -642,7 +2123,19 @@ static VALUE m_title(VALUE self)
 */
 static VALUE m_window_id(VALUE self)
 {
-  return rb_ivar_get(self, rb_intern("@window_id"));
+  return LONG2NUM(GET_WINDOW);
+}
+
+/*
+*Returns the connection this window was created with. 
+*===Return value
+*The Imitator::X::Connection this window's methods use. 
+*===Example
+*  Imitator::X::XWindow.default_root_window.connection.equal?(Imitator::X::Connection.default) #=> true
+*/
+static VALUE m_connection(VALUE self)
+{
+  return imitator_get_xwindow(self)->rconn;
 }
 
 /*
@@ -660,19 +2153,11 @@ static VALUE m_root_win(VALUE self)
   Display * p_display;
   Window win = GET_WINDOW;
   XWindowAttributes xattr;
-  VALUE args[1];
-  VALUE rroot_win;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
-  
-  XGetWindowAttributes(p_display, win, &xattr);
-  args[0] = LONG2NUM(xattr.root);
-  rroot_win = rb_class_new_instance(1, args, XWindow);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return rroot_win;
+  imitator_get_window_attributes(p_display, win, &xattr);
+  return imitator_xwindow_for(imitator_get_xwindow(self)->rconn, xattr.root);
 }
 
 /*
@@ -687,23 +2172,15 @@ static VALUE m_parent(VALUE self)
 {
   Display * p_display;
   Window win = GET_WINDOW;
-  Window root_win, parent;
+  Window parent;
   Window * p_children;
   unsigned int nchildren;
-  VALUE args[1];
-  VALUE result;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XQueryTree(p_display, win, &root_win, &parent, &p_children, &nchildren);
-  args[0] = LONG2NUM(parent);
-  result = rb_class_new_instance(1, args, XWindow);
-  
-  XFree(p_children);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return result;
+  imitator_cached_query_tree(p_display, win, &parent, &p_children, &nchildren);
+  free(p_children);
+  return imitator_xwindow_for(imitator_get_xwindow(self)->rconn, parent);
 }
 
 /*
@@ -714,18 +2191,13 @@ static VALUE m_parent(VALUE self)
 *  #Get a list of all windows that are searched by XWindow.search
 *  Imitator::X::XWindow.default_root_window.children #=> [...]
 *===Remarks
-*I orginally wanted to return an array of XWindow obejcts, but everytime 
-*I tried to #inspect the created array, I got a segfault, memory corruption or 
-*malloc failed assertion. When only inspecting parts of the array, everything goes fine. 
-*So, don't try to map the list returned by this method into an array and then inspect it. 
-*E-mail me at sutniuq$gmx:net if you know a solution... See also the commented-out source 
-*in the for loop inside this function. 
+*If you want XWindow objects, use <tt>each_descendant(1)</tt>. 
 */
 static VALUE m_children(VALUE self)
 {
   Display * p_display;
   Window win = GET_WINDOW;
-  Window root_win, parent;
+  Window parent;
   Window * p_children;
   unsigned int num_children;
   int i;
@@ -734,9 +2206,8 @@ static VALUE m_children(VALUE self)
   //VALUE rtemp;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XQueryTree(p_display, win, &root_win, &parent, &p_children, &num_children);
+  imitator_cached_query_tree(p_display, win, &parent, &p_children, &num_children);
   for(i = 0;i < num_children; i++)
   {
     //printf("%lu\n", *(p_children + i));
@@ -746,12 +2217,51 @@ static VALUE m_children(VALUE self)
     rb_ary_push(result, LONG2NUM(*(p_children + i)));
   }
   
-  XFree(p_children);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  free(p_children);
   return result;
 }
 
+/*
+*call-seq: 
+*  each_descendant( [ depth = nil ] ){|xwin| ...} ==> self
+*  each_descendant( [ depth = nil ] ) ==> anEnumerator
+*
+*Walks through the windows below +self+, layer by layer: first the children, 
+*then the grandchildren and so on. 
+*===Parameters
+*[+depth+] (nil) The number of layers to walk, +nil+ means all. 
+*===Return value
+*self, or an Enumerator if you don't give a block. 
+*===Example
+*  root = Imitator::X::XWindow.default_root_window
+*  #The children as XWindow objects
+*  root.each_descendant(1).to_a #=> [<Imitator::X::XWindow ...>, ...]
+*  #Stops walking at the first match
+*  root.each_descendant.find{|xwin| xwin.title =~ /imitator/}
+*===Remarks
+*See XWindow.each. 
+*/
+static VALUE m_each_descendant(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rdepth;
+  struct walk_args args;
+  Window parent_win;
+  
+  RETURN_ENUMERATOR(self, argc, argv);
+  rb_scan_args(argc, argv, "01", &rdepth);
+  
+  memset(&args, 0, sizeof(struct walk_args));
+  args.rconn = imitator_get_xwindow(self)->rconn;
+  args.p_display = get_win_display(self);
+  args.max_depth = NIL_P(rdepth) ? -1 : NUM2INT(rdepth);
+  if (args.max_depth == 0)
+    return self;
+  imitator_cached_query_tree(args.p_display, GET_WINDOW, &parent_win, &args.p_layer, &args.layer_size);
+  
+  rb_ensure(walk_tree, (VALUE) &args, end_walk, (VALUE) &args);
+  return self;
+}
+
 /*
 *Returns true if +self+ is a root window. 
 *===Return value
@@ -772,9 +2282,8 @@ static VALUE m_is_root_win(VALUE self)
   VALUE result;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XQueryTree(p_display, win, &root_win, &parent, &p_children, &num_children);
+  imitator_query_tree(p_display, win, &root_win, &parent, &p_children, &num_children);
   
   if (parent == 0)
     result = Qtrue;
@@ -782,8 +2291,6 @@ static VALUE m_is_root_win(VALUE self)
     result = Qfalse;
   
   XFree(p_children);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return result;
 }
 
@@ -799,18 +2306,16 @@ static VALUE m_position(VALUE self)
 {
   Display * p_display;
   Window win = GET_WINDOW;
-  XWindowAttributes xattr;
+  int x, y;
+  unsigned int width, height;
   VALUE pos = rb_ary_new();
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XGetWindowAttributes(p_display, win, &xattr);
-  rb_ary_push(pos, INT2NUM(xattr.x));
-  rb_ary_push(pos, INT2NUM(xattr.y));
+  imitator_cached_get_geometry(p_display, win, &x, &y, &width, &height);
+  rb_ary_push(pos, INT2NUM(x));
+  rb_ary_push(pos, INT2NUM(y));
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return pos;
 }
 
@@ -826,18 +2331,16 @@ static VALUE m_size(VALUE self)
 {
   Display * p_display;
   Window win = GET_WINDOW;
-  XWindowAttributes xattr;
+  int x, y;
+  unsigned int width, height;
   VALUE size = rb_ary_new();
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XGetWindowAttributes(p_display, win, &xattr);
-  rb_ary_push(size, INT2NUM(xattr.width));
-  rb_ary_push(size, INT2NUM(xattr.height));
+  imitator_cached_get_geometry(p_display, win, &x, &y, &width, &height);
+  rb_ary_push(size, UINT2NUM(width));
+  rb_ary_push(size, UINT2NUM(height));
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return size;
 }
 
@@ -862,9 +2365,8 @@ static VALUE m_is_visible(VALUE self)
   VALUE result;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XGetWindowAttributes(p_display, win, &xattr);
+  imitator_get_window_attributes(p_display, win, &xattr);
   if (xattr.class == InputOnly)
     result = Qfalse; /*Input-only windows are always invisible*/
   else
@@ -875,8 +2377,6 @@ static VALUE m_is_visible(VALUE self)
       result = Qtrue;
   }
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return result;
 }
 
@@ -901,34 +2401,43 @@ static VALUE m_is_mapped(VALUE self)
   VALUE result;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  XGetWindowAttributes(p_display, win, &xattr);
+  imitator_get_window_attributes(p_display, win, &xattr);
   if (xattr.map_state == IsUnmapped || xattr.map_state == IsUnviewable)
     result = Qfalse;
   else
     result = Qtrue;
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
   return result;
 }
 
 /*
 *call-seq: 
-*  move(x, y) ==> anArray
+*  move(x, y [, mode = :query [, timeout = 1 ] ] ) ==> anArray or nil
 *
 *Moves +self+ to the specified position. 
 *===Parameters
 *[+x+] The goal X coordinate. 
 *[+y+] The goal Y coordinate. 
+*[+mode+] (:query) How to wait for the window to move: 
+*         [:query] Ask X for the window's position afterwards. 
+*         [:async] Just send the request, don't wait at all. 
+*         [:confirm] Wait for the window manager to move the window and return the position it chose. 
+*[+timeout+] (1) The maximum number of seconds to wait for in the :confirm mode. 
 *===Return value
-*The window's new position. 
+*The window's new position, or nil in the :async mode and inside XWindow.batch. 
+*===Raises
+*[ArgumentError] Unknown +mode+. 
+*[XProtocolError] +self+ doesn't exist. Not in the :async mode, see remarks. 
 *===Example
 *  xwin = Imitator::X::XWindow.from_title(/imitator/)
 *  #Move the window to (100|100)
 *  xwin.move(100, 100) #=> [103, 123]
 *  xwin.pos #=> [103, 123] #See remarks
+*  #Fast, but you don't know where it ends up
+*  xwin.move(200, 200, :async) #=> nil
+*  #Where the window manager put the window
+*  xwin.move(300, 300, :confirm) #=> [300, 300]
 *===Remarks
 *It's impossible to set a window exactly to that coordinate you want. It seems, 
 *that X sets and retrieves a window's position at the upper-left coordinate of a window's client area, 
@@ -938,59 +2447,93 @@ static VALUE m_is_mapped(VALUE self)
 *
 *Also, this function can't move the window off the screen. If you try to, the window will 
 *be moved as near to the screen's edge as possible. 
+*
+*Window managers move windows whenever they like, so the position returned in the :query 
+*mode may be the old one. The :confirm mode waits for the ConfigureNotify event the move 
+*causes instead. A window manager that reparented the window sends that event itself, with 
+*coordinates relative to the root window. If no event comes within +timeout+ seconds, 
+*the current position is returned like in the :query mode. 
+*
+*In the :async mode a nonexistant window isn't reported until the next 
+*Connection#sync. 
 */
-static VALUE m_move(VALUE self, VALUE rx, VALUE ry)
+static VALUE m_move(int argc, VALUE argv[], VALUE self)
 {
-  Display * p_display;
-  Window win = GET_WINDOW;
-  int x = NUM2INT(rx);
-  int y = NUM2INT(ry);
-  
-  p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  VALUE rx, ry, rmode, rtimeout;
+  XWindowChanges changes;
+  VALUE pos;
+  unsigned long serial;
   
-  XMoveWindow(p_display, win, x, y);
+  rb_scan_args(argc, argv, "22", &rx, &ry, &rmode, &rtimeout);
+  changes.x = NUM2INT(rx);
+  changes.y = NUM2INT(ry);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return m_position(self);
+  switch (configure_window(self, CWX | CWY, &changes, rmode, rtimeout, &serial))
+  {
+    case CONFIGURE_QUERY:
+      return query_configured(self, m_position, serial);
+    case CONFIGURE_CONFIRM:
+      pos = rb_ary_new();
+      rb_ary_push(pos, INT2NUM(changes.x));
+      rb_ary_push(pos, INT2NUM(changes.y));
+      return pos;
+    default:
+      return Qnil;
+  }
 }
 
 /*
 *call-seq: 
-*  resize(width, height) ==> anArray
+*  resize(width, height [, mode = :query [, timeout = 1 ] ] ) ==> anArray or nil
 *
 *Resizes a window. 
 *===Parameters
 *[+width+] The desired width, in pixels. 
 *[+height+] The desired height, in pixels. 
+*[+mode+] (:query) How to wait for the window to change, see #move. 
+*[+timeout+] (1) The maximum number of seconds to wait for in the :confirm mode. 
 *===Return value
-*The new window size. 
+*The new window size, or nil in the :async mode and inside XWindow.batch. 
+*===Raises
+*[ArgumentError] Unknown +mode+. 
+*[XProtocolError] +self+ doesn't exist. Not in the :async mode. 
 *===Example
 *  xwin = Imitator::X::XWindow.from_title(/imitator/)
 *  #Resize the window to 400x400px
 *  xwin.resize(400, 400) #=> [400, 400]
 *  xwin.size #=> [400, 400]
+*  #The size the window manager allowed
+*  xwin.resize(10, 10, :confirm) #=> [120, 80]
 *===Remarks
 *Some windows have a minumum width value set. If a windows has, you can't change it's size 
 *to a smaller value than that one. Also, it's impossible to make a window larger than the screen. 
 *In any of those cases, the window will be resized to the minimum/maximum acceptable value. 
+*
+*See #move for the modes. 
 */
-static VALUE m_resize(VALUE self, VALUE rwidth, VALUE rheight)
+static VALUE m_resize(int argc, VALUE argv[], VALUE self)
 {
-  Display * p_display;
-  Window win = GET_WINDOW;
-  unsigned int width = NUM2UINT(rwidth);
-  unsigned int height = NUM2UINT(rheight);
-  
-  p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  VALUE rwidth, rheight, rmode, rtimeout;
+  XWindowChanges changes;
+  VALUE size;
+  unsigned long serial;
   
-  XResizeWindow(p_display, win, width, height);
+  rb_scan_args(argc, argv, "22", &rwidth, &rheight, &rmode, &rtimeout);
+  changes.width = NUM2UINT(rwidth);
+  changes.height = NUM2UINT(rheight);
   
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return m_size(self);
+  switch (configure_window(self, CWWidth | CWHeight, &changes, rmode, rtimeout, &serial))
+  {
+    case CONFIGURE_QUERY:
+      return query_configured(self, m_size, serial);
+    case CONFIGURE_CONFIRM:
+      size = rb_ary_new();
+      rb_ary_push(size, UINT2NUM(changes.width));
+      rb_ary_push(size, UINT2NUM(changes.height));
+      return size;
+    default:
+      return Qnil;
+  }
 }
 
 /*
@@ -1010,15 +2553,22 @@ static VALUE m_resize(VALUE self, VALUE rwidth, VALUE rheight)
 static VALUE m_raise_win(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
+  imitator_batch * p_batch;
+  XWindowChanges changes;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
+  if ((p_batch = imitator_current_batch(p_display)) != NULL)
+  {
+    changes.stack_mode = Above; /*That's what XRaiseWindow() does*/
+    imitator_batch_configure(p_batch, win, CWStackMode, &changes);
+    return Qnil;
+  }
   XRaiseWindow(p_display, win);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial); /*Report errors now, not at some later call*/
   return Qnil;
 }
 
@@ -1036,15 +2586,20 @@ static VALUE m_raise_win(VALUE self)
 static VALUE m_focus(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
+  imitator_batch * p_batch;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
+  if ((p_batch = imitator_current_batch(p_display)) != NULL)
+  {
+    imitator_batch_add(p_batch, win, IMITATOR_BATCH_FOCUS);
+    return Qnil;
+  }
   XSetInputFocus(p_display, win, RevertToNone, CurrentTime);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1060,14 +2615,13 @@ static VALUE m_focus(VALUE self)
 static VALUE m_unfocus(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
   XSetInputFocus(p_display, None, RevertToNone, CurrentTime);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1090,15 +2644,20 @@ static VALUE m_unfocus(VALUE self)
 static VALUE m_map(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
+  imitator_batch * p_batch;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
+  if ((p_batch = imitator_current_batch(p_display)) != NULL)
+  {
+    imitator_batch_add(p_batch, win, IMITATOR_BATCH_MAP);
+    return Qnil;
+  }
   XMapWindow(p_display, win);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1115,15 +2674,20 @@ static VALUE m_map(VALUE self)
 static VALUE m_unmap(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
+  imitator_batch * p_batch;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
+  if ((p_batch = imitator_current_batch(p_display)) != NULL)
+  {
+    imitator_batch_add(p_batch, win, IMITATOR_BATCH_UNMAP);
+    return Qnil;
+  }
   XUnmapWindow(p_display, win);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1142,32 +2706,24 @@ static VALUE m_unmap(VALUE self)
 static VALUE m_activate(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
-  XEvent xevt;
   XWindowAttributes xattr;
-  Window root;
+  imitator_batch * p_batch;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
-  check_for_ewmh(p_display, "_NET_ACTIVE_WINDOW");
+  check_for_ewmh(p_display, IMITATOR_ATOM_NET_ACTIVE_WINDOW);
+  if ((p_batch = imitator_current_batch(p_display)) != NULL)
+  {
+    imitator_batch_add(p_batch, win, IMITATOR_BATCH_ACTIVATE); /*The connection's root is the window's*/
+    return Qnil;
+  }
   /*We're going to notify the root window*/
-  XGetWindowAttributes(p_display, win, &xattr);
-  root = xattr.root;
-  
-  xevt.type = ClientMessage; /*It's a message for a client*/
-  xevt.xclient.display = p_display;
-  xevt.xclient.window = win;
-  xevt.xclient.message_type = XInternAtom(p_display, "_NET_ACTIVE_WINDOW", False); /*Activate request*/
-  xevt.xclient.format = 32; /*Using 32-bit messages*/
-  xevt.xclient.data.l[0] = 2L;
-  xevt.xclient.data.l[1] = CurrentTime;
-  
-  /*Actually send the event; this has to happen to all child windows of the target window. */
-  XSendEvent(p_display, root, False, SubstructureNotifyMask | SubstructureRedirectMask, &xevt);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_get_window_attributes(p_display, win, &xattr);
+  imitator_send_active_window_message(p_display, win, xattr.root);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1176,48 +2732,36 @@ static VALUE m_activate(VALUE self)
 *===Return value
 *The PID of the window process. 
 *===Raises
-*[XError] Failed to retrieve the window's PID. Either your window manager does not support EWMH at all, _NET_WM_PID in special, or your queried window hasn't set this property (see _Remarks_). 
+*[XError] Failed to retrieve the window's PID (see _Remarks_). 
+*[XProtocolError] The window doesn't exist. 
 *===Example
 *  puts  Imitator::X::XWindow.from_title(/imitator/).pid #=> 4478
 *===Remarks
-*This method is part of the EWMH standard _NET_WM_PID. 
+*This method reads the EWMH property _NET_WM_PID. Not every program sets it, 
+*so if the X server has the X-Resource extension, it's asked for the PID of the 
+*client that created the window instead. That also works for the windows of 
+*remote clients, but isn't the PID on your machine then. If both fail, 
+*an XError is raised. 
 *
-*This method may fail even if the window manager supports the _NET_WM_PID standard, beacuse 
-*the use of _NET_WM_PID isn't enforced. Some programs don't use it, and those will cause this 
-*method to fail. The most prominent example is the default root window, which doesn't have the 
-*_NET_WM_PID property set (at least on my Ubuntu Karmic). 
+*With the window cache on (see Connection#window_cache=), the PID is 
+*remembered until the window changes _NET_WM_PID. 
 */
 static VALUE m_pid(VALUE self)
 {
   Display * p_display;
   Window win = GET_WINDOW;
-  Atom actual_type;
-  int obtain_prop, actual_format, pid;
-  unsigned long nitems;
-  unsigned long bytes;
-  unsigned char * property;
-  VALUE result;
+  long pid;
+  imitator_x_error err;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
   
-  //check_for_ewmh(p_display, "_NET_WM_PID"); /*For some unknown reason, this always fails*/
-  obtain_prop = XInternAtom(p_display, "_NET_WM_PID", True);
+  imitator_cached_get_pids(p_display, &win, 1, &pid, &err);
+  if (err.error_code != 0) /*The window doesn't exist*/
+    imitator_raise_x_error(p_display, &err);
+  if (pid == -1)
+    rb_raise(XError, "Could not get the PID of window %lu!", win);
   
-  XGetWindowProperty(p_display, win, obtain_prop, 0, 1000000, False, AnyPropertyType, &actual_type, &actual_format, &nitems, &bytes, &property);
-  if (property == None)
-    rb_raise(XError, "Could not get _NET_WM_PID attribute!");
-  
-  /*OK, got the property. Compute the PID. I don't know why this works, I 
-  *just saw the arithmetic somewhere on the Internet. */
-  pid = property[1] * 256;
-  pid += property[0];
-  result = INT2NUM(pid);
-  
-  XFree(property);
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
-  return result;
+  return LONG2NUM(pid);
 }
 
 /*
@@ -1235,15 +2779,14 @@ static VALUE m_pid(VALUE self)
 static VALUE m_kill(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
   XDestroyWindow(p_display, win);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1262,15 +2805,14 @@ static VALUE m_kill(VALUE self)
 static VALUE m_bang_kill(VALUE self)
 {
   Display * p_display;
+  unsigned long serial;
   Window win = GET_WINDOW;
   
   p_display = get_win_display(self);
-  XSetErrorHandler(handle_x_errors);
+  serial = NextRequest(p_display);
   
   XKillClient(p_display, win);
-  
-  XSetErrorHandler(NULL);
-  XCloseDisplay(p_display);
+  imitator_sync(p_display, serial);
   return Qnil;
 }
 
@@ -1332,7 +2874,7 @@ static VALUE m_close(VALUE self)
 
 /*
 *Checks weather +self+ exists or not by calling XWindow.exists? with 
-*the information of this object. 
+*the connection of this object. 
 *===Return value
 *true or false. 
 *===Example
@@ -1344,17 +2886,120 @@ static VALUE m_close(VALUE self)
 static VALUE m_exists(VALUE self)
 {
   VALUE args[3];
-  VALUE rmatch_data, screen, display;
-  
-  rmatch_data = rb_funcall(rb_ivar_get(self, rb_intern("@display_string")), rb_intern("match"), 1, rb_reg_new("\\:(\\d+?)\\.(\\d+?)", strlen("\\:(\\d+?)\\.(\\d+?)"), 0));
-  display = rb_funcall(rb_reg_nth_match(1, rmatch_data), rb_intern("to_i"), 0);
-  screen = rb_funcall(rb_reg_nth_match(2, rmatch_data), rb_intern("to_i"), 0);
-  args[0] = rb_ivar_get(self, rb_intern("@window_id"));
-  args[1] = screen;
-  args[2] = display;
+  
+  args[0] = LONG2NUM(GET_WINDOW);
+  args[1] = Qnil;
+  args[2] = imitator_get_xwindow(self)->rconn;
   return cm_exists(3, args, XWindow);
 }
 
+/*
+*call-seq: 
+*  wait_until_destroyed( [ timeout = nil ] ) ==> true or false
+*
+*Pauses execution flow until +self+ is destroyed. 
+*===Parameters
+*[+timeout+] (nil) The maximum number of seconds to wait. +nil+ means forever. 
+*===Return value
+*true if the window is gone, false if the timeout expired. 
+*===Example
+*  xwin = Imitator::X::XWindow.from_title(/imitator/)
+*  xwin.close
+*  xwin.wait_until_destroyed(5) #=> true
+*===Remarks
+*This method listens for the window's DestroyNotify event, so it returns 
+*as soon as the X server reports the window gone. It replaces the polling 
+*  sleep 0.1 while xwin.exists?
+*/
+static VALUE m_wait_until_destroyed(int argc, VALUE argv[], VALUE self)
+{
+  VALUE rtimeout;
+  struct wait_args args;
+  
+  rb_scan_args(argc, argv, "01", &rtimeout);
+  args.self = self;
+  args.search_args[0] = LONG2NUM(GET_WINDOW);
+  args.search_args[1] = Qnil;
+  args.search_args[2] = Qnil;
+  args.p_conn = imitator_get_xwindow(self)->p_conn;
+  args.p_display = get_win_display(self);
+  args.deadline = NIL_P(rtimeout) ? -1 : imitator_stats_now() + NUM2DBL(rtimeout);
+  
+  return with_window_cache(&args, wait_until_destroyed);
+}
+
+/*
+*call-seq: 
+*  on(event){|evt| ...} ==> aProc
+*
+*Calls the block whenever X reports +event+ for +self+. 
+*===Parameters
+*[+event+] The kind of events to listen for: 
+*          [:configure] The window was moved, resized or restacked. 
+*          [:property] One of the window's properties changed, e.g. its title. 
+*          [:map] The window was mapped. 
+*          [:unmap] The window was unmapped. 
+*          [:destroy] The window was destroyed. All its blocks are removed afterwards. 
+*          [:focus] The window got or lost the input focus. 
+*===Return value
+*The block as a Proc, for #off. 
+*===Raises
+*[ArgumentError] Unknown +event+ or no block given. 
+*[XProtocolError] +self+ doesn't exist. 
+*===Example
+*  xwin = Imitator::X::XWindow.from_title(/imitator/)
+*  xwin.on(:configure){|evt| p [evt.x, evt.y, evt.width, evt.height]}
+*  xwin.on(:property){|evt| puts "New title: #{evt.window.title}" if evt.property == "_NET_WM_NAME"}
+*  xwin.on(:destroy){puts "Gone!"}
+*===Remarks
+*The block gets a XWindow::Event. Its +type+ is the +event+ (:focus_in or :focus_out for :focus), 
+*+window+ is the XWindow the event is about, +x+, +y+, +width+ and +height+ are only set for 
+*:configure and +property+ (the property's name) only for :property events. 
+*
+*The blocks of a connection are called by its event pump, a thread that waits for 
+*X events without holding the GVL and runs as long as any block is registered. It 
+*calls the blocks with all events that arrived together, in order. An exception 
+*raised by a block is shown as a warning. 
+*/
+static VALUE m_on(VALUE self, VALUE revent)
+{
+  enum imitator_subscription_kind kind = imitator_subscription_kind_of(revent);
+  imitator_xwindow * p_xwin = imitator_get_xwindow(self);
+  VALUE proc;
+  
+  if (!rb_block_given_p())
+    rb_raise(rb_eArgError, "No block given!");
+  proc = rb_block_proc();
+  
+  imitator_subscribe(p_xwin->rconn, p_xwin->win, kind, False, proc);
+  return proc;
+}
+
+/*
+*call-seq: 
+*  off( [ event = nil [, proc = nil ] ] ) ==> anInteger
+*
+*Removes blocks registered with #on. 
+*===Parameters
+*[+event+] (nil) Only remove the blocks for this kind of events. +nil+ means all. 
+*[+proc+] (nil) Only remove this block, as returned by #on. +nil+ means all. 
+*===Return value
+*The number of blocks removed. 
+*===Example
+*  xwin = Imitator::X::XWindow.from_title(/imitator/)
+*  block = xwin.on(:map){|evt| p evt}
+*  xwin.off(:map, block) #=> 1
+*  xwin.off #=> Removes all the others
+*/
+static VALUE m_off(int argc, VALUE argv[], VALUE self)
+{
+  VALUE revent, proc;
+  imitator_xwindow * p_xwin = imitator_get_xwindow(self);
+  
+  rb_scan_args(argc, argv, "02", &revent, &proc);
+  return INT2NUM(imitator_unsubscribe(p_xwin->rconn, p_xwin->win, NIL_P(revent) ? -1 : (int) imitator_subscription_kind_of(revent), False, proc));
+}
+
 /*
 *call-seq: 
 *  xwin.eql?( other_xwin ) ==> true or false
@@ -1378,41 +3023,69 @@ static VALUE m_exists(VALUE self)
 */
 static VALUE m_is_equal_to(VALUE self, VALUE other)
 {
-  VALUE self_id = rb_ivar_get(self, rb_intern("@window_id"));
-  VALUE other_id = rb_ivar_get(other, rb_intern("@window_id"));
-  
-  return rb_funcall(self_id, rb_intern("=="), 1, other_id);
+  if (self == other)
+    return Qtrue;
+  if (!rb_typeddata_is_kind_of(other, &xwindow_type))
+    return Qfalse;
+  return GET_WINDOW == imitator_get_xwindow(other)->win ? Qtrue : Qfalse;
 }
 /***********************Init-Function*******************************/
 
 void Init_xwindow(void)
 {
+  int state = 0;
+  
   XWindow = rb_define_class_under(X, "XWindow", rb_cObject);
+  rb_define_alloc_func(XWindow, xwindow_alloc);
+  /*For the window maps*/
+  weak_map_class = rb_protect(probe_weak_map, Qnil, &state);
+  if (state)
+  {
+    weak_map_class = Qnil;
+    rb_set_errinfo(Qnil);
+  }
+  rb_global_variable(&weak_map_class);
+  /*The result of XWindow.attributes_for*/
+  WindowAttributes = rb_struct_define_under(XWindow, "Attributes", "window_id", "x", "y", "width", "height", "border_width", "map_state", "window_class", "root", NULL);
+  /*What XWindow#on blocks get*/
+  WindowEvent = rb_struct_define_under(XWindow, "Event", "type", "window", "x", "y", "width", "height", "property", NULL);
   
   rb_define_singleton_method(XWindow, "default_root_window", cm_default_root_window, 0);
+  rb_define_singleton_method(XWindow, "ewmh_supported?", cm_ewmh_supported, -1);
   rb_define_singleton_method(XWindow, "exists?", cm_exists, -1);
-  rb_define_singleton_method(XWindow, "xquery", cm_xquery, 2); /* :nodoc: */
+  rb_define_singleton_method(XWindow, "exists_many?", cm_exists_many, -1);
+  rb_define_singleton_method(XWindow, "attributes_for", cm_attributes_for, -1);
+  rb_define_singleton_method(XWindow, "clients", cm_clients, -1);
+  rb_define_singleton_method(XWindow, "for_pid", cm_for_pid, -1);
   rb_define_singleton_method(XWindow, "search", cm_search, -1);
+  rb_define_singleton_method(XWindow, "select", cm_select, -1);
   rb_define_singleton_method(XWindow, "from_title", cm_from_title, -1);
   rb_define_singleton_method(XWindow, "from_focused", cm_from_focused, -1);
   rb_define_singleton_method(XWindow, "from_active", cm_from_active, -1);
   rb_define_singleton_method(XWindow, "wait_for_window", cm_wait_for_window, -1);
   rb_define_singleton_method(XWindow, "wait_for_window_termination", cm_wait_for_window_termination, -1);
+  rb_define_singleton_method(XWindow, "batch", cm_batch, -1);
+  rb_define_singleton_method(XWindow, "each", cm_each, -1);
+  rb_define_singleton_method(XWindow, "on", cm_on, -1);
+  rb_define_singleton_method(XWindow, "off", cm_off, -1);
   
   rb_define_method(XWindow, "initialize", m_initialize, -1);
+  rb_define_method(XWindow, "initialize_copy", m_initialize_copy, 1);
   rb_define_method(XWindow, "inspect", m_inspect, 0);
   rb_define_method(XWindow, "title", m_title, 0);
   rb_define_method(XWindow, "window_id", m_window_id, 0);
+  rb_define_method(XWindow, "connection", m_connection, 0);
   rb_define_method(XWindow, "root_win", m_root_win, 0);
   rb_define_method(XWindow, "parent", m_parent, 0);
   rb_define_method(XWindow, "children", m_children, 0);
+  rb_define_method(XWindow, "each_descendant", m_each_descendant, -1);
   rb_define_method(XWindow, "root_win?", m_is_root_win, 0);
   rb_define_method(XWindow, "position", m_position, 0);
   rb_define_method(XWindow, "size", m_size, 0);
   rb_define_method(XWindow, "visible?", m_is_visible, 0);
   rb_define_method(XWindow, "mapped?", m_is_mapped, 0);
-  rb_define_method(XWindow, "move", m_move, 2);
-  rb_define_method(XWindow, "resize", m_resize, 2);
+  rb_define_method(XWindow, "move", m_move, -1);
+  rb_define_method(XWindow, "resize", m_resize, -1);
   rb_define_method(XWindow, "raise_win", m_raise_win, 0);
   rb_define_method(XWindow, "focus", m_focus, 0);
   rb_define_method(XWindow, "unfocus", m_unfocus, 0);
@@ -1425,6 +3098,9 @@ void Init_xwindow(void)
   rb_define_method(XWindow, "kill_process", m_kill_process, -1);
   rb_define_method(XWindow, "close", m_close, 0);
   rb_define_method(XWindow, "exists?", m_exists, 0);
+  rb_define_method(XWindow, "wait_until_destroyed", m_wait_until_destroyed, -1);
+  rb_define_method(XWindow, "on", m_on, 1);
+  rb_define_method(XWindow, "off", m_off, -1);
   rb_define_method(XWindow, "eql?", m_is_equal_to, 1);
   
   rb_define_alias(XWindow, "to_s", "title");
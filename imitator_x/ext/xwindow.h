@@ -20,17 +20,32 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef IMITATOR_XWINDOW_HEADER
 #define IMITATOR_XWINDOW_HEADER
 
-/*Gets the window ID of self and converts it to a Window. A Window is just a long. */
-#define GET_WINDOW (Window) NUM2LONG(rb_ivar_get(self, rb_intern("@window_id")))
+/*The native part of an Imitator::X::XWindow*/
+typedef struct {
+  Window win;
+  /*The Connection the window was created with*/
+  VALUE rconn;
+  /*Its native part, to get the Display quickly*/
+  struct imitator_connection_s * p_conn;
+} imitator_xwindow;
 
-/*Converts a string returned by a X function (cp), a char *, to a ruby string 
-*(encoded in ISO-88591; I couldn't find out how to get the locale encoding out of X, 
-*so you may have to change this if ISO-8859-1 isn't your X Server's locale) and then 
-*to an UTF-8-encoded string. */
-#define XSTR_TO_RSTR(cp) rb_str_export_to_enc(rb_enc_str_new(cp, strlen(cp), rb_enc_find("ISO-8859-1")), rb_utf8_encoding())
+/*Gets the Window of self. A Window is just a long. */
+#define GET_WINDOW (imitator_get_xwindow(self)->win)
+
+/*Converts a UTF-8 string (like the titles from pipeline.h) to a ruby string*/
+#define UTF8_TO_RSTR(cp) rb_enc_str_new(cp, strlen(cp), rb_utf8_encoding())
 
 /*Imitator::X::XWindow*/
 VALUE XWindow;
+/*Imitator::X::XWindow::Attributes*/
+VALUE WindowAttributes;
+/*Imitator::X::XWindow::Event*/
+VALUE WindowEvent;
+
+/*Returns the native part of the XWindow +rxwin+. Raises a TypeError for non-XWindows. */
+imitator_xwindow * imitator_get_xwindow(VALUE rxwin);
+/*Returns the XWindow for +win+ on the Connection +rconn+. It's the same object as long as somebody references it. */
+VALUE imitator_xwindow_for(VALUE rconn, Window win);
 
 /*XWindow initialization function*/
 void Init_xwindow(void);
@@ -0,0 +1,121 @@
+#!/usr/bin/env ruby
+#Encoding: UTF-8
+=begin
+--
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright © 2010 Marvin Gülker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+++
+=end
+
+#Ensure we use the correct key combinations file
+$imitator_x_charfile_path = File.join(File.expand_path(File.dirname(__FILE__)), "..", "lib", "imitator_x_special_chars.yml")
+
+require "test/unit"
+require_relative "../lib/imitator/x"
+
+class ConnectionTest < Test::Unit::TestCase
+  
+  def test_shared
+    assert_same(Imitator::X::Connection.open, Imitator::X::Connection.open)
+    assert_same(Imitator::X::Connection.open, Imitator::X::Connection.default)
+    assert_same(Imitator::X::Connection.open(":0.0"), Imitator::X::XWindow.default_root_window.connection)
+  end
+  
+  def test_close
+    conn = Imitator::X::Connection.new
+    assert(!conn.closed?)
+    conn.close
+    assert(conn.closed?)
+    assert_raise(Imitator::X::XError){conn.sync}
+  end
+  
+  def test_use
+    conn = Imitator::X::Connection.new
+    conn.use do
+      assert_same(conn, Imitator::X::Connection.default)
+      assert_kind_of(Array, Imitator::X::Mouse.position)
+    end
+    assert_not_same(conn, Imitator::X::Connection.default)
+    conn.close
+  end
+  
+  def test_xwindow
+    conn = Imitator::X::Connection.new
+    root = Imitator::X::XWindow.new(Imitator::X::XWindow.default_root_window.window_id, 0, conn)
+    assert(root.root_win?)
+    assert(root.exists?)
+    conn.close
+  end
+  
+  def test_threads
+    counter = 0
+    ticker = Thread.new{loop{counter += 1; Thread.pass}}
+    threads = 4.times.map{Thread.new{10.times{Imitator::X::XWindow.default_root_window.children}}}
+    threads.each(&:join)
+    ticker.kill
+    assert(counter > 0)
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).title}
+    assert(Imitator::X::XWindow.default_root_window.exists?) #Nothing left over from the error above
+  end
+  
+  def test_errors
+    err = assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).unmap}
+    assert_equal(3, err.error_code) #BadWindow
+    assert_equal(1, err.resource_id)
+    assert_kind_of(Integer, err.serial)
+    assert_nothing_raised{Imitator::X::Connection.default.sync} #Already raised
+  end
+  
+  def test_events
+    conn = Imitator::X::Connection.new
+    assert_equal([], Imitator::X.events(connection: conn))
+    assert_kind_of(Array, Imitator::X.events(since: 10, connection: conn))
+    conn.close
+    assert_raise(Imitator::X::XError){Imitator::X.events(connection: conn)}
+  end
+  
+  def test_window_cache
+    conn = Imitator::X::Connection.new
+    root = Imitator::X::XWindow.new(Imitator::X::XWindow.default_root_window.window_id, 0, conn)
+    live_children = root.children
+    live_titles = Imitator::X::XWindow.search(/./, 0, conn)
+    
+    assert(!conn.window_cache?)
+    conn.window_cache = true
+    assert(conn.window_cache?)
+    assert_equal(live_children, root.children)
+    assert_equal(live_titles, Imitator::X::XWindow.search(/./, 0, conn))
+    
+    client = Imitator::X::XWindow.clients(0, conn).first
+    client_title = Imitator::X::XWindow.new(client, 0, conn).title if client
+    Imitator::X::XWindow.search(client_title, 0, conn) if client
+    
+    Imitator::X.reset_stats
+    Imitator::X::XWindow.search(/./, 0, conn)
+    root.children
+    assert(Imitator::X::XWindow.search(client_title, 0, conn).include?(client)) if client #From the title index
+    assert_equal(0, Imitator::X.stats[:round_trips]) #All from the cache
+    
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1, 0, conn).position}
+    conn.window_cache = false
+    assert(!conn.window_cache?)
+    assert_equal(live_children, root.children)
+    conn.close
+  end
+  
+end
@@ -0,0 +1,63 @@
+#!/usr/bin/env ruby
+#Encoding: UTF-8
+=begin
+--
+Imitator for X is a library allowing you to fake input to systems using X11. 
+Copyright © 2010 Marvin Gülker
+
+This file is part of Imitator for X.
+
+Imitator for X is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Imitator for X is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
+++
+=end
+
+#Ensure we use the correct key combinations file
+$imitator_x_charfile_path = File.join(File.expand_path(File.dirname(__FILE__)), "..", "lib", "imitator_x_special_chars.yml")
+
+require "test/unit"
+require_relative "../lib/imitator/x"
+
+class StatsTest < Test::Unit::TestCase
+  
+  def setup
+    Imitator::X.reset_stats
+  end
+  
+  def test_reset
+    Imitator::X::XWindow.default_root_window.children
+    assert(Imitator::X.stats[:round_trips] > 0)
+    Imitator::X.reset_stats
+    stats = Imitator::X.stats
+    assert_equal(0, stats[:round_trips])
+    assert_equal({}, stats[:methods])
+  end
+  
+  def test_methods
+    Imitator::X::XWindow.search(/imitator/)
+    Imitator::X::Mouse.position
+    stats = Imitator::X.stats
+    assert(stats[:methods].has_key?("XWindow.search"))
+    assert(stats[:methods]["Mouse.position"][:round_trips] >= 1)
+    assert(stats[:methods]["Mouse.position"][:requests] >= 1)
+    latency = stats[:methods]["Mouse.position"][:latency]
+    assert_equal(latency[:count], latency[:histogram].values.inject(:+))
+    assert(latency[:total] >= latency[:max])
+  end
+  
+  def test_connections
+    Imitator::X::Connection.new.close
+    assert_equal(1, Imitator::X.stats[:connections_opened])
+  end
+  
+end
@@ -26,6 +26,7 @@ along with Imitator for X.  If not, see <http://www.gnu.org/licenses/>.
 $imitator_x_charfile_path = File.join(File.expand_path(File.dirname(__FILE__)), "..", "lib", "imitator_x_special_chars.yml")
 
 require "test/unit"
+require "timeout"
 require_relative "../lib/imitator/x"
 
 class XWindowTest < Test::Unit::TestCase
@@ -57,8 +58,77 @@ class XWindowTest < Test::Unit::TestCase
     assert_not_equal(@@xwin, Imitator::X::XWindow.from_focused)
   end
   
+  def test_batch
+    Imitator::X.reset_stats
+    errors = Imitator::X::XWindow.batch do
+      assert_nil(@@xwin.resize(450, 350))
+      assert_nil(@@xwin.raise_win)
+      assert_nil(Imitator::X::XWindow.new(1).map)
+    end
+    assert_equal(1, Imitator::X.stats[:round_trips])
+    assert_equal(3, errors.size)
+    assert_nil(errors[0])
+    assert_nil(errors[1])
+    assert_kind_of(Imitator::X::XProtocolError, errors[2])
+    sleep 1
+    assert_equal([450, 350], @@xwin.size)
+    assert_equal([], Imitator::X::XWindow.batch{})
+    assert_raise(LocalJumpError){Imitator::X::XWindow.batch}
+  end
+  
+  def test_ewmh_supported
+    assert_equal(Imitator::X::XWindow.ewmh_supported?("_NET_ACTIVE_WINDOW"), Imitator::X::XWindow.ewmh_supported?(:_NET_ACTIVE_WINDOW))
+    assert(!Imitator::X::XWindow.ewmh_supported?("_IMITATOR_X_SURELY_NOT_SUPPORTED"))
+    Imitator::X.reset_stats
+    Imitator::X::XWindow.ewmh_supported?("_NET_ACTIVE_WINDOW")
+    assert_equal(0, Imitator::X.stats[:round_trips]) #Kept until the window manager changes it
+  end
+  
   def test_exists
     assert(@@xwin.exists?)
+    assert(!Imitator::X::XWindow.exists?(1))
+    assert_equal([true, false, true], Imitator::X::XWindow.exists_many?([@@xwin.window_id, 1, Imitator::X::XWindow.default_root_window.window_id]))
+    assert_equal([], Imitator::X::XWindow.exists_many?([]))
+    assert_nothing_raised{Imitator::X::Connection.default.sync} #No error left over
+  end
+  
+  def test_attributes_for
+    attrs = Imitator::X::XWindow.attributes_for([@@xwin, 1, Imitator::X::XWindow.default_root_window.window_id])
+    assert_equal(3, attrs.size)
+    assert_equal(@@xwin.window_id, attrs[0].window_id)
+    assert_equal(@@xwin.position, [attrs[0].x, attrs[0].y])
+    assert_equal(@@xwin.size, [attrs[0].width, attrs[0].height])
+    assert_equal(@@xwin.root_win.window_id, attrs[0].root)
+    assert_equal(:viewable, attrs[0].map_state)
+    assert_equal(:input_output, attrs[0].window_class)
+    assert_nil(attrs[1])
+    assert_equal(attrs[0].root, attrs[2].window_id)
+  end
+  
+  def test_each
+    root = Imitator::X::XWindow.default_root_window
+    assert_equal(root.children, root.each_descendant(1).map(&:window_id))
+    assert_equal(Imitator::X::XWindow.clients, Imitator::X::XWindow.each.map(&:window_id))
+    assert((Imitator::X::XWindow.search(/./, 0, 0, nil) - Imitator::X::XWindow.each(0, 0, nil).map(&:window_id)).empty?)
+    assert_same(@@xwin, Imitator::X::XWindow.each.find{|xwin| xwin == @@xwin})
+    assert_equal(3, root.each_descendant.first(3).size)
+    assert_equal([], root.each_descendant(0).to_a)
+    #Stopping early doesn't ask for the layers below
+    Imitator::X.reset_stats
+    root.each_descendant.first
+    assert_equal(1, Imitator::X.stats[:round_trips]) #Only the root's children
+  end
+  
+  def test_identity
+    assert_same(@@xwin, Imitator::X::XWindow.from_title(@@xwin.title))
+    assert_same(@@xwin.parent, @@xwin.parent)
+    assert_same(@@xwin.root_win, Imitator::X::XWindow.default_root_window)
+    copy = @@xwin.dup
+    assert_not_same(@@xwin, copy)
+    assert_equal(@@xwin, copy)
+    assert_equal(@@xwin.window_id, copy.window_id)
+    assert(@@xwin != @@xwin.window_id)
+    assert_raise(TypeError){Imitator::X::XWindow.allocate.title}
   end
   
   def test_map
@@ -75,6 +145,58 @@ class XWindowTest < Test::Unit::TestCase
     assert_equal(@@xwin.root_win, @@xwin.parent)
   end
   
+  def test_on
+    events = Queue.new
+    block = @@xwin.on(:configure){|evt| events << evt}
+    @@xwin.on(:unmap){|evt| events << evt}
+    @@xwin.resize(400, 300)
+    evt = Timeout.timeout(2){events.pop}
+    assert_equal(:configure, evt.type)
+    assert_same(@@xwin, evt.window)
+    assert_equal([400, 300], [evt.width, evt.height])
+    assert_equal(1, @@xwin.off(:configure, block))
+    @@xwin.unmap
+    assert_equal(:unmap, Timeout.timeout(2){events.pop}.type)
+    @@xwin.map
+    assert_equal(1, @@xwin.off)
+    assert_raise(ArgumentError){@@xwin.on(:colour){}}
+    assert_raise(ArgumentError){@@xwin.on(:map)}
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).on(:map){}}
+    #Top-level windows
+    Imitator::X::XWindow.on(:map){|evt| events << evt}
+    @@xwin.unmap
+    @@xwin.map
+    assert_equal(:map, Timeout.timeout(2){events.pop}.type)
+    assert_equal(1, Imitator::X::XWindow.off(:map))
+    sleep 1
+  end
+  
+  def test_events
+    Imitator::X.events #Start the journal
+    seen = Imitator::X.events.map(&:sequence).max.to_i
+    @@xwin.resize(420, 320)
+    sleep 1
+    events = Imitator::X.events(since: seen)
+    assert(events.any?{|evt| evt.type == :configure})
+    assert(events.all?{|evt| evt.sequence > seen})
+    assert_equal(events.map(&:sequence).sort, events.map(&:sequence))
+    assert_equal(0, Imitator::X.stats[:events_dropped])
+  end
+  
+  def test_events_with_cache
+    conn = Imitator::X::Connection.new
+    conn.window_cache = true
+    xwin = Imitator::X::XWindow.new(@@xwin.window_id, 0, conn)
+    xwin.title #The cache tracks it now, its parent gets its events too
+    seen = Imitator::X.events(connection: conn).map(&:sequence).max.to_i
+    xwin.resize(430, 330)
+    sleep 1
+    configures = Imitator::X.events(since: seen, connection: conn).select{|evt| evt.type == :configure && evt.window.window_id == xwin.window_id}
+    assert(!configures.empty?)
+    assert_equal(configures.uniq{|evt| [evt.x, evt.y, evt.width, evt.height]}.size, configures.size) #No copies
+    conn.close
+  end
+  
   def test_pid
     begin
       assert_equal(@@editor_pid, @@xwin.pid)
@@ -83,12 +205,117 @@ class XWindowTest < Test::Unit::TestCase
     end
   end
   
+  def test_for_pid
+    assert(Imitator::X::XWindow.for_pid(@@xwin.pid).include?(@@xwin.window_id))
+    assert_equal([], Imitator::X::XWindow.for_pid(-2))
+    assert_equal(Imitator::X::XWindow.for_pid(@@xwin.pid), Imitator::X::XWindow.select(:pid => @@xwin.pid))
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).pid}
+  end
+  
   def test_resize
     @@xwin.resize(500, 400)
     sleep 1
     assert_equal([500, 400], @@xwin.size)
   end
   
+  def test_resize_modes
+    assert_nil(@@xwin.resize(480, 380, :async))
+    sleep 1
+    assert_equal([480, 380], @@xwin.size)
+    assert_equal(@@xwin.size, @@xwin.resize(520, 420, :confirm))
+    assert_equal(@@xwin.position, @@xwin.move(*@@xwin.position, :confirm, 0.5)) #Nothing changes, times out
+    assert_raise(ArgumentError){@@xwin.resize(500, 400, :later)}
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).move(10, 10, :confirm)}
+    Imitator::X::XWindow.new(1).move(10, 10, :async)
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::Connection.default.sync}
+  end
+  
+  def test_confirm_with_subscription
+    events = Queue.new
+    block = @@xwin.on(:configure){|evt| events << evt}
+    start = Time.now
+    assert_equal(@@xwin.size, @@xwin.resize(440, 340, :confirm, 5))
+    assert(Time.now - start < 4, "The subscription took the ConfigureNotify")
+    assert_equal(:configure, Timeout.timeout(2){events.pop}.type)
+  ensure
+    @@xwin.off(:configure, block) if block
+  end
+  
+  def test_search
+    assert(Imitator::X::XWindow.search(@@xwin.title).include?(@@xwin.window_id))
+    assert(Imitator::X::XWindow.search(Regexp.new(Regexp.escape(EDITOR))).include?(@@xwin.window_id))
+    assert_equal([], Imitator::X::XWindow.search("Imitator for X surely has no window with this title"))
+    #The whole tree contains at least the first layer
+    all = Imitator::X::XWindow.search(/./, 0, 0, nil)
+    assert((Imitator::X::XWindow.search(/./) - all).empty?)
+    assert(all.include?(@@xwin.window_id))
+    assert_equal([all.first], Imitator::X::XWindow.search(/./, 0, 0, nil, true))
+    assert_equal([], Imitator::X::XWindow.search(/./, 0, 0, 0))
+    #Regexps match like Regexp#=~ does, whatever their own encoding is
+    assert(Imitator::X::XWindow.search(Regexp.new("\\A#{Regexp.escape(@@xwin.title)}\\z", Regexp::IGNORECASE)).include?(@@xwin.window_id))
+    assert(Imitator::X::XWindow.search(Regexp.new(Regexp.escape(EDITOR).force_encoding("US-ASCII"))).include?(@@xwin.window_id))
+  end
+  
+  def test_clients
+    clients = Imitator::X::XWindow.clients
+    assert(clients.include?(@@xwin.window_id))
+    assert_equal(clients.sort, Imitator::X::XWindow.clients(0, 0, true).sort)
+    assert_equal(Imitator::X::XWindow.search(/./).sort, Imitator::X::XWindow.search(/./, 0, 0, :clients).sort)
+    conn = Imitator::X::Connection.new
+    conn.window_cache = true
+    assert_equal(clients, Imitator::X::XWindow.clients(0, conn))
+    Imitator::X.reset_stats
+    Imitator::X::XWindow.clients(0, conn)
+    assert_equal(0, Imitator::X.stats[:round_trips])
+    conn.close
+  end
+  
+  def test_select
+    by_title = Imitator::X::XWindow.search(@@xwin.title)
+    assert_equal(by_title, Imitator::X::XWindow.select(:title => @@xwin.title))
+    assert(Imitator::X::XWindow.select(:title => @@xwin.title, :visible => true, :min_size => @@xwin.size, :max_size => @@xwin.size).include?(@@xwin.window_id))
+    assert_equal([], Imitator::X::XWindow.select(:title => @@xwin.title, :mapped => false))
+    assert_equal([], Imitator::X::XWindow.select(:title => @@xwin.title, :min_size => @@xwin.size.map{|x| x + 1}))
+    #The editor sets WM_CLASS and usually its PID somewhere below the frame
+    assert(!Imitator::X::XWindow.select(:class => Regexp.new(EDITOR, Regexp::IGNORECASE), :depth => nil).empty?)
+    assert_equal(1, Imitator::X::XWindow.select({:class => /./, :depth => nil, :first => true}, 0, 0).size)
+    assert_equal([], Imitator::X::XWindow.select(:pid => -2, :depth => nil))
+    assert_raise(ArgumentError){Imitator::X::XWindow.select(:colour => "blue")}
+  end
+  
+  def test_search_title_index
+    conn = Imitator::X::Connection.new
+    conn.window_cache = true
+    assert_equal(Imitator::X::XWindow.search(@@xwin.title), Imitator::X::XWindow.search(@@xwin.title, 0, conn))
+    assert_equal(Imitator::X::XWindow.search(@@xwin.title, 0, 0, nil).sort, Imitator::X::XWindow.search(@@xwin.title, 0, conn, nil).sort)
+    Imitator::X.reset_stats
+    Imitator::X::XWindow.search(@@xwin.title, 0, conn)
+    assert_equal(0, Imitator::X.stats[:round_trips]) #A hash lookup
+    conn.close
+  end
+  
+  def test_title
+    assert_equal(Encoding::UTF_8, @@xwin.title.encoding)
+    assert(@@xwin.title.valid_encoding?)
+    assert_equal("(null)", Imitator::X::XWindow.default_root_window.title)
+    assert_raise(Imitator::X::XProtocolError){Imitator::X::XWindow.new(1).title}
+  end
+  
+  def test_wait_for_window
+    start = Time.now
+    assert_equal(@@xwin, Imitator::X::XWindow.wait_for_window(@@xwin.title)) #Already there
+    assert_nil(Imitator::X::XWindow.wait_for_window("Imitator for X surely has no window with this title", 0, 0, 0.5))
+    assert(Time.now - start < 1.5)
+    assert(!Imitator::X::Connection.default.window_cache?) #Only on while waiting
+  end
+  
+  def test_wait_for_termination
+    assert(Imitator::X::XWindow.wait_for_window_termination("Imitator for X surely has no window with this title"))
+    assert(!Imitator::X::XWindow.wait_for_window_termination(@@xwin.title, 0, 0, 0.5))
+    assert(Imitator::X::XWindow.new(1).wait_until_destroyed) #Doesn't exist
+    assert(!@@xwin.wait_until_destroyed(0.5))
+  end
+  
   def test_is_root_win
     assert(Imitator::X::XWindow.default_root_window.root_win?)
   end